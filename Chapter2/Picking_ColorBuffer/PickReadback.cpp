@@ -0,0 +1,228 @@
+#include "PickReadback.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+PickReadback::PickReadback(void)
+{
+	width = height = 0;
+	fboID = 0;
+	idTextureID = depthTextureID = 0;
+	frame = 0;
+}
+
+PickReadback::~PickReadback(void)
+{
+}
+
+void PickReadback::Init(int w, int h, int ringSize) {
+	width = w;
+	height = h;
+
+	glGenFramebuffers(1, &fboID);
+	CreateAttachments();
+
+	//the buffers grow to the largest rectangle read through them
+	slots.resize(max(1, ringSize));
+	for(size_t i=0;i<slots.size();i++) {
+		glGenBuffers(1, &slots[i].pboIDsID);
+		glGenBuffers(1, &slots[i].pboDepthsID);
+		slots[i].capacity = 0;
+		slots[i].fence = 0;
+	}
+	queue.clear();
+	frame = 0;
+}
+
+void PickReadback::Resize(int w, int h) {
+	if(w == width && h == height)
+		return;
+	width = w;
+	height = h;
+
+	//copies in flight are already in their buffers, only the attachments change
+	DeleteAttachments();
+	CreateAttachments();
+}
+
+void PickReadback::Destroy() {
+	//the requests which never got their result still own their user data
+	for(size_t i=0;i<queue.size();i++) {
+		if(queue[i].release)
+			queue[i].release(queue[i].userData);
+	}
+	for(size_t i=0;i<slots.size();i++) {
+		if(slots[i].fence) {
+			glDeleteSync(slots[i].fence);
+			if(slots[i].request.release)
+				slots[i].request.release(slots[i].request.userData);
+		}
+		glDeleteBuffers(1, &slots[i].pboIDsID);
+		glDeleteBuffers(1, &slots[i].pboDepthsID);
+	}
+	slots.clear();
+	queue.clear();
+	DeleteAttachments();
+	glDeleteFramebuffers(1, &fboID);
+	fboID = 0;
+}
+
+void PickReadback::CreateAttachments() {
+	glGenTextures(1, &idTextureID);
+	glBindTexture(GL_TEXTURE_2D, idTextureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+
+	glGenTextures(1, &depthTextureID);
+	glBindTexture(GL_TEXTURE_2D, depthTextureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, idTextureID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTextureID, 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE)
+		cerr<<"Error: ID framebuffer is not complete"<<endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PickReadback::DeleteAttachments() {
+	glDeleteTextures(1, &idTextureID);
+	glDeleteTextures(1, &depthTextureID);
+	idTextureID = depthTextureID = 0;
+}
+
+void PickReadback::BeginIDPass() {
+	glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+	GLuint background[4] = {0, 0, 0, 0};
+	glClearBufferuiv(GL_COLOR, 0, background);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void PickReadback::EndIDPass() {
+	//start the copies of as many queued requests as there are free slots,
+	//oldest first
+	size_t issued = 0;
+	for(size_t i=0;i<slots.size() && issued<queue.size();i++) {
+		Slot& slot = slots[i];
+		if(slot.fence)
+			continue;
+		slot.request = queue[issued++];
+		const Request& request = slot.request;
+		GLsizeiptr pixels = GLsizeiptr(request.width)*request.height;
+		slot.capacity = max(slot.capacity, pixels);
+
+		//orphan the buffers and read into them, glReadPixels returns as soon
+		//as the copy is queued since a pack buffer is bound
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pboIDsID);
+		glBufferData(GL_PIXEL_PACK_BUFFER, slot.capacity*sizeof(GLuint), 0, GL_STREAM_READ);
+		glReadPixels(request.x, request.y, request.width, request.height, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pboDepthsID);
+		glBufferData(GL_PIXEL_PACK_BUFFER, slot.capacity*sizeof(GLfloat), 0, GL_STREAM_READ);
+		glReadPixels(request.x, request.y, request.width, request.height, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	queue.erase(queue.begin(), queue.begin() + issued);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PickReadback::RequestPixel(int x, int y, Callback callback, void* userData, Release release) {
+	RequestRect(x, y, 1, 1, callback, userData, release);
+}
+
+void PickReadback::RequestRect(int x, int y, int w, int h, Callback callback, void* userData, Release release) {
+	//clamp the rectangle to the framebuffer
+	int x0 = max(0, min(x, width-1)), y0 = max(0, min(y, height-1));
+	int x1 = max(x0+1, min(x+w, width)), y1 = max(y0+1, min(y+h, height));
+
+	Request request;
+	request.x = x0;
+	request.y = y0;
+	request.width = x1 - x0;
+	request.height = y1 - y0;
+	request.callback = callback;
+	request.userData = userData;
+	request.release = release;
+	request.frame = frame;
+	queue.push_back(request);
+}
+
+void PickReadback::Update() {
+	//resolve the finished slots in the order of their requests
+	for(;;) {
+		Slot* oldest = 0;
+		for(size_t i=0;i<slots.size();i++) {
+			if(slots[i].fence && (!oldest || slots[i].request.frame < oldest->request.frame))
+				oldest = &slots[i];
+		}
+		if(!oldest)
+			break;
+
+		//a zero timeout only polls, the flush makes sure the fence reaches
+		//the GPU
+		GLenum status = glClientWaitSync(oldest->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+		Resolve(*oldest);
+	}
+	frame++;
+}
+
+void PickReadback::Resolve(Slot& slot) {
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+
+	const Request& request = slot.request;
+	Result result;
+	result.x = request.x;
+	result.y = request.y;
+	result.width = request.width;
+	result.height = request.height;
+	result.latency = frame - request.frame;
+	result.userData = request.userData;
+
+	GLsizeiptr pixels = GLsizeiptr(request.width)*request.height;
+	result.ids.resize(pixels);
+	result.depths.resize(pixels);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pboIDsID);
+	void* ids = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels*sizeof(GLuint), GL_MAP_READ_BIT);
+	if(ids) {
+		memcpy(&result.ids[0], ids, pixels*sizeof(GLuint));
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pboDepthsID);
+	void* depths = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels*sizeof(GLfloat), GL_MAP_READ_BIT);
+	if(depths) {
+		memcpy(&result.depths[0], depths, pixels*sizeof(GLfloat));
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if(request.callback)
+		request.callback(result);
+	if(request.release)
+		request.release(request.userData);
+}
+
+bool PickReadback::HasPendingRequests() const {
+	return !queue.empty();
+}
+
+int PickReadback::GetInFlight() const {
+	int total = 0;
+	for(size_t i=0;i<slots.size();i++)
+		total += slots[i].fence ? 1 : 0;
+	return total;
+}
@@ -12,6 +12,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "GLSLShader.h"
+#include "PickReadback.h"
 
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
@@ -86,6 +87,26 @@ glm::mat4 MV,P;
 //selected box index
 int selected_box=-1;
 
+//boxes selected by the last rectangle
+bool box_selected[3]={false, false, false};
+
+//asynchronous readback of the box IDs and depths
+PickReadback readback;
+
+//shader drawing the box IDs and shader drawing the selection rectangle
+GLSLShader idShader;
+GLSLShader rectShader;
+
+//box vertex array and vertex buffer objects for the ID pass
+GLuint cubeVAOID, cubeVerticesID, cubeIndicesID;
+
+//selection rectangle vertex array and vertex buffer objects
+GLuint rectVAOID, rectVerticesID;
+
+//shift+left drag selects the boxes inside a rectangle
+bool bRectSelection = false;
+int rectStartX=0, rectStartY=0, rectEndX=0, rectEndY=0;
+
 //box positions
 glm::vec3 box_positions[3]={glm::vec3(-1,0.5,0),
 							glm::vec3(0,0.5,1),
@@ -136,6 +157,37 @@ void filterMouseMoves(float dx, float dy) {
 
 }
 
+//selects every box with at least one pixel inside the rectangle
+void selectRect(const PickReadback::Result& result) {
+	for(int i=0;i<3;i++)
+		box_selected[i] = false;
+	for(size_t i=0;i<result.ids.size();i++) {
+		GLuint id = result.ids[i];
+		if(id>0 && id<=3)
+			box_selected[id-1] = true;
+	}
+	cout<<"Selected boxes:";
+	for(int i=0;i<3;i++)
+		if(box_selected[i])
+			cout<<" "<<i+1;
+	cout<<" ("<<result.width<<"x"<<result.height<<" pixels, "<<result.latency<<" frames after the selection)"<<endl;
+}
+
+//called by the readback one or two frames after a click or a rectangle
+//selection. The box IDs are the box indices plus 1, 0 is the background.
+void OnPickResolved(const PickReadback::Result& result) {
+	if(result.width*result.height == 1) {
+		selected_box = int(result.ids[0]) - 1;
+		if(selected_box==-1)
+			cout<<"No box picked";
+		else
+			cout<<"picked box "<<selected_box+1;
+		cout<<" ("<<result.latency<<" frames after the click)"<<endl;
+		return;
+	}
+	selectRect(result);
+}
+
 //mouse click handler
 void OnMouseDown(int button, int s, int x, int y)
 {
@@ -144,24 +196,24 @@ void OnMouseDown(int button, int s, int x, int y)
 		oldX = x;
 		oldY = y;
 
-		//read pixel colour at mouse click position
-		GLubyte pixel[4];
-		glReadPixels(x, HEIGHT-y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
-
-		//based on colour decide which box was selected
-		selected_box=-1;
-		if(pixel[0]==255 && pixel[1]==0 && pixel[2]==0) {
-			cout<<"picked box 1"<<endl;
-			selected_box = 0;
-		}
-		if(pixel[0]==0 && pixel[1]==255 && pixel[2]==0) {
-			cout<<"picked box 2"<<endl;
-			selected_box = 1;
-		}
-		if(pixel[0]==0 && pixel[1]==0 && pixel[2]==255) {
-			cout<<"picked box 3"<<endl;
-			selected_box = 2;
+		//shift+left drag starts a rectangle selection
+		if(button == GLUT_LEFT_BUTTON && (glutGetModifiers() & GLUT_ACTIVE_SHIFT)) {
+			bRectSelection = true;
+			rectStartX = rectEndX = x;
+			rectStartY = rectEndY = y;
+		} else {
+			//queue a read of the box ID at the mouse click position, the
+			//result arrives in OnPickResolved
+			for(int i=0;i<3;i++)
+				box_selected[i] = false;
+			readback.RequestPixel(x, HEIGHT-y, OnPickResolved);
 		}
+	} else if(bRectSelection) {
+		//read the box IDs inside the rectangle
+		bRectSelection = false;
+		int x0 = min(rectStartX, x), x1 = max(rectStartX, x);
+		int y0 = min(rectStartY, y), y1 = max(rectStartY, y);
+		readback.RequestRect(x0, HEIGHT-1-y1, x1-x0+1, y1-y0+1, OnPickResolved);
 	}
 
 	if(button == GLUT_MIDDLE_BUTTON)
@@ -174,6 +226,13 @@ void OnMouseDown(int button, int s, int x, int y)
 //mouse move handler
 void OnMouseMove(int x, int y)
 {
+	//grow the selection rectangle instead of moving the camera
+	if(bRectSelection) {
+		rectEndX = x;
+		rectEndY = y;
+		glutPostRedisplay();
+		return;
+	}
 	if(selected_box == -1) {
 		if (state == 0) {
 			fov += (y - oldY)/5.0f;
@@ -230,6 +289,68 @@ void OnInit() {
 
 	//disbale dithering (requried for colour based picking since dithering might change the colours)
 	glDisable(GL_DITHER);
+
+	//load the ID shader, the boxes are drawn with their IDs for picking
+	idShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/cube_shader.vert");
+	idShader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/id_shader.frag");
+	idShader.CreateAndLinkProgram();
+	idShader.Use();
+		idShader.AddAttribute("vVertex");
+		idShader.AddUniform("MVP");
+		idShader.AddUniform("ID");
+	idShader.UnUse();
+
+	//load the constant colour shader for the selection rectangle
+	rectShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/cube_shader.vert");
+	rectShader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/cube_shader.frag");
+	rectShader.CreateAndLinkProgram();
+	rectShader.Use();
+		rectShader.AddAttribute("vVertex");
+		rectShader.AddUniform("MVP");
+		rectShader.AddUniform("vColor");
+	rectShader.UnUse();
+
+	GL_CHECK_ERRORS
+
+	//setup the unit cube geometry for the ID pass
+	glm::vec3 cubeVertices[8];
+	for(int i=0;i<8;i++)
+		cubeVertices[i] = glm::vec3((i&1)?0.5f:-0.5f, (i&2)?0.5f:-0.5f, (i&4)?0.5f:-0.5f);
+	GLushort cubeIndices[36]={0,2,1,1,2,3, //back
+							  4,5,6,5,7,6, //front
+							  0,1,4,1,5,4, //bottom
+							  2,6,3,3,6,7, //top
+							  0,4,2,2,4,6, //left
+							  1,3,5,3,7,5  //right
+							  };
+	glGenVertexArrays(1, &cubeVAOID);
+	glGenBuffers(1, &cubeVerticesID);
+	glGenBuffers(1, &cubeIndicesID);
+	glBindVertexArray(cubeVAOID);
+		glBindBuffer (GL_ARRAY_BUFFER, cubeVerticesID);
+		glBufferData (GL_ARRAY_BUFFER, sizeof(cubeVertices), &cubeVertices[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(idShader["vVertex"]);
+		glVertexAttribPointer(idShader["vVertex"], 3, GL_FLOAT, GL_FALSE,0,0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeIndicesID);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), &cubeIndices[0], GL_STATIC_DRAW);
+
+	//setup the selection rectangle, its corners are updated while dragging
+	glGenVertexArrays(1, &rectVAOID);
+	glGenBuffers(1, &rectVerticesID);
+	glBindVertexArray(rectVAOID);
+		glBindBuffer (GL_ARRAY_BUFFER, rectVerticesID);
+		glBufferData (GL_ARRAY_BUFFER, 4*sizeof(glm::vec3), 0, GL_DYNAMIC_DRAW);
+		glEnableVertexAttribArray(rectShader["vVertex"]);
+		glVertexAttribPointer(rectShader["vVertex"], 3, GL_FLOAT, GL_FALSE,0,0);
+	glBindVertexArray(0);
+
+	GL_CHECK_ERRORS
+
+	//create the ID framebuffer and the ring of readback buffers
+	readback.Init(WIDTH, HEIGHT);
+
+	GL_CHECK_ERRORS
+
 	//enable depth test
 	glEnable(GL_DEPTH_TEST);
 
@@ -242,6 +363,20 @@ void OnShutdown() {
 
 	delete grid;
 	delete cube;
+
+	//Destroy shaders
+	idShader.DeleteShaderProgram();
+	rectShader.DeleteShaderProgram();
+
+	//Destroy vao and vbos
+	glDeleteVertexArrays(1, &cubeVAOID);
+	glDeleteBuffers(1, &cubeVerticesID);
+	glDeleteBuffers(1, &cubeIndicesID);
+	glDeleteVertexArrays(1, &rectVAOID);
+	glDeleteBuffers(1, &rectVerticesID);
+
+	//Destroy the ID framebuffer and the readback buffers
+	readback.Destroy();
 	cout<<"Shutdown successfull"<<endl;
 }
 
@@ -249,6 +384,8 @@ void OnShutdown() {
 void OnResize(int w, int h) {
 	//set the viewport size
 	glViewport (0, 0, (GLsizei) w, (GLsizei) h);
+	//resize the ID framebuffer
+	readback.Resize(w, h);
 	//set the camera projection matrix
 	cam.SetupProjection(fov, (GLfloat)w/h);
 }
@@ -336,6 +473,9 @@ void OnRender() {
 	current_time = glutGet(GLUT_ELAPSED_TIME)/1000.0f;
 	dt = current_time-last_time;
 
+	//resolve the picks whose reads have finished
+	readback.Update();
+
 	//clear color buffer and depth buffer
 	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
@@ -357,23 +497,49 @@ void OnRender() {
 	//render the grid object
 	grid->Render(glm::value_ptr(MVP));
 
-	//set the first cube transform 
-	//set its colour to cyan if selected, red otherwise
-	glm::mat4 T = glm::translate(glm::mat4(1), box_positions[0]);
-	cube->color = (selected_box==0)?glm::vec3(0,1,1):glm::vec3(1,0,0);
-	cube->Render(glm::value_ptr(MVP*T));
-
-	//set the second cube transform 
-	//set its colour to cyan if selected, green otherwise
-	T = glm::translate(glm::mat4(1), box_positions[1]);
-	cube->color = (selected_box==1)?glm::vec3(0,1,1):glm::vec3(0,1,0);
-	cube->Render(glm::value_ptr(MVP*T));
-
-	//set the third cube transform 
-	//set its colour to cyan if selected, blue otherwise
-	T = glm::translate(glm::mat4(1), box_positions[2]);
-	cube->color = (selected_box==2)?glm::vec3(0,1,1):glm::vec3(0,0,1);
-	cube->Render(glm::value_ptr(MVP*T));
+	//render the three boxes, set their colour to cyan if selected, 
+	//red, green and blue otherwise
+	glm::vec3 colors[3]={glm::vec3(1,0,0), glm::vec3(0,1,0), glm::vec3(0,0,1)};
+	for(int i=0;i<3;i++) {
+		glm::mat4 T = glm::translate(glm::mat4(1), box_positions[i]);
+		cube->color = (selected_box==i || box_selected[i])?glm::vec3(0,1,1):colors[i];
+		cube->Render(glm::value_ptr(MVP*T));
+	}
+
+	//when a pick waits for the box IDs, draw the boxes with their IDs into
+	//the ID framebuffer and start the reads
+	if(readback.HasPendingRequests()) {
+		readback.BeginIDPass();
+		idShader.Use();
+			glBindVertexArray(cubeVAOID);
+			for(int i=0;i<3;i++) {
+				glm::mat4 T = glm::translate(glm::mat4(1), box_positions[i]);
+				glUniformMatrix4fv(idShader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP*T));
+				glUniform1ui(idShader("ID"), i+1);
+				glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, 0);
+			}
+			glBindVertexArray(0);
+		idShader.UnUse();
+		readback.EndIDPass();
+	}
+
+	//draw the selection rectangle in normalized device coordinates
+	if(bRectSelection) {
+		float x0 = 2.0f*rectStartX/WIDTH-1, x1 = 2.0f*rectEndX/WIDTH-1;
+		float y0 = 1-2.0f*rectStartY/HEIGHT, y1 = 1-2.0f*rectEndY/HEIGHT;
+		glm::vec3 corners[4]={glm::vec3(x0,y0,0), glm::vec3(x1,y0,0), glm::vec3(x1,y1,0), glm::vec3(x0,y1,0)};
+		glDisable(GL_DEPTH_TEST);
+		rectShader.Use();
+			glUniformMatrix4fv(rectShader("MVP"), 1, GL_FALSE, glm::value_ptr(glm::mat4(1)));
+			glUniform3f(rectShader("vColor"), 1, 1, 1);
+			glBindVertexArray(rectVAOID);
+				glBindBuffer(GL_ARRAY_BUFFER, rectVerticesID);
+				glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(corners), &corners[0]);
+				glDrawArrays(GL_LINE_LOOP, 0, 4);
+			glBindVertexArray(0);
+		rectShader.UnUse();
+		glEnable(GL_DEPTH_TEST);
+	}
 
 	//swap front and back buffers to show the rendered result
 	glutSwapBuffers();
@@ -0,0 +1,12 @@
+#version 330 core
+
+layout(location = 0) out uint vFragID;	//fragment shader output
+
+//uniform
+uniform uint ID; //object ID, 0 is the background
+
+void main()
+{
+	//return the object ID as shader output
+	vFragID = ID;
+}
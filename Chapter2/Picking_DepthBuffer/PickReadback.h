@@ -0,0 +1,99 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+
+using namespace std;
+
+//PickReadback class reads object IDs and depths back from the GPU without
+//stalling the frame. The objects are drawn with their IDs into an offscreen
+//framebuffer with a GL_R32UI colour and a 32 bit float depth attachment, ID
+//0 is the background. A request copies a rectangle of both attachments into
+//the pixel buffer objects of one slot of a small ring and puts a fence sync
+//after the copies. The fences are polled every frame without waiting; once
+//the copy is done the buffers are mapped and the callback of the request
+//gets the IDs and depths, usually one or two frames after the request.
+//
+//Requests which find no free slot wait in a queue, so the ID pass has to be
+//drawn as long as HasPendingRequests returns true.
+//
+//The user data of a request belongs to the readback until its release
+//function is called, exactly once: after the callback, or from Destroy for
+//requests which are still queued or in flight.
+class PickReadback
+{
+public:
+	//IDs and depths of a rectangle in window coordinates with the origin at
+	//the bottom left, stored row by row from the bottom
+	struct Result {
+		int x, y, width, height;
+		vector<GLuint> ids;
+		vector<float> depths;
+		int latency;			//frames between the request and the result
+		void* userData;
+	};
+	typedef void (*Callback)(const Result& result);
+	typedef void (*Release)(void* userData);
+
+	//constructor/destructor
+	PickReadback(void);
+	~PickReadback(void);
+
+	//creates the framebuffer and the ring of pixel buffer objects
+	void Init(int width, int height, int ringSize = 3);
+	void Resize(int width, int height);
+	void Destroy();
+
+	//binds and clears the ID framebuffer, the objects are drawn after this
+	//with a shader writing their ID to an unsigned integer output
+	void BeginIDPass();
+
+	//binds the default framebuffer again and starts the copies of the
+	//queued requests into free slots
+	void EndIDPass();
+
+	//queues a read of one pixel or of a rectangle, which is clamped to the
+	//framebuffer
+	void RequestPixel(int x, int y, Callback callback, void* userData = 0, Release release = 0);
+	void RequestRect(int x, int y, int width, int height, Callback callback, void* userData = 0, Release release = 0);
+
+	//polls the fences and calls the callbacks of the finished copies, call
+	//once per frame
+	void Update();
+
+	//true if requests wait for the next ID pass
+	bool HasPendingRequests() const;
+
+	//copies started but not yet resolved
+	int GetInFlight() const;
+
+protected:
+	struct Request {
+		int x, y, width, height;
+		Callback callback;
+		void* userData;
+		Release release;
+		int frame;
+	};
+
+	//a pair of pixel buffer objects with the fence of their copies
+	struct Slot {
+		GLuint pboIDsID, pboDepthsID;
+		GLsizeiptr capacity;	//pixels both buffers can hold
+		GLsync fence;
+		Request request;
+	};
+
+	void CreateAttachments();
+	void DeleteAttachments();
+
+	//maps the buffers of a finished slot and calls its callback
+	void Resolve(Slot& slot);
+
+	int width, height;
+	GLuint fboID;
+	GLuint idTextureID, depthTextureID;
+
+	vector<Slot> slots;
+	vector<Request> queue;
+	int frame;
+};
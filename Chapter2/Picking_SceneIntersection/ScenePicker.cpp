@@ -0,0 +1,562 @@
+#include "ScenePicker.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+
+//children per node, one SSE register
+const int NODE_WIDTH = 4;
+
+//triangles per leaf, one AVX2 register
+const int PACKET_SIZE = 8;
+
+//bins per axis of the surface area heuristic
+const int TOTAL_BINS = 16;
+
+//deeper than this ranges are split at the median instead of binned, the
+//traversal keeps the stack of trees up to this depth in a local array
+const int MAX_DEPTH = 48;
+const int MAX_STACK = MAX_DEPTH*(NODE_WIDTH-1) + 1;
+
+//direction components smaller than this are clamped so the slab test never
+//multiplies zero by infinity
+const float MIN_DIRECTION = 1e-20f;
+
+ScenePicker::ScenePicker(void)
+{
+}
+
+ScenePicker::~ScenePicker(void)
+{
+}
+
+inline float HalfArea(const glm::vec3& min, const glm::vec3& max) {
+	glm::vec3 d = max - min;
+	return d.x*d.y + d.y*d.z + d.z*d.x;
+}
+
+int ScenePicker::AddMesh(const glm::vec3* vertices, int totalVertices, const unsigned int* indices, int totalIndices) {
+	meshes.push_back(Mesh());
+	Mesh& mesh = meshes.back();
+	mesh.vertices.assign(vertices, vertices + totalVertices);
+	mesh.indices.assign(indices, indices + totalIndices);
+
+	int totalTriangles = totalIndices/3;
+	vector<glm::vec3> mins(totalTriangles), maxs(totalTriangles);
+	for(int i=0;i<totalTriangles;i++) {
+		const glm::vec3& a = vertices[indices[i*3]];
+		const glm::vec3& b = vertices[indices[i*3+1]];
+		const glm::vec3& c = vertices[indices[i*3+2]];
+		mins[i] = glm::min(glm::min(a, b), c);
+		maxs[i] = glm::max(glm::max(a, b), c);
+	}
+	BuildTree(mesh.tree, mins, maxs, PACKET_SIZE);
+
+	//store the triangles of every leaf as one packet and let the leaf
+	//reference the packet
+	for(size_t n=0;n<mesh.tree.nodes.size();n++) {
+		Node& node = mesh.tree.nodes[n];
+		for(int c=0;c<NODE_WIDTH;c++) {
+			if(!(node.validMask & (1<<c)) || node.count[c] == 0)
+				continue;
+			TrianglePacket packet;
+			memset(&packet, 0, sizeof(TrianglePacket));
+			for(int i=0;i<PACKET_SIZE;i++) {
+				packet.ids[i] = -1;
+				if(i >= node.count[c])
+					continue;
+				int triangle = mesh.tree.order[node.child[c] + i];
+				const glm::vec3& a = vertices[indices[triangle*3]];
+				glm::vec3 e1 = vertices[indices[triangle*3+1]] - a;
+				glm::vec3 e2 = vertices[indices[triangle*3+2]] - a;
+				packet.v0x[i] = a.x;  packet.v0y[i] = a.y;  packet.v0z[i] = a.z;
+				packet.e1x[i] = e1.x; packet.e1y[i] = e1.y; packet.e1z[i] = e1.z;
+				packet.e2x[i] = e2.x; packet.e2y[i] = e2.y; packet.e2z[i] = e2.z;
+				packet.ids[i] = triangle;
+			}
+			node.child[c] = int(mesh.packets.size());
+			mesh.packets.push_back(packet);
+		}
+	}
+	mesh.tree.order.clear();
+	return int(meshes.size()) - 1;
+}
+
+int ScenePicker::AddInstance(int mesh, const glm::mat4& transform) {
+	Instance instance;
+	instance.mesh = mesh;
+	instances.push_back(instance);
+	SetTransform(int(instances.size()) - 1, transform);
+	return int(instances.size()) - 1;
+}
+
+void ScenePicker::SetTransform(int instance, const glm::mat4& transform) {
+	Instance& inst = instances[instance];
+	inst.transform = transform;
+	inst.invTransform = glm::inverse(transform);
+
+	//world space bounds of the 8 transformed corners of the mesh bounds
+	const Tree& tree = meshes[inst.mesh].tree;
+	inst.min = glm::vec3(FLT_MAX);
+	inst.max = glm::vec3(-FLT_MAX);
+	for(int i=0;i<8;i++) {
+		glm::vec3 corner((i&1) ? tree.max.x : tree.min.x, (i&2) ? tree.max.y : tree.min.y, (i&4) ? tree.max.z : tree.min.z);
+		glm::vec3 p = glm::vec3(transform * glm::vec4(corner, 1));
+		inst.min = glm::min(inst.min, p);
+		inst.max = glm::max(inst.max, p);
+	}
+}
+
+void ScenePicker::Build() {
+	vector<glm::vec3> mins(instances.size()), maxs(instances.size());
+	for(size_t i=0;i<instances.size();i++) {
+		mins[i] = instances[i].min;
+		maxs[i] = instances[i].max;
+	}
+	BuildTree(topLevel, mins, maxs, 1);
+
+	//the leaves reference the instance directly
+	for(size_t n=0;n<topLevel.nodes.size();n++) {
+		Node& node = topLevel.nodes[n];
+		for(int c=0;c<NODE_WIDTH;c++) {
+			if((node.validMask & (1<<c)) && node.count[c] != 0)
+				node.child[c] = topLevel.order[node.child[c]];
+		}
+	}
+}
+
+void ScenePicker::BuildTree(Tree& tree, const vector<glm::vec3>& mins, const vector<glm::vec3>& maxs, int leafSize) {
+	int count = int(mins.size());
+	tree.nodes.clear();
+	tree.order.resize(count);
+	tree.depth = 0;
+	tree.min = glm::vec3(FLT_MAX);
+	tree.max = glm::vec3(-FLT_MAX);
+	if(count == 0)
+		return;
+
+	vector<BuildPrimitive> primitives(count);
+	for(int i=0;i<count;i++) {
+		primitives[i].min = mins[i];
+		primitives[i].max = maxs[i];
+		primitives[i].id = i;
+		primitives[i].pad = 0;
+		tree.min = glm::min(tree.min, mins[i]);
+		tree.max = glm::max(tree.max, maxs[i]);
+	}
+	tree.nodes.reserve(count/leafSize + 1);
+	BuildNode(tree, primitives, 0, count, leafSize, 0);
+	for(int i=0;i<count;i++)
+		tree.order[i] = primitives[i].id;
+}
+
+//box centers are compared instead of centroids, they are twice as large
+inline glm::vec3 Center2(const glm::vec3& min, const glm::vec3& max) {
+	return min + max;
+}
+
+int ScenePicker::SplitRange(BuildPrimitive* primitives, int count, int depth) {
+	glm::vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+	for(int i=0;i<count;i++) {
+		glm::vec3 c = Center2(primitives[i].min, primitives[i].max);
+		cmin = glm::min(cmin, c);
+		cmax = glm::max(cmax, c);
+	}
+	glm::vec3 extent = cmax - cmin;
+	int longest = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+
+	//all centers in one point, any split is as good as another
+	if(extent[longest] <= 0)
+		return count/2;
+
+	if(depth < MAX_DEPTH) {
+		//count the primitives and grow the bounds of the bins along the
+		//longest axis of the centers
+		int binCounts[TOTAL_BINS];
+		glm::vec3 binMins[TOTAL_BINS], binMaxs[TOTAL_BINS];
+		for(int b=0;b<TOTAL_BINS;b++) {
+			binCounts[b] = 0;
+			binMins[b] = glm::vec3(FLT_MAX);
+			binMaxs[b] = glm::vec3(-FLT_MAX);
+		}
+		float origin = cmin[longest], scale = TOTAL_BINS*0.9999f/extent[longest];
+		for(int i=0;i<count;i++) {
+			const BuildPrimitive& p = primitives[i];
+			int b = int((p.min[longest] + p.max[longest] - origin)*scale);
+			binCounts[b]++;
+			binMins[b] = glm::min(binMins[b], p.min);
+			binMaxs[b] = glm::max(binMaxs[b], p.max);
+		}
+
+		//sweep the bins from the right to get the cost of all right parts,
+		//then from the left to find the cheapest split
+		float rightCosts[TOTAL_BINS];
+		glm::vec3 rmin(FLT_MAX), rmax(-FLT_MAX);
+		int rcount = 0;
+		for(int b=TOTAL_BINS-1;b>0;b--) {
+			rcount += binCounts[b];
+			rmin = glm::min(rmin, binMins[b]);
+			rmax = glm::max(rmax, binMaxs[b]);
+			rightCosts[b] = rcount ? rcount*HalfArea(rmin, rmax) : 0;
+		}
+		float bestCost = FLT_MAX;
+		int bestBin = -1;
+		glm::vec3 lmin(FLT_MAX), lmax(-FLT_MAX);
+		int lcount = 0;
+		for(int b=0;b<TOTAL_BINS-1;b++) {
+			lcount += binCounts[b];
+			lmin = glm::min(lmin, binMins[b]);
+			lmax = glm::max(lmax, binMaxs[b]);
+			if(lcount == 0 || lcount == count)
+				continue;
+			float cost = lcount*HalfArea(lmin, lmax) + rightCosts[b+1];
+			if(cost < bestCost) {
+				bestCost = cost;
+				bestBin = b;
+			}
+		}
+
+		if(bestBin >= 0) {
+			BuildPrimitive* middle = partition(primitives, primitives + count, [&](const BuildPrimitive& p) {
+				return int((p.min[longest] + p.max[longest] - origin)*scale) <= bestBin;
+			});
+			int left = int(middle - primitives);
+			if(left > 0 && left < count)
+				return left;
+		}
+	}
+
+	//median split along the longest axis
+	nth_element(primitives, primitives + count/2, primitives + count, [&](const BuildPrimitive& a, const BuildPrimitive& b) {
+		return a.min[longest] + a.max[longest] < b.min[longest] + b.max[longest];
+	});
+	return count/2;
+}
+
+int ScenePicker::BuildNode(Tree& tree, vector<BuildPrimitive>& primitives, int first, int count, int leafSize, int depth) {
+	//split the range up to two times to get up to 4 children, always
+	//splitting the largest range which is too big for a leaf
+	int firsts[NODE_WIDTH] = {first}, counts[NODE_WIDTH] = {count};
+	int totalChildren = 1;
+	while(totalChildren < NODE_WIDTH) {
+		int largest = -1;
+		for(int c=0;c<totalChildren;c++) {
+			if(counts[c] > leafSize && (largest < 0 || counts[c] > counts[largest]))
+				largest = c;
+		}
+		if(largest < 0)
+			break;
+		int left = SplitRange(&primitives[firsts[largest]], counts[largest], depth);
+		firsts[totalChildren] = firsts[largest] + left;
+		counts[totalChildren] = counts[largest] - left;
+		counts[largest] = left;
+		totalChildren++;
+	}
+
+	int index = int(tree.nodes.size());
+	tree.nodes.push_back(Node());
+	tree.depth = max(tree.depth, depth);
+	Node node;
+	memset(&node, 0, sizeof(Node));
+	for(int c=0;c<totalChildren;c++) {
+		glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+		for(int i=0;i<counts[c];i++) {
+			const BuildPrimitive& p = primitives[firsts[c] + i];
+			min = glm::min(min, p.min);
+			max = glm::max(max, p.max);
+		}
+		node.minX[c] = min.x; node.minY[c] = min.y; node.minZ[c] = min.z;
+		node.maxX[c] = max.x; node.maxY[c] = max.y; node.maxZ[c] = max.z;
+		node.validMask |= 1<<c;
+		if(counts[c] <= leafSize) {
+			node.child[c] = firsts[c];
+			node.count[c] = counts[c];
+		} else {
+			node.child[c] = BuildNode(tree, primitives, firsts[c], counts[c], leafSize, depth+1);
+			node.count[c] = 0;
+		}
+	}
+	tree.nodes[index] = node;
+	return index;
+}
+
+ScenePicker::Ray ScenePicker::MakeRay(const glm::vec3& origin, const glm::vec3& direction) {
+	Ray ray;
+	ray.origin = origin;
+	ray.direction = direction;
+	for(int i=0;i<3;i++) {
+		float d = direction[i];
+		if(fabs(d) < MIN_DIRECTION)
+			d = (d < 0) ? -MIN_DIRECTION : MIN_DIRECTION;
+		ray.invDirection[i] = 1.0f/d;
+	}
+	return ray;
+}
+
+int ScenePicker::IntersectNode(const Node& node, const Ray& ray, float tMax, float tNear[4]) {
+#ifdef USE_AVX2
+	__m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+	__m128 ix = _mm_set1_ps(ray.invDirection.x), iy = _mm_set1_ps(ray.invDirection.y), iz = _mm_set1_ps(ray.invDirection.z);
+	__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), ix);
+	__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), ix);
+	__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), iy);
+	__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), iy);
+	__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), iz);
+	__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), iz);
+	__m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+	__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+	_mm_storeu_ps(tNear, enter);
+	return _mm_movemask_ps(_mm_cmple_ps(enter, exit)) & node.validMask;
+#else
+	int mask = 0;
+	for(int c=0;c<NODE_WIDTH;c++) {
+		float t0x = (node.minX[c] - ray.origin.x)*ray.invDirection.x, t1x = (node.maxX[c] - ray.origin.x)*ray.invDirection.x;
+		float t0y = (node.minY[c] - ray.origin.y)*ray.invDirection.y, t1y = (node.maxY[c] - ray.origin.y)*ray.invDirection.y;
+		float t0z = (node.minZ[c] - ray.origin.z)*ray.invDirection.z, t1z = (node.maxZ[c] - ray.origin.z)*ray.invDirection.z;
+		float enter = max(max(min(t0x, t1x), min(t0y, t1y)), max(min(t0z, t1z), 0.0f));
+		float exit = min(min(max(t0x, t1x), max(t0y, t1y)), min(max(t0z, t1z), tMax));
+		tNear[c] = enter;
+		if(enter <= exit)
+			mask |= 1<<c;
+	}
+	return mask & node.validMask;
+#endif
+}
+
+bool ScenePicker::IntersectPacket(const TrianglePacket& packet, const Ray& ray, Hit& hit) {
+	float t[PACKET_SIZE], u[PACKET_SIZE], v[PACKET_SIZE];
+	int mask = 0;
+#ifdef USE_AVX2
+	__m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+	__m256 e1x = _mm256_loadu_ps(packet.e1x), e1y = _mm256_loadu_ps(packet.e1y), e1z = _mm256_loadu_ps(packet.e1z);
+	__m256 e2x = _mm256_loadu_ps(packet.e2x), e2y = _mm256_loadu_ps(packet.e2y), e2z = _mm256_loadu_ps(packet.e2z);
+
+	//p = d x e2, det = e1.p
+	__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+	__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+	__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+	__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+	//s = o - v0, u = s.p/det
+	__m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_loadu_ps(packet.v0x));
+	__m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_loadu_ps(packet.v0y));
+	__m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_loadu_ps(packet.v0z));
+	__m256 uu = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+	//q = s x e1, v = d.q/det, t = e2.q/det
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+	__m256 vv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+	__m256 tt = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+	//ordered compares fail for the NaNs of degenerate and unused lanes
+	__m256 zero = _mm256_setzero_ps();
+	__m256 valid = _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ);
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(uu, zero, _CMP_GE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(vv, zero, _CMP_GE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(uu, vv), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(tt, zero, _CMP_GT_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(tt, _mm256_set1_ps(hit.t), _CMP_LT_OQ));
+	mask = _mm256_movemask_ps(valid);
+	if(mask == 0)
+		return false;
+	_mm256_storeu_ps(t, tt);
+	_mm256_storeu_ps(u, uu);
+	_mm256_storeu_ps(v, vv);
+#else
+	for(int i=0;i<PACKET_SIZE;i++) {
+		glm::vec3 e1(packet.e1x[i], packet.e1y[i], packet.e1z[i]);
+		glm::vec3 e2(packet.e2x[i], packet.e2y[i], packet.e2z[i]);
+		glm::vec3 p = glm::cross(ray.direction, e2);
+		float det = glm::dot(e1, p);
+		if(det == 0)
+			continue;
+		float invDet = 1.0f/det;
+		glm::vec3 s = ray.origin - glm::vec3(packet.v0x[i], packet.v0y[i], packet.v0z[i]);
+		u[i] = glm::dot(s, p)*invDet;
+		glm::vec3 q = glm::cross(s, e1);
+		v[i] = glm::dot(ray.direction, q)*invDet;
+		t[i] = glm::dot(e2, q)*invDet;
+		if(u[i] >= 0 && v[i] >= 0 && u[i] + v[i] <= 1 && t[i] > 0 && t[i] < hit.t)
+			mask |= 1<<i;
+	}
+	if(mask == 0)
+		return false;
+#endif
+
+	//nearest of the hit lanes
+	int best = -1;
+	for(int i=0;i<PACKET_SIZE;i++) {
+		if((mask & (1<<i)) && (best < 0 || t[i] < t[best]))
+			best = i;
+	}
+	hit.triangle = packet.ids[best];
+	hit.u = u[best];
+	hit.v = v[best];
+	hit.t = t[best];
+	return true;
+}
+
+template<class LeafTest>
+bool ScenePicker::Traverse(const Tree& tree, const Ray& ray, Hit& hit, const LeafTest& leafTest) {
+	if(tree.nodes.empty())
+		return false;
+
+	//nodes to visit with their entry distances, every level below the root
+	//adds at most NODE_WIDTH-1 entries. The median splits past MAX_DEPTH
+	//only halve the ranges, so degenerate input can build deeper trees,
+	//those get a stack on the heap.
+	int localStack[MAX_STACK];
+	float localStackNear[MAX_STACK];
+	vector<int> heapStack;
+	vector<float> heapStackNear;
+	int* stack = localStack;
+	float* stackNear = localStackNear;
+	int stackSize = tree.depth*(NODE_WIDTH-1) + 1;
+	if(stackSize > MAX_STACK) {
+		heapStack.resize(stackSize);
+		heapStackNear.resize(stackSize);
+		stack = &heapStack[0];
+		stackNear = &heapStackNear[0];
+	}
+	int top = 0;
+	stack[top] = 0;
+	stackNear[top++] = 0;
+
+	bool bHit = false;
+	while(top > 0) {
+		top--;
+		if(stackNear[top] > hit.t)
+			continue;
+		const Node& node = tree.nodes[stack[top]];
+
+		float tNear[NODE_WIDTH];
+		int mask = IntersectNode(node, ray, hit.t, tNear);
+		if(mask == 0)
+			continue;
+
+		//sort the hit children by entry distance
+		int children[NODE_WIDTH];
+		int totalChildren = 0;
+		for(int c=0;c<NODE_WIDTH;c++) {
+			if(!(mask & (1<<c)))
+				continue;
+			int i = totalChildren++;
+			while(i > 0 && tNear[children[i-1]] > tNear[c]) {
+				children[i] = children[i-1];
+				i--;
+			}
+			children[i] = c;
+		}
+
+		//test the leaves nearest first, which shrinks hit.t for the rest,
+		//and push the inner nodes farthest first so the nearest is popped next
+		for(int i=0;i<totalChildren;i++) {
+			int c = children[i];
+			if(node.count[c] != 0 && tNear[c] <= hit.t && leafTest(node.child[c], ray, hit))
+				bHit = true;
+		}
+		for(int i=totalChildren-1;i>=0;i--) {
+			int c = children[i];
+			if(node.count[c] == 0 && tNear[c] <= hit.t) {
+				stack[top] = node.child[c];
+				stackNear[top++] = tNear[c];
+			}
+		}
+	}
+	return bHit;
+}
+
+bool ScenePicker::IntersectMesh(const Mesh& mesh, const Ray& ray, Hit& hit) {
+	const TrianglePacket* packets = mesh.packets.empty() ? 0 : &mesh.packets[0];
+	return Traverse(mesh.tree, ray, hit, [packets](int child, const Ray& r, Hit& h) {
+		return IntersectPacket(packets[child], r, h);
+	});
+}
+
+bool ScenePicker::Pick(const glm::vec3& origin, const glm::vec3& direction, Hit& hit, float tMax) const {
+	hit.instance = -1;
+	hit.triangle = -1;
+	hit.u = hit.v = 0;
+	hit.t = tMax;
+	Ray ray = MakeRay(origin, direction);
+	return Traverse(topLevel, ray, hit, [this](int child, const Ray& r, Hit& h) {
+		//move the ray into the object space of the instance
+		const Instance& instance = instances[child];
+		Ray local = MakeRay(glm::vec3(instance.invTransform*glm::vec4(r.origin, 1)), glm::vec3(instance.invTransform*glm::vec4(r.direction, 0)));
+		if(!IntersectMesh(meshes[instance.mesh], local, h))
+			return false;
+		h.instance = child;
+		return true;
+	});
+}
+
+bool ScenePicker::PickBruteForce(const glm::vec3& origin, const glm::vec3& direction, Hit& hit, float tMax) const {
+	hit.instance = -1;
+	hit.triangle = -1;
+	hit.u = hit.v = 0;
+	hit.t = tMax;
+	for(size_t i=0;i<instances.size();i++) {
+		const Instance& instance = instances[i];
+		const Mesh& mesh = meshes[instance.mesh];
+		glm::vec3 o = glm::vec3(instance.invTransform*glm::vec4(origin, 1));
+		glm::vec3 d = glm::vec3(instance.invTransform*glm::vec4(direction, 0));
+		for(size_t j=0;j+2<mesh.indices.size();j+=3) {
+			const glm::vec3& a = mesh.vertices[mesh.indices[j]];
+			glm::vec3 e1 = mesh.vertices[mesh.indices[j+1]] - a;
+			glm::vec3 e2 = mesh.vertices[mesh.indices[j+2]] - a;
+			glm::vec3 p = glm::cross(d, e2);
+			float det = glm::dot(e1, p);
+			if(det == 0)
+				continue;
+			float invDet = 1.0f/det;
+			glm::vec3 s = o - a;
+			float u = glm::dot(s, p)*invDet;
+			glm::vec3 q = glm::cross(s, e1);
+			float v = glm::dot(d, q)*invDet;
+			float t = glm::dot(e2, q)*invDet;
+			if(u >= 0 && v >= 0 && u + v <= 1 && t > 0 && t < hit.t) {
+				hit.instance = int(i);
+				hit.triangle = int(j/3);
+				hit.u = u;
+				hit.v = v;
+				hit.t = t;
+			}
+		}
+	}
+	return hit.instance >= 0;
+}
+
+int ScenePicker::GetTotalMeshes() const {
+	return int(meshes.size());
+}
+
+int ScenePicker::GetTotalInstances() const {
+	return int(instances.size());
+}
+
+long long ScenePicker::GetTotalTriangles() const {
+	long long total = 0;
+	for(size_t i=0;i<instances.size();i++)
+		total += meshes[instances[i].mesh].indices.size()/3;
+	return total;
+}
+
+int ScenePicker::GetTotalNodes() const {
+	int total = int(topLevel.nodes.size());
+	for(size_t i=0;i<meshes.size();i++)
+		total += int(meshes[i].tree.nodes.size());
+	return total;
+}
+
+void ScenePicker::GetBounds(int instance, glm::vec3& min, glm::vec3& max) const {
+	min = instances[instance].min;
+	max = instances[instance].max;
+}
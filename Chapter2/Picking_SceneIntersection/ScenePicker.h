@@ -0,0 +1,148 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+
+//ScenePicker class finds the nearest triangle hit by a ray in a scene of
+//instanced triangle meshes. Every mesh gets its own bounding volume
+//hierarchy (BVH) over its triangles and a top level hierarchy is built over
+//the world space bounds of the instances, so moving an instance only
+//rebuilds the small top level tree.
+//
+//Both trees have 4 children per node whose boxes are stored in structure of
+//arrays layout, so one node is tested with a single SSE slab test. The
+//leaves of the mesh trees hold up to 8 triangles as one packet of
+//precomputed vertices and edges, which is intersected with the Moller-
+//Trumbore test in one pass of AVX2 instructions. The children are visited
+//nearest first and subtrees farther than the current hit are skipped.
+//
+//Instances hold an affine transform. The ray is moved into the object space
+//of every instance it reaches without normalizing the direction, so the hit
+//distances of all instances are comparable.
+class ScenePicker
+{
+public:
+	//result of a pick, the hit point is origin + t*direction and the
+	//barycentrics weight the 2nd and 3rd vertex of the triangle
+	struct Hit {
+		int instance, triangle;
+		float u, v, t;
+	};
+
+	//constructor/destructor
+	ScenePicker(void);
+	~ScenePicker(void);
+
+	//builds the hierarchy of an indexed triangle mesh and returns its ID
+	int AddMesh(const glm::vec3* vertices, int totalVertices, const unsigned int* indices, int totalIndices);
+
+	//adds an instance of a mesh and returns its ID
+	int AddInstance(int mesh, const glm::mat4& transform);
+	void SetTransform(int instance, const glm::mat4& transform);
+
+	//builds the top level hierarchy, call after the instances are added or moved
+	void Build();
+
+	//returns true if the ray hits a triangle closer than tMax and stores the
+	//nearest hit. It is safe to pick from many threads at once.
+	bool Pick(const glm::vec3& origin, const glm::vec3& direction, Hit& hit, float tMax = 3.4e38f) const;
+
+	//tests every triangle of every instance without the hierarchies, for comparison
+	bool PickBruteForce(const glm::vec3& origin, const glm::vec3& direction, Hit& hit, float tMax = 3.4e38f) const;
+
+	int GetTotalMeshes() const;
+	int GetTotalInstances() const;
+
+	//triangles of all instances
+	long long GetTotalTriangles() const;
+
+	//nodes of all mesh hierarchies and of the top level hierarchy
+	int GetTotalNodes() const;
+
+	//world space bounds of an instance
+	void GetBounds(int instance, glm::vec3& min, glm::vec3& max) const;
+
+protected:
+	//4 child boxes of an inner node. A child with count 0 is an inner node,
+	//otherwise it is a leaf with count primitives starting at first.
+	struct Node {
+		float minX[4], minY[4], minZ[4];
+		float maxX[4], maxY[4], maxZ[4];
+		int child[4];
+		int count[4];
+		int validMask;			//bit set for every used child
+	};
+
+	//up to 8 triangles of a leaf, unused lanes have zero edges and never hit
+	struct TrianglePacket {
+		float v0x[8], v0y[8], v0z[8];
+		float e1x[8], e1y[8], e1z[8];
+		float e2x[8], e2y[8], e2z[8];
+		int ids[8];
+	};
+
+	//hierarchy over a set of boxes, the leaves reference ranges of order
+	struct Tree {
+		vector<Node> nodes;
+		vector<int> order;
+		glm::vec3 min, max;		//bounds of the root
+		int depth;				//depth of the deepest inner node, sizes the traversal stack
+	};
+
+	struct Mesh {
+		Tree tree;
+		vector<TrianglePacket> packets;
+		vector<glm::vec3> vertices;
+		vector<unsigned int> indices;
+	};
+
+	struct Instance {
+		int mesh;
+		glm::mat4 transform, invTransform;
+		glm::vec3 min, max;		//world space bounds
+	};
+
+	//ray with the reciprocal direction used by the slab test
+	struct Ray {
+		glm::vec3 origin, direction, invDirection;
+	};
+
+	//bounds of a primitive during the build, the primitives are reordered
+	//in place so that every range stays contiguous in memory
+	struct BuildPrimitive {
+		glm::vec3 min;
+		int id;
+		glm::vec3 max;
+		float pad;
+	};
+
+	//builds a tree with up to leafSize primitives per leaf
+	static void BuildTree(Tree& tree, const vector<glm::vec3>& mins, const vector<glm::vec3>& maxs, int leafSize);
+
+	//splits the range [first, first+count) of the primitives into two with
+	//the binned surface area heuristic and returns the size of the first part
+	static int SplitRange(BuildPrimitive* primitives, int count, int depth);
+	static int BuildNode(Tree& tree, vector<BuildPrimitive>& primitives, int first, int count, int leafSize, int depth);
+
+	//tests the 4 child boxes of a node, returns the mask of the hit children
+	//and their entry distances
+	static int IntersectNode(const Node& node, const Ray& ray, float tMax, float tNear[4]);
+
+	//intersects a packet and updates hit if a closer triangle is found
+	static bool IntersectPacket(const TrianglePacket& packet, const Ray& ray, Hit& hit);
+
+	//visits the leaves of a tree nearest first, leafTest(child, ray, hit)
+	//returns true if it found a closer hit
+	template<class LeafTest>
+	static bool Traverse(const Tree& tree, const Ray& ray, Hit& hit, const LeafTest& leafTest);
+
+	//finds the nearest hit in a mesh, the ray is in object space
+	static bool IntersectMesh(const Mesh& mesh, const Ray& ray, Hit& hit);
+
+	static Ray MakeRay(const glm::vec3& origin, const glm::vec3& direction);
+
+	vector<Mesh> meshes;
+	vector<Instance> instances;
+	Tree topLevel;
+};
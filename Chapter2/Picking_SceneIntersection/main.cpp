@@ -12,6 +12,17 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "GLSLShader.h"
+#include "ScenePicker.h"
+
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
@@ -76,15 +87,32 @@ CFreeCamera cam;
 #include "Grid.h"
 CGrid* grid;
 
-//unit cube object
-#include "UnitCube.h"
-CUnitCube* cube;
-
 //modelview and projection matrices
 glm::mat4 MV,P;
 
-//selected box index
-int selected_box=-1;
+//mesh shader
+GLSLShader meshShader;
+
+//triangle mesh with its vertex array and buffer objects
+struct Mesh {
+	vector<glm::vec3> positions, normals;
+	vector<GLuint> indices;
+	GLuint vaoID, vboVerticesID, vboNormalsID, vboIndicesID;
+};
+
+//box, sphere and torus meshes
+const int BOX_MESH = 0;
+const int SPHERE_MESH = 1;
+const int TORUS_MESH = 2;
+Mesh meshes[3];
+
+//scene object, an instance of a mesh
+struct Object {
+	int mesh;
+	glm::mat4 M;
+	glm::vec3 color;
+};
+vector<Object> objects;
 
 //box positions
 glm::vec3 box_positions[3]={glm::vec3(-1,0.5,0),
@@ -92,35 +120,227 @@ glm::vec3 box_positions[3]={glm::vec3(-1,0.5,0),
 							glm::vec3(1,0.5,0)
 							};
 
+//spheres and tori around the boxes
+const int TOTAL_RING_OBJECTS = 8;
+const float RING_RADIUS = 4;
+
+//sphere tessellation, the torus has as many triangles
+int sphereStacks = 64;
+
+//picker with one hierarchy per mesh and one over the objects
+ScenePicker picker;
+
+//result of the last pick and its time
+ScenePicker::Hit pickHit;
+bool bPicked = false;
+float pickTime = 0;
+
+//creates a unit cube centered at the origin with flat normals
+void CreateBox(Mesh& mesh) {
+	mesh.positions.clear();
+	mesh.normals.clear();
+	mesh.indices.clear();
+	for(int f=0;f<6;f++) {
+		int axis = f/2;
+		float side = (f%2) ? 0.5f : -0.5f;
+		glm::vec3 n(0), u(0), v(0);
+		n[axis] = side*2;
+		u[(axis+1)%3] = 0.5f;
+		v[(axis+2)%3] = 0.5f;
+		GLuint first = GLuint(mesh.positions.size());
+		for(int i=0;i<4;i++) {
+			float a = (i&1) ? 1.0f : -1.0f, b = (i&2) ? 1.0f : -1.0f;
+			mesh.positions.push_back(n*0.5f + u*a + v*b);
+			mesh.normals.push_back(n);
+		}
+		//keep the front faces counter clockwise
+		if(side > 0) {
+			GLuint quad[6] = {0,1,3,0,3,2};
+			for(int i=0;i<6;i++) mesh.indices.push_back(first + quad[i]);
+		} else {
+			GLuint quad[6] = {0,3,1,0,2,3};
+			for(int i=0;i<6;i++) mesh.indices.push_back(first + quad[i]);
+		}
+	}
+}
+
+//creates a sphere of radius 0.5 with 2*stacks*slices triangles
+void CreateSphere(Mesh& mesh, int stacks, int slices) {
+	mesh.positions.clear();
+	mesh.normals.clear();
+	mesh.indices.clear();
+	for(int j=0;j<=stacks;j++) {
+		float theta = float(M_PI)*j/stacks;
+		for(int i=0;i<=slices;i++) {
+			float phi = 2*float(M_PI)*i/slices;
+			glm::vec3 n(sin(theta)*cos(phi), cos(theta), -sin(theta)*sin(phi));
+			mesh.positions.push_back(n*0.5f);
+			mesh.normals.push_back(n);
+		}
+	}
+	for(int j=0;j<stacks;j++) {
+		for(int i=0;i<slices;i++) {
+			GLuint a = j*(slices+1) + i, b = a + slices + 1;
+			mesh.indices.push_back(a);   mesh.indices.push_back(b);   mesh.indices.push_back(a+1);
+			mesh.indices.push_back(a+1); mesh.indices.push_back(b);   mesh.indices.push_back(b+1);
+		}
+	}
+}
 
-//box struct 
-struct Box { glm::vec3 min, max;}boxes[3];
-#include <limits>
+//creates a torus in the XZ plane with 2*rings*sides triangles
+void CreateTorus(Mesh& mesh, int rings, int sides, float radius, float tubeRadius) {
+	mesh.positions.clear();
+	mesh.normals.clear();
+	mesh.indices.clear();
+	for(int j=0;j<=rings;j++) {
+		float phi = 2*float(M_PI)*j/rings;
+		glm::vec3 center(cos(phi)*radius, 0, -sin(phi)*radius);
+		glm::vec3 out(cos(phi), 0, -sin(phi));
+		for(int i=0;i<=sides;i++) {
+			float theta = 2*float(M_PI)*i/sides;
+			glm::vec3 n = out*cos(theta) + glm::vec3(0,1,0)*sin(theta);
+			mesh.positions.push_back(center + n*tubeRadius);
+			mesh.normals.push_back(n);
+		}
+	}
+	for(int j=0;j<rings;j++) {
+		for(int i=0;i<sides;i++) {
+			GLuint a = j*(sides+1) + i, b = a + sides + 1;
+			mesh.indices.push_back(a);   mesh.indices.push_back(b);   mesh.indices.push_back(a+1);
+			mesh.indices.push_back(a+1); mesh.indices.push_back(b);   mesh.indices.push_back(b+1);
+		}
+	}
+}
+
+//creates the meshes and the objects of the scene and builds the picker
+void CreateScene(int stacks) {
+	CreateBox(meshes[BOX_MESH]);
+	CreateSphere(meshes[SPHERE_MESH], stacks, stacks*2);
+	CreateTorus(meshes[TORUS_MESH], stacks*2, stacks, 0.35f, 0.15f);
+	for(int i=0;i<3;i++)
+		picker.AddMesh(&meshes[i].positions[0], int(meshes[i].positions.size()), &meshes[i].indices[0], int(meshes[i].indices.size()));
+
+	//the three boxes keep their colours, the ring alternates spheres and tori
+	glm::vec3 colors[3] = {glm::vec3(1,0,0), glm::vec3(0,1,0), glm::vec3(0,0,1)};
+	objects.clear();
+	for(int i=0;i<3;i++) {
+		Object box = {BOX_MESH, glm::translate(glm::mat4(1), box_positions[i]), colors[i]};
+		objects.push_back(box);
+	}
+	for(int i=0;i<TOTAL_RING_OBJECTS;i++) {
+		float angle = 2*float(M_PI)*i/TOTAL_RING_OBJECTS;
+		glm::mat4 T = glm::translate(glm::mat4(1), glm::vec3(cos(angle)*RING_RADIUS, 1, sin(angle)*RING_RADIUS));
+		glm::mat4 R = glm::rotate(glm::mat4(1), angle*2, glm::vec3(1,0,1));
+		glm::mat4 S = glm::scale(glm::mat4(1), glm::vec3(1.5f));
+		Object object = {(i%2) ? TORUS_MESH : SPHERE_MESH, T*R*S, colors[i%3]*0.75f};
+		objects.push_back(object);
+	}
+	for(size_t i=0;i<objects.size();i++)
+		picker.AddInstance(objects[i].mesh, objects[i].M);
+	picker.Build();
+}
+
+//returns the world space ray through a window position. The ray is
+//unprojected at two different depths, 0 at the near clip plane and 1 at the
+//far clip plane, which gives two world space points. Subtracting these
+//gives the ray direction vector.
+void GetEyeRay(int x, int y, const glm::mat4& MV, const glm::mat4& P, glm::vec3& origin, glm::vec3& direction) {
+	glm::vec3 start = glm::unProject(glm::vec3(x,HEIGHT-y,0), MV, P, glm::vec4(0,0,WIDTH,HEIGHT));
+	glm::vec3   end = glm::unProject(glm::vec3(x,HEIGHT-y,1), MV, P, glm::vec4(0,0,WIDTH,HEIGHT));
+	origin = start;
+	direction = glm::normalize(end-start);
+}
+
+//picks random window positions on a scene of instanced meshes and reports
+//the build time, the pick latency and the number of picks per second on one
+//and on all threads. The hits of the first rays are compared with testing
+//every triangle.
+void RunBenchmark() {
+	const int TOTAL_SCENES = 4;
+	const char* names[TOTAL_SCENES] = {"1 x 1M sphere", "64 x 16K spheres", "16 x 250K tori", "256 x 16K mixed"};
+	const int instanceCounts[TOTAL_SCENES] = {1, 64, 16, 256};
+	const int stackCounts[TOTAL_SCENES] = {500, 64, 250, 64};
+	const int meshKinds[TOTAL_SCENES] = {SPHERE_MESH, SPHERE_MESH, TORUS_MESH, -1};
+	const int TOTAL_PICKS = 100000;
+	const int VERIFIED_PICKS = 100;
+
+	printf("Scene picking benchmark: %d picks at random window positions\n", TOTAL_PICKS);
+	printf("%-18s %12s %10s %10s %8s %12s %12s %12s %14s\n", "scene", "triangles", "nodes", "build ms", "hits",
+		"usecs/pick", "99% usecs", "picks/sec", "picks/sec MT");
+
+	glm::mat4 view = glm::lookAt(glm::vec3(6,6,6), glm::vec3(0), glm::vec3(0,1,0));
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), (float)WIDTH/HEIGHT, 0.1f, 1000.0f);
+
+	for(int s=0;s<TOTAL_SCENES;s++) {
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		ScenePicker scenePicker;
+		Mesh mesh;
+		int sphereMesh = -1, torusMesh = -1;
+		if(meshKinds[s] != TORUS_MESH) {
+			CreateSphere(mesh, stackCounts[s], stackCounts[s]*2);
+			sphereMesh = scenePicker.AddMesh(&mesh.positions[0], int(mesh.positions.size()), &mesh.indices[0], int(mesh.indices.size()));
+		}
+		if(meshKinds[s] != SPHERE_MESH) {
+			CreateTorus(mesh, stackCounts[s]*2, stackCounts[s], 0.35f, 0.15f);
+			torusMesh = scenePicker.AddMesh(&mesh.positions[0], int(mesh.positions.size()), &mesh.indices[0], int(mesh.indices.size()));
+		}
 
-//simple Ray struct
-struct Ray {
+		//the instances stand on a square grid around the origin
+		int side = int(ceil(sqrt(float(instanceCounts[s]))));
+		float spacing = 8.0f/side;
+		for(int i=0;i<instanceCounts[s];i++) {
+			glm::vec3 position = (instanceCounts[s] == 1) ? glm::vec3(0) : glm::vec3((i%side + 0.5f)*spacing - 4, 0, (i/side + 0.5f)*spacing - 4);
+			glm::mat4 M = glm::translate(glm::mat4(1), position)*glm::rotate(glm::mat4(1), float(i), glm::vec3(0,1,1))*glm::scale(glm::mat4(1), glm::vec3(instanceCounts[s] == 1 ? 8.0f : spacing*1.5f));
+			scenePicker.AddInstance((torusMesh >= 0 && (sphereMesh < 0 || i%2)) ? torusMesh : sphereMesh, M);
+		}
+		scenePicker.Build();
+		float buildTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+
+		//the same random window positions for every run
+		vector<glm::vec3> origins(TOTAL_PICKS), directions(TOTAL_PICKS);
+		srand(1234);
+		for(int i=0;i<TOTAL_PICKS;i++)
+			GetEyeRay(rand()%WIDTH, rand()%HEIGHT, view, proj, origins[i], directions[i]);
+
+		//single thread latency
+		vector<ScenePicker::Hit> hits(TOTAL_PICKS);
+		vector<double> times(TOTAL_PICKS);
+		double totalTime = 0;
+		int totalHits = 0;
+		for(int i=0;i<TOTAL_PICKS;i++) {
+			chrono::high_resolution_clock::time_point t0 = chrono::high_resolution_clock::now();
+			bool bHit = scenePicker.Pick(origins[i], directions[i], hits[i]);
+			double time = chrono::duration<double, micro>(chrono::high_resolution_clock::now() - t0).count();
+			totalTime += time;
+			times[i] = time;
+			totalHits += bHit ? 1 : 0;
+		}
 
-public:
-	glm::vec3 origin, direction;
-	float t;
+		//99th percentile, the slowest picks are mostly interrupted by the system
+		nth_element(times.begin(), times.begin() + TOTAL_PICKS*99/100, times.end());
+		double percentileTime = times[TOTAL_PICKS*99/100];
+
+		//throughput on all threads
+		start = chrono::high_resolution_clock::now();
+		#pragma omp parallel for schedule(dynamic, 256)
+		for(int i=0;i<TOTAL_PICKS;i++)
+			scenePicker.Pick(origins[i], directions[i], hits[i]);
+		double mtTime = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+		//compare with the brute force test
+		int mismatches = 0;
+		for(int i=0;i<VERIFIED_PICKS;i++) {
+			ScenePicker::Hit reference;
+			bool bHit = scenePicker.PickBruteForce(origins[i], directions[i], reference);
+			if(bHit != (hits[i].instance >= 0) || (bHit && (reference.instance != hits[i].instance || fabs(reference.t - hits[i].t) > 1e-4f*reference.t)))
+				mismatches++;
+		}
 
-	Ray() {
-		t=std::numeric_limits<float>::max();
-		origin=glm::vec3(0);
-		direction=glm::vec3(0);
+		printf("%-18s %12lld %10d %10.1f %8d %12.3f %12.3f %12.0f %14.0f\n", names[s], scenePicker.GetTotalTriangles(), scenePicker.GetTotalNodes(),
+			buildTime, totalHits, totalTime/TOTAL_PICKS, percentileTime, TOTAL_PICKS/(totalTime*1e-6), TOTAL_PICKS/mtTime);
+		printf("%-18s %d of %d verified picks %s\n", "", VERIFIED_PICKS - mismatches, VERIFIED_PICKS,
+			mismatches ? "DIFFER from brute force" : "match brute force");
 	}
-}eyeRay;
-
-//ray Box intersection code
-glm::vec2 intersectBox(const Ray& ray, const Box& cube) {
-	glm::vec3 inv_dir = 1.0f/ray.direction;
-	glm::vec3   tMin = (cube.min - ray.origin) * inv_dir;
-	glm::vec3   tMax = (cube.max - ray.origin) * inv_dir;
-	glm::vec3     t1 = glm::min(tMin, tMax);
-	glm::vec3     t2 = glm::max(tMin, tMax);
-	float tNear = max(max(t1.x, t1.y), t1.z);
-	float  tFar = min(min(t2.x, t2.y), t2.z);
-	return glm::vec2(tNear, tFar);
 }
 
 //output message
@@ -176,30 +396,19 @@ void OnMouseDown(int button, int s, int x, int y)
 		oldX = x;
 		oldY = y;
 
-		//unproject the ray at the click position at two different depths 0 at near clip plne
-		//and 1 at far clip plane. These give us two world space points. Subtracting these we get 
-		//the ray direction vector.
-		glm::vec3 start = glm::unProject(glm::vec3(x,HEIGHT-y,0), MV, P, glm::vec4(0,0,WIDTH,HEIGHT));
-		glm::vec3   end = glm::unProject(glm::vec3(x,HEIGHT-y,1), MV, P, glm::vec4(0,0,WIDTH,HEIGHT));
-
-		eyeRay.origin=cam.GetPosition();
-		eyeRay.direction =  glm::normalize(end-start);
-		float tMin = numeric_limits<float>::max();
-		selected_box = -1;
-
-		//next we loop through all scene objects and find the ray intersection with the bounding box
-		//of each object. The nearest intersected object's index is stored
-		for(int i=0;i<3;i++) {
-			glm::vec2 tMinMax = intersectBox(eyeRay, boxes[i]);
-			if(tMinMax.x<tMinMax.y && tMinMax.x<tMin) {
-				selected_box=i;
-				tMin = tMinMax.x;
-			}
-		}
-		if(selected_box==-1)
-			cout<<"No box picked"<<endl;
+		//get the eye ray at the click position
+		glm::vec3 origin, direction;
+		GetEyeRay(x, y, MV, P, origin, direction);
+
+		//find the nearest triangle hit by the ray in the object and mesh hierarchies
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		bPicked = picker.Pick(origin, direction, pickHit);
+		pickTime = chrono::duration<float, micro>(chrono::high_resolution_clock::now() - start).count();
+
+		if(!bPicked)
+			cout<<"No object picked"<<endl;
 		else
-			cout<<"Selected box: "<<selected_box<<endl;
+			cout<<"Selected object: "<<pickHit.instance<<" triangle: "<<pickHit.triangle<<" barycentrics: ("<<pickHit.u<<", "<<pickHit.v<<") distance: "<<pickHit.t<<endl;
 	}
 
 	if(button == GLUT_MIDDLE_BUTTON)
@@ -212,7 +421,7 @@ void OnMouseDown(int button, int s, int x, int y)
 //mouse move handler
 void OnMouseMove(int x, int y)
 {
-	if(selected_box == -1) {
+	if(!bPicked) {
 		if (state == 0) {
 			fov += (y - oldY)/5.0f;
 			cam.SetupProjection(fov, cam.GetAspectRatio());
@@ -242,8 +451,48 @@ void OnInit() {
 	//create a grid of size 20x20 in XZ plane
 	grid = new CGrid(20,20);
 
-	//create a unit cube
-	cube = new CUnitCube();
+	//load the mesh shader
+	meshShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/mesh.vert");
+	meshShader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/mesh.frag");
+	//compile and link shader
+	meshShader.CreateAndLinkProgram();
+	meshShader.Use();
+		//add attributes and uniforms
+		meshShader.AddAttribute("vVertex");
+		meshShader.AddAttribute("vNormal");
+		meshShader.AddUniform("MVP");
+		meshShader.AddUniform("N");
+		meshShader.AddUniform("vColor");
+	meshShader.UnUse();
+
+	GL_CHECK_ERRORS
+
+	//create the scene meshes and objects and build the picking hierarchies
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	CreateScene(sphereStacks);
+	float buildTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+	cout<<"Built picking hierarchies over "<<picker.GetTotalTriangles()<<" triangles in "<<buildTime<<" msecs"<<endl;
+
+	//setup the mesh vertex array and buffer objects
+	for(int i=0;i<3;i++) {
+		Mesh& mesh = meshes[i];
+		glGenVertexArrays(1, &mesh.vaoID);
+		glGenBuffers(1, &mesh.vboVerticesID);
+		glGenBuffers(1, &mesh.vboNormalsID);
+		glGenBuffers(1, &mesh.vboIndicesID);
+		glBindVertexArray(mesh.vaoID);
+			glBindBuffer (GL_ARRAY_BUFFER, mesh.vboVerticesID);
+			glBufferData (GL_ARRAY_BUFFER, mesh.positions.size()*sizeof(glm::vec3), &mesh.positions[0], GL_STATIC_DRAW);
+			glEnableVertexAttribArray(meshShader["vVertex"]);
+			glVertexAttribPointer(meshShader["vVertex"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+			glBindBuffer (GL_ARRAY_BUFFER, mesh.vboNormalsID);
+			glBufferData (GL_ARRAY_BUFFER, mesh.normals.size()*sizeof(glm::vec3), &mesh.normals[0], GL_STATIC_DRAW);
+			glEnableVertexAttribArray(meshShader["vNormal"]);
+			glVertexAttribPointer(meshShader["vNormal"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vboIndicesID);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size()*sizeof(GLuint), &mesh.indices[0], GL_STATIC_DRAW);
+		glBindVertexArray(0);
+	}
 
 	GL_CHECK_ERRORS
 
@@ -270,12 +519,6 @@ void OnInit() {
 	//enable depth testing
 	glEnable(GL_DEPTH_TEST);
 
-	//determine the scene geometry bounding boxes
-	for(int i=0;i<3;i++) {
-		boxes[i].min=box_positions[i]-0.5f;
-		boxes[i].max=box_positions[i]+0.5f;
-	}
-
 	cout<<"Initialization successfull"<<endl;
 }
 
@@ -283,7 +526,17 @@ void OnInit() {
 void OnShutdown() {
 
 	delete grid;
-	delete cube;
+
+	//Destroy shader
+	meshShader.DeleteShaderProgram();
+
+	//Destroy mesh vao and vbos
+	for(int i=0;i<3;i++) {
+		glDeleteVertexArrays(1, &meshes[i].vaoID);
+		glDeleteBuffers(1, &meshes[i].vboVerticesID);
+		glDeleteBuffers(1, &meshes[i].vboNormalsID);
+		glDeleteBuffers(1, &meshes[i].vboIndicesID);
+	}
 	cout<<"Shutdown successfull"<<endl;
 }
 
@@ -383,10 +636,11 @@ void OnRender() {
 
 	//set the mesage
 	msg.str(std::string());
-	if(selected_box==-1)
-		msg<<"No box picked";
+	if(!bPicked)
+		msg<<"No object picked";
 	else
-		msg<<"Picked box: "<<selected_box;
+		msg<<"Picked object: "<<pickHit.instance<<" triangle: "<<pickHit.triangle<<" barycentrics: ("<<pickHit.u<<", "<<pickHit.v<<") distance: "<<pickHit.t;
+	msg<<" :: "<<picker.GetTotalTriangles()<<" triangles, pick: "<<pickTime<<" usecs";
 
 	//set the window title
 	glutSetWindowTitle(msg.str().c_str());
@@ -399,29 +653,36 @@ void OnRender() {
 	//render the grid object
 	grid->Render(glm::value_ptr(MVP));
 
-	//set the first cube transform 
-	//set its colour to cyan if selected, red otherwise
-	glm::mat4 T = glm::translate(glm::mat4(1), box_positions[0]);
-	cube->color = (selected_box==0)?glm::vec3(0,1,1):glm::vec3(1,0,0);
-	cube->Render(glm::value_ptr(MVP*T));
-
-	//set the second cube transform 
-	//set its colour to cyan if selected, green otherwise
-	T = glm::translate(glm::mat4(1), box_positions[1]);
-	cube->color = (selected_box==1)?glm::vec3(0,1,1):glm::vec3(0,1,0);
-	cube->Render(glm::value_ptr(MVP*T));
-
-	//set the third cube transform 
-	//set its colour to cyan if selected, blue otherwise
-	T = glm::translate(glm::mat4(1), box_positions[2]);
-	cube->color = (selected_box==2)?glm::vec3(0,1,1):glm::vec3(0,0,1);
-	cube->Render(glm::value_ptr(MVP*T));
+	//render the objects, the picked object is drawn in cyan
+	meshShader.Use();
+	for(size_t i=0;i<objects.size();i++) {
+		const Object& object = objects[i];
+		glm::vec3 color = (bPicked && pickHit.instance==int(i))?glm::vec3(0,1,1):object.color;
+		glm::mat3 N = glm::inverse(glm::transpose(glm::mat3(object.M)));
+		glUniformMatrix4fv(meshShader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP*object.M));
+		glUniformMatrix3fv(meshShader("N"), 1, GL_FALSE, glm::value_ptr(N));
+		glUniform3fv(meshShader("vColor"), 1, glm::value_ptr(color));
+		glBindVertexArray(meshes[object.mesh].vaoID);
+			glDrawElements(GL_TRIANGLES, GLsizei(meshes[object.mesh].indices.size()), GL_UNSIGNED_INT, 0);
+	}
+	glBindVertexArray(0);
+	meshShader.UnUse();
 
 	//swap front and back buffers to show the rendered result
 	glutSwapBuffers();
 }
 
 int main(int argc, char** argv) {
+	//run the picking benchmark without opening a window
+	if(argc>1 && strcmp(argv[1], "--benchmark")==0) {
+		RunBenchmark();
+		return 0;
+	}
+
+	//optional sphere tessellation, every sphere and torus has 4*stacks*stacks triangles
+	if(argc>1)
+		sphereStacks = max(2, atoi(argv[1]));
+
 	//freeglut initialization calls
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
@@ -0,0 +1,19 @@
+#version 330 core
+
+layout(location = 0) out vec4 vFragColor;	//fragment shader output
+
+//input from vertex shader
+smooth in vec3 vWorldNormal;
+
+//uniform
+uniform vec3 vColor; //object colour
+
+//light direction in world space
+const vec3 L = vec3(0.408248, 0.816497, 0.408248);
+
+void main()
+{
+	//diffuse lighting with a constant ambient term
+	float diffuse = max(0, dot(normalize(vWorldNormal), L));
+	vFragColor = vec4(vColor*(0.3 + 0.7*diffuse), 1);
+}
@@ -0,0 +1,20 @@
+#version 330 core
+  
+layout(location = 0) in vec3 vVertex;	//object space vertex position
+layout(location = 1) in vec3 vNormal;	//object space vertex normal
+
+//uniforms
+uniform mat4 MVP;	//combined modelview projection matrix
+uniform mat3 N;		//object to world space normal matrix
+
+//output to fragment shader
+smooth out vec3 vWorldNormal;
+
+void main()
+{  
+	//get the world space normal
+	vWorldNormal = N*vNormal;
+
+	//get the clipspace position
+	gl_Position = MVP*vec4(vVertex.xyz,1);
+}
@@ -0,0 +1,411 @@
+#include "FrustumCuller.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+
+//spheres per leaf, one AVX2 register
+const int SIMD_WIDTH = 8;
+const int LEAF_SIZE = SIMD_WIDTH;
+
+//below this many spheres the threads cost more than they save
+const int PARALLEL_THRESHOLD = 16384;
+
+//subtrees per thread, more tasks balance better when the visible part of
+//the tree is uneven
+const int TASKS_PER_THREAD = 8;
+
+//the tree is balanced so its depth stays far below this
+const int MAX_STACK = 128;
+
+//all six planes
+const int ALL_PLANES = 0x3F;
+
+FrustumCuller::FrustumCuller(void)
+{
+	totalSpheres = 0;
+	bMultithreaded = true;
+	nodesVisited = 0;
+	spheresTested = 0;
+	for(int i=0;i<8;i++) {
+		planeX[i] = planeY[i] = planeZ[i] = 0;
+		planeW[i] = 1;
+		absX[i] = absY[i] = absZ[i] = 0;
+	}
+}
+
+FrustumCuller::~FrustumCuller(void)
+{
+}
+
+//spreads the lower 10 bits of v so that there are two zero bits between them
+inline unsigned int ExpandBits(unsigned int v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+void FrustumCuller::Build(const glm::vec4* spheres, int count) {
+	totalSpheres = count;
+	nodes.clear();
+	if(count == 0) {
+		cx.clear(); cy.clear(); cz.clear(); radius.clear();
+		sphereIDs.clear();
+		lastPlanes.clear();
+		return;
+	}
+
+	//order the spheres along a Morton curve through the bounds of their
+	//centers, nearby spheres end up next to each other. The grid cells are
+	//cubes, so flat scenes are not split along their thin axis too early.
+	glm::vec3 centerMin(FLT_MAX), centerMax(-FLT_MAX);
+	for(int i=0;i<count;i++) {
+		glm::vec3 c(spheres[i].x, spheres[i].y, spheres[i].z);
+		centerMin = glm::min(centerMin, c);
+		centerMax = glm::max(centerMax, c);
+	}
+	glm::vec3 size = centerMax - centerMin;
+	float scale = 1023.0f/max(max(size.x, size.y), max(size.z, 1e-6f));
+	vector<pair<unsigned int, int> > codes(count);
+	for(int i=0;i<count;i++) {
+		glm::vec3 q = (glm::vec3(spheres[i].x, spheres[i].y, spheres[i].z) - centerMin)*scale;
+		codes[i].first = (ExpandBits((unsigned int)q.x) << 2) | (ExpandBits((unsigned int)q.y) << 1) | ExpandBits((unsigned int)q.z);
+		codes[i].second = i;
+	}
+	sort(codes.begin(), codes.end());
+
+	//store the spheres in that order, padded so that a leaf can always be
+	//loaded with one full register
+	int padded = count + SIMD_WIDTH;
+	cx.assign(padded, 0.0f);
+	cy.assign(padded, 0.0f);
+	cz.assign(padded, 0.0f);
+	radius.assign(padded, 0.0f);
+	sphereIDs.resize(count);
+	for(int i=0;i<count;i++) {
+		const glm::vec4& s = spheres[codes[i].second];
+		sphereIDs[i] = codes[i].second;
+		cx[i] = s.x;
+		cy[i] = s.y;
+		cz[i] = s.z;
+		radius[i] = s.w;
+	}
+
+	//halving the curve gives about two nodes per leaf
+	nodes.reserve(2*(count/LEAF_SIZE + 1));
+	BuildNode(0, count);
+	lastPlanes.assign(nodes.size(), 0);
+}
+
+int FrustumCuller::BuildNode(int first, int count) {
+	int index = int(nodes.size());
+	Node node;
+	node.first = first;
+	node.count = count;
+	node.right = -1;
+	nodes.push_back(node);
+
+	glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+	if(count <= LEAF_SIZE) {
+		for(int i=first;i<first+count;i++) {
+			glm::vec3 c(cx[i], cy[i], cz[i]);
+			boxMin = glm::min(boxMin, c - glm::vec3(radius[i]));
+			boxMax = glm::max(boxMax, c + glm::vec3(radius[i]));
+		}
+	} else {
+		//split the curve in the middle, keeping the halves multiples of the
+		//leaf size so that the leaves are full
+		int half = (count/2 + LEAF_SIZE - 1)/LEAF_SIZE*LEAF_SIZE;
+		int left = BuildNode(first, half);
+		int right = BuildNode(first + half, count - half);
+		nodes[index].right = right;
+
+		//the node bounds the boxes of its children
+		boxMin = glm::min(nodes[left].center - nodes[left].extent, nodes[right].center - nodes[right].extent);
+		boxMax = glm::max(nodes[left].center + nodes[left].extent, nodes[right].center + nodes[right].extent);
+	}
+	nodes[index].center = (boxMin + boxMax)*0.5f;
+	nodes[index].extent = (boxMax - boxMin)*0.5f;
+	return index;
+}
+
+void FrustumCuller::SetPlanes(const glm::vec4 planes[6]) {
+	for(int i=0;i<6;i++) {
+		glm::vec4 p = planes[i]/glm::length(glm::vec3(planes[i]));
+		planeX[i] = p.x;
+		planeY[i] = p.y;
+		planeZ[i] = p.z;
+		planeW[i] = p.w;
+		absX[i] = fabs(p.x);
+		absY[i] = fabs(p.y);
+		absZ[i] = fabs(p.z);
+	}
+}
+
+int FrustumCuller::TestNode(int node, int mask) {
+	const Node& n = nodes[node];
+	//the plane that rejected the node last frame most likely rejects it again
+	int last = lastPlanes[node];
+	if(mask & (1<<last)) {
+		float d = planeX[last]*n.center.x + planeY[last]*n.center.y + planeZ[last]*n.center.z + planeW[last];
+		float r = absX[last]*n.extent.x + absY[last]*n.extent.y + absZ[last]*n.extent.z;
+		if(d + r < 0)
+			return -1;
+	}
+
+#ifdef USE_AVX2
+	//then all planes at once, one per lane
+	__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(planeX), _mm256_set1_ps(n.center.x)),
+										   _mm256_mul_ps(_mm256_loadu_ps(planeY), _mm256_set1_ps(n.center.y))),
+							 _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(planeZ), _mm256_set1_ps(n.center.z)), _mm256_loadu_ps(planeW)));
+	__m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(absX), _mm256_set1_ps(n.extent.x)),
+										   _mm256_mul_ps(_mm256_loadu_ps(absY), _mm256_set1_ps(n.extent.y))),
+							 _mm256_mul_ps(_mm256_loadu_ps(absZ), _mm256_set1_ps(n.extent.z)));
+	int outside = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_LT_OQ)) & mask;
+	if(outside) {
+		int p = 0;
+		while(!(outside & (1<<p)))
+			p++;
+		lastPlanes[node] = (unsigned char)p;
+		return -1;
+	}
+	return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_sub_ps(d, r), _mm256_setzero_ps(), _CMP_LT_OQ)) & mask;
+#else
+	int straddled = 0;
+	for(int i=0;i<6;i++) {
+		if(!(mask & (1<<i)))
+			continue;
+		float d = planeX[i]*n.center.x + planeY[i]*n.center.y + planeZ[i]*n.center.z + planeW[i];
+		float r = absX[i]*n.extent.x + absY[i]*n.extent.y + absZ[i]*n.extent.z;
+		if(d + r < 0) {
+			lastPlanes[node] = (unsigned char)i;
+			return -1;
+		}
+		if(d - r < 0)
+			straddled |= 1<<i;
+	}
+	return straddled;
+#endif
+}
+
+void FrustumCuller::TestSpheres(int first, int count, int mask, vector<int>& visible) {
+#ifdef USE_AVX2
+	__m256 x = _mm256_loadu_ps(&cx[first]);
+	__m256 y = _mm256_loadu_ps(&cy[first]);
+	__m256 z = _mm256_loadu_ps(&cz[first]);
+	__m256 negR = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&radius[first]));
+	int inside = (1<<count) - 1;
+	for(int i=0;i<6 && inside;i++) {
+		if(!(mask & (1<<i)))
+			continue;
+		__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(planeX[i])), _mm256_mul_ps(y, _mm256_set1_ps(planeY[i]))),
+								 _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(planeZ[i])), _mm256_set1_ps(planeW[i])));
+		inside &= _mm256_movemask_ps(_mm256_cmp_ps(d, negR, _CMP_GT_OQ));
+	}
+	for(int k=0;inside;k++, inside>>=1)
+		if(inside & 1)
+			visible.push_back(sphereIDs[first+k]);
+#else
+	for(int k=first;k<first+count;k++) {
+		bool bInside = true;
+		for(int i=0;i<6 && bInside;i++) {
+			if(mask & (1<<i))
+				bInside = planeX[i]*cx[k] + planeY[i]*cy[k] + planeZ[i]*cz[k] + planeW[i] > -radius[k];
+		}
+		if(bInside)
+			visible.push_back(sphereIDs[k]);
+	}
+#endif
+}
+
+void FrustumCuller::Traverse(int node, int mask, vector<int>& visible, int& nodesVisited, int& spheresTested) {
+	int stackNodes[MAX_STACK], stackMasks[MAX_STACK];
+	int top = 0;
+	stackNodes[top] = node;
+	stackMasks[top++] = mask;
+	while(top > 0) {
+		top--;
+		int n = stackNodes[top];
+		int m = TestNode(n, stackMasks[top]);
+		nodesVisited++;
+		if(m < 0)
+			continue;
+
+		const Node& nd = nodes[n];
+		if(m == 0) {
+			//inside all planes, the whole subtree is visible
+			visible.insert(visible.end(), sphereIDs.begin() + nd.first, sphereIDs.begin() + nd.first + nd.count);
+		} else if(nd.right < 0) {
+			TestSpheres(nd.first, nd.count, m, visible);
+			spheresTested += nd.count;
+		} else {
+			//the left child is visited first to keep the hierarchy order
+			stackNodes[top] = nd.right;
+			stackMasks[top++] = m;
+			stackNodes[top] = n + 1;
+			stackMasks[top++] = m;
+		}
+	}
+}
+
+void FrustumCuller::Cull(const glm::vec4 planes[6], vector<int>& visible) {
+	visible.clear();
+	nodesVisited = 0;
+	spheresTested = 0;
+	if(nodes.empty())
+		return;
+	SetPlanes(planes);
+
+	int threads = 1;
+#ifdef _OPENMP
+	if(bMultithreaded && totalSpheres >= PARALLEL_THRESHOLD)
+		threads = omp_get_max_threads();
+#endif
+	if(threads == 1) {
+		Traverse(0, ALL_PLANES, visible, nodesVisited, spheresTested);
+		return;
+	}
+
+	//expand the top of the tree level by level until there are enough
+	//subtrees. Rejected nodes are dropped and nodes inside the frustum or
+	//leaves are kept as they are.
+	frontier.assign(1, 0);
+	frontierMasks.assign(1, ALL_PLANES);
+	bool bExpanded = true;
+	while(bExpanded && int(frontier.size()) < threads*TASKS_PER_THREAD) {
+		bExpanded = false;
+		nextFrontier.clear();
+		nextMasks.clear();
+		for(size_t i=0;i<frontier.size();i++) {
+			int n = frontier[i];
+			int m = TestNode(n, frontierMasks[i]);
+			nodesVisited++;
+			if(m < 0)
+				continue;
+			if(m != 0 && nodes[n].right >= 0) {
+				nextFrontier.push_back(n + 1);
+				nextMasks.push_back(m);
+				nextFrontier.push_back(nodes[n].right);
+				nextMasks.push_back(m);
+				bExpanded = true;
+			} else {
+				nextFrontier.push_back(n);
+				nextMasks.push_back(m);
+			}
+		}
+		frontier.swap(nextFrontier);
+		frontierMasks.swap(nextMasks);
+	}
+
+	//traverse the subtrees in parallel, each one into its own list
+	int totalTasks = int(frontier.size());
+	if(int(tasks.size()) < totalTasks)
+		tasks.resize(totalTasks);
+	#pragma omp parallel for schedule(dynamic) num_threads(threads)
+	for(int t=0;t<totalTasks;t++) {
+		Task& task = tasks[t];
+		task.visible.clear();
+		task.nodesVisited = task.spheresTested = 0;
+		Traverse(frontier[t], frontierMasks[t], task.visible, task.nodesVisited, task.spheresTested);
+	}
+
+	//concatenate the lists in tree order
+	vector<int> offsets(totalTasks + 1, 0);
+	for(int t=0;t<totalTasks;t++) {
+		offsets[t+1] = offsets[t] + int(tasks[t].visible.size());
+		nodesVisited += tasks[t].nodesVisited;
+		spheresTested += tasks[t].spheresTested;
+	}
+	visible.resize(offsets[totalTasks]);
+	#pragma omp parallel for num_threads(threads)
+	for(int t=0;t<totalTasks;t++) {
+		if(!tasks[t].visible.empty())
+			copy(tasks[t].visible.begin(), tasks[t].visible.end(), visible.begin() + offsets[t]);
+	}
+}
+
+void FrustumCuller::CullBruteForce(const glm::vec4 planes[6], vector<int>& visible) {
+	visible.clear();
+	nodesVisited = 0;
+	spheresTested = totalSpheres;
+	if(totalSpheres == 0)
+		return;
+	SetPlanes(planes);
+
+	int threads = 1;
+#ifdef _OPENMP
+	if(bMultithreaded && totalSpheres >= PARALLEL_THRESHOLD)
+		threads = omp_get_max_threads();
+#endif
+	if(int(tasks.size()) < threads)
+		tasks.resize(threads);
+
+	//every thread tests a contiguous range that starts at a multiple of 8
+	//OpenMP may start fewer threads than asked for, so the ranges are split
+	//by the size of the team that started
+	int groups = (totalSpheres + SIMD_WIDTH - 1)/SIMD_WIDTH;
+	int team = 1;
+	#pragma omp parallel num_threads(threads)
+	{
+		int t = 0;
+#ifdef _OPENMP
+		#pragma omp single
+		team = omp_get_num_threads();
+		t = omp_get_thread_num();
+#endif
+		vector<int>& out = tasks[t].visible;
+		out.clear();
+		int first = int((long long)groups*t/team)*SIMD_WIDTH;
+		int last = min(totalSpheres, int((long long)groups*(t+1)/team)*SIMD_WIDTH);
+		for(int i=first;i<last;i+=SIMD_WIDTH)
+			TestSpheres(i, min(SIMD_WIDTH, last - i), ALL_PLANES, out);
+	}
+
+	for(int t=0;t<team;t++)
+		visible.insert(visible.end(), tasks[t].visible.begin(), tasks[t].visible.end());
+}
+
+void FrustumCuller::SetMultithreaded(bool bMultithreaded) {
+	this->bMultithreaded = bMultithreaded;
+}
+
+int FrustumCuller::GetNodesVisited() const {
+	return nodesVisited;
+}
+
+int FrustumCuller::GetSpheresTested() const {
+	return spheresTested;
+}
+
+int FrustumCuller::GetTotalSpheres() const {
+	return totalSpheres;
+}
+
+int FrustumCuller::GetTotalNodes() const {
+	return int(nodes.size());
+}
+
+void FrustumCuller::ExtractPlanes(const glm::mat4& MVP, glm::vec4 planes[6]) {
+	//the rows of the matrix, glm stores columns
+	glm::vec4 row[4];
+	for(int i=0;i<4;i++)
+		row[i] = glm::vec4(MVP[0][i], MVP[1][i], MVP[2][i], MVP[3][i]);
+
+	planes[0] = row[3] + row[0];	//left
+	planes[1] = row[3] - row[0];	//right
+	planes[2] = row[3] + row[1];	//bottom
+	planes[3] = row[3] - row[1];	//top
+	planes[4] = row[3] + row[2];	//near
+	planes[5] = row[3] - row[2];	//far
+	for(int i=0;i<6;i++)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+
+//FrustumCuller class culls large sets of bounding spheres against a view
+//frustum on the CPU. The spheres are stored in structure of arrays layout,
+//sorted along a Morton curve and grouped into a balanced bounding volume
+//hierarchy with leaves of up to 8 spheres, so that a leaf is tested with one
+//AVX2 instruction per plane.
+//
+//The traversal keeps a mask of the planes a node still straddles: children
+//only test those planes and a node that is inside all planes adds its whole
+//subtree without any further tests. Every node remembers the plane that
+//rejected it last, which is tested first in the next frame. The top of the
+//tree is split into tasks that are traversed on all threads.
+//
+//Planes are (normal, distance) with the inside where dot(normal, p) + distance
+//is positive, as returned by the camera classes.
+class FrustumCuller
+{
+public:
+	//constructor/destructor
+	FrustumCuller(void);
+	~FrustumCuller(void);
+
+	//builds the hierarchy over the given spheres (xyz center, w radius)
+	void Build(const glm::vec4* spheres, int count);
+
+	//writes the indices of the spheres which intersect the frustum to
+	//visible, in the order of the hierarchy
+	void Cull(const glm::vec4 planes[6], vector<int>& visible);
+
+	//tests every sphere without the hierarchy, for comparison
+	void CullBruteForce(const glm::vec4 planes[6], vector<int>& visible);
+
+	//enables traversal on all threads
+	void SetMultithreaded(bool bMultithreaded);
+
+	//statistics of the last Cull call
+	int GetNodesVisited() const;
+	int GetSpheresTested() const;
+
+	int GetTotalSpheres() const;
+	int GetTotalNodes() const;
+
+	//extracts the frustum planes from a combined projection and view matrix
+	static void ExtractPlanes(const glm::mat4& MVP, glm::vec4 planes[6]);
+
+protected:
+	struct Node {
+		glm::vec3 center, extent;	//bounding box
+		int first, count;			//spheres of the subtree
+		int right;					//right child, the left child follows the node, -1 for leaves
+	};
+
+	//results of a subtree or a range of spheres handled by one thread
+	struct Task {
+		vector<int> visible;
+		int nodesVisited, spheresTested;
+	};
+
+	//builds the subtree over the sorted spheres [first, first+count) and
+	//returns its index
+	int BuildNode(int first, int count);
+
+	//classifies a box against the planes in mask: returns -1 if it is
+	//outside, otherwise the planes it still straddles
+	int TestNode(int node, int mask);
+
+	//traverses a subtree and appends the visible spheres
+	void Traverse(int node, int mask, vector<int>& visible, int& nodesVisited, int& spheresTested);
+	void TestSpheres(int first, int count, int mask, vector<int>& visible);
+
+	void SetPlanes(const glm::vec4 planes[6]);
+
+	//spheres in hierarchy order, padded to 8
+	vector<float> cx, cy, cz, radius;
+	vector<int> sphereIDs;
+	int totalSpheres;
+
+	vector<Node> nodes;
+	vector<unsigned char> lastPlanes;	//plane that rejected the node last
+
+	//normalized planes and their absolute normals, lanes 6 and 7 always pass
+	float planeX[8], planeY[8], planeZ[8], planeW[8];
+	float absX[8], absY[8], absZ[8];
+
+	//the top of the tree is split into subtrees with their plane masks
+	vector<Task> tasks;
+	vector<int> frontier, frontierMasks, nextFrontier, nextMasks;
+	bool bMultithreaded;
+	int nodesVisited, spheresTested;
+};
@@ -0,0 +1,416 @@
+#include "OcclusionCuller.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+
+//pixels per register and the tile size, tiles start at multiples of 8
+const int SIMD_WIDTH = 8;
+const int TILE_WIDTH = 32;
+const int TILE_HEIGHT = 16;
+
+//below this many candidates the threads cost more than they save
+const int PARALLEL_THRESHOLD = 4096;
+
+//candidates ahead of the one being tested whose sphere is prefetched
+const int PREFETCH_DISTANCE = 16;
+
+//clip space w below which a box is treated as crossing the camera plane
+const float MIN_W = 1e-4f;
+
+#ifdef USE_AVX2
+//minimum and maximum of the 8 lanes
+static inline float HorizontalMin(__m256 v) {
+	__m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+	return _mm_cvtss_f32(_mm_min_ss(m, _mm_shuffle_ps(m, m, 1)));
+}
+
+static inline float HorizontalMax(__m256 v) {
+	__m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+	return _mm_cvtss_f32(_mm_max_ss(m, _mm_shuffle_ps(m, m, 1)));
+}
+#endif
+
+OcclusionCuller::OcclusionCuller(void)
+{
+	width = height = 0;
+	tilesX = tilesY = 0;
+	VP = glm::mat4(1);
+	bMultithreaded = true;
+	rasterTime = 0;
+	testTime = 0;
+}
+
+OcclusionCuller::~OcclusionCuller(void)
+{
+}
+
+void OcclusionCuller::Init(int width, int height) {
+	this->width = (width + SIMD_WIDTH - 1)/SIMD_WIDTH*SIMD_WIDTH;
+	this->height = height;
+	tilesX = (this->width + TILE_WIDTH - 1)/TILE_WIDTH;
+	tilesY = (height + TILE_HEIGHT - 1)/TILE_HEIGHT;
+	tileBins.resize(tilesX*tilesY);
+
+	//every level halves the size of the last one, rounding up
+	levels.clear();
+	levelWidths.clear();
+	levelHeights.clear();
+	int w = this->width, h = height;
+	for(;;) {
+		levels.push_back(vector<float>(w*h, 1.0f));
+		levelWidths.push_back(w);
+		levelHeights.push_back(h);
+		if(w == 1 && h == 1)
+			break;
+		w = max(1, (w + 1)/2);
+		h = max(1, (h + 1)/2);
+	}
+}
+
+void OcclusionCuller::ClearOccluders() {
+	occluderVertices.clear();
+	occluderIndices.clear();
+}
+
+void OcclusionCuller::AddOccluder(const glm::vec3* vertices, int totalVertices, const unsigned int* indices, int totalIndices) {
+	unsigned int base = (unsigned int)occluderVertices.size();
+	occluderVertices.insert(occluderVertices.end(), vertices, vertices + totalVertices);
+	for(int i=0;i<totalIndices;i++)
+		occluderIndices.push_back(base + indices[i]);
+}
+
+void OcclusionCuller::SetupTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c) {
+	//viewport transform, y points up as in window coordinates
+	glm::vec3 p[3];
+	const glm::vec4* v[3] = {&a, &b, &c};
+	for(int i=0;i<3;i++) {
+		float invW = 1.0f/v[i]->w;
+		p[i] = glm::vec3((v[i]->x*invW*0.5f + 0.5f)*width, (v[i]->y*invW*0.5f + 0.5f)*height, v[i]->z*invW*0.5f + 0.5f);
+	}
+
+	//occluders are drawn from both sides, so the winding is made counter
+	//clockwise and only degenerate triangles are dropped
+	float area = (p[1].x - p[0].x)*(p[2].y - p[0].y) - (p[1].y - p[0].y)*(p[2].x - p[0].x);
+	if(area == 0)
+		return;
+	if(area < 0) {
+		swap(p[1], p[2]);
+		area = -area;
+	}
+
+	Triangle t;
+	float minX = min(p[0].x, min(p[1].x, p[2].x)), maxX = max(p[0].x, max(p[1].x, p[2].x));
+	float minY = min(p[0].y, min(p[1].y, p[2].y)), maxY = max(p[0].y, max(p[1].y, p[2].y));
+	t.minX = max(0, int(floor(minX)));
+	t.minY = max(0, int(floor(minY)));
+	t.maxX = min(width - 1, int(ceil(maxX)));
+	t.maxY = min(height - 1, int(ceil(maxY)));
+	if(t.minX > t.maxX || t.minY > t.maxY)
+		return;
+
+	//edge i is opposite to vertex i and positive inside, its value divided
+	//by the area is the barycentric weight of vertex i
+	for(int i=0;i<3;i++) {
+		const glm::vec3& s = p[(i+1)%3];
+		const glm::vec3& e = p[(i+2)%3];
+		t.edgeA[i] = s.y - e.y;
+		t.edgeB[i] = e.x - s.x;
+		t.edgeC[i] = -(t.edgeA[i]*s.x + t.edgeB[i]*s.y);
+	}
+	//the edge functions are evaluated at pixel centers
+	for(int i=0;i<3;i++)
+		t.edgeC[i] += 0.5f*(t.edgeA[i] + t.edgeB[i]);
+
+	float invArea = 1.0f/area;
+	t.depthA = (t.edgeA[0]*p[0].z + t.edgeA[1]*p[1].z + t.edgeA[2]*p[2].z)*invArea;
+	t.depthB = (t.edgeB[0]*p[0].z + t.edgeB[1]*p[1].z + t.edgeB[2]*p[2].z)*invArea;
+	t.depthC = (t.edgeC[0]*p[0].z + t.edgeC[1]*p[1].z + t.edgeC[2]*p[2].z)*invArea;
+
+	//a pixel is only covered if all of it is inside the triangle and gets
+	//the farthest depth over its area, so gaps between occluders stay open
+	for(int i=0;i<3;i++)
+		t.edgeC[i] -= 0.5f*(fabs(t.edgeA[i]) + fabs(t.edgeB[i]));
+	t.depthC += 0.5f*(fabs(t.depthA) + fabs(t.depthB));
+	triangles.push_back(t);
+}
+
+void OcclusionCuller::ClipTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c) {
+	//distance to the near plane z = -w, the rest of the frustum is handled
+	//by the bounding box clamp
+	const glm::vec4* in[3] = {&a, &b, &c};
+	float d[3];
+	int inside = 0;
+	for(int i=0;i<3;i++) {
+		d[i] = in[i]->z + in[i]->w;
+		if(d[i] >= 0)
+			inside++;
+	}
+	if(inside == 0)
+		return;
+	if(inside == 3) {
+		SetupTriangle(a, b, c);
+		return;
+	}
+
+	//Sutherland Hodgman against one plane gives at most a quad
+	glm::vec4 out[4];
+	int count = 0;
+	for(int i=0;i<3;i++) {
+		int j = (i+1)%3;
+		if(d[i] >= 0)
+			out[count++] = *in[i];
+		if((d[i] >= 0) != (d[j] >= 0)) {
+			float t = d[i]/(d[i] - d[j]);
+			out[count++] = *in[i] + (*in[j] - *in[i])*t;
+		}
+	}
+	SetupTriangle(out[0], out[1], out[2]);
+	if(count == 4)
+		SetupTriangle(out[0], out[2], out[3]);
+}
+
+void OcclusionCuller::RasterizeTile(int tile) {
+	int tileX = (tile % tilesX)*TILE_WIDTH, tileY = (tile / tilesX)*TILE_HEIGHT;
+	int tileMaxX = min(width, tileX + TILE_WIDTH) - 1, tileMaxY = min(height, tileY + TILE_HEIGHT) - 1;
+	float* depth = &levels[0][0];
+
+	const vector<int>& bin = tileBins[tile];
+	for(size_t k=0;k<bin.size();k++) {
+		const Triangle& t = triangles[bin[k]];
+		//the rows are walked in groups of 8 pixels aligned to the tile
+		int x0 = max(tileX, t.minX)/SIMD_WIDTH*SIMD_WIDTH, x1 = min(tileMaxX, t.maxX);
+		int y0 = max(tileY, t.minY), y1 = min(tileMaxY, t.maxY);
+#ifdef USE_AVX2
+		__m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+		__m256 zero = _mm256_setzero_ps();
+		for(int y=y0;y<=y1;y++) {
+			float* row = depth + y*width;
+			for(int x=x0;x<=x1;x+=SIMD_WIDTH) {
+				__m256 px = _mm256_add_ps(_mm256_set1_ps(float(x)), lane);
+				__m256 e0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.edgeA[0]), px), _mm256_set1_ps(t.edgeB[0]*y + t.edgeC[0]));
+				__m256 e1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.edgeA[1]), px), _mm256_set1_ps(t.edgeB[1]*y + t.edgeC[1]));
+				__m256 e2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.edgeA[2]), px), _mm256_set1_ps(t.edgeB[2]*y + t.edgeC[2]));
+				__m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+											  _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+				if(_mm256_movemask_ps(inside) == 0)
+					continue;
+				__m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.depthA), px), _mm256_set1_ps(t.depthB*y + t.depthC));
+				__m256 old = _mm256_loadu_ps(row + x);
+				_mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_min_ps(old, z), inside));
+			}
+		}
+#else
+		for(int y=y0;y<=y1;y++) {
+			float* row = depth + y*width;
+			for(int x=x0;x<=x1;x++) {
+				float e0 = t.edgeA[0]*x + t.edgeB[0]*y + t.edgeC[0];
+				float e1 = t.edgeA[1]*x + t.edgeB[1]*y + t.edgeC[1];
+				float e2 = t.edgeA[2]*x + t.edgeB[2]*y + t.edgeC[2];
+				if(e0 >= 0 && e1 >= 0 && e2 >= 0)
+					row[x] = min(row[x], t.depthA*x + t.depthB*y + t.depthC);
+			}
+		}
+#endif
+	}
+}
+
+void OcclusionCuller::BuildHiZ() {
+	//every texel keeps the farthest depth of the 2x2 texels below it, the
+	//last row and column of odd sized levels are clamped
+	for(size_t l=1;l<levels.size();l++) {
+		const vector<float>& src = levels[l-1];
+		vector<float>& dst = levels[l];
+		int sw = levelWidths[l-1], sh = levelHeights[l-1];
+		int dw = levelWidths[l], dh = levelHeights[l];
+		for(int y=0;y<dh;y++) {
+			int y0 = min(2*y, sh-1), y1 = min(2*y+1, sh-1);
+			for(int x=0;x<dw;x++) {
+				int x0 = min(2*x, sw-1), x1 = min(2*x+1, sw-1);
+				dst[y*dw+x] = max(max(src[y0*sw+x0], src[y0*sw+x1]), max(src[y1*sw+x0], src[y1*sw+x1]));
+			}
+		}
+	}
+}
+
+void OcclusionCuller::RenderOccluders(const glm::mat4& VP) {
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	this->VP = VP;
+
+	//transform, clip and set up the occluder triangles
+	int totalVertices = int(occluderVertices.size());
+	clipVertices.resize(totalVertices);
+	for(int i=0;i<totalVertices;i++)
+		clipVertices[i] = VP*glm::vec4(occluderVertices[i], 1);
+	triangles.clear();
+	for(size_t i=0;i+2<occluderIndices.size();i+=3)
+		ClipTriangle(clipVertices[occluderIndices[i]], clipVertices[occluderIndices[i+1]], clipVertices[occluderIndices[i+2]]);
+
+	//bin the triangles into the tiles they overlap
+	for(size_t i=0;i<tileBins.size();i++)
+		tileBins[i].clear();
+	for(size_t i=0;i<triangles.size();i++) {
+		const Triangle& t = triangles[i];
+		for(int ty=t.minY/TILE_HEIGHT;ty<=t.maxY/TILE_HEIGHT;ty++)
+			for(int tx=t.minX/TILE_WIDTH;tx<=t.maxX/TILE_WIDTH;tx++)
+				tileBins[ty*tilesX+tx].push_back(int(i));
+	}
+
+	//the tiles do not share pixels so they are rasterized in parallel
+	fill(levels[0].begin(), levels[0].end(), 1.0f);
+	int totalTiles = tilesX*tilesY;
+	#pragma omp parallel for schedule(dynamic) if(bMultithreaded && !triangles.empty())
+	for(int tile=0;tile<totalTiles;tile++)
+		RasterizeTile(tile);
+
+	BuildHiZ();
+	rasterTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+bool OcclusionCuller::IsOccluded(const glm::vec4& sphere) const {
+	//project the corners of the bounding box of the sphere
+	float minX, minY, maxX, maxY, minZ;
+#ifdef USE_AVX2
+	__m256 sx = _mm256_setr_ps(-1, 1, -1, 1, -1, 1, -1, 1);
+	__m256 sy = _mm256_setr_ps(-1, -1, 1, 1, -1, -1, 1, 1);
+	__m256 sz = _mm256_setr_ps(-1, -1, -1, -1, 1, 1, 1, 1);
+	__m256 r = _mm256_set1_ps(sphere.w);
+	__m256 x = _mm256_add_ps(_mm256_set1_ps(sphere.x), _mm256_mul_ps(sx, r));
+	__m256 y = _mm256_add_ps(_mm256_set1_ps(sphere.y), _mm256_mul_ps(sy, r));
+	__m256 z = _mm256_add_ps(_mm256_set1_ps(sphere.z), _mm256_mul_ps(sz, r));
+	__m256 clip[4];
+	for(int k=0;k<4;k++)
+		clip[k] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(VP[0][k])), _mm256_mul_ps(y, _mm256_set1_ps(VP[1][k]))),
+								_mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(VP[2][k])), _mm256_set1_ps(VP[3][k])));
+	if(_mm256_movemask_ps(_mm256_cmp_ps(clip[3], _mm256_set1_ps(MIN_W), _CMP_LT_OQ)))
+		return false;
+	__m256 invW = _mm256_div_ps(_mm256_set1_ps(1.0f), clip[3]);
+	__m256 ndcX = _mm256_mul_ps(clip[0], invW);
+	__m256 ndcY = _mm256_mul_ps(clip[1], invW);
+	minX = HorizontalMin(ndcX);
+	maxX = HorizontalMax(ndcX);
+	minY = HorizontalMin(ndcY);
+	maxY = HorizontalMax(ndcY);
+	minZ = HorizontalMin(_mm256_mul_ps(clip[2], invW));
+#else
+	minX = minY = minZ = 1e30f;
+	maxX = maxY = -1e30f;
+	for(int i=0;i<8;i++) {
+		glm::vec4 corner(sphere.x + ((i&1) ? sphere.w : -sphere.w),
+						 sphere.y + ((i&2) ? sphere.w : -sphere.w),
+						 sphere.z + ((i&4) ? sphere.w : -sphere.w), 1);
+		glm::vec4 clip = VP*corner;
+		if(clip.w < MIN_W)
+			return false;
+		float invW = 1.0f/clip.w;
+		minX = min(minX, clip.x*invW); maxX = max(maxX, clip.x*invW);
+		minY = min(minY, clip.y*invW); maxY = max(maxY, clip.y*invW);
+		minZ = min(minZ, clip.z*invW);
+	}
+#endif
+	//to the pixels of the depth buffer
+	float nearest = minZ*0.5f + 0.5f;
+	int x0 = int(floor((minX*0.5f + 0.5f)*width));
+	int y0 = int(floor((minY*0.5f + 0.5f)*height));
+	int x1 = int(floor((maxX*0.5f + 0.5f)*width));
+	int y1 = int(floor((maxY*0.5f + 0.5f)*height));
+	if(x1 < 0 || y1 < 0 || x0 >= width || y0 >= height)
+		return false;
+	x0 = max(x0, 0);
+	y0 = max(y0, 0);
+	x1 = min(x1, width - 1);
+	y1 = min(y1, height - 1);
+
+	//the level where the rectangle covers at most 2x2 texels, the block
+	//starting at its corner is read without branches on its size
+	int extent = max(x1 - x0, y1 - y0);
+	int level = 0;
+	while((1 << level) < extent)
+		level++;
+	level = min(level, int(levels.size()) - 1);
+	const float* hiz = &levels[level][0];
+	int w = levelWidths[level];
+	int lx0 = x0 >> level, ly0 = y0 >> level;
+	int lx1 = min(lx0 + 1, w - 1), ly1 = min(ly0 + 1, levelHeights[level] - 1);
+	float farthest = max(max(hiz[ly0*w+lx0], hiz[ly0*w+lx1]), max(hiz[ly1*w+lx0], hiz[ly1*w+lx1]));
+	return nearest > farthest;
+}
+
+void OcclusionCuller::Cull(const glm::vec4* spheres, const vector<int>& candidates, vector<int>& visible) {
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	int count = int(candidates.size());
+
+	int threads = 1;
+#ifdef _OPENMP
+	if(bMultithreaded && count >= PARALLEL_THRESHOLD)
+		threads = omp_get_max_threads();
+#endif
+	if(int(threadVisible.size()) < threads)
+		threadVisible.resize(threads);
+
+	//every thread tests a contiguous range so the order is kept, the ranges
+	//are split by the size of the team that started as OpenMP may start
+	//fewer threads than asked for
+	int team = 1;
+	#pragma omp parallel num_threads(threads)
+	{
+		int t = 0;
+#ifdef _OPENMP
+		#pragma omp single
+		team = omp_get_num_threads();
+		t = omp_get_thread_num();
+#endif
+		vector<int>& out = threadVisible[t];
+		out.clear();
+		int first = int((long long)count*t/team), last = int((long long)count*(t+1)/team);
+		for(int i=first;i<last;i++) {
+#ifdef USE_AVX2
+			//the candidates are scattered over the sphere array
+			if(i + PREFETCH_DISTANCE < last)
+				_mm_prefetch((const char*)&spheres[candidates[i + PREFETCH_DISTANCE]], _MM_HINT_T0);
+#endif
+			if(!IsOccluded(spheres[candidates[i]]))
+				out.push_back(candidates[i]);
+		}
+	}
+
+	visible.clear();
+	for(int t=0;t<team;t++)
+		visible.insert(visible.end(), threadVisible[t].begin(), threadVisible[t].end());
+	testTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+void OcclusionCuller::SetMultithreaded(bool bMultithreaded) {
+	this->bMultithreaded = bMultithreaded;
+}
+
+float OcclusionCuller::GetRasterTime() const {
+	return rasterTime;
+}
+
+float OcclusionCuller::GetTestTime() const {
+	return testTime;
+}
+
+int OcclusionCuller::GetTotalTriangles() const {
+	return int(triangles.size());
+}
+
+const float* OcclusionCuller::GetDepth(int level, int& width, int& height) const {
+	width = levelWidths[level];
+	height = levelHeights[level];
+	return &levels[level][0];
+}
+
+int OcclusionCuller::GetTotalLevels() const {
+	return int(levels.size());
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+
+//OcclusionCuller class rejects objects hidden behind large occluders on the
+//CPU. The occluder triangles are rasterized into a small depth buffer which
+//is split into tiles; the triangles are binned per tile and every tile is
+//rasterized by one thread, 8 pixels at a time with AVX2. A hierarchical Z
+//(HiZ) chain stores the farthest depth of every 2x2 block of the level
+//below. An object is hidden if the nearest depth of its bounding box is
+//behind the farthest occluder depth over the screen rectangle it covers,
+//which is looked up in the level where the rectangle spans at most 2x2
+//texels.
+//
+//The test is conservative: a pixel is only covered by an occluder if all of
+//it lies inside one of its triangles, and it gets the farthest depth over its
+//area, so small gaps between occluders are never closed. Objects crossing
+//the near plane are never rejected. The input and output are index lists
+//into the sphere array, the same as for FrustumCuller, so the two can be
+//chained.
+class OcclusionCuller
+{
+public:
+	//constructor/destructor
+	OcclusionCuller(void);
+	~OcclusionCuller(void);
+
+	//sets the depth buffer resolution, the width is rounded up to 8
+	void Init(int width, int height);
+
+	//occluder meshes are given as indexed triangles in world space
+	void ClearOccluders();
+	void AddOccluder(const glm::vec3* vertices, int totalVertices, const unsigned int* indices, int totalIndices);
+
+	//rasterizes the occluders with the given combined projection and view
+	//matrix and builds the HiZ chain
+	void RenderOccluders(const glm::mat4& VP);
+
+	//writes the candidate spheres (xyz center, w radius) which are not hidden
+	//by the occluders to visible, keeping their order
+	void Cull(const glm::vec4* spheres, const vector<int>& candidates, vector<int>& visible);
+
+	//enables rasterization and testing on all threads
+	void SetMultithreaded(bool bMultithreaded);
+
+	//times of the last RenderOccluders and Cull calls in milliseconds
+	float GetRasterTime() const;
+	float GetTestTime() const;
+
+	//triangles rasterized in the last RenderOccluders call
+	int GetTotalTriangles() const;
+
+	//returns a level of the HiZ chain, level 0 is the depth buffer. Depths
+	//are in [0,1] with 1 at the far plane.
+	const float* GetDepth(int level, int& width, int& height) const;
+	int GetTotalLevels() const;
+
+	//returns true if the sphere is hidden by the occluders
+	bool IsOccluded(const glm::vec4& sphere) const;
+
+protected:
+	//a triangle in screen space with its edge and depth planes, so that
+	//value = A*x + B*y + C at the pixel center (x, y)
+	struct Triangle {
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthA, depthB, depthC;
+		int minX, minY, maxX, maxY;
+	};
+
+	//clips a triangle against the near plane and sets up the pieces
+	void ClipTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+	void SetupTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+
+	void RasterizeTile(int tile);
+	void BuildHiZ();
+
+	int width, height;
+	int tilesX, tilesY;
+
+	//HiZ chain, levels[0] is the depth buffer
+	vector<vector<float> > levels;
+	vector<int> levelWidths, levelHeights;
+
+	glm::mat4 VP;
+
+	vector<glm::vec3> occluderVertices;
+	vector<unsigned int> occluderIndices;
+	vector<glm::vec4> clipVertices;
+	vector<Triangle> triangles;
+	vector<vector<int> > tileBins;		//triangles overlapping every tile
+
+	//per thread results of Cull
+	vector<vector<int> > threadVisible;
+
+	bool bMultithreaded;
+	float rasterTime, testTime;
+};
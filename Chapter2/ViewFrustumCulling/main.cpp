@@ -2,6 +2,12 @@
 
 #include <GL/freeglut.h>
 #include <iostream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #ifdef __linux__
 #include <GL/glx.h>
@@ -13,6 +19,8 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "GLSLShader.h"
+#include "FrustumCuller.h"
+#include "OcclusionCuller.h"
 
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
@@ -126,6 +134,7 @@ glm::vec3 frustum_vertices[8];
 GLfloat white[4] = {1,1,1,1};
 GLfloat red[4] = {1,0,0,0.5};
 GLfloat cyan[4] = {0,1,1,0.5};
+GLfloat yellow[4] = {1,1,0,1};
 
 //points
 const int PX = 100;
@@ -143,6 +152,50 @@ int total_visible=0;
 //hardware query 
 GLuint query;
 
+//default number of spheres culled on the CPU, can be given on the command line
+const int DEFAULT_SPHERES = 1000000;
+int totalSpheres = DEFAULT_SPHERES;
+
+//bounding spheres (xyz center, w radius) spread over the ground plane
+vector<glm::vec4> spheres;
+
+//CPU frustum culler and the indices of the visible spheres
+FrustumCuller culler;
+vector<int> visibleSpheres;
+
+//sphere centers and the visible index list on the GPU
+GLuint sphereVAOID, sphereVBOID, sphereIndicesID;
+
+//occluder boxes standing on the ground plane and their triangles
+const int OCCLUDERS_X = 4;
+const int OCCLUDERS_Z = 4;
+const float OCCLUDER_SPACING = 6;
+const glm::vec3 OCCLUDER_SIZE(3, 4, 3);
+
+//size of the software depth buffer
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 192;
+
+vector<glm::vec3> occluderBoxes;		//min and max corner of every box
+vector<glm::vec3> occluderVertices;
+vector<GLuint> occluderIndices;
+
+//CPU occlusion culler, it removes the hidden spheres from the frustum culled list
+OcclusionCuller occlusionCuller;
+vector<int> unoccludedSpheres;
+
+//occluder vertex array and vertex buffer objects
+GLuint occluderVAOID, occluderVBOID, occluderIndicesID;
+
+//toggles CPU culling of the spheres, the brute force test and threading
+bool bCPUCulling = false;
+bool bBruteForce = false;
+bool bMultithreaded = true;
+bool bOcclusionCulling = true;
+
+//time spent culling the spheres in milliseconds
+float cullTime = 0;
+
 //FPS related variables
 float start_time = 0;
 float fps=0;
@@ -152,6 +205,220 @@ float last_time_fps=0;
 //string buffer for message display
 char buffer[MAX_PATH]={'\0'};
 
+//creates random bounding spheres over the ground plane
+void CreateSpheres(vector<glm::vec4>& spheres, int count) {
+	spheres.resize(count);
+	srand(1234);
+	for(int i=0;i<count;i++) {
+		float x = (rand()/(float)RAND_MAX*2-1)*HALF_SIZE_X;
+		float z = (rand()/(float)RAND_MAX*2-1)*HALF_SIZE_Z;
+		float y = rand()/(float)RAND_MAX*2;
+		float r = 0.02f + rand()/(float)RAND_MAX*0.08f;
+		spheres[i] = glm::vec4(x, y, z, r);
+	}
+}
+
+//creates a grid of boxes around the origin as occluders with their
+//triangles
+void CreateOccluders(vector<glm::vec3>& boxes, vector<glm::vec3>& vertices, vector<GLuint>& indices) {
+	const GLuint boxIndices[36]={0,2,1,1,2,3, //bottom
+								 4,5,6,5,7,6, //top
+								 0,1,4,1,5,4, //front
+								 2,6,3,3,6,7, //back
+								 0,4,2,2,4,6, //left
+								 1,3,5,3,7,5, //right
+								 };
+	boxes.clear();
+	vertices.clear();
+	indices.clear();
+	for(int j=0;j<OCCLUDERS_Z;j++) {
+		for(int i=0;i<OCCLUDERS_X;i++) {
+			glm::vec3 center((i - (OCCLUDERS_X-1)*0.5f)*OCCLUDER_SPACING, OCCLUDER_SIZE.y*0.5f, (j - (OCCLUDERS_Z-1)*0.5f)*OCCLUDER_SPACING);
+			glm::vec3 boxMin = center - OCCLUDER_SIZE*0.5f;
+			glm::vec3 boxMax = center + OCCLUDER_SIZE*0.5f;
+			boxes.push_back(boxMin);
+			boxes.push_back(boxMax);
+
+			GLuint base = GLuint(vertices.size());
+			for(int k=0;k<8;k++)
+				vertices.push_back(glm::vec3((k&1) ? boxMax.x : boxMin.x, (k&4) ? boxMax.y : boxMin.y, (k&2) ? boxMax.z : boxMin.z));
+			for(int k=0;k<36;k++)
+				indices.push_back(base + boxIndices[k]);
+		}
+	}
+}
+
+//returns true if the segment from start to end passes through one of the
+//boxes, used to check the occlusion culler independently of its rasterizer
+bool SegmentHitsBox(const glm::vec3& start, const glm::vec3& end, const vector<glm::vec3>& boxes) {
+	glm::vec3 dir = end - start;
+	for(size_t b=0;b+1<boxes.size();b+=2) {
+		float tMin = 0, tMax = 1;
+		for(int a=0;a<3 && tMin<=tMax;a++) {
+			if(fabs(dir[a]) < 1e-8f) {
+				if(start[a] < boxes[b][a] || start[a] > boxes[b+1][a])
+					tMax = -1;
+				continue;
+			}
+			float t0 = (boxes[b][a] - start[a])/dir[a];
+			float t1 = (boxes[b+1][a] - start[a])/dir[a];
+			if(t0 > t1)
+				swap(t0, t1);
+			tMin = max(tMin, t0);
+			tMax = min(tMax, t1);
+		}
+		if(tMin <= tMax)
+			return true;
+	}
+	return false;
+}
+
+//returns true if some part of the sphere on the screen can be seen from the
+//eye past the boxes. Besides the center the points on its silhouette are
+//tested, so a sphere whose center is hidden but whose edge is not counts as
+//visible.
+bool SphereSeenPastBoxes(const glm::vec3& eye, const glm::vec4& sphere, const glm::mat4& MVP, const vector<glm::vec3>& boxes) {
+	const int SILHOUETTE_POINTS = 16;
+	glm::vec3 center = glm::vec3(sphere);
+	float r = sphere.w;
+	glm::vec3 w = center - eye;
+	float d = glm::length(w);
+	if(d <= r)
+		return true;
+	w /= d;
+
+	//the silhouette is the circle where the rays from the eye touch the sphere
+	glm::vec3 u = glm::normalize(glm::cross(w, fabs(w.y) < 0.9f ? glm::vec3(0,1,0) : glm::vec3(1,0,0)));
+	glm::vec3 v = glm::cross(w, u);
+	glm::vec3 circleCenter = center - w*(r*r/d);
+	float circleRadius = r*sqrt(d*d - r*r)/d;
+
+	for(int i=0;i<=SILHOUETTE_POINTS;i++) {
+		glm::vec3 p = center;
+		if(i < SILHOUETTE_POINTS) {
+			float angle = float(2*M_PI*i/SILHOUETTE_POINTS);
+			p = circleCenter + (u*cos(angle) + v*sin(angle))*circleRadius;
+		}
+		glm::vec4 clip = MVP*glm::vec4(p, 1);
+		if(fabs(clip.x) < clip.w && fabs(clip.y) < clip.w && !SegmentHitsBox(eye, p, boxes))
+			return true;
+	}
+	return false;
+}
+
+//culls the spheres against the given planes and returns the time in milliseconds
+float CullSpheres(FrustumCuller& culler, const glm::vec4 planes[6], vector<int>& visible, bool bBruteForce) {
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	if(bBruteForce)
+		culler.CullBruteForce(planes, visible);
+	else
+		culler.Cull(planes, visible);
+	return chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+//culls growing sets of spheres with every method while the camera turns
+//around, and checks that the hierarchy finds the same spheres as the brute
+//force test
+void RunBenchmark() {
+	const int TOTAL_COUNTS = 4;
+	const int counts[TOTAL_COUNTS] = {10000, 100000, 1000000, 4000000};
+	const int BENCHMARK_FRAMES = 100;
+	const char* methods[4] = {"brute force", "brute force MT", "hierarchy", "hierarchy MT"};
+
+	CreateOccluders(occluderBoxes, occluderVertices, occluderIndices);
+
+	printf("Frustum culling benchmark: %d frames, camera turning 1 degree per frame\n", BENCHMARK_FRAMES);
+	printf("%10s %-16s %10s %12s %12s %12s\n", "spheres", "method", "visible", "nodes", "tested", "msecs/frame");
+
+	vector<glm::vec4> spheres;
+	vector<int> visible, reference;
+	vector<vector<int> > references(BENCHMARK_FRAMES);
+	for(int c=0;c<TOTAL_COUNTS;c++) {
+		CreateSpheres(spheres, counts[c]);
+		FrustumCuller culler;
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		culler.Build(&spheres[0], counts[c]);
+		float buildTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+
+		int mismatches = 0;
+		for(int m=0;m<4;m++) {
+			bool bBrute = (m < 2);
+			culler.SetMultithreaded(m % 2 == 1);
+			double time = 0, totalVisible = 0, nodes = 0, tested = 0;
+			for(int f=0;f<BENCHMARK_FRAMES;f++) {
+				//the camera looks at the ground from a height of 2 units
+				float angle = glm::radians(float(f));
+				glm::vec3 eye(cos(angle)*20, 2, sin(angle)*20);
+				glm::mat4 MV = glm::lookAt(eye, glm::vec3(0,0,0), glm::vec3(0,1,0));
+				glm::mat4 P = glm::perspective(glm::radians(45.0f), (float)WIDTH/HEIGHT, 1.0f, 30.0f);
+				glm::vec4 planes[6];
+				FrustumCuller::ExtractPlanes(P*MV, planes);
+
+				time += CullSpheres(culler, planes, visible, bBrute);
+				totalVisible += visible.size();
+				nodes += culler.GetNodesVisited();
+				tested += culler.GetSpheresTested();
+
+				//compare every frame of every method with the brute force result
+				sort(visible.begin(), visible.end());
+				if(m == 0)
+					references[f] = visible;
+				else if(visible != references[f])
+					mismatches++;
+			}
+			printf("%10d %-16s %10.0f %12.0f %12.0f %12.3f\n", counts[c], methods[m], totalVisible/BENCHMARK_FRAMES,
+				nodes/BENCHMARK_FRAMES, tested/BENCHMARK_FRAMES, time/BENCHMARK_FRAMES);
+		}
+		printf("%10d hierarchy: %d nodes built in %3.3f msecs, %s\n", counts[c], culler.GetTotalNodes(), buildTime,
+			mismatches ? "MISMATCH with brute force" : "same spheres as brute force");
+
+		//occlusion culling of the frustum culled list; every rejected sphere
+		//must have occluder boxes between the eye and all of its visible
+		//outline
+		OcclusionCuller occlusion;
+		occlusion.Init(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+		occlusion.AddOccluder(&occluderVertices[0], int(occluderVertices.size()), &occluderIndices[0], int(occluderIndices.size()));
+		culler.SetMultithreaded(true);
+		for(int m=0;m<2;m++) {
+			occlusion.SetMultithreaded(m == 1);
+			double rasterTime = 0, testTime = 0, totalVisible = 0, totalCandidates = 0;
+			int errors = 0;
+			for(int f=0;f<BENCHMARK_FRAMES;f++) {
+				float angle = glm::radians(float(f));
+				glm::vec3 eye(cos(angle)*20, 2, sin(angle)*20);
+				glm::mat4 MV = glm::lookAt(eye, glm::vec3(0,0,0), glm::vec3(0,1,0));
+				glm::mat4 P = glm::perspective(glm::radians(45.0f), (float)WIDTH/HEIGHT, 1.0f, 30.0f);
+				glm::vec4 planes[6];
+				FrustumCuller::ExtractPlanes(P*MV, planes);
+				culler.Cull(planes, reference);
+
+				occlusion.RenderOccluders(P*MV);
+				occlusion.Cull(&spheres[0], reference, visible);
+				rasterTime += occlusion.GetRasterTime();
+				testTime += occlusion.GetTestTime();
+				totalVisible += visible.size();
+				totalCandidates += reference.size();
+
+				//both lists are in hierarchy order, walk them together and check
+				//the rejected spheres
+				size_t k = 0;
+				for(size_t i=0;i<reference.size();i++) {
+					if(k < visible.size() && visible[k] == reference[i]) {
+						k++;
+						continue;
+					}
+					if(SphereSeenPastBoxes(eye, spheres[reference[i]], P*MV, occluderBoxes))
+						errors++;
+				}
+			}
+			printf("%10d occlusion%-7s %10.0f of %.0f frustum visible, raster %3.3f + test %3.3f msecs/frame, %s\n", counts[c], m ? " MT" : "",
+				totalVisible/BENCHMARK_FRAMES, totalCandidates/BENCHMARK_FRAMES, rasterTime/BENCHMARK_FRAMES, testTime/BENCHMARK_FRAMES,
+				errors ? "VISIBLE spheres rejected" : "all rejected spheres behind occluders");
+		}
+		printf("\n");
+	}
+}
+
 //mouse move filtering function
 void filterMouseMoves(float dx, float dy) {
     for (int i = MOUSE_HISTORY_BUFFER_SIZE - 1; i > 0; --i) {
@@ -422,6 +689,44 @@ void OnInit() {
 	glEnableVertexAttribArray(pointShader["vVertex"]);
 	glVertexAttribPointer(pointShader["vVertex"], 3, GL_FLOAT, GL_FALSE,0,0);
 
+	//setup the spheres for CPU culling and build the hierarchy
+	CreateSpheres(spheres, totalSpheres);
+	culler.Build(&spheres[0], totalSpheres);
+	cout<<"Built hierarchy with "<<culler.GetTotalNodes()<<" nodes over "<<totalSpheres<<" spheres"<<endl;
+
+	//the sphere centers are drawn as points, the visible index list is
+	//uploaded as element array every frame
+	glGenVertexArrays(1, &sphereVAOID);
+	glGenBuffers(1, &sphereVBOID);
+	glGenBuffers(1, &sphereIndicesID);
+	glBindVertexArray(sphereVAOID);
+		glBindBuffer (GL_ARRAY_BUFFER, sphereVBOID);
+		glBufferData (GL_ARRAY_BUFFER, spheres.size()*sizeof(glm::vec4), &spheres[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(shader["vVertex"]);
+		glVertexAttribPointer(shader["vVertex"], 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereIndicesID);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, spheres.size()*sizeof(GLuint), 0, GL_STREAM_DRAW);
+	glBindVertexArray(0);
+
+	//setup the occluder boxes, they are drawn and rasterized by the occlusion culler
+	CreateOccluders(occluderBoxes, occluderVertices, occluderIndices);
+	occlusionCuller.Init(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+	occlusionCuller.AddOccluder(&occluderVertices[0], int(occluderVertices.size()), &occluderIndices[0], int(occluderIndices.size()));
+
+	glGenVertexArrays(1, &occluderVAOID);
+	glGenBuffers(1, &occluderVBOID);
+	glGenBuffers(1, &occluderIndicesID);
+	glBindVertexArray(occluderVAOID);
+		glBindBuffer (GL_ARRAY_BUFFER, occluderVBOID);
+		glBufferData (GL_ARRAY_BUFFER, occluderVertices.size()*sizeof(glm::vec3), &occluderVertices[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(shader["vVertex"]);
+		glVertexAttribPointer(shader["vVertex"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, occluderIndicesID);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, occluderIndices.size()*sizeof(GLuint), &occluderIndices[0], GL_STATIC_DRAW);
+	glBindVertexArray(0);
+
+	GL_CHECK_ERRORS
+
 	// get the camera look direction to determine the yaw and pitch amount
 	glm::vec3 look =  glm::normalize(cam.GetPosition());
 	float yaw = glm::degrees(float(atan2(look.z, look.x)+M_PI));
@@ -464,6 +769,16 @@ void OnShutdown() {
 	glDeleteVertexArrays(1, &pointVAOID);
 	glDeleteBuffers(1, &pointVBOID);
 
+	//Delete sphere vao/vbos
+	glDeleteVertexArrays(1, &sphereVAOID);
+	glDeleteBuffers(1, &sphereVBOID);
+	glDeleteBuffers(1, &sphereIndicesID);
+
+	//Delete occluder vao/vbos
+	glDeleteVertexArrays(1, &occluderVAOID);
+	glDeleteBuffers(1, &occluderVBOID);
+	glDeleteBuffers(1, &occluderIndicesID);
+
 	cout<<"Shutdown successfull"<<endl;
 }
 
@@ -594,32 +909,80 @@ void OnRender() {
 	glm::vec4 p[6];
 	pCurrentCam->GetFrustumPlanes(p);
 
-	//begin hardware query
-	glBeginQuery(GL_PRIMITIVES_GENERATED, query);
-
-	//bind point shader
-	pointShader.Use();
-		//set shader uniforms
-		glUniform1f(pointShader("t"), current_time);
-		glUniformMatrix4fv(pointShader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
-		glUniform4fv(pointShader("FrustumPlanes"), 6, glm::value_ptr(p[0]));
-
-		//bind the point vertex array object
-		glBindVertexArray(pointVAOID);
-			//draw points
-			glDrawArrays(GL_POINTS,0,MAX_POINTS);
-
-	//unbind point shader
-	pointShader.UnUse();
-
-	//end hardware query
-	glEndQuery(GL_PRIMITIVES_GENERATED);
-
-	//check the query result to get the total number of visible points
-	GLuint res;
-	glGetQueryObjectuiv(query, GL_QUERY_RESULT, &res);
-	sprintf(buffer, "FPS: %3.3f :: Total visible points: %3d",fps, res);
-	glutSetWindowTitle(buffer);
+	if(bCPUCulling) {
+		//cull against the local camera so that the world camera shows
+		//which spheres are inside its frustum
+		glm::vec4 planes[6];
+		cam.GetFrustumPlanes(planes);
+		culler.SetMultithreaded(bMultithreaded);
+		cullTime = CullSpheres(culler, planes, visibleSpheres, bBruteForce);
+		int frustum_visible = int(visibleSpheres.size());
+
+		//then remove the spheres hidden behind the occluders
+		if(bOcclusionCulling) {
+			occlusionCuller.SetMultithreaded(bMultithreaded);
+			occlusionCuller.RenderOccluders(cam.GetProjectionMatrix()*cam.GetViewMatrix());
+			occlusionCuller.Cull(&spheres[0], visibleSpheres, unoccludedSpheres);
+			visibleSpheres.swap(unoccludedSpheres);
+		}
+		total_visible = int(visibleSpheres.size());
+
+		sprintf(buffer, "FPS: %3.3f :: Visible spheres: %d of %d :: %s%s: %3.3f msecs, %d nodes, %d spheres tested", fps, frustum_visible, totalSpheres,
+			bBruteForce ? "Brute force" : "Hierarchy", bMultithreaded ? " MT" : "", cullTime, culler.GetNodesVisited(), culler.GetSpheresTested());
+		if(bOcclusionCulling) {
+			int length = int(strlen(buffer));
+			sprintf(buffer + length, " :: Unoccluded: %d, raster %3.3f + test %3.3f msecs", total_visible,
+				occlusionCuller.GetRasterTime(), occlusionCuller.GetTestTime());
+		}
+		glutSetWindowTitle(buffer);
+
+		shader.Use();
+			glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
+			glUniform4fv(shader("color"),1,cyan);
+			glBindVertexArray(sphereVAOID);
+				//orphan the index buffer and upload the visible list
+				if(total_visible > 0) {
+					glBufferData(GL_ELEMENT_ARRAY_BUFFER, spheres.size()*sizeof(GLuint), 0, GL_STREAM_DRAW);
+					glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, total_visible*sizeof(GLuint), &visibleSpheres[0]);
+					glPointSize(2);
+						glDrawElements(GL_POINTS, total_visible, GL_UNSIGNED_INT, 0);
+					glPointSize(10);
+				}
+			glBindVertexArray(0);
+			//draw the occluders
+			glUniform4fv(shader("color"),1,yellow);
+			glBindVertexArray(occluderVAOID);
+				glDrawElements(GL_TRIANGLES, GLsizei(occluderIndices.size()), GL_UNSIGNED_INT, 0);
+			glBindVertexArray(0);
+		shader.UnUse();
+	} else {
+		//begin hardware query
+		glBeginQuery(GL_PRIMITIVES_GENERATED, query);
+
+		//bind point shader
+		pointShader.Use();
+			//set shader uniforms
+			glUniform1f(pointShader("t"), current_time);
+			glUniformMatrix4fv(pointShader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
+			glUniform4fv(pointShader("FrustumPlanes"), 6, glm::value_ptr(p[0]));
+
+			//bind the point vertex array object
+			glBindVertexArray(pointVAOID);
+				//draw points
+				glDrawArrays(GL_POINTS,0,MAX_POINTS);
+
+		//unbind point shader
+		pointShader.UnUse();
+
+		//end hardware query
+		glEndQuery(GL_PRIMITIVES_GENERATED);
+
+		//check the query result to get the total number of visible points
+		GLuint res;
+		glGetQueryObjectuiv(query, GL_QUERY_RESULT, &res);
+		sprintf(buffer, "FPS: %3.3f :: Total visible points: %3d",fps, res);
+		glutSetWindowTitle(buffer);
+	}
 
 	//set the normal shader
 	shader.Use();
@@ -671,12 +1034,42 @@ void OnKey(unsigned char key, int x, int y) {
 		case '2':
 			pCurrentCam = &world;
 		break;
+
+		//toggle CPU culling of the spheres
+		case 'c':
+			bCPUCulling = !bCPUCulling;
+		break;
+
+		//toggle the brute force test of all spheres
+		case 'b':
+			bBruteForce = !bBruteForce;
+		break;
+
+		//toggle multithreaded culling
+		case 't':
+			bMultithreaded = !bMultithreaded;
+		break;
+
+		//toggle occlusion culling of the frustum culled spheres
+		case 'o':
+			bOcclusionCulling = !bOcclusionCulling;
+		break;
 	}
 	glutPostRedisplay();
 }
 
 
 int main(int argc, char** argv) {
+	//run the culling benchmark without opening a window
+	if(argc>1 && strcmp(argv[1], "--benchmark")==0) {
+		RunBenchmark();
+		return 0;
+	}
+
+	//optional number of spheres
+	if(argc>1)
+		totalSpheres = max(1, atoi(argv[1]));
+
 	//freeglut initialization calls
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
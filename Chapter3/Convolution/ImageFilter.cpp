@@ -0,0 +1,453 @@
+#define _USE_MATH_DEFINES
+#include "ImageFilter.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+
+//SIMD width in floats
+const int SIMD_WIDTH = 8;
+
+//largest difference relative to the largest weight for which a kernel still
+//counts as separable
+const float SEPARABLE_TOLERANCE = 1e-5f;
+
+//measured cost of the FFT method per pixel and per log2 of the block size
+//relative to a multiply of the direct method, which runs on 8 channels at
+//once with AVX2. Above about 21x21 the FFT is faster.
+const float FFT_COST = 45.0f;
+
+//complex multiply without the checks for infinities of the operator
+inline complex<float> Multiply(const complex<float>& a, const complex<float>& b) {
+	return complex<float>(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+}
+
+//rounds half up and clamps to the byte range
+inline GLubyte ToByte(float value) {
+	return GLubyte(min(max(floorf(value + 0.5f), 0.0f), 255.0f));
+}
+
+ImageFilter::ImageFilter(void)
+{
+	kernelWidth = kernelHeight = 1;
+	weights.assign(1, 1.0f);
+	bSeparable = true;
+	horizontal.assign(1, 1.0f);
+	vertical.assign(1, 1.0f);
+	borderMode = BORDER_ZERO;
+	method = METHOD_AUTO;
+	bUseSIMD = true;
+	tileWidth = 256;
+	tileHeight = 64;
+}
+
+ImageFilter::~ImageFilter(void)
+{
+}
+
+void ImageFilter::SetKernel(const float* kernel, int w, int h) {
+	kernelWidth = w|1;
+	kernelHeight = h|1;
+	weights.assign(kernelWidth*kernelHeight, 0.0f);
+	for(int y=0;y<h;y++) {
+		for(int x=0;x<w;x++)
+			weights[y*kernelWidth + x] = kernel[y*w + x];
+	}
+
+	//a separable kernel is the outer product of its column and its row
+	//through the largest weight, scaled by that weight
+	int largest = 0;
+	for(int i=1;i<int(weights.size());i++) {
+		if(fabs(weights[i]) > fabs(weights[largest]))
+			largest = i;
+	}
+	int row = largest/kernelWidth, column = largest%kernelWidth;
+	float pivot = weights[largest];
+	horizontal.assign(weights.begin() + row*kernelWidth, weights.begin() + (row+1)*kernelWidth);
+	vertical.resize(kernelHeight);
+	for(int y=0;y<kernelHeight;y++)
+		vertical[y] = (pivot != 0) ? weights[y*kernelWidth + column]/pivot : 0;
+
+	bSeparable = true;
+	for(int y=0;y<kernelHeight && bSeparable;y++) {
+		for(int x=0;x<kernelWidth;x++) {
+			if(fabs(weights[y*kernelWidth + x] - vertical[y]*horizontal[x]) > SEPARABLE_TOLERANCE*fabs(pivot)) {
+				bSeparable = false;
+				break;
+			}
+		}
+	}
+}
+
+int ImageFilter::GetKernelWidth() const {
+	return kernelWidth;
+}
+
+int ImageFilter::GetKernelHeight() const {
+	return kernelHeight;
+}
+
+bool ImageFilter::IsSeparable() const {
+	return bSeparable;
+}
+
+const vector<float>& ImageFilter::GetHorizontalKernel() const {
+	return horizontal;
+}
+
+const vector<float>& ImageFilter::GetVerticalKernel() const {
+	return vertical;
+}
+
+void ImageFilter::SetBorderMode(BorderMode mode) {
+	borderMode = mode;
+}
+
+void ImageFilter::SetMethod(Method filterMethod) {
+	method = filterMethod;
+}
+
+void ImageFilter::SetUseSIMD(bool bSIMD) {
+	bUseSIMD = bSIMD;
+}
+
+void ImageFilter::SetTileSize(int width, int height) {
+	tileWidth = max(width, SIMD_WIDTH);
+	tileHeight = max(height, 1);
+}
+
+bool ImageFilter::IsSIMDAvailable() {
+#ifdef USE_AVX2
+	return true;
+#else
+	return false;
+#endif
+}
+
+int ImageFilter::GetFFTSize() const {
+	//blocks of at least four times the kernel so most of a block is output
+	int size = 64;
+	while(size < 4*max(kernelWidth, kernelHeight))
+		size *= 2;
+	return size;
+}
+
+ImageFilter::Method ImageFilter::GetMethod(int width, int height) const {
+	if(method == METHOD_SEPARABLE && !bSeparable)
+		return METHOD_DIRECT;
+	if(method != METHOD_AUTO)
+		return method;
+
+	//multiplies per pixel for the direct methods, the FFTs of a block are
+	//shared by the pixels of its tile
+	float direct = float(kernelWidth*kernelHeight);
+	float separable = bSeparable ? float(kernelWidth + kernelHeight) : FLT_MAX;
+	int size = GetFFTSize();
+	int tileW = min(size - kernelWidth + 1, width), tileH = min(size - kernelHeight + 1, height);
+	float fft = FFT_COST*size*size*log2f(float(size))/(float(tileW)*tileH);
+	if(separable <= direct && separable <= fft)
+		return METHOD_SEPARABLE;
+	return (fft < direct) ? METHOD_FFT : METHOD_DIRECT;
+}
+
+const char* ImageFilter::GetMethodName(Method filterMethod) {
+	const char* names[] = {"auto", "direct", "separable", "FFT"};
+	return names[filterMethod];
+}
+
+void ImageFilter::ConvolveRow(const float* src, int length, int channels, const float* kernel, int taps, float* dst) const {
+	int j = 0;
+#ifdef USE_AVX2
+	if(bUseSIMD) {
+		for(;j+SIMD_WIDTH<=length;j+=SIMD_WIDTH) {
+			__m256 sum = _mm256_loadu_ps(dst + j);
+			for(int i=0;i<taps;i++)
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(kernel[i]), _mm256_loadu_ps(src + j + i*channels)));
+			_mm256_storeu_ps(dst + j, sum);
+		}
+	}
+#endif
+	for(;j<length;j++) {
+		float sum = dst[j];
+		for(int i=0;i<taps;i++)
+			sum += kernel[i]*src[j + i*channels];
+		dst[j] = sum;
+	}
+}
+
+void ImageFilter::ConvolveColumns(const float* const* rows, int length, const float* kernel, int taps, float* dst) const {
+	int j = 0;
+#ifdef USE_AVX2
+	if(bUseSIMD) {
+		for(;j+SIMD_WIDTH<=length;j+=SIMD_WIDTH) {
+			__m256 sum = _mm256_setzero_ps();
+			for(int i=0;i<taps;i++)
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(kernel[i]), _mm256_loadu_ps(rows[i] + j)));
+			_mm256_storeu_ps(dst + j, sum);
+		}
+	}
+#endif
+	for(;j<length;j++) {
+		float sum = 0;
+		for(int i=0;i<taps;i++)
+			sum += kernel[i]*rows[i][j];
+		dst[j] = sum;
+	}
+}
+
+void ImageFilter::StoreRow(const float* src, int length, GLubyte* dst) const {
+	//round half up and clamp to the byte range
+	int j = 0;
+#ifdef USE_AVX2
+	if(bUseSIMD) {
+		__m256 half = _mm256_set1_ps(0.5f), zero = _mm256_setzero_ps(), full = _mm256_set1_ps(255.0f);
+		for(;j+SIMD_WIDTH<=length;j+=SIMD_WIDTH) {
+			__m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_floor_ps(_mm256_add_ps(_mm256_loadu_ps(src + j), half)), zero), full);
+			__m256i i32 = _mm256_cvttps_epi32(v);
+			__m128i i16 = _mm_packus_epi32(_mm256_castsi256_si128(i32), _mm256_extracti128_si256(i32, 1));
+			_mm_storel_epi64((__m128i*)(dst + j), _mm_packus_epi16(i16, i16));
+		}
+	}
+#endif
+	for(;j<length;j++)
+		dst[j] = ToByte(src[j]);
+}
+
+void ImageFilter::ApplyTile(const GLubyte* src, int width, int height, int channels, int x0, int y0, int x1, int y1, bool bSeparablePasses, GLubyte* dst) const {
+	int rx = kernelWidth/2, ry = kernelHeight/2;
+	int tileW = x1 - x0, tileH = y1 - y0;
+	int inputLength = (tileW + 2*rx)*channels, outputLength = tileW*channels;
+
+	//convert the rows of the tile and its apron to floats
+	int inputRows = tileH + 2*ry;
+	vector<float> input(size_t(inputRows)*inputLength, 0.0f);
+	for(int r=0;r<inputRows;r++) {
+		int y = y0 - ry + r;
+		if(borderMode == BORDER_ZERO && (y < 0 || y >= height))
+			continue;
+		const GLubyte* row = src + size_t(min(max(y, 0), height-1))*width*channels;
+		float* dstRow = &input[size_t(r)*inputLength];
+		for(int x=x0-rx;x<x1+rx;x++) {
+			float* pixel = dstRow + (x - x0 + rx)*channels;
+			if(x < 0 || x >= width) {
+				if(borderMode == BORDER_CLAMP) {
+					const GLubyte* border = row + min(max(x, 0), width-1)*channels;
+					for(int c=0;c<channels;c++)
+						pixel[c] = border[c];
+				}
+				continue;
+			}
+			for(int c=0;c<channels;c++)
+				pixel[c] = row[x*channels + c];
+		}
+	}
+
+	vector<float> output(outputLength);
+	if(bSeparablePasses) {
+		//horizontal pass over all input rows, then the vertical pass
+		vector<float> temp(size_t(inputRows)*outputLength, 0.0f);
+		for(int r=0;r<inputRows;r++)
+			ConvolveRow(&input[size_t(r)*inputLength], outputLength, channels, &horizontal[0], kernelWidth, &temp[size_t(r)*outputLength]);
+		vector<const float*> rows(kernelHeight);
+		for(int y=0;y<tileH;y++) {
+			for(int i=0;i<kernelHeight;i++)
+				rows[i] = &temp[size_t(y + i)*outputLength];
+			ConvolveColumns(&rows[0], outputLength, &vertical[0], kernelHeight, &output[0]);
+			StoreRow(&output[0], outputLength, dst + (size_t(y0 + y)*width + x0)*channels);
+		}
+	} else {
+		//every kernel row is a horizontal pass summed into the output row
+		for(int y=0;y<tileH;y++) {
+			fill(output.begin(), output.end(), 0.0f);
+			for(int i=0;i<kernelHeight;i++)
+				ConvolveRow(&input[size_t(y + i)*inputLength], outputLength, channels, &weights[i*kernelWidth], kernelWidth, &output[0]);
+			StoreRow(&output[0], outputLength, dst + (size_t(y0 + y)*width + x0)*channels);
+		}
+	}
+}
+
+void ImageFilter::FFT(complex<float>* data, int size, int stride, const complex<float>* twiddles) {
+	//bit reversed order
+	for(int i=1, j=0;i<size;i++) {
+		int bit = size>>1;
+		for(;j&bit;bit>>=1)
+			j ^= bit;
+		j ^= bit;
+		if(i < j)
+			swap(data[i*stride], data[j*stride]);
+	}
+
+	//butterflies of doubling length
+	for(int length=2;length<=size;length*=2) {
+		int half = length/2, step = size/length;
+		for(int i=0;i<size;i+=length) {
+			for(int k=0;k<half;k++) {
+				complex<float>& a = data[(i + k)*stride];
+				complex<float>& b = data[(i + k + half)*stride];
+				complex<float> product = Multiply(b, twiddles[k*step]);
+				b = a - product;
+				a += product;
+			}
+		}
+	}
+}
+
+void ImageFilter::FFT2D(complex<float>* data, int size, const complex<float>* twiddles) {
+	//the columns are transformed as rows of the transposed block, which is
+	//much faster than strided access
+	for(int pass=0;pass<2;pass++) {
+		for(int y=0;y<size;y++)
+			FFT(data + y*size, size, 1, twiddles);
+		for(int y=0;y<size;y++)
+			for(int x=y+1;x<size;x++)
+				swap(data[y*size + x], data[x*size + y]);
+	}
+}
+
+void ImageFilter::ApplyFFT(const GLubyte* src, int width, int height, int channels, GLubyte* dst) const {
+	int size = GetFFTSize();
+	int rx = kernelWidth/2, ry = kernelHeight/2;
+	int tileWidth = size - 2*rx, tileHeight = size - 2*ry;
+
+	//twiddle factors of the forward and the inverse transform
+	vector< complex<float> > twiddles(size/2), inverseTwiddles(size/2);
+	for(int k=0;k<size/2;k++) {
+		twiddles[k] = complex<float>(polar(1.0, -2.0*M_PI*k/size));
+		inverseTwiddles[k] = conj(twiddles[k]);
+	}
+
+	//spectrum of the kernel, a correlation of the block with the kernel is
+	//the product of their spectra with the kernel one conjugated
+	vector< complex<float> > spectrum(size*size);
+	for(int y=0;y<kernelHeight;y++)
+		for(int x=0;x<kernelWidth;x++)
+			spectrum[y*size + x] = weights[y*kernelWidth + x];
+	FFT2D(&spectrum[0], size, &twiddles[0]);
+	float scale = 1.0f/(float(size)*size);
+	for(size_t i=0;i<spectrum.size();i++)
+		spectrum[i] = conj(spectrum[i])*scale;
+
+	int tilesX = (width + tileWidth - 1)/tileWidth;
+	int tilesY = (height + tileHeight - 1)/tileHeight;
+	#pragma omp parallel for schedule(dynamic)
+	for(int t=0;t<tilesX*tilesY;t++) {
+		int x0 = (t%tilesX)*tileWidth, y0 = (t/tilesX)*tileHeight;
+		int x1 = min(x0 + tileWidth, width), y1 = min(y0 + tileHeight, height);
+		vector< complex<float> > block(size*size);
+
+		//two channels are filtered at once as the real and imaginary part
+		for(int c=0;c<channels;c+=2) {
+			bool bPair = (c+1 < channels);
+
+			//the tile with its apron fills the block
+			for(int y=0;y<size;y++) {
+				complex<float>* row = &block[y*size];
+				int sy = y0 - ry + y;
+				if(borderMode == BORDER_ZERO && (sy < 0 || sy >= height)) {
+					fill(row, row + size, complex<float>(0, 0));
+					continue;
+				}
+				const GLubyte* srcRow = src + size_t(min(max(sy, 0), height-1))*width*channels;
+				for(int x=0;x<size;x++) {
+					int sx = x0 - rx + x;
+					if(borderMode == BORDER_ZERO && (sx < 0 || sx >= width)) {
+						row[x] = complex<float>(0, 0);
+						continue;
+					}
+					const GLubyte* pixel = srcRow + min(max(sx, 0), width-1)*channels;
+					row[x] = complex<float>(pixel[c], bPair ? pixel[c+1] : 0);
+				}
+			}
+
+			FFT2D(&block[0], size, &twiddles[0]);
+			for(size_t i=0;i<block.size();i++)
+				block[i] = Multiply(block[i], spectrum[i]);
+			FFT2D(&block[0], size, &inverseTwiddles[0]);
+
+			//the first pixels of the block have the whole kernel inside it
+			for(int y=0;y<y1-y0;y++) {
+				GLubyte* dstRow = dst + (size_t(y0 + y)*width + x0)*channels;
+				for(int x=0;x<x1-x0;x++) {
+					dstRow[x*channels + c] = ToByte(block[y*size + x].real());
+					if(bPair)
+						dstRow[x*channels + c + 1] = ToByte(block[y*size + x].imag());
+				}
+			}
+		}
+	}
+}
+
+void ImageFilter::Apply(const GLubyte* src, int width, int height, int channels, GLubyte* dst) const {
+	Method used = GetMethod(width, height);
+	if(used == METHOD_FFT) {
+		ApplyFFT(src, width, height, channels, dst);
+		return;
+	}
+
+	int tilesX = (width + tileWidth - 1)/tileWidth;
+	int tilesY = (height + tileHeight - 1)/tileHeight;
+	#pragma omp parallel for schedule(dynamic)
+	for(int t=0;t<tilesX*tilesY;t++) {
+		int x0 = (t%tilesX)*tileWidth, y0 = (t/tilesX)*tileHeight;
+		ApplyTile(src, width, height, channels, x0, y0, min(x0 + tileWidth, width), min(y0 + tileHeight, height), used == METHOD_SEPARABLE, dst);
+	}
+}
+
+int ImageFilter::GetTotalPasses() const {
+	return (bSeparable && method != METHOD_DIRECT) ? 2 : 1;
+}
+
+void ImageFilter::GetTaps(int pass, bool bLinearFetches, vector<Tap>& taps) const {
+	taps.clear();
+	if(GetTotalPasses() == 1) {
+		int rx = kernelWidth/2, ry = kernelHeight/2;
+		for(int y=0;y<kernelHeight;y++) {
+			for(int x=0;x<kernelWidth;x++) {
+				if(weights[y*kernelWidth + x] != 0) {
+					Tap tap = {float(x - rx), float(y - ry), weights[y*kernelWidth + x]};
+					taps.push_back(tap);
+				}
+			}
+		}
+	} else {
+		//neighbouring weights of the same sign become one linear fetch at
+		//the weighted position between the two texels
+		const vector<float>& kernel = (pass == 0) ? horizontal : vertical;
+		int radius = int(kernel.size())/2;
+		for(int i=0;i<int(kernel.size());) {
+			float offset = float(i - radius), weight = kernel[i];
+			if(weight == 0) {
+				i++;
+				continue;
+			}
+			if(bLinearFetches && i+1 < int(kernel.size()) && kernel[i+1]*weight > 0) {
+				offset += kernel[i+1]/(weight + kernel[i+1]);
+				weight += kernel[i+1];
+				i += 2;
+			} else {
+				i++;
+			}
+			Tap tap = {(pass == 0) ? offset : 0, (pass == 0) ? 0 : offset, weight};
+			taps.push_back(tap);
+		}
+	}
+
+	//a kernel of zeros still needs a tap
+	if(taps.empty()) {
+		Tap tap = {0, 0, 0};
+		taps.push_back(tap);
+	}
+}
+
+int ImageFilter::GetTotalFetches(int pass) const {
+	vector<Tap> taps;
+	GetTaps(pass, true, taps);
+	return int(taps.size());
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <complex>
+
+using namespace std;
+
+//ImageFilter class convolves 8 bit images with a kernel given at runtime, on
+//the CPU or through generated GLSL fragment shaders. The kernel is applied
+//as a correlation: weight (kx,ky) multiplies the pixel kx-kernelWidth/2
+//columns right and ky-kernelHeight/2 rows up of the output pixel, the rows
+//of the images are stored from the bottom like OpenGL textures.
+//
+//When a kernel is set it is tested for separability, that is whether it is
+//the product of a column and a row kernel. Separable kernels are applied as
+//a horizontal and a vertical pass, which needs kernelWidth+kernelHeight
+//instead of kernelWidth*kernelHeight multiplies per pixel.
+//
+//Large kernels which are not separable are applied with FFTs: the image is
+//cut into tiles which with their apron fill a power of two block, each block
+//is multiplied with the spectrum of the kernel and transformed back (overlap
+//save), so the cost per pixel grows with the logarithm of the block size
+//instead of the kernel area. By default the method with the lowest
+//estimated cost for the kernel is used.
+//
+//On the CPU the image is cut into tiles which are filtered in parallel with
+//OpenMP. Each tile converts its rows, including the apron the kernel needs,
+//to floats and runs the passes on rows of interleaved channels with AVX2
+//when it is available; the scalar code does the same operations in the same
+//order so both give the same result. Between the passes the values stay
+//floats, the result is rounded and clamped to [0,255] once.
+//
+//On the GPU the taps of a pass are passed to the shaders at runtime. When
+//the image is sampled with linear filtering two neighbouring taps of a
+//separable pass with weights of the same sign can be merged into one fetch
+//between the two texels, so a 21 tap pass needs 11 fetches. The
+//intermediate image of the two passes should be a float texture to match
+//the CPU result.
+class ImageFilter
+{
+public:
+	//pixels outside the image are zero or the closest border pixel
+	enum BorderMode { BORDER_ZERO, BORDER_CLAMP };
+
+	//how the kernel is applied, METHOD_AUTO picks the cheapest method
+	enum Method { METHOD_AUTO, METHOD_DIRECT, METHOD_SEPARABLE, METHOD_FFT };
+
+	//a tap of a pass, the offset in texels and the weight
+	struct Tap {
+		float x, y, weight;
+	};
+
+	//constructor/destructor
+	ImageFilter(void);
+	~ImageFilter(void);
+
+	//sets a kernel of odd size with the weights given row by row from the bottom
+	void SetKernel(const float* weights, int kernelWidth, int kernelHeight);
+	int GetKernelWidth() const;
+	int GetKernelHeight() const;
+
+	//true if the kernel is the product of a column and a row kernel
+	bool IsSeparable() const;
+	const vector<float>& GetHorizontalKernel() const;
+	const vector<float>& GetVerticalKernel() const;
+
+	//options
+	void SetBorderMode(BorderMode mode);
+	void SetMethod(Method method);
+	void SetUseSIMD(bool bUseSIMD);
+	void SetTileSize(int width, int height);
+	static bool IsSIMDAvailable();
+
+	//the method used for an image of the given size, METHOD_SEPARABLE is
+	//only used for separable kernels
+	Method GetMethod(int width, int height) const;
+	static const char* GetMethodName(Method method);
+
+	//filters a width x height image with channels interleaved 8 bit channels
+	void Apply(const GLubyte* src, int width, int height, int channels, GLubyte* dst) const;
+
+	//passes on the GPU, two for a separable kernel (horizontal first) unless
+	//the direct method is set, otherwise one. There is no FFT on the GPU.
+	int GetTotalPasses() const;
+
+	//the taps of a pass with zero weights left out, with bLinearFetches
+	//neighbouring taps of separable passes are merged
+	void GetTaps(int pass, bool bLinearFetches, vector<Tap>& taps) const;
+
+	//texture fetches per pixel of a pass with linear fetches
+	int GetTotalFetches(int pass) const;
+
+protected:
+	//filters one tile of the output image directly or in two passes
+	void ApplyTile(const GLubyte* src, int width, int height, int channels, int x0, int y0, int x1, int y1, bool bSeparablePasses, GLubyte* dst) const;
+
+	//filters the image with FFTs of blocks of fftSize x fftSize
+	void ApplyFFT(const GLubyte* src, int width, int height, int channels, GLubyte* dst) const;
+	int GetFFTSize() const;
+
+	//in place FFT of size values and of the rows and then the columns of a
+	//size x size block, twiddles holds exp(-2*pi*i*k/size) for k < size/2
+	//or its conjugate for the inverse transform (without the 1/size scale)
+	static void FFT(complex<float>* data, int size, int stride, const complex<float>* twiddles);
+	static void FFT2D(complex<float>* data, int size, const complex<float>* twiddles);
+
+	//row operations on channels interleaved float rows, tap i of a
+	//horizontal pass reads the row at i*channels
+	void ConvolveRow(const float* src, int length, int channels, const float* kernel, int taps, float* dst) const;
+	void ConvolveColumns(const float* const* rows, int length, const float* kernel, int taps, float* dst) const;
+	void StoreRow(const float* src, int length, GLubyte* dst) const;
+
+	int kernelWidth, kernelHeight;
+	vector<float> weights;
+	bool bSeparable;
+	vector<float> horizontal, vertical;
+
+	BorderMode borderMode;
+	Method method;
+	bool bUseSIMD;
+	int tileWidth, tileHeight;
+};
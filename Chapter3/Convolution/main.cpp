@@ -1,6 +1,12 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -8,7 +14,12 @@
 
 #include <SOIL.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "GLSLShader.h"
+#include "ImageFilter.h"
 
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
@@ -31,10 +42,32 @@ using namespace std;
 const int WIDTH  = 512;
 const int HEIGHT = 512;
 
-//shader for rendering of image and convolution
+//shader for rendering of image, the convolution shader and the tiled compute
+//shader, both read the taps of a pass from the Kernel uniform block
 GLSLShader shader;
 GLSLShader convolution_shader;
-GLSLShader* current_shader;
+GLSLShader compute_shader;
+
+//uniform buffers with the taps of each pass of the current kernel, they are
+//bound to binding point 0 which all uniform blocks use by default
+GLuint uboIDs[2];
+int total_passes = 0;
+
+//layout of the Kernel uniform block, an ivec4 header with the total taps
+//and the kernel radius followed by a vec4 per tap
+const int MAX_TAPS = 1000;
+
+//the compute shader filters tiles of 16x16 pixels and has room in shared
+//memory for kernels of up to 25x25, larger kernels use the fragment shader
+const int COMPUTE_TILE_SIZE = 16;
+const int MAX_COMPUTE_RADIUS = 12;
+bool bComputeAvailable = false;
+bool bUseCompute = true;
+bool bComputePath = false;
+
+//filtered or normal image and GPU or CPU filtering
+bool bFiltered = false;
+bool bUseCPU = false;
 
 //vertex array and vertex buffer object IDs
 GLuint vaoID;
@@ -44,6 +77,35 @@ GLuint vboIndicesID;
 //texture image ID
 GLuint textureID;
 
+//texture holding the CPU filtered image
+GLuint cpuTextureID;
+
+//FBO with a float texture for the result of the first pass of a separable
+//kernel and an 8 bit texture for the filtered image
+GLuint fboID;
+GLuint passTextureID;
+GLuint resultTextureID;
+
+//query for the GPU time of the filter
+GLuint queryID;
+
+//the image on the CPU with rows from the bottom like the texture
+vector<GLubyte> image;
+int image_width = 0, image_height = 0;
+const int image_channels = 3;
+
+//CPU and shader filter of the current kernel
+ImageFilter filter;
+int current_kernel = 0;
+
+//largest difference in 8 bit levels allowed between the shader and the CPU
+//result, linear fetches use a lower precision for their interpolation
+const int GOLDEN_TOLERANCE = 2;
+
+//methods cycled through with the 'm' key
+const ImageFilter::Method methods[] = {ImageFilter::METHOD_AUTO, ImageFilter::METHOD_DIRECT, ImageFilter::METHOD_SEPARABLE, ImageFilter::METHOD_FFT};
+int current_method = 0;
+
 //vertices and indices arrays for fullscreen quad
 glm::vec2 vertices[4];
 GLushort indices[6];
@@ -51,6 +113,308 @@ GLushort indices[6];
 //texture image filename
 const string filename = "media/Lenna.png";
 
+//a kernel that can be picked with the number keys
+struct Kernel {
+	const char* name;
+	vector<float> weights;
+	int width, height;
+};
+vector<Kernel> kernels;
+
+//converts a 3x3 kernel written like in the former convolution shader, which
+//read it backwards, divided the sum by 9 and optionally added the pixel
+Kernel ShaderKernel(const char* name, const float kernel[9], bool bAddPixel) {
+	Kernel result;
+	result.name = name;
+	result.width = result.height = 3;
+	result.weights.resize(9);
+	for(int i=0;i<9;i++)
+		result.weights[i] = kernel[8-i]/9.0f;
+	if(bAddPixel)
+		result.weights[4] += 1.0f;
+	return result;
+}
+
+//a size x size box average
+Kernel BoxKernel(const char* name, int size) {
+	Kernel result;
+	result.name = name;
+	result.width = result.height = size;
+	result.weights.assign(size*size, 1.0f/(size*size));
+	return result;
+}
+
+//the outer product of the 21 tap kernel of the GaussH/GaussV shaders
+Kernel GaussianKernel(const char* name) {
+	const float gauss[21] = {0.000272337f, 0.00089296f, 0.002583865f, 0.00659813f, 0.014869116f,
+							 0.029570767f, 0.051898313f, 0.080381679f, 0.109868729f, 0.132526984f,
+							 0.14107424f,
+							 0.132526984f, 0.109868729f, 0.080381679f, 0.051898313f, 0.029570767f,
+							 0.014869116f, 0.00659813f, 0.002583865f, 0.00089296f, 0.000272337f};
+	Kernel result;
+	result.name = name;
+	result.width = result.height = 21;
+	result.weights.resize(21*21);
+	for(int y=0;y<21;y++)
+		for(int x=0;x<21;x++)
+			result.weights[y*21+x] = gauss[y]*gauss[x];
+	return result;
+}
+
+//a size x size disc average, which is not separable
+Kernel DiscKernel(const char* name, int size) {
+	Kernel result;
+	result.name = name;
+	result.width = result.height = size;
+	result.weights.assign(size*size, 0.0f);
+	int radius = size/2, total = 0;
+	for(int y=-radius;y<=radius;y++)
+		for(int x=-radius;x<=radius;x++)
+			if(x*x + y*y <= radius*radius) {
+				result.weights[(y+radius)*size + x+radius] = 1.0f;
+				total++;
+			}
+	for(int i=0;i<size*size;i++)
+		result.weights[i] /= float(total);
+	return result;
+}
+
+void InitKernels() {
+	const float sharpen[9] = {-1,-1,-1,
+							  -1, 8,-1,
+							  -1,-1,-1};
+	const float smooth[9] = {1,1,1,
+							 1,1,1,
+							 1,1,1};
+	const float gaussian[9] = {0,1,0,
+							   1,5,1,
+							   0,1,0};
+	const float emboss[9] = {-4,-4, 0,
+							 -4,12, 0,
+							  0, 0, 0};
+	kernels.push_back(ShaderKernel("3x3 sharpen", sharpen, true));
+	kernels.push_back(ShaderKernel("3x3 smoothing", smooth, false));
+	kernels.push_back(ShaderKernel("3x3 Gaussian smoothing", gaussian, false));
+	kernels.push_back(ShaderKernel("3x3 emboss", emboss, true));
+	kernels.push_back(GaussianKernel("21x21 Gaussian"));
+	kernels.push_back(BoxKernel("15x15 box", 15));
+	kernels.push_back(DiscKernel("25x25 disc", 25));
+}
+
+//loads the image with its rows from the bottom
+bool LoadImage(vector<GLubyte>& pixels, int& width, int& height) {
+	int channels = 0;
+	GLubyte* pData = SOIL_load_image(filename.c_str(), &width, &height, &channels, SOIL_LOAD_RGB);
+	if(pData == NULL) {
+		cerr<<"Cannot load image: "<<filename.c_str()<<endl;
+		return false;
+	}
+	pixels.resize(size_t(width)*height*image_channels);
+	size_t rowSize = size_t(width)*image_channels;
+	for(int j=0;j<height;j++)
+		memcpy(&pixels[j*rowSize], pData + (height-1-j)*rowSize, rowSize);
+
+	//free SOIL image data
+	SOIL_free_image_data(pData);
+	return true;
+}
+
+//milliseconds taken by filtering an image with the current options
+double TimeFilter(const ImageFilter& imageFilter, const vector<GLubyte>& src, int width, int height, vector<GLubyte>& dst) {
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	imageFilter.Apply(&src[0], width, height, image_channels, &dst[0]);
+	return chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+//largest difference between two images and the number of values that differ
+//by more than tolerance
+int CompareImages(const vector<GLubyte>& a, const vector<GLubyte>& b, int tolerance, int& mismatches) {
+	int maxDifference = 0;
+	mismatches = 0;
+	for(size_t i=0;i<a.size();i++) {
+		int difference = abs(int(a[i]) - int(b[i]));
+		maxDifference = max(maxDifference, difference);
+		if(difference > tolerance)
+			mismatches++;
+	}
+	return maxDifference;
+}
+
+//filters a size x size image made of copies of the test image with every
+//kernel with each method, with and without SIMD, and checks the results
+//against the scalar direct code. The method picked by METHOD_AUTO is marked.
+void RunBenchmark(int size) {
+	vector<GLubyte> tile;
+	int tileWidth = 0, tileHeight = 0;
+	if(!LoadImage(tile, tileWidth, tileHeight))
+		return;
+	vector<GLubyte> src(size_t(size)*size*image_channels), dst(src.size()), reference(src.size());
+	for(int j=0;j<size;j++)
+		for(int i=0;i<size;i++)
+			memcpy(&src[(size_t(j)*size + i)*image_channels], &tile[(size_t(j%tileHeight)*tileWidth + i%tileWidth)*image_channels], image_channels);
+
+	int threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	printf("Image filter benchmark: %dx%d RGB image, %d threads\n", size, size, threads);
+	printf("%-24s %-10s %-8s %4s %10s %10s\n", "kernel", "method", "code", "auto", "ms", "MPix/s");
+
+	InitKernels();
+	int maxDifference = 0, totalMismatches = 0;
+	for(size_t k=0;k<kernels.size();k++) {
+		ImageFilter imageFilter;
+		imageFilter.SetKernel(&kernels[k].weights[0], kernels[k].width, kernels[k].height);
+		ImageFilter::Method picked = imageFilter.GetMethod(size, size);
+		for(int m=1;m<4;m++) {
+			ImageFilter::Method method = methods[m];
+			if(method == ImageFilter::METHOD_SEPARABLE && !imageFilter.IsSeparable())
+				continue;
+			imageFilter.SetMethod(method);
+			for(int simd=0;simd<2;simd++) {
+				//the FFT method has no SIMD code
+				if(simd && (!ImageFilter::IsSIMDAvailable() || method == ImageFilter::METHOD_FFT))
+					break;
+				imageFilter.SetUseSIMD(simd == 1);
+				double ms = TimeFilter(imageFilter, src, size, size, dst);
+				printf("%-24s %-10s %-8s %4s %10.1f %10.1f\n", kernels[k].name, ImageFilter::GetMethodName(method),
+					simd ? "AVX2" : "scalar", (method == picked) ? "*" : "", ms, double(size)*size/ms/1000.0);
+
+				//SIMD must give the same bytes as the scalar code, the other
+				//methods differ from the direct sum only by rounding
+				if(method == ImageFilter::METHOD_DIRECT && !simd) {
+					reference = dst;
+				} else {
+					int mismatches = 0;
+					maxDifference = max(maxDifference, CompareImages(dst, reference, (method == ImageFilter::METHOD_DIRECT) ? 0 : 1, mismatches));
+					totalMismatches += mismatches;
+				}
+			}
+		}
+	}
+	printf("correctness: %d values differ from the scalar direct result by more than the rounding, max difference %d\n", totalMismatches, maxDifference);
+}
+
+//passes the taps of the current kernel to the uniform buffers, the compute
+//shader reads exact texels from shared memory while the fragment shader
+//merges taps into linear fetches
+bool UploadTaps() {
+	total_passes = filter.GetTotalPasses();
+	glm::ivec2 radius(filter.GetKernelWidth()/2, filter.GetKernelHeight()/2);
+	bComputePath = bComputeAvailable && bUseCompute && max(radius.x, radius.y) <= MAX_COMPUTE_RADIUS;
+	for(int pass=0;pass<total_passes;pass++) {
+		vector<ImageFilter::Tap> taps;
+		filter.GetTaps(pass, !bComputePath, taps);
+		if(taps.size() > MAX_TAPS)
+			return false;
+
+		//the passes of a separable kernel only need an apron along their axis
+		glm::ivec2 passRadius = radius;
+		if(total_passes == 2)
+			passRadius = (pass == 0) ? glm::ivec2(radius.x, 0) : glm::ivec2(0, radius.y);
+		glm::ivec4 header(int(taps.size()), passRadius.x, passRadius.y, 0);
+		vector<glm::vec4> data(taps.size());
+		for(size_t i=0;i<taps.size();i++)
+			data[i] = glm::vec4(taps[i].x, taps[i].y, taps[i].weight, 0);
+
+		glBindBuffer(GL_UNIFORM_BUFFER, uboIDs[pass]);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(header), glm::value_ptr(header));
+		glBufferSubData(GL_UNIFORM_BUFFER, sizeof(header), data.size()*sizeof(glm::vec4), &data[0]);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	return true;
+}
+
+//sets the current kernel on the GPU and filters the image on the CPU
+void SetKernel(int index) {
+	current_kernel = index;
+	const Kernel& kernel = kernels[index];
+	filter.SetKernel(&kernel.weights[0], kernel.width, kernel.height);
+	filter.SetMethod(methods[current_method]);
+	if(!UploadTaps()) {
+		cout<<kernel.name<<" has more than "<<MAX_TAPS<<" taps, showing the CPU result"<<endl;
+		bUseCPU = true;
+	}
+
+	//filter the image on the CPU and upload the result
+	vector<GLubyte> result(image.size());
+	double ms = TimeFilter(filter, image, image_width, image_height, result);
+	glBindTexture(GL_TEXTURE_2D, cpuTextureID);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image_width, image_height, GL_RGB, GL_UNSIGNED_BYTE, &result[0]);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+
+	cout<<kernel.name<<(filter.IsSeparable() ? " (separable)" : "")<<": CPU "
+		<<ImageFilter::GetMethodName(filter.GetMethod(image_width, image_height))<<" "<<ms<<" ms, GPU "
+		<<total_passes<<" pass(es) with the ";
+	if(bComputePath) {
+		cout<<"compute shader"<<endl;
+	} else {
+		int fetches = 0;
+		for(int pass=0;pass<total_passes;pass++)
+			fetches += filter.GetTotalFetches(pass);
+		cout<<"fragment shader, "<<fetches<<" fetches per pixel"<<endl;
+	}
+}
+
+//runs the passes of the current kernel on the image, the last one into the
+//result texture
+void RenderFiltered() {
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	for(int pass=0;pass<total_passes;pass++) {
+		//earlier passes write the float texture at the image size
+		GLuint target = (pass == total_passes-1) ? resultTextureID : passTextureID;
+		glBindBufferBase(GL_UNIFORM_BUFFER, 0, uboIDs[pass]);
+		if(bComputePath) {
+			glBindImageTexture(0, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, (target == passTextureID) ? GL_RGBA32F : GL_RGBA8);
+			compute_shader.Use();
+				glDispatchCompute((image_width + COMPUTE_TILE_SIZE - 1)/COMPUTE_TILE_SIZE, (image_height + COMPUTE_TILE_SIZE - 1)/COMPUTE_TILE_SIZE, 1);
+			compute_shader.UnUse();
+			//the image writes have to be visible to the fetches of the next
+			//pass and the framebuffer reads
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+		} else {
+			glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+			glViewport(0, 0, image_width, image_height);
+			convolution_shader.Use();
+				glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+			convolution_shader.UnUse();
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glViewport(0, 0, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+		}
+		//the next pass reads the float texture
+		glBindTexture(GL_TEXTURE_2D, passTextureID);
+	}
+	glBindTexture(GL_TEXTURE_2D, textureID);
+}
+
+//times the GPU filter of the current kernel, reads its result back and
+//compares it with the CPU result
+void CheckGolden() {
+	const int runs = 10;
+	glBeginQuery(GL_TIME_ELAPSED, queryID);
+	for(int i=0;i<runs;i++)
+		RenderFiltered();
+	glEndQuery(GL_TIME_ELAPSED);
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(queryID, GL_QUERY_RESULT, &elapsed);
+
+	vector<GLubyte> gpu(image.size()), cpu(image.size());
+	glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, resultTextureID, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, image_width, image_height, GL_RGB, GL_UNSIGNED_BYTE, &gpu[0]);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	filter.Apply(&image[0], image_width, image_height, image_channels, &cpu[0]);
+	int mismatches = 0;
+	int maxDifference = CompareImages(gpu, cpu, GOLDEN_TOLERANCE, mismatches);
+	cout<<kernels[current_kernel].name<<" on the "<<(bComputePath ? "compute" : "fragment")<<" shader: "
+		<<elapsed/(runs*1e6)<<" ms, golden image check: max difference "<<maxDifference
+		<<", "<<mismatches<<" values differ by more than "<<GOLDEN_TOLERANCE<<(mismatches ? " FAILED" : " passed")<<endl;
+}
+
 void OnInit() {
 	GL_CHECK_ERRORS
 	//load shader
@@ -66,13 +430,11 @@ void OnInit() {
 		glUniform1i(shader("textureMap"), 0);
 	shader.UnUse();
 
-	current_shader = &shader;
-
 	GL_CHECK_ERRORS
 
-	//load shader
+	//load the convolution shader
 	convolution_shader.LoadFromFile(GL_VERTEX_SHADER, "shaders/shader.vert");
-	convolution_shader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/shader_convolution.frag");
+	convolution_shader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/convolution.frag");
 	//compile and link shader
 	convolution_shader.CreateAndLinkProgram();
 	convolution_shader.Use();
@@ -83,6 +445,33 @@ void OnInit() {
 		glUniform1i(convolution_shader("textureMap"), 0);
 	convolution_shader.UnUse();
 
+	//load the compute shader if the context supports it
+	bComputeAvailable = (GLEW_VERSION_4_3 != 0);
+	if(bComputeAvailable) {
+		compute_shader.LoadFromFile(GL_COMPUTE_SHADER, "shaders/convolution.comp");
+		compute_shader.CreateAndLinkProgram();
+		compute_shader.Use();
+			compute_shader.AddUniform("textureMap");
+			compute_shader.AddUniform("outputImage");
+			//texture unit and image unit 0
+			glUniform1i(compute_shader("textureMap"), 0);
+			glUniform1i(compute_shader("outputImage"), 0);
+		compute_shader.UnUse();
+	} else {
+		cout<<"Compute shaders are not supported, using the fragment shader only"<<endl;
+	}
+
+	//setup the uniform buffers for the taps of the passes
+	glGenBuffers(2, uboIDs);
+	for(int pass=0;pass<2;pass++) {
+		glBindBuffer(GL_UNIFORM_BUFFER, uboIDs[pass]);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::ivec4) + MAX_TAPS*sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	//setup the query for the GPU time
+	glGenQueries(1, &queryID);
+
 	GL_CHECK_ERRORS
 
 	//setup quad geometry
@@ -125,24 +514,8 @@ void OnInit() {
 
 
 	//load the image using SOIL
-	int texture_width = 0, texture_height = 0, channels=0;
-	GLubyte* pData = SOIL_load_image(filename.c_str(), &texture_width, &texture_height, &channels, SOIL_LOAD_AUTO);
-
-	//vertically flip the image on Y axis since it is inverted
-	int i,j;
-	for( j = 0; j*2 < texture_height; ++j )
-	{
-		int index1 = j * texture_width * channels;
-		int index2 = (texture_height - 1 - j) * texture_width * channels;
-		for( i = texture_width * channels; i > 0; --i )
-		{
-			GLubyte temp = pData[index1];
-			pData[index1] = pData[index2];
-			pData[index2] = temp;
-			++index1;
-			++index2;
-		}
-	}
+	if(!LoadImage(image, image_width, image_height))
+		exit(EXIT_FAILURE);
 
 	//setup OpenGL texture and bind to texture unit 0
 	glGenTextures(1, &textureID);
@@ -154,10 +527,32 @@ void OnInit() {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 		//allocate texture 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texture_width, texture_height, 0, GL_RGB, GL_UNSIGNED_BYTE, pData);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image_width, image_height, 0, GL_RGB, GL_UNSIGNED_BYTE, &image[0]);
+
+	//setup the textures for the CPU result, the first pass and the GPU result,
+	//outside of the image they are black like the image texture
+	GLuint* textures[3] = {&cpuTextureID, &passTextureID, &resultTextureID};
+	GLint formats[3] = {GL_RGB8, GL_RGBA32F, GL_RGBA8};
+	for(int i=0;i<3;i++) {
+		glGenTextures(1, textures[i]);
+		glBindTexture(GL_TEXTURE_2D, *textures[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexImage2D(GL_TEXTURE_2D, 0, formats[i], image_width, image_height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, textureID);
 
-	//free SOIL image data
-	SOIL_free_image_data(pData);
+	//setup the FBO, the attachment is set before each use
+	glGenFramebuffers(1, &fboID);
+
+	GL_CHECK_ERRORS
+
+	//the zero border of the textures
+	filter.SetBorderMode(ImageFilter::BORDER_ZERO);
+	InitKernels();
+	SetKernel(0);
 
 	GL_CHECK_ERRORS
 
@@ -167,11 +562,16 @@ void OnInit() {
 //release all allocated resources
 void OnShutdown() {
 
-	current_shader = 0;
-
 	//Destroy shader
 	shader.DeleteShaderProgram();
 	convolution_shader.DeleteShaderProgram();
+	if(bComputeAvailable)
+		compute_shader.DeleteShaderProgram();
+
+	//Destroy FBO, uniform buffers and query
+	glDeleteFramebuffers(1, &fboID);
+	glDeleteBuffers(2, uboIDs);
+	glDeleteQueries(1, &queryID);
 
 
 	//Destroy vao and vbo
@@ -181,6 +581,9 @@ void OnShutdown() {
 
 	//Delete textures
 	glDeleteTextures(1, &textureID);
+	glDeleteTextures(1, &cpuTextureID);
+	glDeleteTextures(1, &passTextureID);
+	glDeleteTextures(1, &resultTextureID);
 	cout<<"Shutdown successfull"<<endl;
 }
 
@@ -195,35 +598,77 @@ void OnRender() {
 	//clear the colour and depth buffers
 	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
-	//bind current shader
-	current_shader->Use();
+	//run the convolution passes
+	if(bFiltered && !bUseCPU)
+		RenderFiltered();
+
+	//show the image, the GPU or the CPU result
+	glBindTexture(GL_TEXTURE_2D, bFiltered ? (bUseCPU ? cpuTextureID : resultTextureID) : textureID);
+	shader.Use();
 		//draw fullscreen quad
 		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 	//unbind shader
-	current_shader->UnUse();
+	shader.UnUse();
+	glBindTexture(GL_TEXTURE_2D, textureID);
 
 	//swap front and back buffers to show the rendered result
 	glutSwapBuffers();
 }
 
-//keyboard event handler to change the output to convolved or normal image
+//keyboard event handler to change the output to convolved or normal image,
+//the kernel and whether it is applied by the shaders or the CPU
 void OnKey(unsigned char key, int x, int y) {
 	switch(key) {
-		case ' ': {
-			if(current_shader == &shader) {
-				current_shader = &convolution_shader;
-				glutSetWindowTitle("Filtered image");
-			} else {
-				current_shader = &shader;
-				glutSetWindowTitle("Normal image");
+		case ' ':
+			bFiltered = !bFiltered;
+		break;
+
+		case 'c':
+			bUseCPU = !bUseCPU;
+		break;
+
+		case 'm':
+			//cycle through the methods
+			current_method = (current_method + 1)%4;
+			cout<<"Method: "<<ImageFilter::GetMethodName(methods[current_method])<<endl;
+			SetKernel(current_kernel);
+		break;
+
+		case 'p':
+			//switch between the compute and the fragment shader
+			bUseCompute = !bUseCompute;
+			SetKernel(current_kernel);
+		break;
+
+		case 'g':
+			CheckGolden();
+		break;
+
+		default:
+			if(key >= '1' && key < '1' + int(kernels.size())) {
+				SetKernel(key - '1');
+				bFiltered = true;
 			}
-		}break;
+		break;
+	}
+	if(bFiltered) {
+		string title = string("Filtered image: ") + kernels[current_kernel].name + (bUseCPU ? " (CPU)" : (bComputePath ? " (compute shader)" : " (fragment shader)"));
+		glutSetWindowTitle(title.c_str());
+	} else {
+		glutSetWindowTitle("Normal image");
 	}
 	//call display function
  	glutPostRedisplay();
 }
 
 int main(int argc, char** argv) {
+	//run the CPU filter benchmark without opening a window, on a 4k x 4k image
+	//unless a size is given
+	if(argc>1 && strcmp(argv[1], "--benchmark")==0) {
+		RunBenchmark((argc>2) ? max(16, atoi(argv[2])) : 4096);
+		return 0;
+	}
+
 	//freeglut initialization calls
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
@@ -254,6 +699,9 @@ int main(int argc, char** argv) {
 	cout<<"\tGLSL: "<<glGetString (GL_SHADING_LANGUAGE_VERSION)<<endl;
 
 	cout<<"Press ' ' key to filter/unfilter\n";
+	cout<<"Press '1'-'7' to pick a kernel, 'm' to cycle the direct, separable and FFT methods\n";
+	cout<<"Press 'c' to toggle CPU filtering, 'p' to toggle the compute shader\n";
+	cout<<"Press 'g' to time the shaders and compare them with the CPU\n";
 	GL_CHECK_ERRORS
 
 	//initialization of OpenGL
@@ -0,0 +1,31 @@
+#version 330 core
+ 
+layout(location=0) out vec4 vFragColor;	//fragment shader output
+
+//input from the vertex shader
+smooth in vec2 vUV;						//2D texture coordinates
+
+//shader uniform
+uniform sampler2D textureMap;			//the filtering image
+
+//kernel uniform block, the number of taps is in header.x and every tap has
+//its offset in texels in xy and its weight in z. Neighbouring taps may be
+//merged into one fetch between two texels.
+const int MAX_TAPS = 1000;
+layout(std140) uniform Kernel {
+	ivec4 header;
+	vec4 taps[MAX_TAPS];
+};
+
+void main()
+{ 
+	//determine the inverse of texture size
+	vec2 delta = 1.0/textureSize(textureMap,0);
+	vec4 color = vec4(0);
+
+	//accumulate the weighted samples around the current sample point
+	for(int i=0;i<header.x;i++) {
+		color += taps[i].z*texture(textureMap, vUV + taps[i].xy*delta);
+	}
+	vFragColor = color;
+}
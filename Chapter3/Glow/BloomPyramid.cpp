@@ -0,0 +1,136 @@
+#include "BloomPyramid.h"
+#include <iostream>
+#include <algorithm>
+
+BloomPyramid::BloomPyramid(void)
+{
+	fboID = 0;
+	levels = 5;
+}
+
+BloomPyramid::~BloomPyramid(void)
+{
+	Destroy();
+}
+
+void BloomPyramid::Init(int width, int height) {
+	//load the downsample shader
+	downsampleShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/full_screen_shader.vert");
+	downsampleShader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/bloom_downsample.frag");
+	//compile and link the shader
+	downsampleShader.CreateAndLinkProgram();
+	downsampleShader.Use();
+		//add shader attributes and uniforms
+		downsampleShader.AddAttribute("vVertex");
+		downsampleShader.AddUniform("textureMap");
+		//set the values of the constant uniforms at initialization
+		glUniform1i(downsampleShader("textureMap"),0);
+	downsampleShader.UnUse();
+
+	//load the upsample shader
+	upsampleShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/full_screen_shader.vert");
+	upsampleShader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/bloom_upsample.frag");
+	//compile and link the shader
+	upsampleShader.CreateAndLinkProgram();
+	upsampleShader.Use();
+		//add shader attributes and uniforms
+		upsampleShader.AddAttribute("vVertex");
+		upsampleShader.AddUniform("textureMap");
+		upsampleShader.AddUniform("intensity");
+		//set the values of the constant uniforms at initialization
+		glUniform1i(upsampleShader("textureMap"),0);
+	upsampleShader.UnUse();
+
+	//setup the levels, each half the size of the previous one down to a
+	//single texel, as float textures so the sums do not saturate
+	glGenFramebuffers(1, &fboID);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboID);
+	textures.resize(MAX_LEVELS);
+	sizes.resize(MAX_LEVELS);
+	glGenTextures(MAX_LEVELS, &textures[0]);
+	glActiveTexture(GL_TEXTURE0);
+	glm::ivec2 size(width, height);
+	for(int i=0;i<MAX_LEVELS;i++) {
+		size = glm::max(size/2, glm::ivec2(1));
+		sizes[i] = size;
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		//set texture parameters
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		//allocate OpenGL texture
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size.x, size.y, 0, GL_RGBA, GL_FLOAT, NULL);
+	}
+
+	//check for framebuffer completeness with the first level attached
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[0], 0);
+	GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		cerr<<"Bloom frame buffer object setup error."<<endl;
+		exit(EXIT_FAILURE);
+	}
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void BloomPyramid::Destroy() {
+	if(fboID == 0)
+		return;
+	downsampleShader.DeleteShaderProgram();
+	upsampleShader.DeleteShaderProgram();
+	glDeleteTextures(GLsizei(textures.size()), &textures[0]);
+	glDeleteFramebuffers(1, &fboID);
+	textures.clear();
+	sizes.clear();
+	fboID = 0;
+}
+
+void BloomPyramid::SetLevels(int totalLevels) {
+	levels = min(max(totalLevels, 1), int(MAX_LEVELS));
+}
+
+int BloomPyramid::GetLevels() const {
+	return levels;
+}
+
+void BloomPyramid::Render(GLuint sourceTexture) {
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboID);
+	glActiveTexture(GL_TEXTURE0);
+
+	//downsample the source into the first level and every level into the next
+	downsampleShader.Use();
+	GLuint source = sourceTexture;
+	for(int i=0;i<levels;i++) {
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+		glViewport(0, 0, sizes[i].x, sizes[i].y);
+		glBindTexture(GL_TEXTURE_2D, source);
+		glDrawElements(GL_TRIANGLES,6,GL_UNSIGNED_SHORT,0);
+		source = textures[i];
+	}
+	downsampleShader.UnUse();
+
+	//upsample every level and add it to the next larger one
+	upsampleShader.Use();
+	glUniform1f(upsampleShader("intensity"), 1.0f);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	for(int i=levels-1;i>0;i--) {
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i-1], 0);
+		glViewport(0, 0, sizes[i-1].x, sizes[i-1].y);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		glDrawElements(GL_TRIANGLES,6,GL_UNSIGNED_SHORT,0);
+	}
+	glDisable(GL_BLEND);
+	upsampleShader.UnUse();
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void BloomPyramid::Draw(float intensity) {
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, textures[0]);
+	upsampleShader.Use();
+		glUniform1f(upsampleShader("intensity"), intensity);
+		glDrawElements(GL_TRIANGLES,6,GL_UNSIGNED_SHORT,0);
+	upsampleShader.UnUse();
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "GLSLShader.h"
+
+using namespace std;
+
+//BloomPyramid class blurs an image by downsampling it through a chain of
+//half sized float textures and adding the levels back up, which gives a
+//wide glow for a roughly constant cost: every level is a quarter of the
+//previous one, so all levels together cost about a third of the first.
+//
+//Every downsample reads 13 bilinear taps of the larger level (the filter of
+//Jimenez, "Next Generation Post Processing in Call of Duty: Advanced
+//Warfare"), which keeps small bright spots from flickering. Going back up,
+//each level is upsampled with a 3x3 tent filter and added to the next
+//larger one with additive blending, so the first level ends up holding the
+//sum of all levels. Draw upsamples the first level once more into the bound
+//framebuffer.
+class BloomPyramid
+{
+public:
+	//largest number of levels
+	static const int MAX_LEVELS = 8;
+
+	//constructor/destructor
+	BloomPyramid(void);
+	~BloomPyramid(void);
+
+	//creates the levels for a source of width x height and loads the shaders
+	void Init(int width, int height);
+	void Destroy();
+
+	//number of levels used, the glow reaches about 2^levels source pixels
+	void SetLevels(int levels);
+	int GetLevels() const;
+
+	//downsamples the source texture through the levels and adds them back
+	//up, the quad vertex array has to be bound
+	void Render(GLuint sourceTexture);
+
+	//draws the summed levels scaled by intensity into the bound framebuffer
+	//and viewport with the current blend state
+	void Draw(float intensity);
+
+protected:
+	GLSLShader downsampleShader;
+	GLSLShader upsampleShader;
+
+	GLuint fboID;
+	vector<GLuint> textures;
+	vector<glm::ivec2> sizes;
+	int levels;
+};
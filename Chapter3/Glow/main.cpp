@@ -3,6 +3,7 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <iostream>
+#include <cstdio>
 
 #ifdef __linux__
 #include <GL/glx.h>
@@ -14,6 +15,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "GLSLShader.h"
+#include "BloomPyramid.h"
 
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
@@ -128,13 +130,31 @@ float angle = 0;
 //FBO ID
 GLuint fboID;
 //FBO colour attachment textures
-GLuint texID[2]; //0 -> glow rendered output
-				 //1 -> blurred output
+GLuint texID[2]; //0 -> glow rendered output, blurred output of the box blur
+				 //1 -> horizontal pass of the box blur
 
 //width and height of the FBO colour attachment
 const int RENDER_TARGET_WIDTH = WIDTH>>1;
 const int RENDER_TARGET_HEIGHT = HEIGHT>>1;
 
+//bloom pyramid blurring the glow target, or a separable box blur of the same
+//reach on the glow target for comparison
+BloomPyramid bloom;
+bool bUseBloomPyramid = true;
+
+//box blur radius in texels of the glow target reaching about as far as the
+//bloom levels
+int GetBoxRadius() {
+	return 1<<(bloom.GetLevels()-1);
+}
+
+//queries for the GPU time of the glow stage, the result of the previous
+//frame is read while the current one is timed
+GLuint queryIDs[2];
+int timedFrames = 0;
+double glowMilliseconds = 0;
+const int FRAMES_PER_TIMING = 60;
+
 //mouse move filtering function
 void filterMouseMoves(float dx, float dy) {
     for (int i = MOUSE_HISTORY_BUFFER_SIZE - 1; i > 0; --i) {
@@ -337,12 +357,22 @@ void OnInit() {
 		//add shader attributes and uniforms
 		blurShader.AddAttribute("vVertex");
 		blurShader.AddUniform("textureMap");
+		blurShader.AddUniform("radius");
+		blurShader.AddUniform("direction");
 		//set the values of the constant uniforms at initialization
 		glUniform1i(blurShader("textureMap"),0);
 	blurShader.UnUse();
 
 	GL_CHECK_ERRORS
 
+	//setup the bloom pyramid on the glow target
+	bloom.Init(RENDER_TARGET_WIDTH, RENDER_TARGET_HEIGHT);
+
+	//setup the queries for the glow time
+	glGenQueries(2, queryIDs);
+
+	GL_CHECK_ERRORS
+
 	//set up quad vertex array and vertex buffer object
 	glGenVertexArrays(1, &quadVAOID);
 	glGenBuffers(1, &quadVBOID);
@@ -372,6 +402,8 @@ void OnInit() {
 void OnShutdown() {
 	particleShader.DeleteShaderProgram();
 	blurShader.DeleteShaderProgram();
+	bloom.Destroy();
+	glDeleteQueries(2, queryIDs);
 
 	delete grid;
 	delete cube;
@@ -538,50 +570,122 @@ void OnRender() {
 		particleShader.UnUse();
 	GL_CHECK_ERRORS
 
-	//set the first colour attachment
-	glDrawBuffer(GL_COLOR_ATTACHMENT1);
-	//bind the output of the previous step as texture
-	glBindTexture(GL_TEXTURE_2D, texID[0]);
+	//time the blur and the composite of the glow
+	glBeginQuery(GL_TIME_ELAPSED, queryIDs[timedFrames%2]);
+
+	//bind the fullscreen quad vertex array
+	glBindVertexArray(quadVAOID);
+
+	if(bUseBloomPyramid) {
+		//downsample the glow target through the pyramid and add the levels
+		//back up
+		bloom.Render(texID[0]);
+
+		//restore the default back buffer and viewport
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glDrawBuffer(GL_BACK_LEFT);
+		glViewport(0,0,WIDTH, HEIGHT);
+
+		//add the glow, the sum of the levels is averaged
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+			bloom.Draw(1.0f/bloom.GetLevels());
+		glDisable(GL_BLEND);
+	} else {
 		//use the blur shader
 		blurShader.Use();
-			//bind the fullscreen quad vertex array
-			glBindVertexArray(quadVAOID);
+			//blur with a box of the reach of the pyramid, as a horizontal
+			//pass into the second colour attachment and a vertical pass back
+			//into the first, so the cost grows with the radius and not with
+			//the area of the box
+			glUniform1i(blurShader("radius"), GetBoxRadius());
+			glDrawBuffer(GL_COLOR_ATTACHMENT1);
+			glBindTexture(GL_TEXTURE_2D, texID[0]);
+			glUniform2f(blurShader("direction"), 1, 0);
+				//render fullscreen quad
+				glDrawElements(GL_TRIANGLES,6,GL_UNSIGNED_SHORT,0);
+			glDrawBuffer(GL_COLOR_ATTACHMENT0);
+			glBindTexture(GL_TEXTURE_2D, texID[1]);
+			glUniform2f(blurShader("direction"), 0, 1);
 				//render fullscreen quad
 				glDrawElements(GL_TRIANGLES,6,GL_UNSIGNED_SHORT,0);
 
-	GL_CHECK_ERRORS
+		GL_CHECK_ERRORS
 
-	//unbind the FBO
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	//restore the default back buffer
-	glDrawBuffer(GL_BACK_LEFT);
-	//bind the filtered texture from the final step
-	glBindTexture(GL_TEXTURE_2D, texID[1]);
+		//unbind the FBO
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		//restore the default back buffer
+		glDrawBuffer(GL_BACK_LEFT);
+		//bind the filtered texture from the final step
+		glBindTexture(GL_TEXTURE_2D, texID[0]);
 
-	GL_CHECK_ERRORS
+		GL_CHECK_ERRORS
 
-	//reset the default viewport
-	glViewport(0,0,WIDTH, HEIGHT);
-	GL_CHECK_ERRORS
-	//enable additive blending
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_ONE, GL_ONE);
-		//draw fullscreen quad
-		glDrawElements(GL_TRIANGLES,6,GL_UNSIGNED_SHORT,0);
+		//reset the default viewport
+		glViewport(0,0,WIDTH, HEIGHT);
+		GL_CHECK_ERRORS
+		//enable additive blending
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+			//the composite only upsamples the blurred texture
+			glUniform1i(blurShader("radius"), 0);
+			//draw fullscreen quad
+			glDrawElements(GL_TRIANGLES,6,GL_UNSIGNED_SHORT,0);
+
+		//unbind the blur shader
+		blurShader.UnUse();
+
+		//disable blending
+		glDisable(GL_BLEND);
+	}
 	glBindVertexArray(0);
+	glEndQuery(GL_TIME_ELAPSED);
 
-	//unbind the blur shader
-	blurShader.UnUse();
+	GL_CHECK_ERRORS
 
-	//disable blending
-	glDisable(GL_BLEND);
+	//add the time of the previous frame and show the average in the title
+	if(timedFrames > 0) {
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queryIDs[(timedFrames-1)%2], GL_QUERY_RESULT, &elapsed);
+		glowMilliseconds += elapsed/1e6;
+	}
+	if(++timedFrames%FRAMES_PER_TIMING == 0) {
+		char title[128];
+		if(bUseBloomPyramid)
+			sprintf(title, "Glow - bloom pyramid, %d levels: %.3f ms", bloom.GetLevels(), glowMilliseconds/FRAMES_PER_TIMING);
+		else
+			sprintf(title, "Glow - separable %dx%d box blur: %.3f ms", 2*GetBoxRadius()+1, 2*GetBoxRadius()+1, glowMilliseconds/FRAMES_PER_TIMING);
+		glutSetWindowTitle(title);
+		glowMilliseconds = 0;
+	}
 
-	GL_CHECK_ERRORS
-	
 	//swap front and back buffers to show the rendered result
 	glutSwapBuffers();
 }
 
+//keyboard handler to switch the blur and change the glow reach, the camera
+//keys are polled in OnIdle
+void OnKey(unsigned char key, int x, int y) {
+	switch(key) {
+		case 'b':
+			bUseBloomPyramid = !bUseBloomPyramid;
+		break;
+
+		case '+':
+			bloom.SetLevels(bloom.GetLevels()+1);
+		break;
+
+		case '-':
+			bloom.SetLevels(bloom.GetLevels()-1);
+		break;
+	}
+	cout<<(bUseBloomPyramid ? "Bloom pyramid" : "Separable box blur")<<", "<<bloom.GetLevels()<<" levels, box radius "<<GetBoxRadius()<<endl;
+
+	//restart the timing
+	glowMilliseconds = 0;
+	timedFrames = 0;
+}
+
 int main(int argc, char** argv) {
 	//freeglut initialization calls
 	glutInit(&argc, argv);
@@ -612,6 +716,8 @@ int main(int argc, char** argv) {
 	cout<<"\tVersion: "<<glGetString (GL_VERSION)<<endl;
 	cout<<"\tGLSL: "<<glGetString (GL_SHADING_LANGUAGE_VERSION)<<endl;
 
+	cout<<"Press 'b' to switch between the bloom pyramid and a separable box blur\n";
+	cout<<"Press '+'/'-' to change the bloom levels and the box radius\n";
 	GL_CHECK_ERRORS
 
 	//opengl initialization
@@ -623,6 +729,7 @@ int main(int argc, char** argv) {
 	glutReshapeFunc(OnResize);
 	glutMouseFunc(OnMouseDown);
 	glutMotionFunc(OnMouseMove);
+	glutKeyboardFunc(OnKey);
 	glutIdleFunc(OnIdle);
 
 	//call main loop
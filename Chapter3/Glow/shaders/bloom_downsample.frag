@@ -0,0 +1,36 @@
+#version 330 core
+ 
+layout (location=0) out vec4 vFragColor;	//fragment shader output
+
+//vertex shader input
+smooth in vec2 vUV;			//intepolated 2D texture coordinate
+
+//uniform
+uniform sampler2D textureMap;	//the larger level
+
+void main()
+{
+	//determine the inverse of texture size
+	vec2 delta = 1.0/textureSize(textureMap,0);
+
+	//13 bilinear taps around the output texel: a box of 4 taps at one texel
+	//and 9 taps at two texels. The sample point lies between four texels of
+	//the larger level, so every tap averages 4 texels.
+	vec4 a = texture(textureMap, vUV + vec2(-2, 2)*delta);
+	vec4 b = texture(textureMap, vUV + vec2( 0, 2)*delta);
+	vec4 c = texture(textureMap, vUV + vec2( 2, 2)*delta);
+	vec4 d = texture(textureMap, vUV + vec2(-2, 0)*delta);
+	vec4 e = texture(textureMap, vUV);
+	vec4 f = texture(textureMap, vUV + vec2( 2, 0)*delta);
+	vec4 g = texture(textureMap, vUV + vec2(-2,-2)*delta);
+	vec4 h = texture(textureMap, vUV + vec2( 0,-2)*delta);
+	vec4 i = texture(textureMap, vUV + vec2( 2,-2)*delta);
+	vec4 j = texture(textureMap, vUV + vec2(-1, 1)*delta);
+	vec4 k = texture(textureMap, vUV + vec2( 1, 1)*delta);
+	vec4 l = texture(textureMap, vUV + vec2(-1,-1)*delta);
+	vec4 m = texture(textureMap, vUV + vec2( 1,-1)*delta);
+
+	//the inner box has half of the weight, the four outer boxes which
+	//overlap it share the other half
+	vFragColor = (j+k+l+m)*0.125 + e*0.125 + (b+d+f+h)*0.0625 + (a+c+g+i)*0.03125;
+}
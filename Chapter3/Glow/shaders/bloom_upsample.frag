@@ -0,0 +1,24 @@
+#version 330 core
+ 
+layout (location=0) out vec4 vFragColor;	//fragment shader output
+
+//vertex shader input
+smooth in vec2 vUV;			//intepolated 2D texture coordinate
+
+//uniforms
+uniform sampler2D textureMap;	//the smaller level
+uniform float intensity;		//scale of the output
+
+void main()
+{
+	//determine the inverse of texture size
+	vec2 delta = 1.0/textureSize(textureMap,0);
+
+	//3x3 tent filter of one texel of the smaller level
+	vec4 color = texture(textureMap, vUV)*4.0;
+	color += (texture(textureMap, vUV + vec2(-1, 0)*delta) + texture(textureMap, vUV + vec2(1, 0)*delta) +
+			  texture(textureMap, vUV + vec2( 0,-1)*delta) + texture(textureMap, vUV + vec2(0, 1)*delta))*2.0;
+	color += texture(textureMap, vUV + vec2(-1,-1)*delta) + texture(textureMap, vUV + vec2(1,-1)*delta) +
+			 texture(textureMap, vUV + vec2(-1, 1)*delta) + texture(textureMap, vUV + vec2(1, 1)*delta);
+	vFragColor = color*(intensity/16.0);
+}
@@ -5,24 +5,25 @@ layout (location=0) out vec4 vFragColor;	//fragment shader output
 //vertex shader input
 smooth in vec2 vUV;			//intepolated 2D texture coordinate
 
-//uniform
+//uniforms
 uniform sampler2D textureMap;	//texture map
+uniform int radius;				//radius of the box in texels
+uniform vec2 direction;			//(1,0) for the horizontal, (0,1) for the vertical pass
 
 void main()
 {	
    	vec4 color = vec4(0);
-	//determine the inverse of texture size
-	vec2 delta = 1.0/textureSize(textureMap,0);
+	//determine the step between the samples along the pass direction
+	vec2 delta = direction/textureSize(textureMap,0);
 
-	//loop through the neighborhood
-	for(int j=-3;j<=3;j++) {
-		for(int i=-3;i<=3;i++) {	
-			//sum all samples in the neighborhodd
-			color += texture(textureMap, vUV+ (vec2(i,j)*delta));
-		}
+	//loop through the samples on the line, the box is the product of a
+	//horizontal and a vertical pass
+	for(int i=-radius;i<=radius;i++) {
+		//sum all samples in the neighborhodd
+		color += texture(textureMap, vUV + (float(i)*delta));
 	}
 	//divide by the total number of samples
-	color/=49.0;
+	color/=float(2*radius+1);
 	//return the average color
     vFragColor =  color;
-}
\ No newline at end of file
+}
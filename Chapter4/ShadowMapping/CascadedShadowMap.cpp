@@ -0,0 +1,395 @@
+#include "CascadedShadowMap.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+//largest tangent of the half angle a point light cascade may cover
+const float MAX_TANGENT = 3.7f;
+
+//closest light near plane distance of a point light cascade
+const float MIN_NEAR = 0.1f;
+
+CascadedShadowMap::CascadedShadowMap(void)
+{
+	textureID = 0;
+	fboID = 0;
+	staticTextureID = 0;
+	staticFboID = 0;
+	size = 0;
+	cascades = MAX_CASCADES;
+	lambda = 0.75f;
+	shadowDistance = 60.0f;
+	minBounds = glm::vec3(-1);
+	maxBounds = glm::vec3(1);
+	light = glm::vec3(0,1,0);
+	bDirectional = true;
+	bCaching = true;
+	for(int i=0;i<MAX_CASCADES;i++) {
+		splits[i] = 0;
+		bStaticValid[i] = false;
+		bStaticChanged[i] = false;
+		bHadDynamic[i] = false;
+	}
+}
+
+CascadedShadowMap::~CascadedShadowMap(void)
+{
+	Destroy();
+}
+
+void CascadedShadowMap::Init(int mapSize, int totalCascades) {
+	size = mapSize;
+	SetCascades(totalCascades);
+
+	//setup the depth texture array with one layer per cascade, with linear
+	//filtering the depth comparison of the four closest texels is averaged
+	glGenTextures(1, &textureID);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+
+	//set texture parameters, outside the map nothing is in shadow
+	GLfloat border[4]={1,0,0,0};
+	glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_COMPARE_MODE,GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_COMPARE_FUNC,GL_LEQUAL);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_BORDER_COLOR,border);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY,0,GL_DEPTH_COMPONENT24,size,size,MAX_CASCADES,0,GL_DEPTH_COMPONENT,GL_UNSIGNED_BYTE,NULL);
+
+	//set up FBO with only a depth attachment
+	glGenFramebuffers(1,&fboID);
+	glBindFramebuffer(GL_FRAMEBUFFER,fboID);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,textureID,0,0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	//check framebuffer completeness status
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		cerr<<"Cascaded shadow map frame buffer object setup error."<<endl;
+		exit(EXIT_FAILURE);
+	}
+
+	//setup the texture array of the static layers, it is only copied from
+	//so it needs no filtering or comparison
+	glGenTextures(1, &staticTextureID);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, staticTextureID);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY,0,GL_DEPTH_COMPONENT24,size,size,MAX_CASCADES,0,GL_DEPTH_COMPONENT,GL_UNSIGNED_BYTE,NULL);
+
+	//set up the FBO of the static layers
+	glGenFramebuffers(1,&staticFboID);
+	glBindFramebuffer(GL_FRAMEBUFFER,staticFboID);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,staticTextureID,0,0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		cerr<<"Static shadow map frame buffer object setup error."<<endl;
+		exit(EXIT_FAILURE);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER,0);
+	InvalidateStatic();
+}
+
+void CascadedShadowMap::Destroy() {
+	if(fboID == 0)
+		return;
+	glDeleteTextures(1, &textureID);
+	glDeleteTextures(1, &staticTextureID);
+	glDeleteFramebuffers(1, &fboID);
+	glDeleteFramebuffers(1, &staticFboID);
+	textureID = 0;
+	staticTextureID = 0;
+	fboID = 0;
+	staticFboID = 0;
+}
+
+void CascadedShadowMap::SetCascades(int totalCascades) {
+	cascades = min(max(totalCascades, 1), int(MAX_CASCADES));
+}
+
+int CascadedShadowMap::GetCascades() const {
+	return cascades;
+}
+
+void CascadedShadowMap::SetSplitLambda(float splitLambda) {
+	lambda = glm::clamp(splitLambda, 0.0f, 1.0f);
+}
+
+void CascadedShadowMap::SetShadowDistance(float distance) {
+	shadowDistance = distance;
+}
+
+void CascadedShadowMap::SetSceneBounds(const glm::vec3& minB, const glm::vec3& maxB) {
+	minBounds = minB;
+	maxBounds = maxB;
+}
+
+void CascadedShadowMap::SetDirectionalLight(const glm::vec3& direction) {
+	light = glm::normalize(direction);
+	bDirectional = true;
+}
+
+void CascadedShadowMap::SetPointLight(const glm::vec3& position) {
+	light = position;
+	bDirectional = false;
+}
+
+bool CascadedShadowMap::IsDirectional() const {
+	return bDirectional;
+}
+
+void CascadedShadowMap::Update(const glm::mat4& View, float fovy, float aspect, float zNear, float zFar) {
+	//the practical split between the near plane and the shadow distance
+	float n = zNear;
+	float f = min(zFar, shadowDistance);
+	for(int i=0;i<cascades;i++) {
+		float p = float(i+1)/cascades;
+		float logSplit = n*pow(f/n, p);
+		float uniformSplit = n + (f-n)*p;
+		splits[i] = lambda*logSplit + (1-lambda)*uniformSplit;
+	}
+
+	glm::mat4 invView = glm::inverse(View);
+	float tanY = tan(fovy*0.5f);
+	float tanX = tanY*aspect;
+	glm::mat4 B = glm::scale(glm::translate(glm::mat4(1),glm::vec3(0.5,0.5,0.5)), glm::vec3(0.5,0.5,0.5));
+
+	for(int i=0;i<cascades;i++) {
+		float sn = (i==0)? n : splits[i-1];
+		float sf = splits[i];
+
+		if(bDirectional) {
+			//the smallest sphere around the slice has its centre on the view
+			//axis, at equal distance to the near and far corners unless that
+			//is behind the far plane. It only depends on the slice, so it
+			//stays the same when the camera turns.
+			float k2 = tanX*tanX + tanY*tanY;
+			float t = 0.5f*(sn+sf)*(1+k2);
+			float r2;
+			if(t > sf) {
+				t = sf;
+				r2 = sf*sf*k2;
+			} else {
+				r2 = sf*sf*k2 + (sf-t)*(sf-t);
+			}
+			//round the radius up to hide the float rounding of the split
+			float r = ceil(sqrt(r2)*16.0f)/16.0f;
+			glm::vec3 center = glm::vec3(invView*glm::vec4(0,0,-t,1));
+			FitDirectional(i, center, r);
+		} else {
+			//the world space box around the slice clipped to the scene
+			//bounds, only there can be receivers
+			glm::vec3 minSlice(FLT_MAX), maxSlice(-FLT_MAX);
+			for(int j=0;j<8;j++) {
+				float d = (j&4)? sf : sn;
+				glm::vec4 p(((j&1)? tanX : -tanX)*d, ((j&2)? tanY : -tanY)*d, -d, 1);
+				glm::vec3 corner = glm::vec3(invView*p);
+				minSlice = glm::min(minSlice, corner);
+				maxSlice = glm::max(maxSlice, corner);
+			}
+			minSlice = glm::clamp(minSlice, minBounds, maxBounds);
+			maxSlice = glm::clamp(maxSlice, minBounds, maxBounds);
+			FitPoint(i, minSlice, maxSlice);
+		}
+		shadowMatrices[i] = B*projections[i]*views[i];
+
+		//the planes of the frustum from the rows of the light matrix
+		//(Gribb and Hartmann), normalized for sphere distances
+		glm::mat4 PV = projections[i]*views[i];
+		glm::vec4 row[4];
+		for(int r=0;r<4;r++)
+			row[r] = glm::vec4(PV[0][r], PV[1][r], PV[2][r], PV[3][r]);
+		for(int j=0;j<6;j++) {
+			glm::vec4 plane = (j&1)? row[3]-row[j/2] : row[3]+row[j/2];
+			planes[i][j] = plane/glm::length(glm::vec3(plane));
+		}
+	}
+}
+
+glm::mat4 CascadedShadowMap::GetLightView(const glm::vec3& eye, const glm::vec3& target) const {
+	glm::vec3 dir = glm::normalize(target-eye);
+	glm::vec3 up = (fabs(dir.y) > 0.99f)? glm::vec3(0,0,1) : glm::vec3(0,1,0);
+	return glm::lookAt(eye, target, up);
+}
+
+void CascadedShadowMap::FitDirectional(int cascade, const glm::vec3& center, float radius) {
+	//all cascades share the rotation of the light, so its texel grid only
+	//depends on the size of the cascade
+	views[cascade] = GetLightView(glm::vec3(0), -light);
+
+	//widen the window by a texel on each side so snapping the centre down
+	//to the texel grid still covers the whole sphere
+	float halfSize = radius*size/(size-2);
+	float texel = 2*halfSize/size;
+	glm::vec3 c = glm::vec3(views[cascade]*glm::vec4(center,1));
+	c.x = floor(c.x/texel)*texel;
+	c.y = floor(c.y/texel)*texel;
+
+	//the light looks down -z, the depth range starts at the scene bound
+	//closest to the light so casters outside the sphere are included
+	float zMax = c.z + radius;
+	for(int j=0;j<8;j++) {
+		glm::vec3 p((j&1)? maxBounds.x : minBounds.x, (j&2)? maxBounds.y : minBounds.y, (j&4)? maxBounds.z : minBounds.z);
+		zMax = max(zMax, (views[cascade]*glm::vec4(p,1)).z);
+	}
+	projections[cascade] = glm::ortho(c.x-halfSize, c.x+halfSize, c.y-halfSize, c.y+halfSize, -zMax, -(c.z-radius));
+}
+
+void CascadedShadowMap::FitPoint(int cascade, const glm::vec3& minSlice, const glm::vec3& maxSlice) {
+	//the light looks at the centre of the slice box snapped to a grid of an
+	//eighth of the box size rounded to a power of two, so the view only
+	//turns in steps while the camera moves
+	glm::vec3 target = (minSlice+maxSlice)*0.5f;
+	float step = exp2(floor(log2(max(glm::length(maxSlice-minSlice), MIN_NEAR)/8.0f)));
+	target = glm::floor(target/step + 0.5f)*step;
+	if(glm::length(target-light) < MIN_NEAR)
+		target = (minBounds+maxBounds)*0.5f;
+	glm::mat4 V = GetLightView(light, target);
+	views[cascade] = V;
+
+	//the window on the plane at distance one from the light, corners behind
+	//the light open it to the largest window
+	glm::vec2 minW(MAX_TANGENT), maxW(-MAX_TANGENT);
+	float zFar = MIN_NEAR;
+	for(int j=0;j<8;j++) {
+		glm::vec3 corner((j&1)? maxSlice.x : minSlice.x, (j&2)? maxSlice.y : minSlice.y, (j&4)? maxSlice.z : minSlice.z);
+		glm::vec3 p = glm::vec3(V*glm::vec4(corner,1));
+		if(-p.z < MIN_NEAR) {
+			minW = glm::vec2(-MAX_TANGENT);
+			maxW = glm::vec2(MAX_TANGENT);
+			zFar = FLT_MAX;
+			continue;
+		}
+		glm::vec2 w = glm::vec2(p.x, p.y)/(-p.z);
+		minW = glm::min(minW, w);
+		maxW = glm::max(maxW, w);
+		zFar = max(zFar, -p.z);
+	}
+	minW = glm::max(minW, glm::vec2(-MAX_TANGENT));
+	maxW = glm::min(maxW, glm::vec2(MAX_TANGENT));
+
+	//the depth range covers the scene but not more than the slice
+	float zNear = FLT_MAX, zSceneFar = MIN_NEAR;
+	for(int j=0;j<8;j++) {
+		glm::vec3 p((j&1)? maxBounds.x : minBounds.x, (j&2)? maxBounds.y : minBounds.y, (j&4)? maxBounds.z : minBounds.z);
+		float z = -(V*glm::vec4(p,1)).z;
+		zNear = min(zNear, z);
+		zSceneFar = max(zSceneFar, z);
+	}
+	zNear = max(zNear, MIN_NEAR);
+	zFar = max(min(zFar, zSceneFar), zNear+MIN_NEAR);
+
+	//round the window size up to a quarter octave and snap its corner to
+	//the texel grid, with a texel of margin for the snapping
+	glm::vec2 extent = maxW-minW;
+	float windowSize = max(extent.x, extent.y)*size/(size-2);
+	windowSize = min(exp2(ceil(log2(windowSize)*4.0f)/4.0f), 2*MAX_TANGENT);
+	float texel = windowSize/size;
+	glm::vec2 center = (minW+maxW)*0.5f;
+	float l = floor((center.x - windowSize*0.5f)/texel)*texel;
+	float b = floor((center.y - windowSize*0.5f)/texel)*texel;
+	projections[cascade] = glm::frustum(l*zNear, (l+windowSize)*zNear, b*zNear, (b+windowSize)*zNear, zNear, zFar);
+}
+
+const glm::mat4& CascadedShadowMap::GetView(int cascade) const {
+	return views[cascade];
+}
+
+const glm::mat4& CascadedShadowMap::GetProjection(int cascade) const {
+	return projections[cascade];
+}
+
+const glm::mat4* CascadedShadowMap::GetShadowMatrices() const {
+	return shadowMatrices;
+}
+
+glm::vec4 CascadedShadowMap::GetSplits() const {
+	//unused cascades end at the last split
+	glm::vec4 s;
+	for(int i=0;i<MAX_CASCADES;i++)
+		s[i] = splits[min(i, cascades-1)];
+	return s;
+}
+
+bool CascadedShadowMap::IsVisible(int cascade, const glm::vec3& center, float radius) const {
+	for(int j=0;j<6;j++) {
+		if(glm::dot(glm::vec3(planes[cascade][j]), center) + planes[cascade][j].w < -radius)
+			return false;
+	}
+	return true;
+}
+
+void CascadedShadowMap::SetCaching(bool bCache) {
+	bCaching = bCache;
+	InvalidateStatic();
+}
+
+bool CascadedShadowMap::IsCaching() const {
+	return bCaching;
+}
+
+void CascadedShadowMap::InvalidateStatic() {
+	for(int i=0;i<MAX_CASCADES;i++)
+		bStaticValid[i] = false;
+}
+
+bool CascadedShadowMap::BeginStatic(int cascade) {
+	//without caching all casters go straight into the shadow map
+	if(!bCaching) {
+		glBindFramebuffer(GL_FRAMEBUFFER,fboID);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,textureID,0,cascade);
+		glViewport(0,0,size,size);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		return true;
+	}
+
+	//keep the cached layer while the light matrix stays the same
+	bStaticChanged[cascade] = !bStaticValid[cascade] || staticMatrices[cascade] != shadowMatrices[cascade];
+	if(!bStaticChanged[cascade])
+		return false;
+	staticMatrices[cascade] = shadowMatrices[cascade];
+	bStaticValid[cascade] = true;
+
+	glBindFramebuffer(GL_FRAMEBUFFER,staticFboID);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,staticTextureID,0,cascade);
+	glViewport(0,0,size,size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	return true;
+}
+
+bool CascadedShadowMap::BeginDynamic(int cascade, bool bHasDynamic) {
+	//without caching the static casters are already in the bound layer
+	if(!bCaching)
+		return bHasDynamic;
+
+	//the shadow map still holds the static layer if it did not change and
+	//no dynamic casters were added last frame
+	bool bCopy = bStaticChanged[cascade] || bHasDynamic || bHadDynamic[cascade];
+	bHadDynamic[cascade] = bHasDynamic;
+	if(!bCopy)
+		return false;
+
+	//copy the static layer into the shadow map layer
+	glBindFramebuffer(GL_READ_FRAMEBUFFER,staticFboID);
+	glFramebufferTextureLayer(GL_READ_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,staticTextureID,0,cascade);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER,fboID);
+	glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,textureID,0,cascade);
+	glBlitFramebuffer(0,0,size,size,0,0,size,size,GL_DEPTH_BUFFER_BIT,GL_NEAREST);
+	glViewport(0,0,size,size);
+	return bHasDynamic;
+}
+
+void CascadedShadowMap::End() {
+	glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
+
+void CascadedShadowMap::Bind() const {
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+//CascadedShadowMap class splits the view frustum of the camera into slices
+//along the view direction and gives each slice its own shadow map, a layer
+//of a depth texture array. Slices close to the camera are short, so their
+//shadow map texels are small on screen, far slices are long but also far
+//away. A large scene thus gets sharp shadows near the camera with a few
+//small maps instead of one huge map.
+//
+//The slices are placed with the practical split scheme (Zhang et al.,
+//"Parallel-Split Shadow Maps"): the split distances blend the logarithmic
+//split, which gives every slice the same texel size on screen, and the
+//uniform split by lambda.
+//
+//For a directional light every slice gets an orthographic projection fitted
+//to the bounding sphere of its frustum corners. The sphere does not change
+//when the camera turns and its centre is snapped to the texel grid of the
+//light, so the shadow edges do not shimmer while the camera moves. The depth
+//range reaches back to the scene bounds so casters outside the slice still
+//cast into it.
+//
+//For a point light every slice gets a perspective projection from the light
+//position, aimed at the box around the slice clipped to the scene bounds and
+//fitted to its corners. The aim point is snapped to a world grid and the
+//window size is rounded up in steps of a quarter octave before its corner
+//is snapped to the texel grid, which keeps the shadows still unless the aim
+//point or the size crosses a step.
+//
+//Casters are culled against the frustum of each cascade. With caching on,
+//the static casters of a cascade are rendered into a layer of a second
+//texture array which is kept as long as the light matrices of the cascade
+//stay the same, that is while neither the light nor the camera moves far
+//enough to change the snapped fit. Every frame the cached layer is copied
+//into the shadow map and the dynamic casters are rendered on top, and when
+//neither the static layer nor the dynamic casters changed even the copy is
+//skipped.
+class CascadedShadowMap
+{
+public:
+	//largest number of cascades
+	static const int MAX_CASCADES = 4;
+
+	//constructor/destructor
+	CascadedShadowMap(void);
+	~CascadedShadowMap(void);
+
+	//creates the depth texture array with size x size texel layers
+	void Init(int size, int cascades);
+	void Destroy();
+
+	//number of cascades used
+	void SetCascades(int cascades);
+	int GetCascades() const;
+
+	//blend between the uniform (0) and the logarithmic (1) split
+	void SetSplitLambda(float lambda);
+
+	//receivers further from the camera than this are not shadowed
+	void SetShadowDistance(float distance);
+
+	//bounds of all shadow casters and receivers in world space
+	void SetSceneBounds(const glm::vec3& minBounds, const glm::vec3& maxBounds);
+
+	//light given by the direction towards it or by its position
+	void SetDirectionalLight(const glm::vec3& direction);
+	void SetPointLight(const glm::vec3& position);
+	bool IsDirectional() const;
+
+	//computes the splits and the light matrices of all cascades for the
+	//camera with the given view matrix and perspective projection parameters
+	void Update(const glm::mat4& View, float fovy, float aspect, float zNear, float zFar);
+
+	//light view and projection matrix of a cascade
+	const glm::mat4& GetView(int cascade) const;
+	const glm::mat4& GetProjection(int cascade) const;
+
+	//maps world space positions to shadow map coordinates of a cascade
+	const glm::mat4* GetShadowMatrices() const;
+
+	//view depths where the cascades end
+	glm::vec4 GetSplits() const;
+
+	//true if a sphere around a caster is inside the frustum of the cascade
+	bool IsVisible(int cascade, const glm::vec3& center, float radius) const;
+
+	//keep the static casters of every cascade in a separate layer
+	void SetCaching(bool bCaching);
+	bool IsCaching() const;
+
+	//drops the cached layers, has to be called when static casters change
+	void InvalidateStatic();
+
+	//for every cascade BeginStatic and then BeginDynamic have to be called,
+	//each binds and sets up the framebuffer object for the casters and
+	//returns false if they need not be rendered. BeginDynamic gets whether
+	//there are dynamic casters in the cascade. End restores the default
+	//framebuffer.
+	bool BeginStatic(int cascade);
+	bool BeginDynamic(int cascade, bool bHasDynamic);
+	void End();
+
+	//binds the depth texture array to the active texture unit
+	void Bind() const;
+
+protected:
+	//fit the projection of a cascade to the bounding sphere or the world
+	//space box of its slice
+	void FitDirectional(int cascade, const glm::vec3& center, float radius);
+	void FitPoint(int cascade, const glm::vec3& minSlice, const glm::vec3& maxSlice);
+
+	//light view with the up vector picked to be away from the view direction
+	glm::mat4 GetLightView(const glm::vec3& eye, const glm::vec3& target) const;
+
+	GLuint textureID;
+	GLuint fboID;
+	GLuint staticTextureID;
+	GLuint staticFboID;
+	int size;
+	int cascades;
+	float lambda;
+	float shadowDistance;
+
+	glm::vec3 minBounds, maxBounds;
+	glm::vec3 light;
+	bool bDirectional;
+
+	float splits[MAX_CASCADES];
+	glm::mat4 views[MAX_CASCADES];
+	glm::mat4 projections[MAX_CASCADES];
+	glm::mat4 shadowMatrices[MAX_CASCADES];
+
+	//frustum planes of the cascades for culling
+	glm::vec4 planes[MAX_CASCADES][6];
+
+	//state of the cached static layers
+	bool bCaching;
+	bool bStaticValid[MAX_CASCADES];
+	bool bStaticChanged[MAX_CASCADES];
+	bool bHadDynamic[MAX_CASCADES];
+	glm::mat4 staticMatrices[MAX_CASCADES];
+};
@@ -5,6 +5,7 @@
 
 #include <GL/freeglut.h>
 #include <iostream>
+#include <cstdio>
 #include <algorithm>
 
 #include <glm/glm.hpp>
@@ -13,6 +14,7 @@
 #include <glm/gtc/matrix_inverse.hpp>
 
 #include "GLSLShader.h"
+#include "CascadedShadowMap.h"
 
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
@@ -39,8 +41,14 @@ const int HEIGHT = 768;
 const int SHADOWMAP_WIDTH = 512;
 const int SHADOWMAP_HEIGHT = 512;
 
-//shadowmapping and flat shader
-GLSLShader shader, flatshader;
+//number of cascades, each has a map of SHADOWMAP_WIDTH x SHADOWMAP_WIDTH
+const int CASCADES = 4;
+
+//spacing of the grid of extra casters on the plane
+const float GRID_SPACING = 10;
+
+//shadowmapping, cascaded shadowmapping and flat shader
+GLSLShader shader, csmShader, flatshader;
 
 //vertex struct with position and normal
 struct Vertex {
@@ -70,6 +78,12 @@ GLuint lightVerticesVBO;
 glm::mat4  P = glm::mat4(1);
 glm::mat4  MV = glm::mat4(1);
 
+//camera projection parameters
+const float FOVY = glm::radians(45.0f);
+const float Z_NEAR = 0.1f;
+const float Z_FAR = 1000.f;
+float aspect = float(WIDTH)/HEIGHT;
+
 //camera transformation variables
 int state = 0, oldX=0, oldY=0;
 float rX=25, rY=-40, dist = -10;
@@ -100,6 +114,44 @@ glm::mat4 B;    //light bias matrix
 glm::mat4 BP;   //light bias and projection matrix combined
 glm::mat4 S;    //light's combined MVPB matrix
 
+//cascaded shadow map
+CascadedShadowMap csm;
+
+//render with the cascades or the single shadow map
+bool bUseCascades = true;
+
+//treat the light as a directional light shining from lightPosOS towards the
+//origin, only used with the cascades
+bool bDirectionalLight = false;
+
+//tint the fragments with the colour of their cascade
+bool bShowCascades = false;
+
+//animate the dynamic sphere
+bool bAnimate = true;
+
+//an object of the scene with its mesh, transform and colour, the radius of
+//its bounding sphere around the origin of the transform and whether it moves
+struct SceneObject {
+	GLuint vao;
+	GLsizei totalIndices;
+	glm::mat4 M;
+	glm::vec3 color;
+	float radius;
+	bool bStatic;
+};
+std::vector<SceneObject> objects;
+
+//index of the sphere circling the cube, the only dynamic object
+size_t dynamicSphereIndex = 0;
+
+//queries for the GPU time of the shadow pass, the result of the previous
+//frame is read while the current one is timed
+GLuint queryIDs[2];
+int timedFrames = 0;
+double shadowMilliseconds = 0;
+const int FRAMES_PER_TIMING = 60;
+
 //adds the given sphere indices to the indices vector
 inline void push_indices(int sectors, int r, int s, std::vector<GLushort>& indices) {
     int curRow = r * sectors;
@@ -262,6 +314,27 @@ void OnMouseMove(int x, int y)
 	glutPostRedisplay();
 }
 
+//keyboard handler to switch between the cascades and the single shadow map,
+//the light type, the caching of static casters and the animation
+void OnKey(unsigned char key, int x, int y) {
+	switch(key) {
+		case 'c': bUseCascades = !bUseCascades; break;
+		case 'l': bDirectionalLight = !bDirectionalLight; break;
+		case 'v': bShowCascades = !bShowCascades; break;
+		case 's': csm.SetCaching(!csm.IsCaching()); break;
+		case 'a': bAnimate = !bAnimate; break;
+		case '+': csm.SetCascades(csm.GetCascades()+1); break;
+		case '-': csm.SetCascades(csm.GetCascades()-1); break;
+	}
+	if(bUseCascades)
+		cout<<csm.GetCascades()<<" cascades, "<<(bDirectionalLight? "directional" : "point")<<" light"<<(csm.IsCaching()? ", cached static casters" : "")<<endl;
+	else
+		cout<<"Single shadow map, point light"<<endl;
+
+	//call display function
+	glutPostRedisplay();
+}
+
 //OpenGL initialization
 void OnInit() {
 
@@ -298,6 +371,32 @@ void OnInit() {
 		glUniform1i(shader("shadowMap"),0);
 	shader.UnUse();
 
+	//load the cascaded shadow mapping shader
+	csmShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/CascadedShadowMapped.vert");
+	csmShader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/CascadedShadowMapped.frag");
+	//compile and link shader
+	csmShader.CreateAndLinkProgram();
+	csmShader.Use();
+		//add attributes and uniforms
+		csmShader.AddAttribute("vVertex");
+		csmShader.AddAttribute("vNormal");
+		csmShader.AddUniform("MVP");
+		csmShader.AddUniform("MV");
+		csmShader.AddUniform("M");
+		csmShader.AddUniform("N");
+		csmShader.AddUniform("cascadeMatrices");
+		csmShader.AddUniform("cascadeSplits");
+		csmShader.AddUniform("totalCascades");
+		csmShader.AddUniform("light_position");
+		csmShader.AddUniform("bDirectional");
+		csmShader.AddUniform("bShowCascades");
+		csmShader.AddUniform("diffuse_color");
+		csmShader.AddUniform("bIsLightPass");
+		csmShader.AddUniform("shadowMap");
+		//pass value of constant uniforms at initialization
+		glUniform1i(csmShader("shadowMap"),0);
+	csmShader.UnUse();
+
 	GL_CHECK_ERRORS
 
 	//setup sphere geometry
@@ -416,11 +515,39 @@ void OnInit() {
 
 	GL_CHECK_ERRORS
 
+	//setup the scene objects, the plane, the cube and the sphere with a grid
+	//of cubes and spheres spread over the plane so there are shadows far
+	//from the camera
+	SceneObject plane = { planeVAOID, 6, glm::mat4(1), glm::vec3(1,1,1), 50*sqrtf(2), true };
+	SceneObject cube = { cubeVAOID, 36, glm::translate(glm::mat4(1), glm::vec3(-1,1,0)), glm::vec3(1,0,0), sqrtf(3), true };
+	SceneObject sphere = { sphereVAOID, totalSphereTriangles, glm::translate(glm::mat4(1), glm::vec3(1,1,0)), glm::vec3(0,0,1), 1, true };
+	objects.push_back(plane);
+	objects.push_back(cube);
+	dynamicSphereIndex = objects.size();
+	objects.push_back(sphere);
+	objects.back().bStatic = false;
+	for(int z=-4;z<=4;z++) {
+		for(int x=-4;x<=4;x++) {
+			if(x==0 && z==0)
+				continue;
+			SceneObject object = ((x+z)&1)? cube : sphere;
+			object.M = glm::translate(glm::mat4(1), glm::vec3(x*GRID_SPACING, 1, z*GRID_SPACING));
+			objects.push_back(object);
+		}
+	}
+
 	//get light position from spherical coordinates
 	lightPosOS.x = radius * cos(theta)*sin(phi);
 	lightPosOS.y = radius * cos(phi);
 	lightPosOS.z = radius * sin(theta)*sin(phi);
 
+	//setup the cascaded shadow map with the bounds of the scene
+	csm.Init(SHADOWMAP_WIDTH, CASCADES);
+	csm.SetSceneBounds(glm::vec3(-50,0,-50), glm::vec3(50,2,50));
+
+	//setup the queries for the shadow pass time
+	glGenQueries(2, queryIDs);
+
 	//setup the shadowmap texture
 	glGenTextures(1, &shadowMapTexID);
 	glActiveTexture(GL_TEXTURE0);
@@ -471,9 +598,12 @@ void OnInit() {
 void OnShutdown() {
 
 	glDeleteTextures(1, &shadowMapTexID);
+	csm.Destroy();
+	glDeleteQueries(2, queryIDs);
 
 	//Destroy shader
 	shader.DeleteShaderProgram();
+	csmShader.DeleteShaderProgram();
 	flatshader.DeleteShaderProgram();
 
 	//Destroy vao and vbo
@@ -502,7 +632,8 @@ void OnResize(int w, int h) {
 	//set the viewport
 	glViewport (0, 0, (GLsizei) w, (GLsizei) h);
 	//setup the projection matrix
-	P = glm::perspective(glm::radians(45.0f), (GLfloat)w/h, 0.1f, 1000.f);
+	aspect = (GLfloat)w/h;
+	P = glm::perspective(FOVY, aspect, Z_NEAR, Z_FAR);
 }
 
 //idle callback just calls the display function
@@ -510,69 +641,63 @@ void OnIdle() {
 	glutPostRedisplay();
 }
 
-//scene rendering function
-void DrawScene(const glm::mat4& View, const glm::mat4& Proj, int isLightPass = 1) {
+//sets the uniforms of an object and draws it with the bound program
+void DrawObject(GLSLShader& program, const SceneObject& object, const glm::mat4& View, const glm::mat4& Proj) {
+	glBindVertexArray(object.vao);
+	glm::mat4 MV = View*object.M;
+	glm::mat4 MVP = Proj*MV;
+	//set the shader uniforms
+	glUniformMatrix4fv(program("M"), 1, GL_FALSE, glm::value_ptr(object.M));
+	glUniformMatrix4fv(program("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
+	glUniformMatrix4fv(program("MV"), 1, GL_FALSE, glm::value_ptr(MV));
+	glUniformMatrix3fv(program("N"), 1, GL_FALSE, glm::value_ptr(glm::inverseTranspose(glm::mat3(MV))));
+	glUniform3fv(program("diffuse_color"), 1, &(object.color.x));
+		//draw triangles
+		glDrawElements(GL_TRIANGLES, object.totalIndices, GL_UNSIGNED_SHORT, 0);
+}
+
+//scene rendering function, the light uniforms of the program have to be set
+void DrawScene(GLSLShader& program, const glm::mat4& View, const glm::mat4& Proj, int isLightPass = 1) {
 
 	GL_CHECK_ERRORS
 
 	//bind the current shader
-	shader.Use();
-	//render plane first
-	glBindVertexArray(planeVAOID); {
-		//set the shader uniforms
-		glUniform3fv(shader("light_position"),1, &(lightPosOS.x));
-		glUniformMatrix4fv(shader("S"), 1, GL_FALSE, glm::value_ptr(S));
-		glUniformMatrix4fv(shader("M"), 1, GL_FALSE, glm::value_ptr(glm::mat4(1)));
-		glUniform1i(shader("bIsLightPass"), isLightPass);		
-		glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, glm::value_ptr(Proj*View));
-		glUniformMatrix4fv(shader("MV"), 1, GL_FALSE, glm::value_ptr(View));
-		glUniformMatrix3fv(shader("N"), 1, GL_FALSE, glm::value_ptr(glm::inverseTranspose(glm::mat3(View))));
-		glUniform3f(shader("diffuse_color"), 1.0f,1.0f,1.0f);
-			//draw plane triangles
-			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-	}
+	program.Use();
+	glUniform1i(program("bIsLightPass"), isLightPass);
 
-	//render the cube 
-	glBindVertexArray(cubeVAOID); {
-		//set the cube's transform
-		glm::mat4 T = glm::translate(glm::mat4(1),  glm::vec3(-1,1,0));
-		glm::mat4 M = T;
-		glm::mat4 MV = View*M;
-		glm::mat4 MVP = Proj*MV;
-		//pass shader uniforms
-		glUniformMatrix4fv(shader("S"), 1, GL_FALSE, glm::value_ptr(S));
-		glUniformMatrix4fv(shader("M"), 1, GL_FALSE, glm::value_ptr(M));
-		glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
-		glUniformMatrix4fv(shader("MV"), 1, GL_FALSE, glm::value_ptr(MV));
-		glUniformMatrix3fv(shader("N"), 1, GL_FALSE, glm::value_ptr(glm::inverseTranspose(glm::mat3(MV))));
-		glUniform3f(shader("diffuse_color"), 1.0f,0.0f,0.0f);
-			//draw cube triangles
-	 		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, 0);
-	}
-	//render the sphere
-	glBindVertexArray(sphereVAOID); {
-		//set the sphere's transform
-		glm::mat4 T = glm::translate(glm::mat4(1), glm::vec3(1,1,0));
-		glm::mat4 M = T;
-		glm::mat4 MV = View*M;
-		glm::mat4 MVP = Proj*MV;
-		//set the shader uniforms
-		glUniformMatrix4fv(shader("S"), 1, GL_FALSE, glm::value_ptr(S));
-		glUniformMatrix4fv(shader("M"), 1, GL_FALSE, glm::value_ptr(M));
-		glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
-		glUniformMatrix4fv(shader("MV"), 1, GL_FALSE, glm::value_ptr(MV));
-		glUniformMatrix3fv(shader("N"), 1, GL_FALSE, glm::value_ptr(glm::inverseTranspose(glm::mat3(MV))));
-		glUniform3f(shader("diffuse_color"), 0.0f, 0.0f, 1.0f);
-			//draw sphere triangles
-	 		glDrawElements(GL_TRIANGLES, totalSphereTriangles, GL_UNSIGNED_SHORT, 0);
-	}
+	//render all objects
+	for(size_t i=0;i<objects.size();i++)
+		DrawObject(program, objects[i], View, Proj);
 
 	//unbind shader
-	shader.UnUse();
+	program.UnUse();
 
 	GL_CHECK_ERRORS 
 }
 
+//collects the static or dynamic objects inside the frustum of a cascade
+void CullCasters(int cascade, bool bStatic, vector<size_t>& casters) {
+	casters.clear();
+	for(size_t i=0;i<objects.size();i++) {
+		if(objects[i].bStatic == bStatic && csm.IsVisible(cascade, glm::vec3(objects[i].M[3]), objects[i].radius))
+			casters.push_back(i);
+	}
+}
+
+//renders the given objects into a cascade
+void DrawCasters(const vector<size_t>& casters, int cascade) {
+
+	GL_CHECK_ERRORS
+
+	csmShader.Use();
+	glUniform1i(csmShader("bIsLightPass"), 1);
+	for(size_t i=0;i<casters.size();i++)
+		DrawObject(csmShader, objects[casters[i]], csm.GetView(cascade), csm.GetProjection(cascade));
+	csmShader.UnUse();
+
+	GL_CHECK_ERRORS
+}
+
 //display callback function
 void OnRender() {
 
@@ -585,30 +710,97 @@ void OnRender() {
 	glm::mat4 T		= glm::translate(glm::mat4(1.0f),glm::vec3(0.0f, 0.0f, dist));
 	glm::mat4 Rx	= glm::rotate(T,  rX, glm::vec3(1.0f, 0.0f, 0.0f));
 	glm::mat4 MV    = glm::rotate(Rx, rY, glm::vec3(0.0f, 1.0f, 0.0f));
-	 
-	//1) Render scene from the light's POV
-	//enable rendering to FBO
- 	glBindFramebuffer(GL_FRAMEBUFFER,fboID);
-	//clear depth buffer
-	glClear(GL_DEPTH_BUFFER_BIT);
-	//reset viewport to the shadow map texture size
-	glViewport(0,0,SHADOWMAP_WIDTH, SHADOWMAP_HEIGHT);
-	
-	//enable front face culling
-	glCullFace(GL_FRONT);
-		//draw scene from the point of view of light
-		DrawScene(MV_L, P_L);
-	//enable back face culling
-	glCullFace(GL_BACK);
-
-	//restore normal rendering path
-	//unbind FBO, set the default back buffer and reset the viewport to screen size
-	glBindFramebuffer(GL_FRAMEBUFFER,0);
-	glDrawBuffer(GL_BACK_LEFT);
-	glViewport(0,0,WIDTH, HEIGHT);
 
-	//2) Render scene from point of view of eye
-	DrawScene(MV, P, 0 );
+	//move the dynamic sphere on a circle around the cube
+	if(bAnimate) {
+		float t = glutGet(GLUT_ELAPSED_TIME)/1000.0f;
+		objects[dynamicSphereIndex].M = glm::translate(glm::mat4(1), glm::vec3(-1+4*cos(t), 1, 4*sin(t)));
+	}
+
+	//time the shadow pass
+	glBeginQuery(GL_TIME_ELAPSED, queryIDs[timedFrames%2]);
+	 
+	if(bUseCascades) {
+		//fit the cascades to the camera
+		if(bDirectionalLight)
+			csm.SetDirectionalLight(lightPosOS);
+		else
+			csm.SetPointLight(lightPosOS);
+		csm.Update(MV, FOVY, aspect, Z_NEAR, Z_FAR);
+
+		//1) Render scene from the light's POV into every cascade, the static
+		//casters only when the cached layer is out of date and the dynamic
+		//casters on top of it, both culled against the cascade
+		//enable front face culling
+		glCullFace(GL_FRONT);
+		vector<size_t> casters;
+		for(int i=0;i<csm.GetCascades();i++) {
+			if(csm.BeginStatic(i)) {
+				CullCasters(i, true, casters);
+				DrawCasters(casters, i);
+			}
+			CullCasters(i, false, casters);
+			if(csm.BeginDynamic(i, !casters.empty()))
+				DrawCasters(casters, i);
+		}
+		csm.End();
+		//enable back face culling
+		glCullFace(GL_BACK);
+		glEndQuery(GL_TIME_ELAPSED);
+
+		//restore normal rendering path
+		//set the default back buffer and reset the viewport to screen size
+		glDrawBuffer(GL_BACK_LEFT);
+		glViewport(0,0,WIDTH, HEIGHT);
+
+		//pass the cascades to the shader
+		csmShader.Use();
+			glUniformMatrix4fv(csmShader("cascadeMatrices"), csm.GetCascades(), GL_FALSE, glm::value_ptr(csm.GetShadowMatrices()[0]));
+			glUniform4fv(csmShader("cascadeSplits"), 1, glm::value_ptr(csm.GetSplits()));
+			glUniform1i(csmShader("totalCascades"), csm.GetCascades());
+			glUniform3fv(csmShader("light_position"),1, &(lightPosOS.x));
+			glUniform1i(csmShader("bDirectional"), bDirectionalLight);
+			glUniform1i(csmShader("bShowCascades"), bShowCascades);
+		csmShader.UnUse();
+		glActiveTexture(GL_TEXTURE0);
+		csm.Bind();
+
+		//2) Render scene from point of view of eye
+		DrawScene(csmShader, MV, P, 0);
+	} else {
+		//pass the light to the shader
+		shader.Use();
+			glUniformMatrix4fv(shader("S"), 1, GL_FALSE, glm::value_ptr(S));
+			glUniform3fv(shader("light_position"),1, &(lightPosOS.x));
+		shader.UnUse();
+
+		//1) Render scene from the light's POV
+		//enable rendering to FBO
+ 		glBindFramebuffer(GL_FRAMEBUFFER,fboID);
+		//clear depth buffer
+		glClear(GL_DEPTH_BUFFER_BIT);
+		//reset viewport to the shadow map texture size
+		glViewport(0,0,SHADOWMAP_WIDTH, SHADOWMAP_HEIGHT);
+		
+		//enable front face culling
+		glCullFace(GL_FRONT);
+			//draw scene from the point of view of light
+			DrawScene(shader, MV_L, P_L);
+		//enable back face culling
+		glCullFace(GL_BACK);
+		glEndQuery(GL_TIME_ELAPSED);
+
+		//restore normal rendering path
+		//unbind FBO, set the default back buffer and reset the viewport to screen size
+		glBindFramebuffer(GL_FRAMEBUFFER,0);
+		glDrawBuffer(GL_BACK_LEFT);
+		glViewport(0,0,WIDTH, HEIGHT);
+
+		//2) Render scene from point of view of eye
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, shadowMapTexID);
+		DrawScene(shader, MV, P, 0 );
+	}
 
 	//bind light gizmo vertex array object
 	glBindVertexArray(lightVAOID); {
@@ -625,6 +817,22 @@ void OnRender() {
 	//unbind the vertex array object
 	glBindVertexArray(0);	
 
+	//add the time of the previous frame and show the average in the title
+	if(timedFrames > 0) {
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queryIDs[(timedFrames-1)%2], GL_QUERY_RESULT, &elapsed);
+		shadowMilliseconds += elapsed/1e6;
+	}
+	if(++timedFrames%FRAMES_PER_TIMING == 0) {
+		char title[128];
+		if(bUseCascades)
+			sprintf(title, "Shadow Mapping - %d cascades%s: shadow pass %.3f ms", csm.GetCascades(), csm.IsCaching()? ", cached" : "", shadowMilliseconds/FRAMES_PER_TIMING);
+		else
+			sprintf(title, "Shadow Mapping - single map: shadow pass %.3f ms", shadowMilliseconds/FRAMES_PER_TIMING);
+		glutSetWindowTitle(title);
+		shadowMilliseconds = 0;
+	}
+
 	//swap front and back buffers to show the rendered result
 	glutSwapBuffers();
 }
@@ -701,6 +909,7 @@ int main(int argc, char** argv) {
 	glutMouseFunc(OnMouseDown);
 	glutMotionFunc(OnMouseMove);
 	glutMouseWheelFunc(OnMouseWheel);
+	glutKeyboardFunc(OnKey);
 	glutIdleFunc(OnIdle);
 
 	//main loop call
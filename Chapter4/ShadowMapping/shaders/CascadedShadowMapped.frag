@@ -0,0 +1,83 @@
+#version 330 core
+
+layout(location=0) out vec4 vFragColor;	//fragment shader output
+
+//largest number of cascades
+const int MAX_CASCADES = 4;
+
+//uniforms
+uniform mat4 MV;						//modelview matrix
+uniform sampler2DArrayShadow shadowMap;	//shadowmap texture array, a layer per cascade
+uniform mat4 cascadeMatrices[MAX_CASCADES];	//shadow matrices of the cascades
+uniform vec4 cascadeSplits;				//view depths where the cascades end
+uniform int totalCascades;				//number of cascades used
+uniform vec3 light_position;			//light position in object space
+uniform bool bDirectional;				//light_position is the direction towards the light
+uniform bool bShowCascades;				//tint the fragments with the colour of their cascade
+uniform vec3 diffuse_color;				//surface's diffuse colour
+uniform bool bIsLightPass;				//flag to indicate the light pass
+										//we donot cast shadows in light pass
+
+//inputs from the vertex shader
+smooth in vec3 vEyeSpaceNormal;		//interpolated eye space normal
+smooth in vec3 vEyeSpacePosition;	//interpolated eye space position
+smooth in vec3 vWorldSpacePosition;	//interpolated world space position
+
+//shader constants
+const float k0 = 1.0;	//constant attenuation
+const float k1 = 0.0;	//linear attenuation
+const float k2 = 0.0;	//quadratic attenuation
+
+//colours of the cascades for debugging
+const vec3 cascadeColors[MAX_CASCADES] = vec3[](vec3(1,0.5,0.5), vec3(0.5,1,0.5), vec3(0.5,0.5,1), vec3(1,1,0.5));
+
+void main() { 
+	//if this is the light pass, we donot cast shadows and simply return
+	//since we only require depth which is stored in the depth attachment
+	//of FBO
+	if(bIsLightPass)
+		return;
+
+	//get the light vector and distance in eye space
+	vec3 L;
+	float d = 0;
+	if(bDirectional) {
+		L = (MV*vec4(light_position,0)).xyz;
+	} else {
+		L = (MV*vec4(light_position,1)).xyz - vEyeSpacePosition;
+		d = length(L);
+	}
+
+	//normalize the light vector
+	L = normalize(L);
+
+	//calculate the diffuse component and apply light attenuation 
+	float attenuationAmount = 1.0/(k0 + (k1*d) + (k2*d*d));
+	float diffuse = max(0, dot(vEyeSpaceNormal, L)) * attenuationAmount;	
+
+	//pick the first cascade which ends behind the fragment, fragments past
+	//the last cascade are not shadowed
+	float depth = -vEyeSpacePosition.z;
+	int cascade = 0;
+	while(cascade < totalCascades && depth > cascadeSplits[cascade])
+		cascade++;
+
+	vec3 tint = vec3(1);
+	if(cascade < totalCascades) {
+		//get the shadow coordinates in the cascade, for a point light the
+		//homogeneous coordinate is > 0 only in front of the light
+		vec4 vShadowCoords = cascadeMatrices[cascade]*vec4(vWorldSpacePosition,1);
+		if(vShadowCoords.w > 0) {
+			vShadowCoords.xyz /= vShadowCoords.w;
+			//check the shadow map layer to see if the fragment is in shadow
+			float shadow = texture(shadowMap, vec4(vShadowCoords.xy, cascade, vShadowCoords.z));
+			//darken the diffuse component apprpriately
+			diffuse = mix(diffuse, diffuse*shadow, 0.5); 
+		}
+		if(bShowCascades)
+			tint = cascadeColors[cascade];
+	}
+
+	//return the final colour by multiplying the diffuse colour with the diffuse component
+	vFragColor = diffuse*vec4(diffuse_color*tint, 1);	 
+}
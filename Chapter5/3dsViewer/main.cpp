@@ -9,6 +9,7 @@
 #include <glm/gtc/matrix_inverse.hpp>
 
 #include "..\src\GLSLShader.h"
+#include "..\src\BatchRenderer.h"
 #include "3ds.h"
 
 #include <SOIL.h>
@@ -40,13 +41,11 @@ GLSLShader shader, flatShader;
 //3dsloader instance
 C3dsLoader loader;
 
-//IDs for vertex array and buffer object
-//here we will load each attribute in a separate buffer object
-GLuint vaoID;			//mesh vertex array object
-GLuint vboVerticesID;	//mesh vertices buffer object
-GLuint vboUVsID;		//mesh texture coordinates buffer object
-GLuint vboNormalsID;	//mesh normals buffer object
-GLuint vboIndicesID;	//mesh indices element array buffer object
+//the submeshes of all materials are drawn from a batch, one object per
+//material, and read their transforms from a buffer texture on this unit
+BatchRenderer batch;
+vector<int> visibleObjects;
+const int TRANSFORM_TEXTURE_UNIT = 1;
 
 //projection and modelview matrices
 glm::mat4  P = glm::mat4(1);
@@ -222,20 +221,14 @@ void OnInit() {
 		shader.AddUniform("hasTexture");	
 		shader.AddUniform("light_position"); 
 		shader.AddUniform("diffuse_color"); 
+		shader.AddUniform("transforms");
 		//set values of constant uniforms as initialization		
 		glUniform1i(shader("textureMap"), 0);
+		glUniform1i(shader("transforms"), TRANSFORM_TEXTURE_UNIT);
 	shader.UnUse();
 
 	GL_CHECK_ERRORS
 
-	//setup the vertex array object and vertex buffer object for the mesh
-	//geometry handling 
-	glGenVertexArrays(1, &vaoID);
-	glGenBuffers(1, &vboVerticesID);
-	glGenBuffers(1, &vboUVsID);
-	glGenBuffers(1, &vboNormalsID);
-	glGenBuffers(1, &vboIndicesID); 
-
 	//get the mesh bounding box
 	glm::vec3 min=glm::vec3(1000.0f), max=glm::vec3(-1000);
 	for(size_t j=0;j<meshes.size();j++) {
@@ -251,60 +244,46 @@ void OnInit() {
 	float r = std::max(glm::distance(center,max), glm::distance(center,min));
 	dist = -(r+(r*.5f));
 	 
-	//bind mesh vertex array object
-	glBindVertexArray(vaoID); 
-	glBindBuffer (GL_ARRAY_BUFFER, vboVerticesID);
-	//pass mesh vertices data to buffer object
-	glBufferData (GL_ARRAY_BUFFER, sizeof(glm::vec3)*vertices.size(), &(vertices[0].x), GL_STATIC_DRAW);
-		
-	GL_CHECK_ERRORS
-	//enable vertex attribute array for vertex position		
-	glEnableVertexAttribArray(shader["vVertex"]);
-	glVertexAttribPointer(shader["vVertex"], 3, GL_FLOAT, GL_FALSE,0,0);
-		
-	GL_CHECK_ERRORS
-
-	//bind the texture coordinate buffer object and pass the texture coordinate to buffer object
-	glBindBuffer (GL_ARRAY_BUFFER, vboUVsID);
-	glBufferData (GL_ARRAY_BUFFER, sizeof(glm::vec2)*uvs.size(), &(uvs[0].x), GL_STATIC_DRAW);
-
-	GL_CHECK_ERRORS
-	//enable vertex attribute array for vertex texture coordinates
-	glEnableVertexAttribArray(shader["vUV"]);
-	glVertexAttribPointer(shader["vUV"], 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-	GL_CHECK_ERRORS
-
-	//bind the normals buffer object and pass the normals to buffer object
-	glBindBuffer (GL_ARRAY_BUFFER, vboNormalsID);
-	glBufferData (GL_ARRAY_BUFFER, sizeof(glm::vec3)*normals.size(), &(normals[0].x), GL_STATIC_DRAW);
-
-	GL_CHECK_ERRORS
-	//enable vertex attribute array for vertex normals
-	glEnableVertexAttribArray(shader["vNormal"]);
-	glVertexAttribPointer(shader["vNormal"], 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-	GL_CHECK_ERRORS
+	//interleave the mesh attributes into the batch vertex layout
+	vector<BatchRenderer::Vertex> batchVertices(vertices.size());
+	for(size_t i=0;i<vertices.size();i++) {
+		batchVertices[i].position = vertices[i];
+		batchVertices[i].normal = (i<normals.size()) ? normals[i] : glm::vec3(0);
+		batchVertices[i].uv = (i<uvs.size()) ? uvs[i] : glm::vec2(0);
+	}
 
-	//if we have a single material, it means the 3ds model contains one mesh
-	//we therefore load it into an element array buffer
+	//if we have a single material, the whole mesh is one object, otherwise
+	//the submesh indices of all materials are stored one after the other and
+	//each material draws its own range
+	vector<GLuint> batchIndices;
 	if(materials.size()==1) {
-		//pass indices to the element array buffer if there is a single material			
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndicesID);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*3*faces.size(), 0, GL_STATIC_DRAW);
-
-		//fill the element array buffer memory with the indices array
-		GLushort* pIndices = static_cast<GLushort*>(glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY));
 		for(size_t i=0;i<faces.size();i++) {
-			*(pIndices++)=faces[i].a;
-			*(pIndices++)=faces[i].b;
-			*(pIndices++)=faces[i].c;
+			batchIndices.push_back(faces[i].a);
+			batchIndices.push_back(faces[i].b);
+			batchIndices.push_back(faces[i].c);
 		}
-		glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-	}  
-		
+	} else {
+		for(size_t i=0;i<materials.size();i++)
+			batchIndices.insert(batchIndices.end(), materials[i]->sub_indices.begin(), materials[i]->sub_indices.end());
+	}
+	int mesh = batch.AddMesh(&batchVertices[0], int(batchVertices.size()), &batchIndices[0], int(batchIndices.size()));
+	if(materials.size()==1) {
+		visibleObjects.push_back(batch.AddObject(mesh, 0, glm::mat4(1)));
+	} else {
+		int offset = 0;
+		for(size_t i=0;i<materials.size();i++) {
+			int count = int(materials[i]->sub_indices.size());
+			int subMesh = batch.AddSubMesh(mesh, offset, count);
+			visibleObjects.push_back(batch.AddObject(subMesh, int(i), glm::mat4(1)));
+			offset += count;
+		}
+	}
+	batch.Init();
+	//the objects do not move so the draw commands are written once
+	batch.Build(visibleObjects);
+
 	GL_CHECK_ERRORS
-		  
+
 	//setup vao and vbo stuff for the light position crosshair
 	glm::vec3 crossHairVertices[6];
 	crossHairVertices[0] = glm::vec3(-0.5f,0,0);
@@ -381,12 +360,8 @@ void OnShutdown() {
 	shader.DeleteShaderProgram();
 	flatShader.DeleteShaderProgram();
 
-	//Destroy vao and vbo
-	glDeleteBuffers(1, &vboVerticesID);
-	glDeleteBuffers(1, &vboUVsID);
-	glDeleteBuffers(1, &vboNormalsID);
-	glDeleteBuffers(1, &vboIndicesID);
-	glDeleteVertexArrays(1, &vaoID); 
+	//Destroy the batch
+	batch.Destroy();
 
 	glDeleteVertexArrays(1, &lightVAOID);
 	glDeleteBuffers(1, &lightVerticesVBO);
@@ -414,8 +389,8 @@ void OnRender() {
 
 	GL_CHECK_ERRORS
 
-	//bind the mesh vertex array object
-	glBindVertexArray(vaoID); {
+	//draw the mesh from the batch
+	{
 		//bind the mesh rendering shader
 		shader.Use();
 			//set shader uniforms
@@ -441,7 +416,7 @@ void OnRender() {
 					glUniform3fv(shader("diffuse_color"),1, materials[0]->diffuse);	
 				}
 				//draw mesh triangles in a single call
-				glDrawElements(GL_TRIANGLES, meshes[0]->faces.size()*3, GL_UNSIGNED_SHORT, 0); 
+				batch.Draw(0, GL_TEXTURE0 + TRANSFORM_TEXTURE_UNIT);
 			}  else {
 				//otherwise we render the submeshes by material
 				for(size_t i=0;i<materials.size();i++) {
@@ -460,8 +435,8 @@ void OnRender() {
 					}
 					//pass the diffuse colour uniform to the material's diffuse color
 					glUniform3fv(shader("diffuse_color"),1, materials[i]->diffuse);	
-					//draw triangles using the submesh indices 
-					glDrawElements(GL_TRIANGLES, materials[i]->sub_indices.size(), GL_UNSIGNED_SHORT, &(materials[i]->sub_indices[0])); 
+					//draw all objects of this material in a single call
+					batch.Draw(int(i), GL_TEXTURE0 + TRANSFORM_TEXTURE_UNIT);
 			
 				}
 			}
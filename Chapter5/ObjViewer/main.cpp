@@ -8,6 +8,7 @@
 #include <glm/gtc/matrix_inverse.hpp>
 
 #include "..\src\GLSLShader.h"
+#include "..\src\BatchRenderer.h"
 #include <vector>
 #include "Obj.h"
 
@@ -38,10 +39,11 @@ const int HEIGHT = 960;
 //mesh rendering shader and flat shader
 GLSLShader shader, flatShader;
 
-//IDs for vertex array and buffer object
-GLuint vaoID;
-GLuint vboVerticesID; 
-GLuint vboIndicesID;
+//the submeshes of all materials are drawn from a batch, one object per
+//material, and read their transforms from a buffer texture on this unit
+BatchRenderer batch;
+vector<int> visibleObjects;
+const int TRANSFORM_TEXTURE_UNIT = 1;
 
 //projection and modelview matrices
 glm::mat4  P = glm::mat4(1);
@@ -214,50 +216,40 @@ void OnInit() {
 		shader.AddUniform("useDefault");		
 		shader.AddUniform("light_position");
 		shader.AddUniform("diffuse_color");
+		shader.AddUniform("transforms");
 		//set values of constant uniforms as initialization	
 		glUniform1i(shader("textureMap"), 0);
+		glUniform1i(shader("transforms"), TRANSFORM_TEXTURE_UNIT);
 	shader.UnUse();
 
 	GL_CHECK_ERRORS
 
-	//setup the vertex array object and vertex buffer object for the mesh
-	//geometry handling 
-	glGenVertexArrays(1, &vaoID);
-	glGenBuffers(1, &vboVerticesID);
-	glGenBuffers(1, &vboIndicesID); 
-	 
-	//here we are using interleaved attributes so we can just push data to one
-	//buffer object and then assign different atribute pointer to identofy the 
-	//different attributes
-	glBindVertexArray(vaoID);	
-		glBindBuffer (GL_ARRAY_BUFFER, vboVerticesID);
-		//pass mesh vertices
-		glBufferData (GL_ARRAY_BUFFER, sizeof(Vertex)*vertices.size(), &(vertices[0].pos.x), GL_STATIC_DRAW);
-		GL_CHECK_ERRORS
-		//enable vertex attribute array for vertex position
-		glEnableVertexAttribArray(shader["vVertex"]);
-		glVertexAttribPointer(shader["vVertex"], 3, GL_FLOAT, GL_FALSE,sizeof(Vertex),0);
-		GL_CHECK_ERRORS 
-		//enable vertex attribute array for vertex normal
-		glEnableVertexAttribArray(shader["vNormal"]);
-		glVertexAttribPointer(shader["vNormal"], 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)(offsetof(Vertex, normal)) );
- 
-		GL_CHECK_ERRORS
-		//enable vertex attribute array for vertex texture coordinates
-		glEnableVertexAttribArray(shader["vUV"]);
-		glVertexAttribPointer(shader["vUV"], 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)(offsetof(Vertex, uv)) );
- 
-		GL_CHECK_ERRORS
-			
-		//if we have a single material, it means the 3ds model contains one mesh
-		//we therefore load it into an element array buffer
-		if(materials.size()==1) {
-			//pass indices to the element array buffer if there is a single material			
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndicesID);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*indices.size(), &(indices[0]), GL_STATIC_DRAW);
+	//copy the mesh into the batch arenas, the vertex layout of the batch
+	//matches the interleaved obj vertices
+	vector<BatchRenderer::Vertex> batchVertices(vertices.size());
+	for(size_t i=0;i<vertices.size();i++) {
+		batchVertices[i].position = vertices[i].pos;
+		batchVertices[i].normal = vertices[i].normal;
+		batchVertices[i].uv = vertices[i].uv;
+	}
+	vector<GLuint> batchIndices(indices.begin(), indices.end());
+	int mesh = batch.AddMesh(&batchVertices[0], int(batchVertices.size()), &batchIndices[0], int(batchIndices.size()));
+
+	//if we have a single material, the whole mesh is one object, otherwise
+	//each material draws its own range of the indices
+	if(materials.size()==1) {
+		visibleObjects.push_back(batch.AddObject(mesh, 0, glm::mat4(1)));
+	} else {
+		for(size_t i=0;i<materials.size();i++) {
+			int subMesh = batch.AddSubMesh(mesh, materials[i]->offset, materials[i]->count);
+			visibleObjects.push_back(batch.AddObject(subMesh, int(i), glm::mat4(1)));
 		}
-		GL_CHECK_ERRORS
-	glBindVertexArray(0); 
+	}
+	batch.Init();
+	//the objects do not move so the draw commands are written once
+	batch.Build(visibleObjects);
+
+	GL_CHECK_ERRORS
 
 	//setup vao and vbo stuff for the light position crosshair
 	glm::vec3 crossHairVertices[6];
@@ -325,10 +317,8 @@ void OnShutdown() {
 	shader.DeleteShaderProgram();
 	flatShader.DeleteShaderProgram();
 
-	//Destroy vao and vbo
-	glDeleteBuffers(1, &vboVerticesID); 
-	glDeleteBuffers(1, &vboIndicesID);
-	glDeleteVertexArrays(1, &vaoID); 
+	//Destroy the batch
+	batch.Destroy();
 		
 	glDeleteVertexArrays(1, &lightVAOID);
 	glDeleteBuffers(1, &lightVerticesVBO);   
@@ -353,8 +343,8 @@ void OnRender() {
 	glm::mat4 Rx	= glm::rotate(T,  rX, glm::vec3(1.0f, 0.0f, 0.0f));
 	glm::mat4 MV    = glm::rotate(Rx, rY, glm::vec3(0.0f, 1.0f, 0.0f));  
 	 
-	//bind the mesh vertex array object
-	glBindVertexArray(vaoID); {
+	//draw the mesh from the batch
+	{
 		//bind the mesh rendering shader
 		shader.Use();		
 			//set the shader uniforms
@@ -379,12 +369,8 @@ void OnRender() {
 					//otherwise we have no texture, we use a default colour
 					glUniform1f(shader("useDefault"), 1.0);
 
-				//if we have a single material, we render the whole mesh in a single call
-				if(materials.size()==1)
-					glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_SHORT, 0);
-				else
-					//otherwise we render the submesh
-					glDrawElements(GL_TRIANGLES, pMat->count, GL_UNSIGNED_SHORT, (const GLvoid*)(&indices[pMat->offset])); 
+				//draw all objects of this material in a single call
+				batch.Draw(int(i), GL_TEXTURE0 + TRANSFORM_TEXTURE_UNIT);
 			}
 		//unbind the shader
 		shader.UnUse(); 
@@ -3,12 +3,16 @@
 layout(location = 0) in vec3 vVertex;	 //vertex position
 layout(location = 1) in vec3 vNormal;	 //vertex normal
 layout(location = 2) in vec2 vUV;		 //vertex uv coordinates
+layout(location = 3) in uint vDrawID;	 //index of the draw in the transform buffer
 
 //uniforms for projection, modelview and normal matrices
 uniform mat4 P; 
 uniform mat4 MV;
 uniform mat3 N;
 
+//modelling matrices of all draws, 4 texels each
+uniform samplerBuffer transforms;
+
 //shader outputs to the fragment shader
 smooth out vec2 vUVout;					//texture coordinates
 smooth out vec3 vEyeSpaceNormal;    	//eye space normals
@@ -19,13 +23,18 @@ void main()
     //output the texture coordinates
 	vUVout=vUV; 
 	
-	//multiply the object space vertex position with the modelview matrix 
-	//to get the eye space position  
-	vEyeSpacePosition = (MV*vec4(vVertex,1)).xyz; 
+	//fetch the modelling matrix of this draw
+	int i = int(vDrawID)*4;
+	mat4 M = mat4(texelFetch(transforms, i), texelFetch(transforms, i+1),
+				  texelFetch(transforms, i+2), texelFetch(transforms, i+3));
+
+	//multiply the object space vertex position with the modelling and
+	//modelview matrices to get the eye space position  
+	vEyeSpacePosition = (MV*M*vec4(vVertex,1)).xyz; 
 
-	//multiply the object space normal with the normal matrix to get 
-	//the eye space normal
-	vEyeSpaceNormal   = N*vNormal;
+	//multiply the object space normal with the modelling and normal matrices
+	//to get the eye space normal, the modelling matrix has no scaling
+	vEyeSpaceNormal   = N*mat3(M)*vNormal;
 
 	//multiply the projection matrix with the eye space position to get
 	//the clipspace postion
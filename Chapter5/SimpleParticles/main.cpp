@@ -3,6 +3,8 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <iostream>
+#include <sstream>
+#include <cstdlib>
 
 
 #include <glm/glm.hpp>
@@ -10,6 +12,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "..\src\GLSLShader.h"
+#include "..\src\ParticleSystem.h"
 
 #include <SOIL.h>
 
@@ -37,12 +40,18 @@ const int HEIGHT = 960;
 //particle shader, textured shader and a pointer to current shader
 GLSLShader shader, texturedShader, *pCurrentShader;
 
-//IDs for vertex array and buffer object
-GLuint vaoID;
-GLuint vboVerticesID; 
-
-//total number of particles
+//default number of particles, can be given on the command line
 const int MAX_PARTICLES = 10000;
+int totalParticles = MAX_PARTICLES;
+
+//the particle engine, simulated on the CPU and sorted back to front
+ParticleSystem particles;
+
+//life of a particle in seconds
+const float PARTICLE_LIFE = 2.0f;
+
+//time of the last frame in milliseconds
+int lastTime = 0;
  
 //projection modelview and emitter transform matrices
 glm::mat4  P = glm::mat4(1);
@@ -52,7 +61,6 @@ glm::mat4 emitterXForm = glm::mat4(1);
 //camera transformation variables
 int state = 0, oldX=0, oldY=0;
 float rX=0, rY=0, dist = -10;
-float time = 0;
  
 //particle texture filename 
 const std::string texture_filename = "../media/particle.dds";
@@ -90,6 +98,36 @@ void OnMouseMove(int x, int y)
 	glutPostRedisplay(); 
 }
 
+//sets up a fire from three point emitters. The particles rise in a cone
+//of 30 degrees around the emitter y axis and are pushed up by a constant
+//acceleration. The rates are scaled so that the emitters fill the pool.
+void CreateEmitters() {
+	const float PI = 3.14159265f;
+	Emitter fire;
+	fire.force = glm::vec3(0,2,0);
+	fire.yaw = 0;
+	fire.yawVar = 2*PI;
+	fire.pitch = PI/3;
+	fire.pitchVar = PI/6;
+	fire.speed = 1;
+	fire.speedVar = 0;
+	fire.life = PARTICLE_LIFE;
+	fire.lifeVar = 0;
+	fire.rate = totalParticles/(3*PARTICLE_LIFE);
+	particles.AddEmitter(fire);
+
+	//two smaller flames on either side
+	fire.speed = 0.6f;
+	fire.life = fire.lifeVar = PARTICLE_LIFE*0.5f;
+	fire.position = glm::vec3(0,0,-1.5f);
+	particles.AddEmitter(fire);
+	fire.position = glm::vec3(0,0,1.5f);
+	particles.AddEmitter(fire);
+
+	//the fire has no floor
+	particles.SetCollisionPlane(glm::vec4(0,1,0,1000), 0);
+}
+
 //OpenGL initialization function
 void OnInit() {
 	GL_CHECK_ERRORS
@@ -101,7 +139,6 @@ void OnInit() {
 	shader.Use();	  
 		//add attribute and uniform
 		shader.AddUniform("MVP");
-		shader.AddUniform("time"); 
 	shader.UnUse();
 
 	GL_CHECK_ERRORS
@@ -114,7 +151,6 @@ void OnInit() {
 	texturedShader.Use();	  
 		//add attribute and uniform
 		texturedShader.AddUniform("MVP");
-		texturedShader.AddUniform("time"); 
 		texturedShader.AddUniform("textureMap");
 		//set values of constant uniforms as initialization	
 		glUniform1i(texturedShader("textureMap"),0);
@@ -122,23 +158,10 @@ void OnInit() {
 	 
 	GL_CHECK_ERRORS
 
-	//setup the vertex array object and vertex buffer object for the mesh
-	//geometry handling 
-	glGenVertexArrays(1, &vaoID);
-	glBindVertexArray(vaoID);
-
-	//These calls marked start ATI/end ATI below are not required but on 
-	//ATI cards i tested, i had to pass an allocated buffer object
-	//uncomment the code marked with start/end ATI if running on an ATI hardware
-	/// start ATI ///
-	/*
-	glGenBuffers(1, &vboVerticesID);  
-	glBindBuffer (GL_ARRAY_BUFFER, vboVerticesID);
-	glBufferData (GL_ARRAY_BUFFER, sizeof(GLubyte)*MAX_PARTICLES, 0, GL_STATIC_DRAW);	 
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0,1,GL_UNSIGNED_BYTE, GL_FALSE, 0,0);
-	*/
-	/// end ATI ////
+	//setup the particle pool and its vertex array and buffer objects
+	particles.Init(totalParticles, PARTICLES_CPU);
+	CreateEmitters();
+	lastTime = glutGet(GLUT_ELAPSED_TIME);
 
 	GL_CHECK_ERRORS 
 	
@@ -219,12 +242,8 @@ void OnShutdown() {
 	shader.DeleteShaderProgram();
 	texturedShader.DeleteShaderProgram();
 
-	//Destroy vao and vbo
-	/// start ATI ///
-	//glDeleteBuffers(1, &vboVerticesID); 
-	/// end ATI ///
-
-	glDeleteVertexArrays(1, &vaoID);
+	//Destroy the particle buffers
+	particles.Destroy();
 
 	cout<<"Shutdown successfull"<<endl;
 }
@@ -239,8 +258,10 @@ void OnResize(int w, int h) {
 
 //display callback function
 void OnRender() { 
-	//get current time
-	GLfloat time = glutGet(GLUT_ELAPSED_TIME)/1000.0f;
+	//get the frame time
+	int time = glutGet(GLUT_ELAPSED_TIME);
+	float dt = min((time - lastTime)/1000.0f, 0.05f);
+	lastTime = time;
 	
 	//clear colour and depth buffer
 	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
@@ -250,16 +271,25 @@ void OnRender() {
 	glm::mat4 Rx	= glm::rotate(T,  rX, glm::vec3(1.0f, 0.0f, 0.0f));
 	glm::mat4 MV	= glm::rotate(Rx, rY, glm::vec3(0.0f, 1.0f, 0.0f)); 
     glm::mat4 MVP	= P*MV;
+
+	//simulate the particles in emitter space and sort them back to front
+	//for the over blending
+	particles.Update(dt);
+	particles.Sort(MV*emitterXForm);
 	 
 	//bind the current shader
 	pCurrentShader->Use();				
 		//pass shader uniforms
-		glUniform1f((*pCurrentShader)("time"), time);
 		glUniformMatrix4fv((*pCurrentShader)("MVP"), 1, GL_FALSE, glm::value_ptr(P*MV*emitterXForm));
 		//render points
-			glDrawArrays(GL_POINTS, 0, MAX_PARTICLES);
+			particles.Draw();
 	//unbind shader
 	pCurrentShader->UnUse();
+
+	//show the particle statistics
+	stringstream title;
+	title<<"Simple particles - "<<particles.GetLiveCount()<<" particles, update: "<<particles.GetUpdateTime()<<" msecs, sort: "<<particles.GetSortTime()<<" msecs";
+	glutSetWindowTitle(title.str().c_str());
 	
 	//swap front and back buffers to show the rendered result
 	glutSwapBuffers();
@@ -288,6 +318,11 @@ void OnKey(unsigned char key, int x, int y) {
 int main(int argc, char** argv) {
 	//freeglut initialization
 	glutInit(&argc, argv);
+
+	//optional number of particles
+	if(argc > 1)
+		totalParticles = max(1, atoi(argv[1]));
+
 	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);	
 	glutInitContextVersion (3, 3);
 	glutInitContextFlags (GLUT_CORE_PROFILE | GLUT_DEBUG);
@@ -0,0 +1,261 @@
+#include "TerrainPatches.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+TerrainPatches::TerrainPatches(void)
+{
+	patchesX = patchesZ = cellsPerPatch = levels = 0;
+	uvSize = 0;
+	pixelTolerance = 1;
+	vaoID = vboVerticesID = vboIndicesID = vboInstancesID = 0;
+	drawnTriangles = 0;
+}
+
+TerrainPatches::~TerrainPatches(void)
+{
+}
+
+void TerrainPatches::Init(const GLubyte* heights, int width, int depth, int cells, float scale, const glm::vec2& halfSize) {
+	cellsPerPatch = cells;
+	levels = 1;
+	while((1<<(levels-1)) < cellsPerPatch)
+		levels++;
+	patchesX = (width - 1 + cellsPerPatch - 1)/cellsPerPatch;
+	patchesZ = (depth - 1 + cellsPerPatch - 1)/cellsPerPatch;
+
+	//the shaders place sample i at texture coordinate i/(width-1)
+	uvSize = float(cellsPerPatch)/(width-1);
+	glm::vec2 cellSize(2*halfSize.x/(width-1), 2*halfSize.y/(depth-1));
+	float heightToWorld = scale/255.0f;
+
+	//bounds and errors of the patches, samples past the heightmap are
+	//clamped like the texture coordinates in the shader
+	patches.resize(patchesX*patchesZ);
+	for(int pz=0;pz<patchesZ;pz++) {
+		for(int px=0;px<patchesX;px++) {
+			Patch& patch = patches[pz*patchesX + px];
+			int x0 = px*cellsPerPatch, z0 = pz*cellsPerPatch;
+			int x1 = min(x0 + cellsPerPatch, width-1), z1 = min(z0 + cellsPerPatch, depth-1);
+			int minHeight = 255, maxHeight = 0;
+			for(int z=z0;z<=z1;z++) {
+				for(int x=x0;x<=x1;x++) {
+					minHeight = min(minHeight, int(heights[z*width + x]));
+					maxHeight = max(maxHeight, int(heights[z*width + x]));
+				}
+			}
+			patch.min = glm::vec3(x0*cellSize.x - halfSize.x, minHeight*heightToWorld - scale*0.5f, z0*cellSize.y - halfSize.y);
+			patch.max = glm::vec3(x1*cellSize.x - halfSize.x, maxHeight*heightToWorld - scale*0.5f, z1*cellSize.y - halfSize.y);
+
+			//the cells of every level are split along the diagonal from
+			//(i+1,j) to (i,j+1) as in the library
+			patch.errors.assign(levels, 0.0f);
+			for(int level=0;level<levels-1;level++) {
+				int step = cellsPerPatch>>level;
+				float error = 0;
+				for(int z=z0;z<=z1;z++) {
+					int za = z0 + min((z - z0)/step, (1<<level)-1)*step, zb = min(za + step, depth-1);
+					float fz = (zb > za) ? float(z - za)/(zb - za) : 0;
+					for(int x=x0;x<=x1;x++) {
+						int xa = x0 + min((x - x0)/step, (1<<level)-1)*step, xb = min(xa + step, width-1);
+						float fx = (xb > xa) ? float(x - xa)/(xb - xa) : 0;
+						float h00 = heights[za*width + xa], h10 = heights[za*width + xb];
+						float h01 = heights[zb*width + xa], h11 = heights[zb*width + xb];
+						float h = (fx + fz <= 1) ? h00 + fx*(h10 - h00) + fz*(h01 - h00)
+												 : h11 + (1-fx)*(h01 - h11) + (1-fz)*(h10 - h11);
+						error = max(error, fabs(h - heights[z*width + x]));
+					}
+				}
+				patch.errors[level] = error*heightToWorld;
+			}
+
+			//a coarser level is never more accurate than a finer one
+			for(int level=levels-2;level>=0;level--)
+				patch.errors[level] = max(patch.errors[level], patch.errors[level+1]);
+			patch.level = 0;
+		}
+	}
+
+	//the library of grids, all levels in one vertex and one index buffer
+	vector<glm::vec2> vertices;
+	vector<GLushort> indices;
+	library.resize(levels);
+	for(int level=0;level<levels;level++) {
+		int n = 1<<level, side = n + 1;
+		library[level].baseVertex = int(vertices.size());
+		library[level].firstIndex = int(indices.size());
+		for(int j=0;j<=n;j++) {
+			for(int i=0;i<=n;i++)
+				vertices.push_back(glm::vec2(float(i)/n, float(j)/n));
+		}
+		for(int j=0;j<n;j++) {
+			for(int i=0;i<n;i++) {
+				GLushort i0 = GLushort(j*side + i);
+				GLushort i1 = i0 + 1;
+				GLushort i2 = GLushort(i0 + side);
+				GLushort i3 = i2 + 1;
+				indices.push_back(i0); indices.push_back(i2); indices.push_back(i1);
+				indices.push_back(i1); indices.push_back(i2); indices.push_back(i3);
+			}
+		}
+		library[level].totalIndices = int(indices.size()) - library[level].firstIndex;
+	}
+
+	glGenVertexArrays(1, &vaoID);
+	glGenBuffers(1, &vboVerticesID);
+	glGenBuffers(1, &vboIndicesID);
+	glGenBuffers(1, &vboInstancesID);
+	glBindVertexArray(vaoID);
+		glBindBuffer(GL_ARRAY_BUFFER, vboVerticesID);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(glm::vec2), &vertices[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+		glVertexAttribPointer(POSITION_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+		glBindBuffer(GL_ARRAY_BUFFER, vboInstancesID);
+		glEnableVertexAttribArray(PATCH_ATTRIBUTE);
+		glVertexAttribPointer(PATCH_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), 0);
+		glVertexAttribDivisor(PATCH_ATTRIBUTE, 1);
+		glEnableVertexAttribArray(NEIGHBOURS_ATTRIBUTE);
+		glVertexAttribPointer(NEIGHBOURS_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (const GLvoid*)sizeof(glm::vec4));
+		glVertexAttribDivisor(NEIGHBOURS_ATTRIBUTE, 1);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndicesID);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void TerrainPatches::Destroy() {
+	glDeleteBuffers(1, &vboVerticesID);
+	glDeleteBuffers(1, &vboIndicesID);
+	glDeleteBuffers(1, &vboInstancesID);
+	glDeleteVertexArrays(1, &vaoID);
+	vaoID = vboVerticesID = vboIndicesID = vboInstancesID = 0;
+	patches.clear();
+	library.clear();
+	instances.clear();
+}
+
+void TerrainPatches::SetPixelTolerance(float pixels) {
+	pixelTolerance = max(pixels, 0.1f);
+}
+
+//extracts the normalized frustum planes from a combined projection and view matrix
+static void ExtractPlanes(const glm::mat4& MVP, glm::vec4 planes[6]) {
+	glm::vec4 row[4];
+	for(int i=0;i<4;i++)
+		row[i] = glm::vec4(MVP[0][i], MVP[1][i], MVP[2][i], MVP[3][i]);
+	planes[0] = row[3] + row[0];
+	planes[1] = row[3] - row[0];
+	planes[2] = row[3] + row[1];
+	planes[3] = row[3] - row[1];
+	planes[4] = row[3] + row[2];
+	planes[5] = row[3] - row[2];
+	for(int i=0;i<6;i++)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+//returns false if the box is outside one of the planes
+static bool BoxInFrustum(const glm::vec4 planes[6], const glm::vec3& min, const glm::vec3& max) {
+	for(int i=0;i<6;i++) {
+		glm::vec3 p((planes[i].x > 0) ? max.x : min.x, (planes[i].y > 0) ? max.y : min.y, (planes[i].z > 0) ? max.z : min.z);
+		if(glm::dot(glm::vec3(planes[i]), p) + planes[i].w < 0)
+			return false;
+	}
+	return true;
+}
+
+void TerrainPatches::Update(const glm::vec3& eye, const glm::mat4& MVP, float viewportHeight, float fovy) {
+	//the level of every patch, also of the ones outside the view since their
+	//visible neighbours need it. K turns a world space error at distance 1
+	//into pixels.
+	float K = viewportHeight/(2*tan(fovy*0.5f));
+	for(size_t i=0;i<patches.size();i++) {
+		Patch& patch = patches[i];
+		glm::vec3 d = glm::max(glm::max(patch.min - eye, eye - patch.max), glm::vec3(0));
+		float distance = max(glm::length(d), 0.001f);
+		int level = 0;
+		while(level < levels-1 && patch.errors[level]*K/distance > pixelTolerance)
+			level++;
+		patch.level = level;
+	}
+
+	//instances of the visible patches sorted by level with a counting sort
+	glm::vec4 planes[6];
+	ExtractPlanes(MVP, planes);
+	levelCounts.assign(levels, 0);
+	vector<int> visible;
+	for(size_t i=0;i<patches.size();i++) {
+		if(BoxInFrustum(planes, patches[i].min, patches[i].max)) {
+			visible.push_back(int(i));
+			levelCounts[patches[i].level]++;
+		}
+	}
+	vector<int> next(levels, 0);
+	for(int level=1;level<levels;level++)
+		next[level] = next[level-1] + levelCounts[level-1];
+	instances.resize(visible.size());
+	drawnTriangles = 0;
+	for(size_t i=0;i<visible.size();i++) {
+		int px = visible[i]%patchesX, pz = visible[i]/patchesX;
+		int level = patches[visible[i]].level;
+
+		//a missing neighbour at the border counts as the same level
+		Instance& instance = instances[next[level]++];
+		instance.patch = glm::vec4(px*uvSize, pz*uvSize, uvSize, float(level));
+		instance.neighbours = glm::vec4(float((px > 0) ? patches[visible[i]-1].level : level),
+										float((px < patchesX-1) ? patches[visible[i]+1].level : level),
+										float((pz > 0) ? patches[visible[i]-patchesX].level : level),
+										float((pz < patchesZ-1) ? patches[visible[i]+patchesX].level : level));
+		drawnTriangles += library[level].totalIndices/3;
+	}
+}
+
+void TerrainPatches::Render() {
+	if(instances.empty())
+		return;
+
+	//orphan the instance buffer and fill it
+	glBindBuffer(GL_ARRAY_BUFFER, vboInstancesID);
+	glBufferData(GL_ARRAY_BUFFER, instances.size()*sizeof(Instance), 0, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size()*sizeof(Instance), &instances[0]);
+
+	//one draw per level, the instance attributes are pointed at the first
+	//instance of the level since there is no base instance in GL 3.3
+	glBindVertexArray(vaoID);
+	int first = 0;
+	for(int level=0;level<levels;level++) {
+		if(!levelCounts[level])
+			continue;
+		glVertexAttribPointer(PATCH_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (const GLvoid*)(first*sizeof(Instance)));
+		glVertexAttribPointer(NEIGHBOURS_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (const GLvoid*)(first*sizeof(Instance) + sizeof(glm::vec4)));
+		const Level& range = library[level];
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.totalIndices, GL_UNSIGNED_SHORT, (const GLvoid*)(range.firstIndex*sizeof(GLushort)), levelCounts[level], range.baseVertex);
+		first += levelCounts[level];
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+int TerrainPatches::GetTotalPatches() const {
+	return int(patches.size());
+}
+
+int TerrainPatches::GetTotalLevels() const {
+	return levels;
+}
+
+int TerrainPatches::GetDrawnPatches() const {
+	return int(instances.size());
+}
+
+int TerrainPatches::GetDrawnTriangles() const {
+	return drawnTriangles;
+}
+
+int TerrainPatches::GetDrawCalls() const {
+	int calls = 0;
+	for(size_t i=0;i<levelCounts.size();i++)
+		calls += levelCounts[i] ? 1 : 0;
+	return calls;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+
+//TerrainPatches class draws a heightmap as square patches, each tessellated
+//on the CPU side by choosing one of a library of pre-tessellated grids.
+//Level L of the library is a grid of 2^L x 2^L cells in [0,1]^2, the finest
+//level matches the heightmap samples of a patch. The heights are read from
+//the heightmap texture in the vertex shader, so the library is the only
+//geometry and is shared by all patches.
+//
+//When a patch is built the largest height difference between every level
+//and the full resolution heightmap is stored. Every frame each patch gets
+//the coarsest level whose error projected to the screen is within a pixel
+//tolerance, the visible patches are written to an instance buffer sorted by
+//level and every level is drawn with one instanced call. Every instance
+//also carries the levels of its four neighbours; the vertex shader snaps
+//the border vertices facing a coarser neighbour onto the coarser grid so
+//there are no cracks.
+class TerrainPatches
+{
+public:
+	//attribute locations of the grid positions and the two instance vectors
+	static const GLuint POSITION_ATTRIBUTE = 0;
+	static const GLuint PATCH_ATTRIBUTE = 1;
+	static const GLuint NEIGHBOURS_ATTRIBUTE = 2;
+
+	//constructor/destructor
+	TerrainPatches(void);
+	~TerrainPatches(void);
+
+	//splits a width x depth 8 bit heightmap into patches of cellsPerPatch
+	//cells, a power of two. The heights are mapped to [-scale/2, scale/2] and
+	//the terrain spans [-halfSize, halfSize] in x and z, as in the shaders.
+	void Init(const GLubyte* heights, int width, int depth, int cellsPerPatch, float scale, const glm::vec2& halfSize);
+	void Destroy();
+
+	//screen space error in pixels a patch may have
+	void SetPixelTolerance(float pixels);
+
+	//picks the level of every patch for a camera and fills the instances of
+	//the visible ones
+	void Update(const glm::vec3& eye, const glm::mat4& MVP, float viewportHeight, float fovy);
+
+	//draws the visible patches with one call per level
+	void Render();
+
+	//statistics
+	int GetTotalPatches() const;
+	int GetTotalLevels() const;
+	int GetDrawnPatches() const;
+	int GetDrawnTriangles() const;
+	int GetDrawCalls() const;
+
+protected:
+	struct Patch {
+		glm::vec3 min, max;			//world space bounds
+		vector<float> errors;		//world space error of every level
+		int level;					//level picked this frame
+	};
+
+	//per instance data, the first texture coordinate, the size and the
+	//level of the patch and the levels of its left, right, bottom and top
+	//neighbours
+	struct Instance {
+		glm::vec4 patch;
+		glm::vec4 neighbours;
+	};
+
+	//range of a level in the library buffers
+	struct Level {
+		int firstIndex, totalIndices, baseVertex;
+	};
+
+	int patchesX, patchesZ, cellsPerPatch, levels;
+	float uvSize;
+	vector<Patch> patches;
+	vector<Level> library;
+	float pixelTolerance;
+
+	GLuint vaoID, vboVerticesID, vboIndicesID, vboInstancesID;
+	vector<Instance> instances;
+	vector<int> levelCounts;
+	int drawnTriangles;
+};
@@ -1,6 +1,7 @@
 ﻿#include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <iostream>
+#include <sstream>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp> 
@@ -9,6 +10,7 @@
 #include <SOIL.h>
 
 #include "GLSLShader.h"
+#include "TerrainPatches.h"
 
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
@@ -30,6 +32,7 @@ const int WIDTH  = 1280;
 const int HEIGHT = 960;
 
 GLSLShader shader;
+GLSLShader patchShader;
 GLuint vaoID;
 GLuint vboVerticesID;
 GLuint vboIndicesID;
@@ -57,6 +60,16 @@ float rX=25, rY=-40, dist = -7;
 float scale = 50;
 float half_scale = scale/2.0f;
 
+//adaptive patches, each picks a grid of the library by its screen space error
+TerrainPatches terrainPatches;
+const int CELLS_PER_PATCH = 16;
+bool bAdaptive = true;
+float pixelTolerance = 1;
+
+//vertical field of view and viewport height for the screen space error
+const float FOVY = glm::radians(45.0f);
+int viewportHeight = HEIGHT;
+
 void OnMouseDown(int button, int s, int x, int y)
 {
 	if (s == GLUT_DOWN) 
@@ -107,6 +120,27 @@ void OnInit() {
 		glUniform1f(shader("half_scale"), half_scale);
 	shader.UnUse();
 
+	//setup the adaptive patch shader, it displaces the library grids in the
+	//vertex shader without a geometry shader
+	patchShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/patch.vert");
+	patchShader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/shader.frag");
+	patchShader.CreateAndLinkProgram();
+	patchShader.Use();	
+		patchShader.AddAttribute("vVertex"); 
+		patchShader.AddAttribute("vPatch"); 
+		patchShader.AddAttribute("vNeighbours"); 
+		patchShader.AddUniform("heightMapTexture");
+		patchShader.AddUniform("scale");
+		patchShader.AddUniform("half_scale");
+		patchShader.AddUniform("HALF_TERRAIN_SIZE");
+		patchShader.AddUniform("MVP");
+
+		glUniform1i(patchShader("heightMapTexture"), 0);
+		glUniform2i(patchShader("HALF_TERRAIN_SIZE"), TERRAIN_WIDTH>>1, TERRAIN_DEPTH>>1);
+		glUniform1f(patchShader("scale"), scale);
+		glUniform1f(patchShader("half_scale"), half_scale);
+	patchShader.UnUse();
+
 	GL_CHECK_ERRORS
 
 	//setup geometry
@@ -182,6 +216,10 @@ void OnInit() {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, texture_width, texture_height, 0, GL_RED, GL_UNSIGNED_BYTE, pData);
+
+	//the patches need the heights for their bounds and errors
+	terrainPatches.Init(pData, texture_width, texture_height, CELLS_PER_PATCH, scale, glm::vec2(TERRAIN_HALF_WIDTH, TERRAIN_HALF_DEPTH));
+	terrainPatches.SetPixelTolerance(pixelTolerance);
 	
 	free(pData);
 	
@@ -196,8 +234,12 @@ void OnInit() {
 
 void OnShutdown() {
 
-	//Destroy shader
+	//Destroy shaders
 	shader.DeleteShaderProgram();
+	patchShader.DeleteShaderProgram();
+
+	//Destroy patches
+	terrainPatches.Destroy();
 
 	//Destroy vao and vbo
 	glDeleteBuffers(1, &vboVerticesID);
@@ -211,9 +253,10 @@ void OnShutdown() {
 
 void OnResize(int w, int h) {
 	glViewport (0, 0, (GLsizei) w, (GLsizei) h);
+	viewportHeight = h;
 
 	//setup the projection matrix
-	P = glm::perspective(glm::radians(45.0f), (GLfloat)w/h, 0.01f, 10000.f);
+	P = glm::perspective(FOVY, (GLfloat)w/h, 0.01f, 10000.f);
 }
 
 void OnRender() {
@@ -224,16 +267,44 @@ void OnRender() {
 	glm::mat4 MV	= Ry;
     glm::mat4 MVP	= P*MV;
 
-	//glBindVertexArray(vaoID);
-		shader.Use();				
-			glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
-				glDrawElements(GL_TRIANGLES, TOTAL_INDICES, GL_UNSIGNED_INT, 0);
-		shader.UnUse();
-	//glBindVertexArray(0);
+	stringstream title;
+	if(bAdaptive) {
+		//pick the patch levels for the eye, which is the translation of the
+		//inverse modelview matrix
+		glm::vec3 eye = glm::vec3(glm::inverse(MV)[3]);
+		terrainPatches.Update(eye, MVP, float(viewportHeight), FOVY);
+		patchShader.Use();				
+			glUniformMatrix4fv(patchShader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
+				terrainPatches.Render();
+		patchShader.UnUse();
+		title<<"Adaptive patches - "<<terrainPatches.GetDrawnPatches()<<" patches, "<<terrainPatches.GetDrawnTriangles()<<" triangles, "<<terrainPatches.GetDrawCalls()<<" draw calls, tolerance: "<<pixelTolerance<<" px";
+	} else {
+		glBindVertexArray(vaoID);
+			shader.Use();				
+				glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
+					glDrawElements(GL_TRIANGLES, TOTAL_INDICES, GL_UNSIGNED_INT, 0);
+			shader.UnUse();
+		glBindVertexArray(0);
+		title<<"Geometry shader terrain - "<<(TERRAIN_WIDTH-1)*(TERRAIN_DEPTH-1)*2<<" triangles";
+	}
+	glutSetWindowTitle(title.str().c_str());
 
 	glutSwapBuffers();
 }
 
+//keyboard event handler to toggle the adaptive patches and to change their
+//screen space error tolerance
+void OnKey(unsigned char key, int x, int y) {
+	switch (key) {
+		case ' ': bAdaptive = !bAdaptive; break;
+		case '+': pixelTolerance *= 0.5f; break;
+		case '-': pixelTolerance *= 2.0f; break;
+	}
+	pixelTolerance = max(pixelTolerance, 0.1f);
+	terrainPatches.SetPixelTolerance(pixelTolerance);
+	glutPostRedisplay();
+}
+
 void main(int argc, char** argv) {
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);	
@@ -271,6 +342,7 @@ void main(int argc, char** argv) {
 
 	glutMouseFunc(OnMouseDown);
 	glutMotionFunc(OnMouseMove);
+	glutKeyboardFunc(OnKey);
 
 	glutMainLoop();	
 }
\ No newline at end of file
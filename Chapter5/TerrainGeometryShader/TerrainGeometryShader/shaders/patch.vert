@@ -0,0 +1,38 @@
+#version 330
+  
+layout (location=0) in vec2 vVertex;		//grid position in the patch
+layout (location=1) in vec4 vPatch;			//first texture coordinate, size and level of the patch
+layout (location=2) in vec4 vNeighbours;	//levels of the left, right, bottom and top neighbours
+
+uniform mat4 MVP;
+uniform ivec2 HALF_TERRAIN_SIZE;
+uniform sampler2D heightMapTexture;
+uniform float scale;
+uniform float half_scale;
+
+//moves a border vertex along the border onto the grid of a coarser neighbour
+int Snap(int cell, int level, float neighbour) {
+	int step = 1<<max(level - int(neighbour), 0);
+	return (cell/step)*step;
+}
+
+void main()
+{    
+	int level = int(vPatch.w);
+	int cells = 1<<level;
+	ivec2 cell = ivec2(vVertex*cells + 0.5);
+	if(cell.x == 0)
+		cell.y = Snap(cell.y, level, vNeighbours.x);
+	else if(cell.x == cells)
+		cell.y = Snap(cell.y, level, vNeighbours.y);
+	if(cell.y == 0)
+		cell.x = Snap(cell.x, level, vNeighbours.z);
+	else if(cell.y == cells)
+		cell.x = Snap(cell.x, level, vNeighbours.w);
+
+	//the patches past the heightmap are clamped to its border
+	vec2 uv = min(vPatch.xy + vec2(cell)/cells*vPatch.z, vec2(1));
+	float height = texture(heightMapTexture, uv).r*scale - half_scale;
+	vec2 xz = (uv*2.0-1)*HALF_TERRAIN_SIZE;
+	gl_Position = MVP*vec4(xz.x, height, xz.y, 1);
+}
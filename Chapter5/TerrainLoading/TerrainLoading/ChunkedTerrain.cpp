@@ -0,0 +1,682 @@
+#include "ChunkedTerrain.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//tile file identification
+const char TILE_FILE_MAGIC[4] = {'T','C','H','K'};
+const int TILE_FILE_VERSION = 1;
+
+//the shared index buffer uses 16 bit indices
+const int MAX_CHUNK_SIZE = 128;
+
+//nodes uploaded per frame at most, so a burst of loads is spread over frames
+const int MAX_UPLOADS_PER_FRAME = 16;
+
+//8 bit height range
+const float HEIGHT_RANGE = 255.0f;
+
+struct TileFileHeader {
+	char magic[4];
+	int version;
+	int width, depth;
+	int chunkSize, levels;
+	int totalNodes;
+};
+
+ChunkedTerrain::ChunkedTerrain(void)
+{
+	width = depth = chunkSize = levels = 0;
+	scale = 1;
+	vboIndicesID = 0;
+	totalIndices = 0;
+	pixelTolerance = 2;
+	maxResident = 1024;
+	totalResident = 0;
+	frame = 0;
+	drawnTriangles = 0;
+	bStreaming = true;
+	patchVaoID = patchVboID = instanceVboID = 0;
+	bQuit = false;
+}
+
+ChunkedTerrain::~ChunkedTerrain(void)
+{
+}
+
+//nodes per side of a level
+inline int NodesPerSide(int samples, int span) {
+	return max(1, (samples - 1 + span - 1)/span);
+}
+
+//first node of every level, the levels are stored from the root down and
+//the nodes of a level row by row. Returns the total number of nodes.
+static int GetLevelOffsets(int width, int depth, int chunkSize, int levels, vector<int>& offsets) {
+	offsets.resize(levels);
+	int total = 0;
+	for(int level=levels-1;level>=0;level--) {
+		offsets[level] = total;
+		int span = chunkSize<<level;
+		total += NodesPerSide(width, span)*NodesPerSide(depth, span);
+	}
+	return total;
+}
+
+bool ChunkedTerrain::WriteTileFile(const string& filename, const GLubyte* heights, int width, int depth, int chunkSize) {
+	chunkSize = max(2, min(chunkSize, MAX_CHUNK_SIZE));
+	int levels = 1;
+	while((chunkSize<<(levels-1)) < max(width-1, depth-1))
+		levels++;
+
+	vector<int> offsets;
+	int totalNodes = GetLevelOffsets(width, depth, chunkSize, levels, offsets);
+	int side = chunkSize + 1;
+	int nodeSize = side*side;
+
+	//point sample the heights of every node, so that the vertices of a node
+	//are also vertices of its children
+	vector<NodeRecord> records(totalNodes);
+	vector<GLubyte> data(size_t(totalNodes)*nodeSize);
+	for(int level=levels-1;level>=0;level--) {
+		int span = chunkSize<<level, step = 1<<level;
+		int nodesX = NodesPerSide(width, span);
+		int first = offsets[level], count = NodesPerSide(depth, span)*nodesX;
+		#pragma omp parallel for schedule(dynamic)
+		for(int n=0;n<count;n++) {
+			NodeRecord& record = records[first + n];
+			record.level = level;
+			record.x = (n%nodesX)*span;
+			record.z = (n/nodesX)*span;
+			record.offset = 0;
+			record.error = 0;
+			GLubyte* grid = &data[size_t(first + n)*nodeSize];
+			int minHeight = 255, maxHeight = 0;
+			for(int j=0;j<side;j++) {
+				int z = min(record.z + j*step, depth-1);
+				for(int i=0;i<side;i++) {
+					int x = min(record.x + i*step, width-1);
+					GLubyte h = heights[z*width + x];
+					grid[j*side + i] = h;
+					minHeight = min(minHeight, int(h));
+					maxHeight = max(maxHeight, int(h));
+				}
+			}
+			record.minHeight = float(minHeight);
+			record.maxHeight = float(maxHeight);
+		}
+	}
+
+	//the error of a node is the largest difference between its triangles and
+	//the heightmap samples it covers. Levels are done from the leaves up so
+	//that the error never shrinks towards the root.
+	for(int level=1;level<levels;level++) {
+		int span = chunkSize<<level, step = 1<<level;
+		int nodesX = NodesPerSide(width, span);
+		int childNodesX = NodesPerSide(width, span>>1), childNodesZ = NodesPerSide(depth, span>>1);
+		int first = offsets[level], count = NodesPerSide(depth, span)*nodesX;
+		#pragma omp parallel for schedule(dynamic)
+		for(int n=0;n<count;n++) {
+			NodeRecord& record = records[first + n];
+			const GLubyte* grid = &data[size_t(first + n)*nodeSize];
+			float error = 0;
+			int x1 = min(record.x + span, width-1), z1 = min(record.z + span, depth-1);
+			for(int z=record.z;z<=z1;z++) {
+				int j = min((z - record.z)/step, chunkSize-1);
+				int za = record.z + j*step, zb = min(za + step, depth-1);
+				float fz = (zb > za) ? float(z - za)/(zb - za) : 0;
+				for(int x=record.x;x<=x1;x++) {
+					int i = min((x - record.x)/step, chunkSize-1);
+					int xa = record.x + i*step, xb = min(xa + step, width-1);
+					float fx = (xb > xa) ? float(x - xa)/(xb - xa) : 0;
+
+					//the cells are split along the diagonal from (i+1,j) to (i,j+1)
+					float h00 = grid[j*side + i], h10 = grid[j*side + i+1];
+					float h01 = grid[(j+1)*side + i], h11 = grid[(j+1)*side + i+1];
+					float h = (fx + fz <= 1) ? h00 + fx*(h10 - h00) + fz*(h01 - h00)
+											 : h11 + (1-fx)*(h01 - h11) + (1-fz)*(h10 - h11);
+					error = max(error, fabs(h - heights[z*width + x]));
+				}
+			}
+			int cx = (n%nodesX)*2, cz = (n/nodesX)*2;
+			for(int c=0;c<4;c++) {
+				int x = cx + (c&1), z = cz + (c>>1);
+				if(x < childNodesX && z < childNodesZ)
+					error = max(error, records[offsets[level-1] + z*childNodesX + x].error);
+			}
+			record.error = error;
+		}
+	}
+
+	ofstream file(filename.c_str(), ios::binary);
+	if(!file)
+		return false;
+	TileFileHeader header;
+	memcpy(header.magic, TILE_FILE_MAGIC, 4);
+	header.version = TILE_FILE_VERSION;
+	header.width = width;
+	header.depth = depth;
+	header.chunkSize = chunkSize;
+	header.levels = levels;
+	header.totalNodes = totalNodes;
+	long long offset = sizeof(TileFileHeader) + sizeof(NodeRecord)*(long long)totalNodes;
+	for(int n=0;n<totalNodes;n++) {
+		records[n].offset = offset;
+		offset += nodeSize;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)&records[0], sizeof(NodeRecord)*records.size());
+	file.write((const char*)&data[0], data.size());
+	return bool(file);
+}
+
+bool ChunkedTerrain::Open(const string& name, float heightScale) {
+	Close();
+
+	ifstream file(name.c_str(), ios::binary);
+	if(!file)
+		return false;
+	TileFileHeader header;
+	file.read((char*)&header, sizeof(header));
+	if(!file || memcmp(header.magic, TILE_FILE_MAGIC, 4) != 0 || header.version != TILE_FILE_VERSION) {
+		cerr<<"Error: "<<name<<" is not a terrain tile file"<<endl;
+		return false;
+	}
+	filename = name;
+	width = header.width;
+	depth = header.depth;
+	chunkSize = header.chunkSize;
+	levels = header.levels;
+	scale = heightScale;
+
+	vector<NodeRecord> records(header.totalNodes);
+	file.read((char*)&records[0], sizeof(NodeRecord)*records.size());
+	if(!file)
+		return false;
+
+	//link the children
+	vector<int> offsets;
+	if(GetLevelOffsets(width, depth, chunkSize, levels, offsets) != header.totalNodes)
+		return false;
+	float heightToWorld = scale/HEIGHT_RANGE;
+	glm::vec3 origin(-(width-1)*0.5f, -scale*0.5f, -(depth-1)*0.5f);
+	nodes.resize(records.size());
+	for(int level=levels-1;level>=0;level--) {
+		int span = chunkSize<<level;
+		int nodesX = NodesPerSide(width, span);
+		int count = NodesPerSide(depth, span)*nodesX;
+		int childNodesX = (level > 0) ? NodesPerSide(width, span>>1) : 0;
+		int childNodesZ = (level > 0) ? NodesPerSide(depth, span>>1) : 0;
+		for(int n=offsets[level];n<offsets[level]+count;n++) {
+			Node& node = nodes[n];
+			node.record = records[n];
+			node.error = node.record.error*heightToWorld;
+			node.state = UNLOADED;
+			node.lastUsed = 0;
+			node.vaoID = node.vboID = 0;
+
+			int local = n - offsets[level];
+			int cx = (local%nodesX)*2, cz = (local/nodesX)*2;
+			for(int c=0;c<4;c++) {
+				int x = cx + (c&1), z = cz + (c>>1);
+				node.children[c] = (level > 0 && x < childNodesX && z < childNodesZ) ? offsets[level-1] + z*childNodesX + x : -1;
+			}
+		}
+	}
+	//a skirt as deep as the error of the coarser node covers the crack
+	//between two neighbours. Since a parent is drawn until all of its
+	//children are resident, the neighbour across an edge may be drawn at any
+	//level below the lowest common ancestor of the two nodes, so the skirt
+	//takes the error of the coarsest of those, which is the child of the
+	//common ancestor on the other side of the edge. Errors never shrink
+	//towards the root, so this also covers all finer neighbours.
+	for(size_t n=0;n<nodes.size();n++) {
+		Node& node = nodes[n];
+		int level = node.record.level, x = node.record.x, z = node.record.z;
+		int span = chunkSize<<level;
+		//a sample just outside every edge which is not the border of the map
+		int totalEdges = 0;
+		glm::ivec2 outside[4];
+		if(x > 0)
+			outside[totalEdges++] = glm::ivec2(x-1, z);
+		if(x + span < width-1)
+			outside[totalEdges++] = glm::ivec2(x+span, z);
+		if(z > 0)
+			outside[totalEdges++] = glm::ivec2(x, z-1);
+		if(z + span < depth-1)
+			outside[totalEdges++] = glm::ivec2(x, z+span);
+		float neighbourError = node.error;
+		for(int e=0;e<totalEdges;e++) {
+			for(int ancestor=level+1;ancestor<levels;ancestor++) {
+				int ancestorSpan = chunkSize<<ancestor;
+				if(x/ancestorSpan == outside[e].x/ancestorSpan && z/ancestorSpan == outside[e].y/ancestorSpan) {
+					int coarseSpan = chunkSize<<(ancestor-1);
+					int coarsest = offsets[ancestor-1] + (outside[e].y/coarseSpan)*NodesPerSide(width, coarseSpan) + outside[e].x/coarseSpan;
+					neighbourError = max(neighbourError, nodes[coarsest].error);
+					break;
+				}
+			}
+		}
+		node.skirt = neighbourError + 1;
+		node.min = origin + glm::vec3(float(node.record.x), node.record.minHeight*heightToWorld - node.skirt, float(node.record.z));
+		node.max = origin + glm::vec3(float(min(node.record.x + span, width-1)), node.record.maxHeight*heightToWorld, float(min(node.record.z + span, depth-1)));
+	}
+
+	//one index list for all nodes: the grid followed by the four skirts
+	int side = chunkSize + 1;
+	vector<GLushort> indices;
+	for(int j=0;j<chunkSize;j++) {
+		for(int i=0;i<chunkSize;i++) {
+			GLushort i0 = GLushort(j*side + i);
+			GLushort i1 = i0 + 1;
+			GLushort i2 = GLushort(i0 + side);
+			GLushort i3 = i2 + 1;
+			indices.push_back(i0); indices.push_back(i2); indices.push_back(i1);
+			indices.push_back(i1); indices.push_back(i2); indices.push_back(i3);
+		}
+	}
+	for(int edge=0;edge<4;edge++) {
+		GLushort skirtFirst = GLushort(side*side + edge*side);
+		for(int k=0;k<chunkSize;k++) {
+			//border vertices along the bottom, top, left and right edge
+			GLushort b0, b1;
+			if(edge < 2) {
+				int j = (edge == 0) ? 0 : chunkSize;
+				b0 = GLushort(j*side + k);
+				b1 = GLushort(j*side + k + 1);
+			} else {
+				int i = (edge == 2) ? 0 : chunkSize;
+				b0 = GLushort(k*side + i);
+				b1 = GLushort((k+1)*side + i);
+			}
+			GLushort s0 = GLushort(skirtFirst + k), s1 = GLushort(skirtFirst + k + 1);
+			indices.push_back(b0); indices.push_back(s0); indices.push_back(b1);
+			indices.push_back(b1); indices.push_back(s0); indices.push_back(s1);
+		}
+	}
+	totalIndices = int(indices.size());
+	glGenBuffers(1, &vboIndicesID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndicesID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	//the patch has the vertex layout of a node so it shares the indices, its
+	//vertices are grid positions with the skirt flag in z
+	vector<glm::vec3> patch(side*side + 4*side);
+	for(int j=0;j<side;j++) {
+		for(int i=0;i<side;i++)
+			patch[j*side + i] = glm::vec3(float(i), float(j), 0);
+	}
+	for(int k=0;k<side;k++) {
+		patch[side*side + k]			= glm::vec3(float(k), 0, 1);
+		patch[side*side + side + k]		= glm::vec3(float(k), float(chunkSize), 1);
+		patch[side*side + 2*side + k]	= glm::vec3(0, float(k), 1);
+		patch[side*side + 3*side + k]	= glm::vec3(float(chunkSize), float(k), 1);
+	}
+	glGenVertexArrays(1, &patchVaoID);
+	glGenBuffers(1, &patchVboID);
+	glGenBuffers(1, &instanceVboID);
+	glBindVertexArray(patchVaoID);
+		glBindBuffer(GL_ARRAY_BUFFER, patchVboID);
+		glBufferData(GL_ARRAY_BUFFER, patch.size()*sizeof(glm::vec3), &patch[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+		glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVboID);
+		glEnableVertexAttribArray(PATCH_ATTRIBUTE);
+		glVertexAttribPointer(PATCH_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, 0, 0);
+		glVertexAttribDivisor(PATCH_ATTRIBUTE, 1);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndicesID);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//the root is loaded right away so there is always something to draw
+	LoadedNode root;
+	root.node = 0;
+	vector<GLubyte> heights;
+	LoadNode(file, 0, heights, root.vertices);
+	Upload(root);
+
+	frame = 0;
+	bQuit = false;
+	streamer = thread(&ChunkedTerrain::StreamNodes, this);
+	return true;
+}
+
+void ChunkedTerrain::Close() {
+	if(streamer.joinable()) {
+		{
+			lock_guard<mutex> lock(queueMutex);
+			bQuit = true;
+		}
+		queueCondition.notify_all();
+		streamer.join();
+	}
+	requests.clear();
+	loaded.clear();
+
+	for(size_t n=0;n<nodes.size();n++) {
+		if(nodes[n].state == RESIDENT)
+			Evict(int(n));
+	}
+	nodes.clear();
+	drawList.clear();
+	if(vboIndicesID) {
+		glDeleteBuffers(1, &vboIndicesID);
+		vboIndicesID = 0;
+	}
+	if(patchVaoID) {
+		glDeleteVertexArrays(1, &patchVaoID);
+		glDeleteBuffers(1, &patchVboID);
+		glDeleteBuffers(1, &instanceVboID);
+		patchVaoID = patchVboID = instanceVboID = 0;
+	}
+}
+
+void ChunkedTerrain::LoadNode(ifstream& file, int node, vector<GLubyte>& heights, vector<glm::vec3>& vertices) const {
+	const NodeRecord& record = nodes[node].record;
+	int side = chunkSize + 1, step = 1<<record.level;
+	heights.resize(side*side);
+	file.seekg(record.offset);
+	file.read((char*)&heights[0], heights.size());
+
+	//world space grid vertices, the node is clamped to the heightmap so the
+	//cells past its border collapse
+	float heightToWorld = scale/HEIGHT_RANGE;
+	glm::vec3 origin(-(width-1)*0.5f, -scale*0.5f, -(depth-1)*0.5f);
+	vertices.resize(side*side + 4*side);
+	for(int j=0;j<side;j++) {
+		float z = float(min(record.z + j*step, depth-1));
+		for(int i=0;i<side;i++) {
+			float x = float(min(record.x + i*step, width-1));
+			vertices[j*side + i] = origin + glm::vec3(x, heights[j*side + i]*heightToWorld, z);
+		}
+	}
+
+	//skirt vertices below the bottom, top, left and right border
+	glm::vec3 down(0, -nodes[node].skirt, 0);
+	glm::vec3* skirts = &vertices[side*side];
+	for(int k=0;k<side;k++) {
+		skirts[k]			= vertices[k] + down;
+		skirts[side + k]	= vertices[chunkSize*side + k] + down;
+		skirts[2*side + k]	= vertices[k*side] + down;
+		skirts[3*side + k]	= vertices[k*side + chunkSize] + down;
+	}
+}
+
+void ChunkedTerrain::Upload(LoadedNode& data) {
+	Node& node = nodes[data.node];
+	glGenVertexArrays(1, &node.vaoID);
+	glGenBuffers(1, &node.vboID);
+	glBindVertexArray(node.vaoID);
+		glBindBuffer(GL_ARRAY_BUFFER, node.vboID);
+		glBufferData(GL_ARRAY_BUFFER, data.vertices.size()*sizeof(glm::vec3), &data.vertices[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+		glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndicesID);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	node.state = RESIDENT;
+	totalResident++;
+}
+
+void ChunkedTerrain::Evict(int n) {
+	Node& node = nodes[n];
+	glDeleteVertexArrays(1, &node.vaoID);
+	glDeleteBuffers(1, &node.vboID);
+	node.vaoID = node.vboID = 0;
+	node.state = UNLOADED;
+	totalResident--;
+}
+
+void ChunkedTerrain::Request(int n) {
+	if(nodes[n].state != UNLOADED)
+		return;
+	nodes[n].state = QUEUED;
+	requests.push_back(n);
+}
+
+void ChunkedTerrain::StreamNodes() {
+	//the thread reads through its own file handle
+	ifstream file(filename.c_str(), ios::binary);
+	vector<GLubyte> heights;
+	for(;;) {
+		LoadedNode data;
+		{
+			unique_lock<mutex> lock(queueMutex);
+			while(!bQuit && requests.empty())
+				queueCondition.wait(lock);
+			if(bQuit)
+				return;
+			data.node = requests.front();
+			requests.pop_front();
+		}
+		LoadNode(file, data.node, heights, data.vertices);
+		{
+			lock_guard<mutex> lock(queueMutex);
+			loaded.push_back(LoadedNode());
+			loaded.back().node = data.node;
+			loaded.back().vertices.swap(data.vertices);
+		}
+	}
+}
+
+//extracts the normalized frustum planes from a combined projection and view matrix
+static void ExtractPlanes(const glm::mat4& MVP, glm::vec4 planes[6]) {
+	glm::vec4 row[4];
+	for(int i=0;i<4;i++)
+		row[i] = glm::vec4(MVP[0][i], MVP[1][i], MVP[2][i], MVP[3][i]);
+	planes[0] = row[3] + row[0];
+	planes[1] = row[3] - row[0];
+	planes[2] = row[3] + row[1];
+	planes[3] = row[3] - row[1];
+	planes[4] = row[3] + row[2];
+	planes[5] = row[3] - row[2];
+	for(int i=0;i<6;i++)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+//returns false if the box is outside one of the planes
+static bool BoxInFrustum(const glm::vec4 planes[6], const glm::vec3& min, const glm::vec3& max) {
+	for(int i=0;i<6;i++) {
+		glm::vec3 p((planes[i].x > 0) ? max.x : min.x, (planes[i].y > 0) ? max.y : min.y, (planes[i].z > 0) ? max.z : min.z);
+		if(glm::dot(glm::vec3(planes[i]), p) + planes[i].w < 0)
+			return false;
+	}
+	return true;
+}
+
+void ChunkedTerrain::Select(int n, const glm::vec3& eye, const glm::vec4 planes[6], float K) {
+	Node& node = nodes[n];
+	if(!BoxInFrustum(planes, node.min, node.max))
+		return;
+	node.lastUsed = frame;
+
+	if(node.record.level > 0) {
+		//project the error of the node at its nearest point to the eye
+		glm::vec3 d = glm::max(glm::max(node.min - eye, eye - node.max), glm::vec3(0));
+		float distance = max(glm::length(d), 0.001f);
+		if(node.error*K/distance > pixelTolerance) {
+			//split only when all children are there, until then the node is drawn
+			bool bReady = true;
+			for(int c=0;c<4 && bStreaming;c++) {
+				int child = node.children[c];
+				if(child >= 0 && nodes[child].state != RESIDENT) {
+					nodes[child].lastUsed = frame;
+					Request(child);
+					bReady = false;
+				}
+			}
+			if(bReady) {
+				for(int c=0;c<4;c++) {
+					if(node.children[c] >= 0)
+						Select(node.children[c], eye, planes, K);
+				}
+				return;
+			}
+		}
+	}
+	if(node.state == RESIDENT || !bStreaming) {
+		drawList.push_back(n);
+		drawnTriangles += totalIndices/3;
+	}
+}
+
+void ChunkedTerrain::Update(const glm::vec3& eye, const glm::mat4& MVP, float viewportHeight, float fovy) {
+	if(nodes.empty())
+		return;
+	frame++;
+
+	//upload the nodes the streaming thread has finished
+	vector<LoadedNode> uploads;
+	{
+		lock_guard<mutex> lock(queueMutex);
+		int count = min(int(loaded.size()), MAX_UPLOADS_PER_FRAME);
+		for(int i=0;i<count;i++) {
+			uploads.push_back(LoadedNode());
+			uploads.back().node = loaded[i].node;
+			uploads.back().vertices.swap(loaded[i].vertices);
+		}
+		loaded.erase(loaded.begin(), loaded.begin() + count);
+	}
+	for(size_t i=0;i<uploads.size();i++)
+		Upload(uploads[i]);
+
+	//select the nodes to draw, K turns a world space error at distance 1
+	//into pixels
+	glm::vec4 planes[6];
+	ExtractPlanes(MVP, planes);
+	float K = viewportHeight/(2*tan(fovy*0.5f));
+	drawList.clear();
+	drawnTriangles = 0;
+	{
+		lock_guard<mutex> lock(queueMutex);
+
+		//drop the requests which were not needed again this frame, their
+		//nodes are requested again when they are
+		size_t kept = 0;
+		for(size_t i=0;i<requests.size();i++) {
+			int r = requests[i];
+			if(nodes[r].lastUsed == frame-1)
+				requests[kept++] = r;
+			else
+				nodes[r].state = UNLOADED;
+		}
+		requests.resize(kept);
+
+		Select(0, eye, planes, K);
+	}
+	queueCondition.notify_one();
+
+	//free the least recently used nodes above the resident limit, nodes
+	//needed this frame and the root are kept
+	if(totalResident > maxResident) {
+		vector<pair<int,int> > candidates;
+		for(size_t n=1;n<nodes.size();n++) {
+			if(nodes[n].state == RESIDENT && nodes[n].lastUsed < frame)
+				candidates.push_back(make_pair(nodes[n].lastUsed, int(n)));
+		}
+		sort(candidates.begin(), candidates.end());
+		for(size_t i=0;i<candidates.size() && totalResident>maxResident;i++)
+			Evict(candidates[i].second);
+	}
+}
+
+void ChunkedTerrain::Render(GLint levelUniform) {
+	for(size_t i=0;i<drawList.size();i++) {
+		const Node& node = nodes[drawList[i]];
+		if(!node.vaoID)
+			continue;
+		if(levelUniform >= 0)
+			glUniform1i(levelUniform, node.record.level);
+		glBindVertexArray(node.vaoID);
+			glDrawElements(GL_TRIANGLES, totalIndices, GL_UNSIGNED_SHORT, 0);
+	}
+	glBindVertexArray(0);
+}
+
+void ChunkedTerrain::RenderPatches(GLint levelUniform) {
+	//sort the selected nodes by level with a counting sort
+	levelCounts.assign(levels, 0);
+	for(size_t i=0;i<drawList.size();i++)
+		levelCounts[nodes[drawList[i]].record.level]++;
+	vector<int> next(levels, 0);
+	for(int level=1;level<levels;level++)
+		next[level] = next[level-1] + levelCounts[level-1];
+	instances.resize(drawList.size());
+	for(size_t i=0;i<drawList.size();i++) {
+		const Node& node = nodes[drawList[i]];
+		instances[next[node.record.level]++] = glm::vec4(float(node.record.x), float(node.record.z), float(1<<node.record.level), node.skirt);
+	}
+	if(instances.empty())
+		return;
+
+	//orphan the instance buffer and fill it
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVboID);
+	glBufferData(GL_ARRAY_BUFFER, instances.size()*sizeof(glm::vec4), 0, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size()*sizeof(glm::vec4), &instances[0]);
+
+	//one draw per level, the instance attribute is pointed at the first
+	//instance of the level since there is no base instance in GL 3.3
+	glBindVertexArray(patchVaoID);
+	int first = 0;
+	for(int level=0;level<levels;level++) {
+		if(!levelCounts[level])
+			continue;
+		glVertexAttribPointer(PATCH_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, 0, (const GLvoid*)(first*sizeof(glm::vec4)));
+		if(levelUniform >= 0)
+			glUniform1i(levelUniform, level);
+		glDrawElementsInstanced(GL_TRIANGLES, totalIndices, GL_UNSIGNED_SHORT, 0, levelCounts[level]);
+		first += levelCounts[level];
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ChunkedTerrain::SetStreaming(bool streaming) {
+	bStreaming = streaming;
+}
+
+void ChunkedTerrain::SetPixelTolerance(float pixels) {
+	pixelTolerance = max(pixels, 0.1f);
+}
+
+void ChunkedTerrain::SetMaxResident(int count) {
+	maxResident = max(count, 1);
+}
+
+int ChunkedTerrain::GetTotalNodes() const {
+	return int(nodes.size());
+}
+
+int ChunkedTerrain::GetTotalLevels() const {
+	return levels;
+}
+
+int ChunkedTerrain::GetResidentNodes() const {
+	return totalResident;
+}
+
+int ChunkedTerrain::GetDrawnNodes() const {
+	return int(drawList.size());
+}
+
+int ChunkedTerrain::GetDrawnTriangles() const {
+	return drawnTriangles;
+}
+
+int ChunkedTerrain::GetPendingLoads() {
+	lock_guard<mutex> lock(queueMutex);
+	return int(requests.size() + loaded.size());
+}
+
+int ChunkedTerrain::GetWidth() const {
+	return width;
+}
+
+int ChunkedTerrain::GetDepth() const {
+	return depth;
+}
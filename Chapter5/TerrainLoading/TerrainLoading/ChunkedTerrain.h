@@ -0,0 +1,158 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+//ChunkedTerrain class draws heightmaps of any size with a bounded number of
+//triangles and a bounded amount of memory. The heightmap is stored in a
+//tile file as a quadtree of chunks: every node has the same number of
+//vertices, the leaves cover chunkSize cells of the heightmap and every level
+//up covers twice the area at half the resolution. Along with the heights the
+//file stores the geometric error of every node, which is the largest height
+//difference between its surface and the full resolution heightmap.
+//
+//Every frame the quadtree is walked from the root and a node is split while
+//its error projected to the screen is larger than a pixel tolerance. Nodes
+//are drawn in place of their children until all children are loaded, so the
+//terrain never has holes. Missing nodes are read and turned into vertices on
+//a background thread and uploaded on the main thread; the least recently
+//used nodes are freed when more than the resident limit are loaded. Cracks
+//between neighbouring nodes of different levels are covered by skirts, a
+//strip of vertices hanging down from the border of every node.
+//
+//The selected nodes can also be drawn as patches: instances of one shared
+//grid whose heights are read from the heightmap texture in the vertex
+//shader. In that mode no vertices are streamed and all nodes count as
+//available, so only the heightmap texture is kept in GPU memory.
+class ChunkedTerrain
+{
+public:
+	//attribute locations of the vertex positions and the patch instances
+	static const GLuint POSITION_ATTRIBUTE = 0;
+	static const GLuint PATCH_ATTRIBUTE = 1;
+
+	//constructor/destructor
+	ChunkedTerrain(void);
+	~ChunkedTerrain(void);
+
+	//writes an 8 bit heightmap of width x depth samples as a tile file, the
+	//leaves of the quadtree cover chunkSize x chunkSize cells
+	static bool WriteTileFile(const string& filename, const GLubyte* heights, int width, int depth, int chunkSize);
+
+	//opens a tile file, loads the root and starts the streaming thread. The
+	//8 bit heights are mapped to [-scale/2, scale/2] and the terrain is
+	//centered at the origin with one unit between samples.
+	bool Open(const string& filename, float scale);
+	void Close();
+
+	//screen space error in pixels above which a node is split
+	void SetPixelTolerance(float pixels);
+
+	//maximum number of nodes kept in GPU memory
+	void SetMaxResident(int nodes);
+
+	//turns the streaming of node vertices on or off, nodes are drawn with
+	//RenderPatches when it is off
+	void SetStreaming(bool bStreaming);
+
+	//uploads the nodes loaded by the streaming thread, selects the nodes to
+	//draw for a camera and requests the missing ones
+	void Update(const glm::vec3& eye, const glm::mat4& MVP, float viewportHeight, float fovy);
+
+	//draws the selected nodes, the level of every node is passed to the
+	//levelUniform if it is not -1
+	void Render(GLint levelUniform = -1);
+
+	//draws the selected nodes as instances of the shared patch with one draw
+	//call per level. The patch vertices hold their grid position and a skirt
+	//flag; every instance is the first sample, the sample spacing and the
+	//skirt depth of its node.
+	void RenderPatches(GLint levelUniform = -1);
+
+	//statistics
+	int GetTotalNodes() const;
+	int GetTotalLevels() const;
+	int GetResidentNodes() const;
+	int GetDrawnNodes() const;
+	int GetDrawnTriangles() const;
+	int GetPendingLoads();
+	int GetWidth() const;
+	int GetDepth() const;
+
+protected:
+	//node record of the tile file, errors and heights are in 8 bit units
+	struct NodeRecord {
+		int level, x, z;			//level and first sample
+		float minHeight, maxHeight, error;
+		long long offset;			//(chunkSize+1)^2 heights
+	};
+
+	enum NodeState { UNLOADED, QUEUED, RESIDENT };
+
+	struct Node {
+		NodeRecord record;
+		int children[4];			//-1 where the map ends
+		glm::vec3 min, max;			//bounds including the skirt
+		float error;				//in world units
+		float skirt;				//depth of the skirt in world units
+		NodeState state;
+		int lastUsed;				//frame the node was last needed
+		GLuint vaoID, vboID;
+	};
+
+	//vertices of a node built by the streaming thread
+	struct LoadedNode {
+		int node;
+		vector<glm::vec3> vertices;
+	};
+
+	//reads a node and builds its grid and skirt vertices
+	void LoadNode(ifstream& file, int node, vector<GLubyte>& heights, vector<glm::vec3>& vertices) const;
+
+	void Upload(LoadedNode& loaded);
+	void Evict(int node);
+	void Request(int node);
+
+	//walks the quadtree and collects the nodes to draw
+	void Select(int node, const glm::vec3& eye, const glm::vec4 planes[6], float K);
+
+	//streaming thread function
+	void StreamNodes();
+
+	int width, depth, chunkSize, levels;
+	float scale;
+	vector<Node> nodes;
+
+	//index buffer shared by all nodes
+	GLuint vboIndicesID;
+	int totalIndices;
+
+	float pixelTolerance;
+	int maxResident, totalResident;
+	int frame;
+	vector<int> drawList;
+	int drawnTriangles;
+	bool bStreaming;
+
+	//patch grid and the instances of the selected nodes sorted by level
+	GLuint patchVaoID, patchVboID, instanceVboID;
+	vector<glm::vec4> instances;
+	vector<int> levelCounts;
+
+	//streaming thread with its request and result queues
+	string filename;
+	thread streamer;
+	mutex queueMutex;
+	condition_variable queueCondition;
+	deque<int> requests;
+	vector<LoadedNode> loaded;
+	bool bQuit;
+};
@@ -0,0 +1,321 @@
+#include "HeightmapProcessor.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+
+//cache file identification
+const char CACHE_FILE_MAGIC[4] = {'T','H','M','C'};
+const int CACHE_FILE_VERSION = 1;
+
+//smallest tile, one AVX2 register of bytes per row
+const int MIN_TILE_SIZE = 32;
+
+//normals are stored as signed bytes
+const float NORMAL_SCALE = 127.0f;
+
+HeightmapProcessor::HeightmapProcessor(void)
+{
+	tileSize = 256;
+	bUseSIMD = true;
+	timings.computeSeconds = timings.writeSeconds = 0;
+	timings.bytesWritten = 0;
+}
+
+HeightmapProcessor::~HeightmapProcessor(void)
+{
+}
+
+void HeightmapProcessor::SetTileSize(int size) {
+	tileSize = MIN_TILE_SIZE;
+	while(tileSize < size)
+		tileSize <<= 1;
+}
+
+int HeightmapProcessor::GetTileSize() const {
+	return tileSize;
+}
+
+void HeightmapProcessor::SetUseSIMD(bool bSIMD) {
+	bUseSIMD = bSIMD;
+}
+
+bool HeightmapProcessor::IsSIMDAvailable() {
+#ifdef USE_AVX2
+	return true;
+#else
+	return false;
+#endif
+}
+
+//levels of the pyramid of a tile, from tileSize/2 down to 1
+inline int GetTileLevels(int tileSize) {
+	int levels = 0;
+	while((tileSize>>levels) > 1)
+		levels++;
+	return levels;
+}
+
+int HeightmapProcessor::GetTileBytes() const {
+	int bytes = tileSize*tileSize*(sizeof(GLushort) + 2*sizeof(GLbyte));
+	for(int level=1;level<=GetTileLevels(tileSize);level++) {
+		int size = tileSize>>level;
+		bytes += 2*size*size*sizeof(GLushort);
+	}
+	return bytes;
+}
+
+const HeightmapProcessor::Timings& HeightmapProcessor::GetTimings() const {
+	return timings;
+}
+
+void HeightmapProcessor::Quantize(const GLubyte* window, int stride, GLushort* heights) const {
+	//b*257 maps [0,255] exactly onto [0,65535]
+	for(int z=0;z<tileSize;z++) {
+		const GLubyte* src = window + (z+1)*stride + 1;
+		GLushort* dst = heights + z*tileSize;
+		int x = 0;
+#ifdef USE_AVX2
+		if(bUseSIMD) {
+			for(;x+32<=tileSize;x+=32) {
+				//unpacking a byte with itself gives b | b<<8, the permute puts
+				//the bytes in order since the unpacks work within 128 bit lanes
+				__m256i v = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)(src + x)), 0xD8);
+				_mm256_storeu_si256((__m256i*)(dst + x), _mm256_unpacklo_epi8(v, v));
+				_mm256_storeu_si256((__m256i*)(dst + x + 16), _mm256_unpackhi_epi8(v, v));
+			}
+		}
+#endif
+		for(;x<tileSize;x++)
+			dst[x] = GLushort(src[x]*257);
+	}
+}
+
+void HeightmapProcessor::ComputeNormals(const GLubyte* window, int stride, float scale, GLbyte* normals) const {
+	//central differences with one unit between the samples
+	float k = 0.5f*scale/255.0f;
+	for(int z=0;z<tileSize;z++) {
+		const GLubyte* up = window + z*stride + 1;
+		const GLubyte* center = up + stride;
+		const GLubyte* down = center + stride;
+		GLbyte* dst = normals + 2*z*tileSize;
+		int x = 0;
+#ifdef USE_AVX2
+		if(bUseSIMD) {
+			__m256 vK = _mm256_set1_ps(k), one = _mm256_set1_ps(1.0f);
+			__m256 vScale = _mm256_set1_ps(NORMAL_SCALE), half = _mm256_set1_ps(0.5f);
+			__m256 zero = _mm256_setzero_ps();
+			for(;x+8<=tileSize;x+=8) {
+				__m256 l = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(center + x - 1))));
+				__m256 r = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(center + x + 1))));
+				__m256 u = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(up + x))));
+				__m256 d = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(down + x))));
+				__m256 dx = _mm256_mul_ps(_mm256_sub_ps(r, l), vK);
+				__m256 dz = _mm256_mul_ps(_mm256_sub_ps(d, u), vK);
+				__m256 length2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), one), _mm256_mul_ps(dz, dz));
+				__m256 invLength = _mm256_div_ps(one, _mm256_sqrt_ps(length2));
+				__m256 nx = _mm256_mul_ps(_mm256_sub_ps(zero, dx), invLength);
+				__m256 nz = _mm256_mul_ps(_mm256_sub_ps(zero, dz), invLength);
+				__m256i ix = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(nx, vScale), half)));
+				__m256i iz = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(nz, vScale), half)));
+
+				//interleave x and z and narrow them to bytes, the low 8 bytes
+				//of both lanes hold the 8 pairs
+				__m256i xz = _mm256_packs_epi32(_mm256_unpacklo_epi32(ix, iz), _mm256_unpackhi_epi32(ix, iz));
+				xz = _mm256_permute4x64_epi64(_mm256_packs_epi16(xz, xz), 0x08);
+				_mm_storeu_si128((__m128i*)(dst + 2*x), _mm256_castsi256_si128(xz));
+			}
+		}
+#endif
+		for(;x<tileSize;x++) {
+			float dx = (float(center[x+1]) - float(center[x-1]))*k;
+			float dz = (float(down[x]) - float(up[x]))*k;
+			float length2 = dx*dx + 1.0f + dz*dz;
+			float invLength = 1.0f/sqrtf(length2);
+			dst[2*x]	= GLbyte(int(floorf(-dx*invLength*NORMAL_SCALE + 0.5f)));
+			dst[2*x+1]	= GLbyte(int(floorf(-dz*invLength*NORMAL_SCALE + 0.5f)));
+		}
+	}
+}
+
+void HeightmapProcessor::Reduce(const GLushort* src, int size, GLushort* dst, bool bMax) const {
+	//minimum or maximum of every 2x2 block of a size x size level
+	int half = size/2;
+	for(int z=0;z<half;z++) {
+		const GLushort* row0 = src + 2*z*size;
+		const GLushort* row1 = row0 + size;
+		GLushort* out = dst + z*half;
+		int x = 0;
+#ifdef USE_AVX2
+		if(bUseSIMD) {
+			__m256i lowMask = _mm256_set1_epi32(0xFFFF);
+			for(;2*x+32<=size;x+=16) {
+				__m256i a0 = _mm256_loadu_si256((const __m256i*)(row0 + 2*x));
+				__m256i a1 = _mm256_loadu_si256((const __m256i*)(row1 + 2*x));
+				__m256i b0 = _mm256_loadu_si256((const __m256i*)(row0 + 2*x + 16));
+				__m256i b1 = _mm256_loadu_si256((const __m256i*)(row1 + 2*x + 16));
+				__m256i a = bMax ? _mm256_max_epu16(a0, a1) : _mm256_min_epu16(a0, a1);
+				__m256i b = bMax ? _mm256_max_epu16(b0, b1) : _mm256_min_epu16(b0, b1);
+
+				//neighbouring columns are the low and high half of a 32 bit lane
+				__m256i aLow = _mm256_and_si256(a, lowMask), aHigh = _mm256_srli_epi32(a, 16);
+				__m256i bLow = _mm256_and_si256(b, lowMask), bHigh = _mm256_srli_epi32(b, 16);
+				a = bMax ? _mm256_max_epu32(aLow, aHigh) : _mm256_min_epu32(aLow, aHigh);
+				b = bMax ? _mm256_max_epu32(bLow, bHigh) : _mm256_min_epu32(bLow, bHigh);
+				_mm256_storeu_si256((__m256i*)(out + x), _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8));
+			}
+		}
+#endif
+		for(;x<half;x++) {
+			GLushort a = row0[2*x], b = row0[2*x+1], c = row1[2*x], d = row1[2*x+1];
+			out[x] = bMax ? max(max(a, b), max(c, d)) : min(min(a, b), min(c, d));
+		}
+	}
+}
+
+void HeightmapProcessor::ProcessTile(const GLubyte* heights, int width, int depth, float scale, int tileX, int tileZ, GLubyte* tile) const {
+	//copy the tile with a one sample apron so that the steps need no border
+	//checks, samples past the map are clamped
+	int stride = tileSize + 2;
+	vector<GLubyte> window(stride*stride);
+	int x0 = tileX*tileSize - 1, z0 = tileZ*tileSize - 1;
+	for(int z=0;z<stride;z++) {
+		const GLubyte* row = heights + size_t(max(0, min(z0 + z, depth-1)))*width;
+		GLubyte* dst = &window[z*stride];
+		int first = max(0, -x0), last = min(stride, width - x0);
+		for(int x=0;x<first;x++)
+			dst[x] = row[0];
+		if(last > first)
+			memcpy(dst + first, row + x0 + first, last - first);
+		for(int x=max(first, last);x<stride;x++)
+			dst[x] = row[width-1];
+	}
+
+	GLushort* quantized = (GLushort*)tile;
+	GLbyte* normals = (GLbyte*)(quantized + tileSize*tileSize);
+	Quantize(&window[0], stride, quantized);
+	ComputeNormals(&window[0], stride, scale, normals);
+
+	//the first pyramid level is reduced from the heights, the others from
+	//the level below
+	GLushort* level = (GLushort*)(normals + 2*tileSize*tileSize);
+	const GLushort* srcMin = quantized;
+	const GLushort* srcMax = quantized;
+	for(int size=tileSize;size>1;size/=2) {
+		int half = size/2;
+		GLushort* dstMin = level;
+		GLushort* dstMax = level + half*half;
+		Reduce(srcMin, size, dstMin, false);
+		Reduce(srcMax, size, dstMax, true);
+		srcMin = dstMin;
+		srcMax = dstMax;
+		level = dstMax + half*half;
+	}
+}
+
+bool HeightmapProcessor::Process(const GLubyte* heights, int width, int depth, float scale, const string& filename) {
+	timings.computeSeconds = timings.writeSeconds = 0;
+	timings.bytesWritten = 0;
+
+	ofstream file(filename.c_str(), ios::binary);
+	if(!file)
+		return false;
+
+	Header header;
+	memcpy(header.magic, CACHE_FILE_MAGIC, 4);
+	header.version = CACHE_FILE_VERSION;
+	header.width = width;
+	header.depth = depth;
+	header.tileSize = tileSize;
+	header.tilesX = (width + tileSize - 1)/tileSize;
+	header.tilesZ = (depth + tileSize - 1)/tileSize;
+	header.tileLevels = GetTileLevels(tileSize);
+	header.topLevels = 1;
+	for(int x=header.tilesX, z=header.tilesZ;x>1 || z>1;x=(x+1)/2, z=(z+1)/2)
+		header.topLevels++;
+	header.scale = scale;
+	file.write((const char*)&header, sizeof(header));
+
+	//one row of tiles is processed in parallel and written at a time
+	int tileBytes = GetTileBytes();
+	int tileRootOffset = tileBytes - 2*sizeof(GLushort);
+	vector<GLubyte> row(size_t(header.tilesX)*tileBytes);
+	vector<GLushort> topMin(header.tilesX*header.tilesZ), topMax(header.tilesX*header.tilesZ);
+	for(int tileZ=0;tileZ<header.tilesZ;tileZ++) {
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		#pragma omp parallel for schedule(dynamic)
+		for(int tileX=0;tileX<header.tilesX;tileX++) {
+			GLubyte* tile = &row[size_t(tileX)*tileBytes];
+			ProcessTile(heights, width, depth, scale, tileX, tileZ, tile);
+			const GLushort* root = (const GLushort*)(tile + tileRootOffset);
+			topMin[tileZ*header.tilesX + tileX] = root[0];
+			topMax[tileZ*header.tilesX + tileX] = root[1];
+		}
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+		timings.computeSeconds += chrono::duration<double>(end - start).count();
+
+		file.write((const char*)&row[0], row.size());
+		timings.writeSeconds += chrono::duration<double>(chrono::high_resolution_clock::now() - end).count();
+	}
+
+	//pyramid over the tiles, odd sizes are rounded up and the missing
+	//neighbours ignored
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	vector<GLushort> top;
+	int sizeX = header.tilesX, sizeZ = header.tilesZ;
+	top.insert(top.end(), topMin.begin(), topMin.end());
+	top.insert(top.end(), topMax.begin(), topMax.end());
+	while(sizeX > 1 || sizeZ > 1) {
+		int halfX = (sizeX + 1)/2, halfZ = (sizeZ + 1)/2;
+		vector<GLushort> levelMin(halfX*halfZ, 0xFFFF), levelMax(halfX*halfZ, 0);
+		for(int z=0;z<sizeZ;z++) {
+			for(int x=0;x<sizeX;x++) {
+				int i = (z/2)*halfX + x/2;
+				levelMin[i] = min(levelMin[i], topMin[z*sizeX + x]);
+				levelMax[i] = max(levelMax[i], topMax[z*sizeX + x]);
+			}
+		}
+		top.insert(top.end(), levelMin.begin(), levelMin.end());
+		top.insert(top.end(), levelMax.begin(), levelMax.end());
+		topMin.swap(levelMin);
+		topMax.swap(levelMax);
+		sizeX = halfX;
+		sizeZ = halfZ;
+	}
+	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+	timings.computeSeconds += chrono::duration<double>(end - start).count();
+
+	file.write((const char*)&top[0], top.size()*sizeof(GLushort));
+	file.flush();
+	timings.writeSeconds += chrono::duration<double>(chrono::high_resolution_clock::now() - end).count();
+	timings.bytesWritten = sizeof(header) + (long long)header.tilesX*header.tilesZ*tileBytes + top.size()*sizeof(GLushort);
+	return bool(file);
+}
+
+bool HeightmapProcessor::ReadTile(const string& filename, int tileX, int tileZ, Header& header, vector<GLubyte>& tile) {
+	ifstream file(filename.c_str(), ios::binary);
+	if(!file)
+		return false;
+	file.read((char*)&header, sizeof(header));
+	if(!file || memcmp(header.magic, CACHE_FILE_MAGIC, 4) != 0 || header.version != CACHE_FILE_VERSION)
+		return false;
+	if(tileX < 0 || tileZ < 0 || tileX >= header.tilesX || tileZ >= header.tilesZ)
+		return false;
+
+	HeightmapProcessor processor;
+	processor.SetTileSize(header.tileSize);
+	int tileBytes = processor.GetTileBytes();
+	tile.resize(tileBytes);
+	file.seekg(sizeof(header) + (long long)(tileZ*header.tilesX + tileX)*tileBytes);
+	file.read((char*)&tile[0], tileBytes);
+	return bool(file);
+}
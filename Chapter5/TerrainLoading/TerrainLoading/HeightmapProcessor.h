@@ -0,0 +1,81 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+//HeightmapProcessor class turns an 8 bit heightmap into a tiled cache file
+//with the data a lit, culled terrain derives from its heights. The map
+//is cut into tiles of tileSize x tileSize samples, samples past the border
+//of the map are clamped. Every tile holds
+//	- the heights quantized to 16 bit unsigned normalized values
+//	- the normals as two signed bytes (x and z, y is always positive and is
+//	  rebuilt from them)
+//	- a min/max pyramid of the 16 bit heights, level k holds the minima and
+//	  then the maxima of the 2^k x 2^k blocks of the tile
+//The tiles are stored row by row after the header, all of them have the same
+//size so a tile is found without a table. After the tiles comes a min/max
+//pyramid over the tiles, from one entry per tile up to one for the map.
+//
+//The tiles are processed in parallel with OpenMP, a row of tiles at a time so
+//that only one row is kept in memory, and with AVX2 when it is available.
+//
+//This is a benchmark tool, run with --benchmark, which measures how fast
+//such a preprocessing stage runs on the CPU. The terrain sample does not
+//read the cache: ChunkedTerrain keeps the bounds of its nodes in its own tile
+//file, from the point samples it draws, and its shaders are not lit.
+class HeightmapProcessor
+{
+public:
+	//cache file header
+	struct Header {
+		char magic[4];
+		int version;
+		int width, depth;
+		int tileSize, tilesX, tilesZ;
+		int tileLevels, topLevels;
+		float scale;
+	};
+
+	//time spent computing the tiles and writing the file
+	struct Timings {
+		double computeSeconds, writeSeconds;
+		long long bytesWritten;
+	};
+
+	//constructor/destructor
+	HeightmapProcessor(void);
+	~HeightmapProcessor(void);
+
+	//tile size in samples, a power of two of at least 32
+	void SetTileSize(int size);
+	int GetTileSize() const;
+
+	//turns the AVX2 code paths off to compare with the scalar ones
+	void SetUseSIMD(bool bUseSIMD);
+	static bool IsSIMDAvailable();
+
+	//processes width x depth heights into a cache file. The heights are
+	//scaled by scale/255 for the normals, as they are for drawing.
+	bool Process(const GLubyte* heights, int width, int depth, float scale, const string& filename);
+
+	//processes one tile into GetTileBytes bytes laid out as in the file
+	void ProcessTile(const GLubyte* heights, int width, int depth, float scale, int tileX, int tileZ, GLubyte* tile) const;
+	int GetTileBytes() const;
+
+	//reads the header and a tile of a cache file
+	static bool ReadTile(const string& filename, int tileX, int tileZ, Header& header, vector<GLubyte>& tile);
+
+	const Timings& GetTimings() const;
+
+protected:
+	//steps of a single tile
+	void Quantize(const GLubyte* window, int stride, GLushort* heights) const;
+	void ComputeNormals(const GLubyte* window, int stride, float scale, GLbyte* normals) const;
+	void Reduce(const GLushort* src, int size, GLushort* dst, bool bMax) const;
+
+	int tileSize;
+	bool bUseSIMD;
+	Timings timings;
+};
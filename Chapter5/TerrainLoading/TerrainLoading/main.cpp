@@ -1,6 +1,15 @@
 ﻿#include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp> 
@@ -9,6 +18,8 @@
 #include <SOIL.h>
 
 #include "GLSLShader.h"
+#include "ChunkedTerrain.h"
+#include "HeightmapProcessor.h"
 
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
@@ -34,35 +45,37 @@ const int HEIGHT = 960;
 //shaders for use in the recipe
 GLSLShader shader;
 
-//IDs for vertex array and buffer object
-GLuint vaoID;
-GLuint vboVerticesID;
-GLuint vboIndicesID;
+//shader drawing the selected nodes as instanced patches
+GLSLShader patchShader;
+
+//chunked terrain streamed from a tile file
+ChunkedTerrain terrain;
 
-//heighmap texture ID
+//heighmap texture ID read by the patches
 GLuint heightMapTextureID;
 
-//heightmap texture dimensions and half dimensions
-const int TERRAIN_WIDTH = 512;
-const int TERRAIN_DEPTH = 512; 
-const int TERRAIN_HALF_WIDTH = TERRAIN_WIDTH>>1;
-const int TERRAIN_HALF_DEPTH = TERRAIN_DEPTH>>1;
+//draw the terrain as instanced patches instead of streamed chunks
+bool bPatches = false;
 
-//heightmap height scale and half scale values
+//heightmap height scale
 float scale = 50;
-float half_scale = scale/2.0f;
 
-//total vertices and indices in the terrain
-const int TOTAL = (TERRAIN_WIDTH*TERRAIN_DEPTH);
-const int TOTAL_INDICES = TOTAL*2*3;
+//the heightmap is repeated this many times along each side
+int tiles = 1;
+
+//cells covered by the leaves of the quadtree
+const int CHUNK_SIZE = 64;
+
+//screen space error tolerance in pixels
+float pixelTolerance = 2;
+
+//vertical field of view and viewport height for the screen space error
+const float FOVY = glm::radians(45.0f);
+int viewportHeight = HEIGHT;
 
 //heightmap filename
 const string filename = "../../media/heightmap512x512.png";
  
-//height map vertices and indices
-glm::vec3 vertices[TOTAL];
-GLuint indices[TOTAL_INDICES];
-
 //projection and modelview matrices
 glm::mat4  P = glm::mat4(1);
 glm::mat4 MV = glm::mat4(1);
@@ -102,118 +115,210 @@ void OnMouseMove(int x, int y)
 	glutPostRedisplay(); 
 }
 
+//loads the heightmap and repeats it tiles x tiles times
+void LoadHeightmap(vector<GLubyte>& heights, int& width, int& depth) {
+	//load the heightmap image using SOIL	
+	int texture_width = 0, texture_height = 0, channels=0;		 
+	GLubyte* pData = SOIL_load_image(filename.c_str(), &texture_width, &texture_height, &channels, SOIL_LOAD_L);
+	if(!pData) {
+		cerr<<"Cannot load heightmap "<<filename<<endl;
+		exit(EXIT_FAILURE);
+	}
+
+	//vertically flip the heightmap image on Y axis since it is inverted 
+	for(int j = 0; j*2 < texture_height; ++j )
+	{
+		int index1 = j * texture_width ;
+		int index2 = (texture_height - 1 - j) * texture_width ;
+		for(int i = texture_width ; i > 0; --i )
+		{
+			GLubyte temp = pData[index1];
+			pData[index1] = pData[index2];
+			pData[index2] = temp;
+			++index1;
+			++index2;
+		}
+	} 
+
+	//mirror every other copy so the copies join without seams
+	width = texture_width*tiles;
+	depth = texture_height*tiles;
+	heights.resize(size_t(width)*depth);
+	for(int z=0;z<depth;z++) {
+		int tz = z/texture_height, iz = z%texture_height;
+		if(tz&1)
+			iz = texture_height-1-iz;
+		for(int x=0;x<width;x++) {
+			int tx = x/texture_width, ix = x%texture_width;
+			if(tx&1)
+				ix = texture_width-1-ix;
+			heights[size_t(z)*width + x] = pData[iz*texture_width + ix];
+		}
+	}
+	SOIL_free_image_data(pData);
+}
+
+//writes the tile file the terrain is streamed from unless it is already there
+string CreateTileFile(const vector<GLubyte>& heights, int width, int depth) {
+	stringstream name;
+	name<<"terrain_"<<width<<"x"<<depth<<".chunks";
+	if(ifstream(name.str().c_str(), ios::binary))
+		return name.str();
+
+	cout<<"Writing tile file "<<name.str()<<endl;
+	if(!ChunkedTerrain::WriteTileFile(name.str(), &heights[0], width, depth, CHUNK_SIZE)) {
+		cerr<<"Cannot write tile file "<<name.str()<<endl;
+		exit(EXIT_FAILURE);
+	}
+	return name.str();
+}
+
+//benchmark of the heightmap preprocessing, which is not used by the terrain:
+//preprocesses a size x size heightmap with and without SIMD on one and on
+//all threads, checks the cache file against the scalar code and deletes it
+void RunBenchmark(int size) {
+	tiles = max(1, (size + 511)/512);
+	vector<GLubyte> heights;
+	int width = 0, depth = 0;
+	LoadHeightmap(heights, width, depth);
+	const char* cacheFile = "benchmark.heights";
+
+	int maxThreads = 1;
+#ifdef _OPENMP
+	maxThreads = omp_get_max_threads();
+#endif
+	printf("Heightmap preprocessing benchmark (the terrain does not use the cache): %dx%d samples, %.1f MB in\n", width, depth, heights.size()/1e6);
+	printf("%-8s %8s %12s %12s %12s %12s\n", "code", "threads", "compute ms", "GB/s in", "write ms", "MB out");
+
+	HeightmapProcessor processor;
+	for(int simd=0;simd<2;simd++) {
+		if(simd && !HeightmapProcessor::IsSIMDAvailable())
+			break;
+		processor.SetUseSIMD(simd == 1);
+		for(int run=0;run<2;run++) {
+			int threads = run ? maxThreads : 1;
+			if(run && maxThreads == 1)
+				break;
+#ifdef _OPENMP
+			omp_set_num_threads(threads);
+#endif
+			if(!processor.Process(&heights[0], width, depth, scale, cacheFile)) {
+				printf("cannot write %s\n", cacheFile);
+				return;
+			}
+			const HeightmapProcessor::Timings& timings = processor.GetTimings();
+			printf("%-8s %8d %12.1f %12.2f %12.1f %12.1f\n", simd ? "AVX2" : "scalar", threads, timings.computeSeconds*1000,
+				heights.size()/timings.computeSeconds/1e9, timings.writeSeconds*1000, timings.bytesWritten/1e6);
+		}
+	}
+#ifdef _OPENMP
+	omp_set_num_threads(maxThreads);
+#endif
+
+	//compare some tiles of the last file with the scalar code and check that
+	//their roots are the range of their heights
+	HeightmapProcessor reference;
+	reference.SetUseSIMD(false);
+	HeightmapProcessor::Header header;
+	vector<GLubyte> tile, expected(reference.GetTileBytes());
+	int tilesX = (width + reference.GetTileSize() - 1)/reference.GetTileSize();
+	int tilesZ = (depth + reference.GetTileSize() - 1)/reference.GetTileSize();
+	vector<int> checked;
+	for(int t=0;t<tilesX*tilesZ;t+=max(1, tilesX*tilesZ/64))
+		checked.push_back(t);
+	if(checked.back() != tilesX*tilesZ-1)
+		checked.push_back(tilesX*tilesZ-1);
+	int mismatches = 0;
+	for(size_t i=0;i<checked.size();i++) {
+		int tileX = checked[i]%tilesX, tileZ = checked[i]/tilesX;
+		if(!HeightmapProcessor::ReadTile(cacheFile, tileX, tileZ, header, tile)) {
+			mismatches++;
+			continue;
+		}
+		reference.ProcessTile(&heights[0], width, depth, scale, tileX, tileZ, &expected[0]);
+		const GLushort* quantized = (const GLushort*)&tile[0];
+		GLushort minHeight = 0xFFFF, maxHeight = 0;
+		for(int j=0;j<header.tileSize*header.tileSize;j++) {
+			minHeight = min(minHeight, quantized[j]);
+			maxHeight = max(maxHeight, quantized[j]);
+		}
+		const GLushort* root = (const GLushort*)&tile[tile.size() - 2*sizeof(GLushort)];
+		if(tile != expected || root[0] != minHeight || root[1] != maxHeight)
+			mismatches++;
+	}
+	remove(cacheFile);
+	printf("correctness: %d of %d tiles checked against the scalar code differ\n", mismatches, int(checked.size()));
+}
+
 //OpenGL initialization
 void OnInit() {
 
 	GL_CHECK_ERRORS
-	//load heightmap shader
-	shader.LoadFromFile(GL_VERTEX_SHADER, "shaders/shader.vert");
-	shader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/shader.frag");
+	//load chunk shader
+	shader.LoadFromFile(GL_VERTEX_SHADER, "shaders/chunk.vert");
+	shader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/chunk.frag");
 	//compile and link shader
 	shader.CreateAndLinkProgram();
 	shader.Use();	
 		//add attributes and uniforms
 		shader.AddAttribute("vVertex"); 
-		shader.AddUniform("heightMapTexture");
-		shader.AddUniform("scale");
-		shader.AddUniform("half_scale");
-		shader.AddUniform("HALF_TERRAIN_SIZE");
 		shader.AddUniform("MVP");
-		//set values of constant uniforms as initialization	
-		glUniform1i(shader("heightMapTexture"), 0);
-		glUniform2i(shader("HALF_TERRAIN_SIZE"), TERRAIN_WIDTH>>1, TERRAIN_DEPTH>>1);
-		glUniform1f(shader("scale"), scale);
-		glUniform1f(shader("half_scale"), half_scale);
+		shader.AddUniform("level");
 	shader.UnUse();
 
-	GL_CHECK_ERRORS
-		 
-		
-	//fill indices array
-	GLuint* id=&indices[0];
-	int i=0, j=0;
-	
-	//setup vertices 
-	int count = 0;
-	//fill terrain vertices
-	for( j=0;j<TERRAIN_DEPTH;j++) {		 
-		for( i=0;i<TERRAIN_WIDTH;i++) {	  
-			vertices[count] = glm::vec3( (float(i)/(TERRAIN_WIDTH-1)), 
-										 0, 
-										 (float(j)/(TERRAIN_DEPTH-1)));
-			count++;
-		}
-	}
-	 
-	//fill terrain indices
-	for (i = 0; i < TERRAIN_DEPTH-1; i++) {        
-		for (j = 0; j < TERRAIN_WIDTH-1; j++) {			
-			int i0 = j+ i*TERRAIN_WIDTH;
-			int i1 = i0+1;
-			int i2 = i0+TERRAIN_WIDTH;
-			int i3 = i2+1;
-			*id++ = i0; 
-			*id++ = i2; 
-			*id++ = i1; 
-			*id++ = i1; 
-			*id++ = i2; 
-			*id++ = i3; 
-		}    
-	}
+	//load patch shader
+	patchShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/shader.vert");
+	patchShader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/shader.frag");
+	//compile and link shader
+	patchShader.CreateAndLinkProgram();
+	patchShader.Use();	
+		//add attributes and uniforms
+		patchShader.AddAttribute("vVertex"); 
+		patchShader.AddAttribute("vPatch"); 
+		patchShader.AddUniform("heightMapTexture");
+		patchShader.AddUniform("scale");
+		patchShader.AddUniform("half_scale");
+		patchShader.AddUniform("TERRAIN_SIZE");
+		patchShader.AddUniform("MVP");
+		patchShader.AddUniform("level");
+		//set values of constant uniforms as initialization	
+		glUniform1i(patchShader("heightMapTexture"), 0);
+		glUniform1f(patchShader("scale"), scale);
+		glUniform1f(patchShader("half_scale"), scale/2.0f);
+	patchShader.UnUse();
 
 	GL_CHECK_ERRORS
 
-	//setup terrain vertex array and vertex buffer objects 
-	glGenVertexArrays(1, &vaoID);
-	glGenBuffers(1, &vboVerticesID);
-	glGenBuffers(1, &vboIndicesID);
-	 
-	glBindVertexArray(vaoID);	
-
-		glBindBuffer (GL_ARRAY_BUFFER, vboVerticesID);
-		//pass terrain vertices to buffer object
-		glBufferData (GL_ARRAY_BUFFER, sizeof(vertices), &vertices[0], GL_STATIC_DRAW);
-		GL_CHECK_ERRORS
-		//enable vertex attribute array for position
-		glEnableVertexAttribArray(shader["vVertex"]);
-		glVertexAttribPointer(shader["vVertex"], 3, GL_FLOAT, GL_FALSE,0,0);
-		GL_CHECK_ERRORS 
-		//pass the terrain indices array to element array buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndicesID);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), &indices[0], GL_STATIC_DRAW);
-		GL_CHECK_ERRORS
-			
-	//load the heightmap texture using SOIL	
-	int texture_width = 0, texture_height = 0, channels=0;		 
-	GLubyte* pData = SOIL_load_image(filename.c_str(), &texture_width, &texture_height, &channels, SOIL_LOAD_L);
-	
-	//vertically flip the heightmap image on Y axis since it is inverted 
-	for( j = 0; j*2 < texture_height; ++j )
-	{
-		int index1 = j * texture_width ;
-		int index2 = (texture_height - 1 - j) * texture_width ;
-		for( i = texture_width ; i > 0; --i )
-		{
-			GLubyte temp = pData[index1];
-			pData[index1] = pData[index2];
-			pData[index2] = temp;
-			++index1;
-			++index2;
-		}
-	} 
+	vector<GLubyte> heights;
+	int width = 0, depth = 0;
+	LoadHeightmap(heights, width, depth);
 
-	//setup OpenGL texture
+	//setup the heightmap texture for the patches, texelFetch is used so it
+	//needs no filtering
 	glGenTextures(1, &heightMapTextureID);
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, heightMapTextureID);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, texture_width, texture_height, 0, GL_RED, GL_UNSIGNED_BYTE, pData);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, depth, 0, GL_RED, GL_UNSIGNED_BYTE, &heights[0]);
 	
-	//free SOIL image data
-	SOIL_free_image_data(pData);
+	patchShader.Use();
+		glUniform2i(patchShader("TERRAIN_SIZE"), width, depth);
+	patchShader.UnUse();
+
+	GL_CHECK_ERRORS
+
+	//open the terrain, only the root is loaded here and the rest is streamed
+	//in as the camera needs it
+	if(!terrain.Open(CreateTileFile(heights, width, depth), scale)) {
+		cerr<<"Cannot open the terrain"<<endl;
+		exit(EXIT_FAILURE);
+	}
+	terrain.SetPixelTolerance(pixelTolerance);
+	cout<<"Terrain: "<<terrain.GetWidth()<<"x"<<terrain.GetDepth()<<" samples, "<<terrain.GetTotalNodes()<<" nodes in "<<terrain.GetTotalLevels()<<" levels"<<endl;
 	
 	GL_CHECK_ERRORS
 
@@ -228,16 +333,16 @@ void OnInit() {
 //release all allocated resources
 void OnShutdown() {
 
-	//Destroy shader
+	//Destroy shaders
 	shader.DeleteShaderProgram();
+	patchShader.DeleteShaderProgram();
 
-	//Destroy vao and vbo
-	glDeleteBuffers(1, &vboVerticesID);
-	glDeleteBuffers(1, &vboIndicesID);
-	glDeleteVertexArrays(1, &vaoID);
+	//stop the streaming thread and free the nodes
+	terrain.Close();
 
 	//Delete textures
 	glDeleteTextures(1, &heightMapTextureID);
+
 	cout<<"Shutdown successfull"<<endl;
 }
 
@@ -245,9 +350,10 @@ void OnShutdown() {
 void OnResize(int w, int h) {
 	//set the viewport
 	glViewport (0, 0, (GLsizei) w, (GLsizei) h);
+	viewportHeight = h;
 
 	//setup the projection matrix
-	P = glm::perspective(glm::radians(45.0f), (GLfloat)w/h, 0.01f, 10000.f);
+	P = glm::perspective(FOVY, (GLfloat)w/h, 0.01f, 10000.f);
 }
 
 //display function
@@ -262,30 +368,75 @@ void OnRender() {
 	glm::mat4 MV	= Ry;
     glm::mat4 MVP	= P*MV;
 
-	//since we have kept the terrain vertex array object bound
-	//it is still bound to the context so we can directly call draw element
-	//which will draw vertices from the bound vertex array object
+	//select the terrain nodes for the camera, the eye is the translation
+	//of the inverse modelview matrix
+	glm::vec3 eye = glm::vec3(glm::inverse(MV)[3]);
+	terrain.Update(eye, MVP, float(viewportHeight), FOVY);
+
 	//bind the terrain shader
-	shader.Use();				
+	GLSLShader& terrainShader = bPatches ? patchShader : shader;
+	terrainShader.Use();				
 		//pass shader uniforms
-		glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
-			//draw terrain mesh
-			glDrawElements(GL_TRIANGLES, TOTAL_INDICES, GL_UNSIGNED_INT, 0);
+		glUniformMatrix4fv(terrainShader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
+			//draw the selected nodes
+			if(bPatches)
+				terrain.RenderPatches(terrainShader("level"));
+			else
+				terrain.Render(terrainShader("level"));
 	//unbind shader
-	shader.UnUse();
+	terrainShader.UnUse();
+
+	//show the terrain statistics
+	stringstream title;
+	title<<(bPatches ? "Patch terrain - " : "Chunked terrain - ")<<terrain.GetDrawnNodes()<<" nodes, "<<terrain.GetDrawnTriangles()<<" triangles, "<<terrain.GetResidentNodes()<<" resident, "<<terrain.GetPendingLoads()<<" loading, tolerance: "<<pixelTolerance<<" px";
+	glutSetWindowTitle(title.str().c_str());
 	
 	//swap front and back buffers to show the rendered result
 	glutSwapBuffers();
 }
 
+//call display function while nodes are streamed in
+void OnIdle() {
+	if(terrain.GetPendingLoads() > 0)
+		glutPostRedisplay();
+}
+
+//keyboard event handler to change the screen space error tolerance and to
+//toggle between streamed chunks and instanced patches
+void OnKey(unsigned char key, int x, int y) {
+	switch (key) {
+		case ' ':
+			bPatches = !bPatches;
+			terrain.SetStreaming(!bPatches);
+		break;
+		case '+': pixelTolerance *= 0.5f; break;
+		case '-': pixelTolerance *= 2.0f; break;
+	}
+	pixelTolerance = max(pixelTolerance, 0.1f);
+	terrain.SetPixelTolerance(pixelTolerance);
+	glutPostRedisplay();
+}
+
 int main(int argc, char** argv) {
+	//run the standalone preprocessing benchmark without opening a window, on
+	//a 16k x 16k heightmap unless a size is given
+	if(argc>1 && strcmp(argv[1], "--benchmark")==0) {
+		RunBenchmark((argc>2) ? max(32, atoi(argv[2])) : 16384);
+		return 0;
+	}
+
 	//freeglut initialization
 	glutInit(&argc, argv);
+
+	//optional number of copies of the heightmap along each side
+	if(argc > 1)
+		tiles = max(1, atoi(argv[1]));
+
 	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);	
 	glutInitContextVersion (3, 3);
 	glutInitContextFlags (GLUT_CORE_PROFILE | GLUT_DEBUG);
 	glutInitWindowSize(WIDTH, HEIGHT);
-	glutCreateWindow("Simple terrain - OpenGL 3.3");
+	glutCreateWindow("Chunked terrain - OpenGL 3.3");
 	
 	//initialize glew
 	glewExperimental = GL_TRUE;	 
@@ -319,6 +470,8 @@ int main(int argc, char** argv) {
 	glutReshapeFunc(OnResize);
 	glutMouseFunc(OnMouseDown);
 	glutMotionFunc(OnMouseMove);
+	glutIdleFunc(OnIdle);
+	glutKeyboardFunc(OnKey);
 
 	//call main loop
 	glutMainLoop();	
@@ -0,0 +1,13 @@
+#version 330 core
+ 
+layout (location=0) out vec4 vFragColor;	//fragment shader output
+
+//uniforms
+uniform int level;	//quadtree level of the chunk
+
+void main()
+{
+	//colour the chunks by their level so the level of detail can be seen
+	const vec3 colors[4] = vec3[4](vec3(1,1,1), vec3(1,1,0), vec3(0,1,1), vec3(1,0,1));
+	vFragColor = vec4(colors[level%4], 1);
+}
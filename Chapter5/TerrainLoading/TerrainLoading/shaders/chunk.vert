@@ -0,0 +1,12 @@
+#version 330 core
+  
+layout (location=0) in vec3 vVertex; //vertex position in world space
+
+//uniforms
+uniform mat4 MVP;					//combined modelview projection matrix
+
+void main()
+{   
+	//the chunk vertices already have their height so they are only projected
+	gl_Position = MVP*vec4(vVertex, 1);			
+}
@@ -2,8 +2,12 @@
  
 layout (location=0) out vec4 vFragColor;	//fragment shader output
 
+//uniforms
+uniform int level;	//quadtree level of the patch
+
 void main()
 {
-	//output solid white color as fragment output
-   vFragColor = vec4(1,1,1,1);
-}
\ No newline at end of file
+	//colour the patches by their level like the chunks
+	const vec3 colors[4] = vec3[4](vec3(1,1,1), vec3(1,1,0), vec3(0,1,1), vec3(1,0,1));
+	vFragColor = vec4(colors[level%4], 1);
+}
@@ -1,24 +1,29 @@
 #version 330 core
   
-layout (location=0) in vec3 vVertex; //vertex position in object space
+layout (location=0) in vec3 vVertex; //patch grid position, the skirt flag is in z
+layout (location=1) in vec4 vPatch;  //first sample, sample spacing and skirt depth of the patch
 
 //uniforms
 uniform mat4 MVP;					//combined modelview projection matrix
-uniform ivec2 HALF_TERRAIN_SIZE;	//half terrain size
+uniform ivec2 TERRAIN_SIZE;			//terrain size in samples
 uniform sampler2D heightMapTexture;	//heightmap texture
 uniform float scale;				//scale for the heightmap height
 uniform float half_scale;			//half of the scale
 
 void main()
 {   
-	//extract height from the heightmap texture for the given vertex position
-	//rescale this height using the scale and half_scale uniforms
-	float height = texture(heightMapTexture, vVertex.xz).r*scale - half_scale;
+	//get the heightmap sample of the patch vertex, the patches are clamped to
+	//the heightmap so the vertices past its border collapse
+	ivec2 heightSample = min(ivec2(vPatch.xy + vVertex.xy*vPatch.z), TERRAIN_SIZE-1);
 
-	//rescale the terrain vertices to be in -HALF_TERRAIN_SIZE to HALF_TERRAIN_SIZE
-	//in width and depth
-	vec2 pos = (vVertex.xz*2.0-1)*HALF_TERRAIN_SIZE;
+	//extract height from the heightmap texture for the given sample and
+	//rescale this height using the scale and half_scale uniforms, the skirt
+	//vertices are moved down by the skirt depth
+	float height = texelFetch(heightMapTexture, heightSample, 0).r*scale - half_scale - vVertex.z*vPatch.w;
 
-	//mulitply the modelview projection matrix with the scaled position and height
+	//center the terrain at the origin with one unit between the samples
+	vec2 pos = vec2(heightSample) - vec2(TERRAIN_SIZE-1)*0.5;
+
+	//mulitply the modelview projection matrix with the position and height
 	gl_Position = MVP*vec4(pos.x, height, pos.y, 1);			
-}
\ No newline at end of file
+}
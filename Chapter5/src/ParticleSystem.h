@@ -0,0 +1,171 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+
+//largest number of emitters, must match the transform feedback update shader
+const int MAX_EMITTERS = 8;
+
+//an emitter spawns particles at a fixed rate from a point. The initial
+//directions are spread around the given yaw and pitch; all angles are in
+//radians, speeds in world units per second and lifetimes in seconds. Each
+//variation is the width of the uniform range added to its base value.
+struct Emitter {
+	glm::vec3 position;
+	glm::vec3 force;			//acceleration applied to the particles
+	float yaw, yawVar;
+	float pitch, pitchVar;
+	float speed, speedVar;
+	float life, lifeVar;
+	float rate;					//particles per second
+
+	Emitter();
+};
+
+//where the particles are simulated
+enum ParticleBackend {
+	PARTICLES_CPU = 0,			//SIMD and OpenMP on the CPU, sorted rendering
+	PARTICLES_GPU,				//transform feedback, unsorted rendering
+	PARTICLES_GPU_COMPACT,		//transform feedback keeping only the live particles
+	TOTAL_BACKENDS
+};
+
+//ParticleSystem class simulates the particles of several emitters in a pool
+//of fixed capacity. The CPU backend keeps the particles in structure of
+//arrays layout and reuses dead slots through a free list; the live particles
+//are packed, optionally depth sorted with a parallel radix sort and uploaded
+//for rendering. The GPU backend runs the same simulation in a transform
+//feedback pass, where every emitter owns a range of the pool and respawns
+//dead particles of a window that advances at its spawn rate. The compact GPU
+//backend stores only the live particles: a geometry shader drops the dead
+//ones from the transform feedback output and the new particles are appended
+//in a second draw. Both the update and the render pass get their vertex
+//count from the transform feedback object, so they cost as much as the live
+//particles and never read anything back.
+//
+//All backends draw one point per particle from attribute 0, which holds the
+//position in xyz and the normalized age in w (0 at birth, 1 and above when
+//dead). Render shaders have to discard particles with w >= 1.
+class ParticleSystem
+{
+public:
+	//constructor/destructor
+	ParticleSystem(void);
+	~ParticleSystem(void);
+
+	//creates the particle pool and the buffer objects. The GPU backends need
+	//the update program, which is relinked to capture its outputs. The
+	//program of the compact backend has a geometry shader that emits only
+	//the live particles.
+	void Init(int capacity, ParticleBackend backend, GLuint updateProgram = 0);
+	void Destroy();
+
+	//emitters, at most MAX_EMITTERS
+	int AddEmitter(const Emitter& emitter);
+	Emitter& GetEmitter(int index);
+	int GetTotalEmitters() const;
+
+	//the particles bounce off the plane (normal, distance from origin)
+	void SetCollisionPlane(const glm::vec4& plane, float restitution);
+
+	//spawns, simulates and kills particles for the given time step in seconds
+	void Update(float dt);
+
+	//orders the live particles back to front for the given modelview
+	//matrix. Only the CPU backend sorts, the GPU backend ignores this call.
+	void Sort(const glm::mat4& MV);
+
+	//draws the particles as points with the currently bound program
+	void Draw();
+
+	ParticleBackend GetBackend() const;
+	int GetCapacity() const;
+
+	//number of live particles. The GPU backend returns the number of
+	//particles spawned within the last lifetime, which is an estimate. The
+	//compact backend returns a count that is a few frames old.
+	int GetLiveCount() const;
+
+	//times spent in the last Update and Sort calls in milliseconds
+	float GetUpdateTime() const;
+	float GetSortTime() const;
+
+	static const char* GetBackendName(ParticleBackend backend);
+
+protected:
+	void InitCPU();
+	void InitGPU(GLuint updateProgram);
+
+	void UpdateCPU(float dt);
+	void UpdateGPU(float dt);
+	void UpdateGPUCompact(float dt);
+
+	//takes particles from the free list for every emitter
+	void Spawn(float dt);
+
+	//advances the given range of slots
+	void Simulate(int first, int last, float dt);
+
+	//returns a random number in [0,1)
+	float Random();
+
+	ParticleBackend backend;
+	int capacity;
+
+	vector<Emitter> emitters;
+	vector<float> spawnAccumulators;		//fractional particles carried to the next frame
+
+	glm::vec4 plane;
+	float restitution;
+
+	//CPU particle slots in structure of arrays layout. A slot is dead once
+	//its age reaches its life; free slots have a life of 0.
+	vector<float> px, py, pz;
+	vector<float> vx, vy, vz;
+	vector<float> age, life;
+	vector<int> emitterIDs;
+	float forceX[MAX_EMITTERS], forceY[MAX_EMITTERS], forceZ[MAX_EMITTERS];
+	vector<int> freeList;
+	int highWater;							//slots at and above this index were never used
+	unsigned int randomState;
+
+	//per block counts of live and newly dead particles
+	vector<int> blockLive, blockDead;
+
+	//packed live particles (xyz position, w normalized age) and the sort buffers
+	vector<glm::vec4> renderData, sortedData;
+	vector<unsigned int> keys, tmpKeys;
+	vector<int> values, tmpValues;
+	vector<int> histograms;
+	int liveCount;
+	bool bDirty;
+
+	//GPU state, ping pong buffers with the position (xyz, age) and velocity
+	//(xyz, life) and one buffer with the render attribute. The compact
+	//backend stores the normalized age in the position buffer, renders from
+	//it and keeps the emitter of every particle in a third buffer.
+	GLuint updateProgram;
+	GLuint vaoUpdateID[2];
+	GLuint vboPositionID[2], vboVelocityID[2], vboEmitterID[2];
+	GLuint vboRenderID;
+	GLuint vaoRenderID;
+	int readID;
+	GLint uniformLocations[11];
+	vector<int> rangeFirst, rangeCount;		//pool range of each emitter
+	vector<int> spawnStart, spawnCount;		//spawn window of each range
+	bool bRangesDirty;
+	unsigned int frame;
+
+	//compact GPU state, the transform feedback objects hold the number of
+	//particles written to each ping pong buffer
+	GLuint tfoID[2];
+	bool bPrimed;				//the read buffer has been written at least once
+	GLuint queryID;				//primitives written, read without waiting
+	bool bQueryPending;
+	int writtenCount;
+
+	float updateTime;		//in milliseconds
+	float sortTime;			//in milliseconds
+};
@@ -7,6 +7,8 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "GLSLShader.h"
+#include "BatchRenderer.h"
+#include <vector>
 
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
@@ -72,10 +74,14 @@ GLuint quadVAOID;
 GLuint quadVBOID;
 GLuint quadIndicesID;
 
-//cube vertex array and vertex buffer object IDs
-GLuint cubeVBOID;
-GLuint cubeVAOID;
-GLuint cubeIndicesID;
+//the cubes are merged into a batch which draws all cubes of a colour with
+//one call, the cube transforms are read from a buffer texture on this unit
+BatchRenderer batch;
+const int TRANSFORM_TEXTURE_UNIT = 3;
+
+//indices of the cubes to draw and their offsets from the centre
+vector<int> visibleCubes;
+vector<glm::mat4> cubeOffsets;
 
 //shaders for cube, initialization, dual depth peeling, blending and final rendering
 GLSLShader cubeShader, initShader, dualPeelShader, blendShader, finalShader;
@@ -273,11 +279,6 @@ void OnInit() {
 		glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, quadIndicesID);
 		glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof(quadIndices), &quadIndices[0], GL_STATIC_DRAW);
 
-	//setup unit cube vertex array and vertex buffer objects
-	glGenVertexArrays(1, &cubeVAOID);
-	glGenBuffers(1, &cubeVBOID);
-	glGenBuffers(1, &cubeIndicesID);
-
 	//unit cube vertices 
 	glm::vec3 vertices[8]={	glm::vec3(-0.5f,-0.5f,-0.5f),
 							glm::vec3( 0.5f,-0.5f,-0.5f),
@@ -289,34 +290,43 @@ void OnInit() {
 							glm::vec3(-0.5f, 0.5f, 0.5f)};
 
 	//unit cube indices
-	GLushort cubeIndices[36]={0,5,4,
-							  5,0,1,
-							  3,7,6,
-							  3,6,2,
-							  7,4,6,
-							  6,4,5,
-							  2,1,3,
-							  3,1,0,
-							  3,0,7,
-							  7,0,4,
-							  6,5,2,
-							  2,5,1};
-	glBindVertexArray(cubeVAOID);
-		glBindBuffer (GL_ARRAY_BUFFER, cubeVBOID);
-		//pass cube vertices to buffer object memory
-		glBufferData (GL_ARRAY_BUFFER, sizeof(vertices), &(vertices[0].x), GL_STATIC_DRAW);
-
-		GL_CHECK_ERRORS
-
-		//enable vertex attributre array for position
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,0,0);
+	GLuint cubeIndices[36]={0,5,4,
+							5,0,1,
+							3,7,6,
+							3,6,2,
+							7,4,6,
+							6,4,5,
+							2,1,3,
+							3,1,0,
+							3,0,7,
+							7,0,4,
+							6,5,2,
+							2,5,1};
+
+	//add the cube mesh to the batch
+	BatchRenderer::Vertex cubeVertices[8];
+	for(int i=0;i<8;i++) {
+		cubeVertices[i].position = vertices[i];
+		cubeVertices[i].normal = glm::vec3(0);
+		cubeVertices[i].uv = glm::vec2(0);
+	}
+	int cubeMesh = batch.AddMesh(cubeVertices, 8, cubeIndices, 36);
 
-		//pass cube indices to element array  buffer
-		glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, cubeIndicesID);
-		glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), &cubeIndices[0], GL_STATIC_DRAW);
+	//add 27 cubes, the colour index is used as the material
+	for(int k=-1;k<=1;k++) {
+		for(int j=-1;j<=1;j++) {
+			for(int i=-1;i<=1;i++) {
+				glm::mat4 T = glm::translate(glm::mat4(1), glm::vec3(i*2,j*2,k*2));
+				visibleCubes.push_back(batch.AddObject(cubeMesh, i+1, T));
+				cubeOffsets.push_back(T);
+			}
+		}
+	}
+	batch.Init();
+	cout<<"Drawing "<<batch.GetTotalObjects()<<" cubes with "<<batch.GetTotalMaterials()<<" calls per pass"
+		<<(batch.IsMultiDrawIndirect() ? " using glMultiDrawElementsIndirect" : "")<<endl;
 
-	glBindVertexArray(0);
+	GL_CHECK_ERRORS
 
 	//Load the cube shader
 	cubeShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/cube_shader.vert");
@@ -328,6 +338,9 @@ void OnInit() {
 		cubeShader.AddAttribute("vVertex");
 		cubeShader.AddUniform("MVP");
 		cubeShader.AddUniform("vColor");
+		cubeShader.AddUniform("transforms");
+		//pass constant uniforms at initialization
+		glUniform1i(cubeShader("transforms"), TRANSFORM_TEXTURE_UNIT);
 	cubeShader.UnUse();
 
 	GL_CHECK_ERRORS
@@ -341,6 +354,9 @@ void OnInit() {
 		//add attributes and uniforms
 		initShader.AddAttribute("vVertex");
 		initShader.AddUniform("MVP");
+		initShader.AddUniform("transforms");
+		//pass constant uniforms at initialization
+		glUniform1i(initShader("transforms"), TRANSFORM_TEXTURE_UNIT);
 	initShader.UnUse();
 
 	GL_CHECK_ERRORS
@@ -358,9 +374,11 @@ void OnInit() {
 		dualPeelShader.AddUniform("alpha");
 		dualPeelShader.AddUniform("depthBlenderTex");
 		dualPeelShader.AddUniform("frontBlenderTex");
+		dualPeelShader.AddUniform("transforms");
 		//pass constant uniforms at initialization
 		glUniform1i(dualPeelShader("depthBlenderTex"), 0);
 		glUniform1i(dualPeelShader("frontBlenderTex"), 1);
+		glUniform1i(dualPeelShader("transforms"), TRANSFORM_TEXTURE_UNIT);
 	dualPeelShader.UnUse();
 
 	GL_CHECK_ERRORS
@@ -417,9 +435,7 @@ void OnShutdown() {
 	glDeleteBuffers(1, &quadVBOID);
 	glDeleteBuffers(1, &quadIndicesID);
 
-	glDeleteVertexArrays(1, &cubeVAOID);
-	glDeleteBuffers(1, &cubeVBOID);
-	glDeleteBuffers(1, &cubeIndicesID);
+	batch.Destroy();
 
 
 	delete grid;
@@ -449,37 +465,29 @@ void DrawScene(const glm::mat4& MVP, GLSLShader& shader, bool useColor=false, bo
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	//bind the cube vertex array object
-	glBindVertexArray(cubeVAOID);
-
 	//bind the shader
 	shader.Use();
 
-	//for all cubes
-	for(int k=-1;k<=1;k++) {
-		for(int j=-1;j<=1;j++) {
-			int index =0;
-			for(int i=-1;i<=1;i++) {
-				GL_CHECK_ERRORS
-				//set the modelling transformation and shader uniforms
-				glm::mat4 T = glm::translate(glm::mat4(1), glm::vec3(i*2,j*2,k*2));
-				if(useColor)
-					glUniform4fv(shader("vColor"),1, &(box_colors[index++].x));
-				if(useAlphaMultiplier)
-					glUniform1f(shader("alpha"), alpha);
-
-				glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP*R*T));
-				
-				//draw the cube
-				glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, 0);
-				GL_CHECK_ERRORS
-			}
+	//set the shader uniforms, the cube transforms come from the batch
+	glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
+	if(useAlphaMultiplier)
+		glUniform1f(shader("alpha"), alpha);
+
+	GL_CHECK_ERRORS
+	if(useColor) {
+		//draw all cubes of a colour in a single call
+		for(int m=0;m<batch.GetTotalMaterials();m++) {
+			glUniform4fv(shader("vColor"),1, &(box_colors[m].x));
+			batch.Draw(m, GL_TEXTURE0 + TRANSFORM_TEXTURE_UNIT);
 		}
+	} else {
+		//without colours all cubes are drawn in a single call
+		batch.DrawAll(GL_TEXTURE0 + TRANSFORM_TEXTURE_UNIT);
 	}
+	GL_CHECK_ERRORS
+
 	//unbind shader
 	shader.UnUse();
-	//unbind vertex array object
-	glBindVertexArray(0);
 	//diable alpha blending
 	glDisable(GL_BLEND);
 }
@@ -506,6 +514,11 @@ void OnRender() {
 
 	//get the combined modelview projection matrix
     glm::mat4 MVP	= P*MV;
+
+	//rotate the cubes and write the draw commands of the visible cubes
+	for(size_t i=0;i<cubeOffsets.size();i++)
+		batch.SetTransform(int(i), R*cubeOffsets[i]);
+	batch.Build(visibleCubes);
 	
 	//if we want to use depth peeling 
 	if(bShowDepthPeeling) {
@@ -1,12 +1,19 @@
 #version 330 core
   
 layout(location = 0) in vec3 vVertex; //object space vertex position
+layout(location = 3) in uint vDrawID; //index of the draw in the transform buffer
 
-//uniform
+//uniforms
 uniform mat4 MVP;  //combined modelview projection matrix
+uniform samplerBuffer transforms;	//modelling matrices of all draws, 4 texels each
 
 void main()
 {  
+	//fetch the modelling matrix of this draw
+	int i = int(vDrawID)*4;
+	mat4 M = mat4(texelFetch(transforms, i), texelFetch(transforms, i+1),
+				  texelFetch(transforms, i+2), texelFetch(transforms, i+3));
+
 	//get the clipspace vertex position
-	gl_Position = MVP*vec4(vVertex.xyz,1);
+	gl_Position = MVP*M*vec4(vVertex.xyz,1);
 }
\ No newline at end of file
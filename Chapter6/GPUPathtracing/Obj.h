@@ -17,7 +17,7 @@ struct Vertex	{
 }; 
 
 struct Face { 
-	unsigned short	a,b,c,  //pos indices
+	unsigned int	a,b,c,  //pos indices
 					d,e,f,  //normal indices
 					g,h,i;  //uv indices
 };
@@ -46,7 +46,7 @@ public:
 	float Ke[3];
 	std::string map_Ka,  map_Kd, name; 
 	float Ns, Ni, d, Tr; 
-	vector<unsigned short> sub_indices;
+	vector<unsigned int> sub_indices;
 	int offset;
 	int count;
 
@@ -57,6 +57,6 @@ class ObjLoader {
 		ObjLoader();
 		~ObjLoader();
 
-	bool Load(const string& filename, vector<Mesh*>& meshes, vector<Vertex>& verts, vector<unsigned short>& inds,	vector<Material*>& materials, BBox& aabb, vector<glm::vec3>& verts2, vector<unsigned short>& inds2);	
+	bool Load(const string& filename, vector<Mesh*>& meshes, vector<Vertex>& verts, vector<unsigned int>& inds,	vector<Material*>& materials, BBox& aabb, vector<glm::vec3>& verts2, vector<unsigned int>& inds2);	
 };
 #endif
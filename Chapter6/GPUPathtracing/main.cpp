@@ -9,7 +9,15 @@
 
 #include "GLSLShader.h"
 #include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include "Obj.h"
+#include "BVH.h"
+#include "ScenePacker.h"
+#include "TextureArrayBuilder.h"
 
 #include <SOIL.h>
 
@@ -51,7 +59,7 @@ glm::mat4 MV = glm::mat4(1);
 ObjLoader obj;
 vector<Mesh*> meshes;				//all meshes 
 vector<Material*> materials;		//all materials 
-vector<unsigned short> indices;		//all mesh indices 
+vector<unsigned int> indices;		//all mesh indices 
 vector<Vertex> vertices;			//all mesh vertices
 vector<GLuint> textures;			//all textures
 
@@ -75,8 +83,15 @@ glm::vec4 bg = glm::vec4(0.5,0.5,1,1);
 glm::vec3 eyePos;
 BBox aabb;
 
-GLuint texVerticesID; //texture storing vertex positions
-GLuint texTrianglesID; //texture storing triangles list 
+//scene textures storing the vertex positions, triangles list, flattened
+//BVH nodes and triangle indices in BVH leaf order
+ScenePacker scenePacker;
+
+//scene bounding volume hierarchy
+BVH bvh;
+
+//flag to enable BVH traversal, otherwise all triangles are tested
+bool bUseBVH = true;
 
 //light crosshair gizmo vetex array and buffer object IDs
 GLuint lightVAOID;
@@ -93,8 +108,137 @@ int total_frames = 0;
 float fps = 0;
 float lastTime =0;
 
-//texture ID for array texture
-GLuint textureID;
+//material texture arrays grouped by image size
+TextureArrayBuilder textureBuilder;
+
+//current window size
+int winWidth = WIDTH, winHeight = HEIGHT;
+
+//progressive rendering: each pass adds one sample per pixel to the running mean
+//stored in the floating point accumulation textures which are ping-ponged
+GLuint accumFBOID;
+GLuint accumTexID[2];
+int readID = 0, writeID = 1;
+
+//flag to enable progressive accumulation, otherwise each frame shows one sample
+bool bProgressive = true;
+
+//total samples in the accumulation texture and the current per frame budget
+int sampleCount = 0;
+int samplesPerFrame = 1;
+
+//the per frame budget is adapted to keep the frame time close to the target
+const int MAX_SAMPLES_PER_FRAME = 32;
+const int MAX_PROGRESSIVE_SAMPLES = 4096;
+const float INTERACTIVE_FRAME_TIME = 33.0f;	//in milliseconds
+const float OFFLINE_FRAME_TIME = 100.0f;	//in milliseconds
+
+//offline mode renders the given number of samples and writes an HDR image
+int targetSamples = 0;
+std::string hdr_filename = "pathtracer.hdr";
+
+//GPU timer queries of the last two frames. The result of the previous frame
+//is read when it is available so the budget update never stalls the pipeline
+GLuint timerQueryID[2];
+int querySamples[2] = {0, 0};
+int currentQuery = 0;
+
+//clears the accumulated samples, called when the camera or light changes
+void ResetAccumulation() {
+	sampleCount = 0;
+}
+
+//adapts the number of samples per frame from the measured GPU time
+void UpdateSampleBudget(float elapsedMS, int samples) {
+	if(samples<=0 || elapsedMS<=0)
+		return;
+	float targetTime = (targetSamples>0) ? OFFLINE_FRAME_TIME : INTERACTIVE_FRAME_TIME;
+	float msPerSample = elapsedMS/samples;
+	int budget = int(targetTime/msPerSample);
+
+	//grow at most twice per frame to avoid overshooting after a reset
+	budget = min(budget, samplesPerFrame*2);
+	samplesPerFrame = max(1, min(budget, MAX_SAMPLES_PER_FRAME));
+}
+
+//creates the accumulation FBO with two floating point colour attachments
+void InitAccumulationFBO(int w, int h) {
+	glGenFramebuffers(1, &accumFBOID);
+	glBindFramebuffer(GL_FRAMEBUFFER, accumFBOID);
+
+	glGenTextures(2, accumTexID);
+	for(int i=0;i<2;i++) {
+		glActiveTexture(GL_TEXTURE5+i);
+		glBindTexture(GL_TEXTURE_2D, accumTexID[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0+i, GL_TEXTURE_2D, accumTexID[i], 0);
+	}
+
+	//check the framebuffer completeness status
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status == GL_FRAMEBUFFER_COMPLETE) {
+		cout<<"Accumulation FBO setup successful."<<endl;
+	} else {
+		cout<<"Problem in Accumulation FBO setup."<<endl;
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	readID = 0;
+	writeID = 1;
+	ResetAccumulation();
+}
+
+//release the accumulation FBO and its textures
+void ShutdownAccumulationFBO() {
+	glDeleteTextures(2, accumTexID);
+	glDeleteFramebuffers(1, &accumFBOID);
+}
+
+//saves the accumulated image as a Radiance RGBE (.hdr) file
+bool SaveHDR(const string& filename) {
+	vector<float> pixels(winWidth*winHeight*3);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, accumFBOID);
+	glReadBuffer(GL_COLOR_ATTACHMENT0+readID);
+	glReadPixels(0, 0, winWidth, winHeight, GL_RGB, GL_FLOAT, &pixels[0]);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	ofstream fp(filename.c_str(), ios::out | ios::binary);
+	if(!fp) {
+		cerr<<"Cannot save image: "<<filename.c_str()<<endl;
+		return false;
+	}
+	fp<<"#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y "<<winHeight<<" +X "<<winWidth<<"\n";
+
+	//the file stores rows top down, glReadPixels returns them bottom up
+	vector<unsigned char> rgbe(winWidth*4);
+	for(int y=winHeight-1;y>=0;y--) {
+		for(int x=0;x<winWidth;x++) {
+			const float* c = &pixels[(y*winWidth+x)*3];
+			float v = max(c[0], max(c[1], c[2]));
+			unsigned char* p = &rgbe[x*4];
+			if(v < 1e-32f) {
+				p[0] = p[1] = p[2] = p[3] = 0;
+			} else {
+				int e;
+				float scale = frexp(v, &e) * 256.0f / v;
+				p[0] = (unsigned char)(c[0]*scale);
+				p[1] = (unsigned char)(c[1]*scale);
+				p[2] = (unsigned char)(c[2]*scale);
+				p[3] = (unsigned char)(e + 128);
+			}
+		}
+		fp.write((const char*)&rgbe[0], rgbe.size());
+	}
+	fp.close();
+	cout<<"Saved "<<filename.c_str()<<" ("<<sampleCount<<" samples per pixel)"<<endl;
+	return true;
+}
 
 //mouse clock handler
 void OnMouseDown(int button, int s, int x, int y)
@@ -134,6 +278,9 @@ void OnMouseMove(int x, int y)
 	oldX = x;
 	oldY = y;
 
+	//the camera or light moved so the accumulated samples are invalid
+	ResetAccumulation();
+
 	//recall display function
 	glutPostRedisplay();
 }
@@ -174,7 +321,7 @@ void OnInit() {
 	std::string mesh_path = mesh_filename.substr(0, mesh_filename.find_last_of("/")+1);
 
 	//load the obj model
-	vector<unsigned short> indices2;
+	vector<unsigned int> indices2;
 	vector<glm::vec3> vertices2;
 	if(!obj.Load(mesh_filename.c_str(), meshes, vertices, indices, materials, aabb, vertices2, indices2)) {
 		cout<<"Cannot load the 3ds mesh"<<endl;
@@ -183,75 +330,18 @@ void OnInit() {
 
 	GL_CHECK_ERRORS
 
-	int total =0;
-	//check the total number of non empty textures since we will use this
-	//information to creare a single array texture to store all textures 
+	//decode the material textures in parallel and group them by size into
+	//array textures with CPU generated mipmaps. The material lookup texture
+	//is bound to texture unit 6 and the texture arrays to units 7 to 10.
+	vector<string> texture_filenames(materials.size());
 	for(size_t k=0;k<materials.size();k++) {
-		if(materials[k]->map_Kd != "") {
-			total++;
-		}
-	}
-
-	//load material textures
-	for(size_t k=0;k<materials.size();k++) {
-		//if the diffuse texture name is not empty
-		if(materials[k]->map_Kd != "") {
-			if(k==0) {
-				//generate a new OpenGL array texture
-				glGenTextures(1, &textureID);
-				glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
-				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP);
-				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP);
-			}
-			int texture_width = 0, texture_height = 0, channels=0;
-
-			const string& filename =  materials[k]->map_Kd;
-
-			std::string full_filename = mesh_path;
-			full_filename.append(filename);
-
-			//use SOIL to load the texture
-			GLubyte* pData = SOIL_load_image(full_filename.c_str(), &texture_width, &texture_height, &channels, SOIL_LOAD_AUTO);
-			if(pData == NULL) {
-				cerr<<"Cannot load image: "<<full_filename.c_str()<<endl;
-				exit(EXIT_FAILURE);
-			}
-
-			//Flip the image on Y axis
-			int i,j;
-			for( j = 0; j*2 < texture_height; ++j )
-			{
-				int index1 = j * texture_width * channels;
-				int index2 = (texture_height - 1 - j) * texture_width * channels;
-				for( i = texture_width * channels; i > 0; --i )
-				{
-					GLubyte temp = pData[index1];
-					pData[index1] = pData[index2];
-					pData[index2] = temp;
-					++index1;
-					++index2;
-				}
-			}
-			//get the image format
-			GLenum format = GL_RGBA;
-			switch(channels) {
-				case 2:	format = GL_RG32UI; break;
-				case 3: format = GL_RGB;	break;
-				case 4: format = GL_RGBA;	break;
-			}
-			//if this is the first texture, allocate the array texture
-			if(k==0) {
-				glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format, texture_width, texture_height, total, 0, format, GL_UNSIGNED_BYTE, NULL);
-			}
-			//modify the existing texture
-			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0,0,0,k, texture_width, texture_height, 1, format, GL_UNSIGNED_BYTE, pData);
-
-			//release the SOIL image data
-			SOIL_free_image_data(pData);
-		}
+		if(materials[k]->map_Kd != "")
+			texture_filenames[k] = mesh_path + materials[k]->map_Kd;
 	}
+	if(!textureBuilder.Load(texture_filenames))
+		exit(EXIT_FAILURE);
+	textureBuilder.Upload(6);
+	textureBuilder.PrintStats();
 	GL_CHECK_ERRORS
 
 	//load flat shader
@@ -282,17 +372,29 @@ void OnInit() {
 		pathtraceShader.AddUniform("vertex_positions");
 		pathtraceShader.AddUniform("triangles_list");
 		pathtraceShader.AddUniform("time");
-		pathtraceShader.AddUniform("VERTEX_TEXTURE_SIZE");
 		pathtraceShader.AddUniform("TRIANGLE_TEXTURE_SIZE");
+		pathtraceShader.AddUniform("bvh_nodes");
+		pathtraceShader.AddUniform("triangle_ids");
+		pathtraceShader.AddUniform("textureMaps");
+		pathtraceShader.AddUniform("material_maps");
+		pathtraceShader.AddUniform("useBVH");
+		pathtraceShader.AddUniform("accumulated");
+		pathtraceShader.AddUniform("sampleCount");
+		pathtraceShader.AddUniform("jitter");
 
 		//set values of constant uniforms as initialization	
-		glUniform1f(pathtraceShader("VERTEX_TEXTURE_SIZE"), (float)vertices2.size());		
 		glUniform1f(pathtraceShader("TRIANGLE_TEXTURE_SIZE"), (float)indices2.size()/4);
 		glUniform3fv(pathtraceShader("aabb.min"),1, glm::value_ptr(aabb.min));
 		glUniform3fv(pathtraceShader("aabb.max"),1, glm::value_ptr(aabb.max));
 		glUniform4fv(pathtraceShader("backgroundColor"),1, glm::value_ptr(bg));
 		glUniform1i(pathtraceShader("vertex_positions"), 1);
 		glUniform1i(pathtraceShader("triangles_list"), 2);
+		glUniform1i(pathtraceShader("bvh_nodes"), 3);
+		glUniform1i(pathtraceShader("triangle_ids"), 4);
+		glUniform1i(pathtraceShader("material_maps"), 6);
+		GLint texture_units[TextureArrayBuilder::MAX_BUCKETS] = {7, 8, 9, 10};
+		glUniform1iv(pathtraceShader("textureMaps"), TextureArrayBuilder::MAX_BUCKETS, texture_units);
+		glUniform1i(pathtraceShader("accumulated"), 5);
 	pathtraceShader.UnUse();
 	
 	GL_CHECK_ERRORS
@@ -312,6 +414,7 @@ void OnInit() {
 		shader.AddUniform("P");
 		shader.AddUniform("textureMap");
 		shader.AddUniform("textureIndex");
+		shader.AddUniform("uvScale");
 		shader.AddUniform("useDefault");
 		shader.AddUniform("diffuse_color");
 		shader.AddUniform("light_position");
@@ -353,7 +456,7 @@ void OnInit() {
 		if(materials.size()==1) {
 			//pass indices to the element array buffer if there is a single material			
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndicesID);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*indices.size(), &(indices[0]), GL_STATIC_DRAW);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*indices.size(), &(indices[0]), GL_STATIC_DRAW);
 		}
 		GL_CHECK_ERRORS
 
@@ -388,56 +491,26 @@ void OnInit() {
 	lightPosOS.y = radius * cos(phi);
 	lightPosOS.z = radius * sin(theta)*sin(phi);
 
-	//pass position to 1D texture bound to texture unit 1
-	glGenTextures(1, &texVerticesID);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture( GL_TEXTURE_2D, texVerticesID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-	GLfloat* pData = new GLfloat[vertices2.size()*4];
-	int count = 0;
-	for(size_t i=0;i<vertices2.size();i++) {
-		pData[count++] = vertices2[i].x;
-		pData[count++] = vertices2[i].y;
-		pData[count++] = vertices2[i].z;
-		pData[count++] = 0;
-	}
-	//allocate a floating point texture
- 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, vertices2.size(),1, 0, GL_RGBA, GL_FLOAT, pData);
-	
-	//delete the data pointer
-	delete [] pData;
-
-	GL_CHECK_ERRORS
+	//build the bounding volume hierarchy over the scene triangles
+	bvh.Build(vertices2, indices2);
+	cout<<"BVH built in "<<bvh.GetBuildTime()<<" ms: "<<bvh.GetNodes().size()<<" nodes, "
+		<<bvh.GetTotalLeaves()<<" leaves, depth "<<bvh.GetMaxDepth()<<", SAH cost "<<bvh.GetSAHCost()<<endl;
 
-	//store the mesh topology in another texture bound to texture unit 2
-	glGenTextures(1, &texTrianglesID);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture( GL_TEXTURE_2D, texTrianglesID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-	GLushort* pData2 = new GLushort[indices2.size()];
-	count = 0;
-	for(size_t i=0;i<indices2.size();i+=4) {
-		pData2[count++] = (indices2[i]);
-		pData2[count++] = (indices2[i+1]);
-		pData2[count++] = (indices2[i+2]);
-		pData2[count++] = (indices2[i+3]);
+	//store the vertex positions, triangles, BVH nodes and triangle ids in 2D
+	//textures bound to texture units 1 to 4. All indices are 32-bit so large
+	//scenes are not limited by the maximum texture width
+	if(!scenePacker.Pack(vertices2, indices2, bvh, 1)) {
+		cout<<"Cannot pack the scene into textures"<<endl;
+		exit(EXIT_FAILURE);
 	}
-	//allocate an integer format texture
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16I, indices2.size()/4,1, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, pData2);
-	
-	//delete heap allocated buffer
-	delete [] pData2;
+	scenePacker.PrintFootprint(vertices2, indices2, bvh);
 
 	GL_CHECK_ERRORS
 
+	//setup the accumulation buffer and the GPU timers for progressive rendering
+	InitAccumulationFBO(winWidth, winHeight);
+	glGenQueries(2, timerQueryID);
+
 	//set texture unit 0 as active texture unit
 	glActiveTexture(GL_TEXTURE0);
 
@@ -461,6 +534,60 @@ void DrawFullScreenQuad() {
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 }
 
+//traces the samples of the current frame into the accumulation textures
+//and returns the number of samples traced
+int RenderSamples(const glm::vec3& eyePos, const glm::mat4& invMVP, float current) {
+	//in non progressive mode every frame starts over with a single sample
+	if(!bProgressive)
+		ResetAccumulation();
+
+	int limit = (targetSamples>0) ? targetSamples : MAX_PROGRESSIVE_SAMPLES;
+	int samples = bProgressive ? min(samplesPerFrame, limit-sampleCount) : 1;
+	if(samples<=0)
+		return 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, accumFBOID);
+	glBeginQuery(GL_TIME_ELAPSED, timerQueryID[currentQuery]);
+
+	//set the pathtracing shader 
+	pathtraceShader.Use();
+		//pass shader uniforms
+		glUniform3fv(pathtraceShader("eyePos"), 1, glm::value_ptr(eyePos));
+		glUniform1i(pathtraceShader("useBVH"), bUseBVH);
+		glUniform3fv(pathtraceShader("light_position"),1, &(lightPosOS.x));
+		glUniformMatrix4fv(pathtraceShader("invMVP"), 1, GL_FALSE, glm::value_ptr(invMVP));
+
+		for(int i=0;i<samples;i++) {
+			//each sample gets its own random seed and subpixel offset
+			//the seeds are spaced so that the per bounce seeds never overlap
+			float seed = bProgressive ? sampleCount*7.31f : current;
+			glm::vec2 jitter(0);
+			if(bProgressive && sampleCount>0) {
+				jitter.x = (float(rand())/RAND_MAX - 0.5f)*2.0f/winWidth;
+				jitter.y = (float(rand())/RAND_MAX - 0.5f)*2.0f/winHeight;
+			}
+			glUniform1f(pathtraceShader("time"), seed);
+			glUniform2fv(pathtraceShader("jitter"), 1, glm::value_ptr(jitter));
+			glUniform1f(pathtraceShader("sampleCount"), float(sampleCount));
+
+			//read the running mean from one texture and write the new mean to the other
+			glDrawBuffer(GL_COLOR_ATTACHMENT0+writeID);
+			glActiveTexture(GL_TEXTURE5);
+			glBindTexture(GL_TEXTURE_2D, accumTexID[readID]);
+				//draw a fullscreen quad
+				DrawFullScreenQuad();
+			swap(readID, writeID);
+			++sampleCount;
+		}
+	//unbind pathtracing shader
+	pathtraceShader.UnUse();
+	glActiveTexture(GL_TEXTURE0);
+
+	glEndQuery(GL_TIME_ELAPSED);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return samples;
+}
+
 //release all allocated resources
 void OnShutdown() {
 
@@ -469,7 +596,7 @@ void OnShutdown() {
 	glDeleteBuffers(1, &quadIndicesID);
 
 	//delete all textures
-	glDeleteTextures(1, &textureID);
+	textureBuilder.Release();
 
 	//delete all meshes
 	size_t total_meshes = meshes.size();
@@ -499,8 +626,10 @@ void OnShutdown() {
 	glDeleteVertexArrays(1, &lightVAOID);
 	glDeleteBuffers(1, &lightVerticesVBO);
 
-	glDeleteTextures(1, &texVerticesID);
-	glDeleteTextures(1, &texTrianglesID);
+	scenePacker.Release();
+
+	ShutdownAccumulationFBO();
+	glDeleteQueries(2, timerQueryID);
 	cout<<"Shutdown successfull"<<endl;
 }
 
@@ -510,6 +639,14 @@ void OnResize(int w, int h) {
 	glViewport (0, 0, (GLsizei) w, (GLsizei) h);
 	//setup the projection matrix
 	P = glm::perspective(glm::radians(60.0f),(float)w/h, 0.1f,1000.0f);
+
+	//recreate the accumulation buffer at the new size
+	if(w != winWidth || h != winHeight) {
+		winWidth = w;
+		winHeight = h;
+		ShutdownAccumulationFBO();
+		InitAccumulationFBO(w, h);
+	}
 }
 
 //display callback function
@@ -521,6 +658,8 @@ void OnRender() {
 	if((current-lastTime)>1000) {
 		fps = 1000.0f*total_frames/(current-lastTime);
 		std::cout<<"FPS: "<<fps<<std::endl;
+		if(bPathtrace)
+			std::cout<<"Samples: "<<sampleCount<<" ("<<samplesPerFrame<<" per frame)"<<std::endl;
 		lastTime= current;
 		total_frames = 0;
 	}
@@ -540,17 +679,38 @@ void OnRender() {
 
 	//if pathtracing is enabled
 	if(bPathtrace) {
-		//set the pathtracing shader 
-		pathtraceShader.Use();
-			//pass shader uniforms
-			glUniform3fv(pathtraceShader("eyePos"), 1, glm::value_ptr(eyePos));
-			glUniform1f(pathtraceShader("time"), current);
-			glUniform3fv(pathtraceShader("light_position"),1, &(lightPosOS.x));
-			glUniformMatrix4fv(pathtraceShader("invMVP"), 1, GL_FALSE, glm::value_ptr(invMVP));
-				//draw a fullscreen quad
-				DrawFullScreenQuad();
-		//unbind pathtracing shader
-		pathtraceShader.UnUse();
+		//update the sample budget from the previous frame's timer query if its
+		//result has arrived, otherwise keep the current budget
+		int previousQuery = 1-currentQuery;
+		if(querySamples[previousQuery]>0) {
+			GLint available = 0;
+			glGetQueryObjectiv(timerQueryID[previousQuery], GL_QUERY_RESULT_AVAILABLE, &available);
+			if(available) {
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(timerQueryID[previousQuery], GL_QUERY_RESULT, &elapsed);
+				UpdateSampleBudget(elapsed/1000000.0f, querySamples[previousQuery]);
+				querySamples[previousQuery] = 0;
+			}
+		}
+
+		//trace this frame's samples
+		int samples = RenderSamples(eyePos, invMVP, current);
+		if(samples>0) {
+			querySamples[currentQuery] = samples;
+			currentQuery = previousQuery;
+		}
+
+		//show the running mean
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, accumFBOID);
+		glReadBuffer(GL_COLOR_ATTACHMENT0+readID);
+		glBlitFramebuffer(0, 0, winWidth, winHeight, 0, 0, winWidth, winHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+		//in offline mode write the image and quit once converged
+		if(targetSamples>0 && sampleCount>=targetSamples) {
+			SaveHDR(hdr_filename);
+			glutLeaveMainLoop();
+		}
 	} else {
 		//do rasterization
 		//bind the mesh vertex array object
@@ -570,8 +730,12 @@ void OnRender() {
 					//if material texture filename is not empty
 					//dont use the default colour
 					if(pMat->map_Kd !="") {
+						//bind the texture array holding the material texture
+						const glm::vec4& map = textureBuilder.GetMaterialMap(int(i));
+						glBindTexture(GL_TEXTURE_2D_ARRAY, textureBuilder.GetArrayTexture(int(map.x)));
 						glUniform1f(shader("useDefault"), 0.0);
-						glUniform1i(shader("textureIndex"), i);
+						glUniform1i(shader("textureIndex"), int(map.y));
+						glUniform2f(shader("uvScale"), map.z, map.w);
 					}
 					else
 						//otherwise we have no texture, we use a default colour
@@ -579,10 +743,10 @@ void OnRender() {
 					 
 					//if we have a single material, we render the whole mesh in a single call					
 					if(materials.size()==1)
-						glDrawElements(GL_TRIANGLES,  indices.size() , GL_UNSIGNED_SHORT, 0);
+						glDrawElements(GL_TRIANGLES,  indices.size() , GL_UNSIGNED_INT, 0);
 					else
 						//otherwise we render the submesh
-						glDrawElements(GL_TRIANGLES, pMat->count, GL_UNSIGNED_SHORT, (const GLvoid*)(&indices[pMat->offset]));
+						glDrawElements(GL_TRIANGLES, pMat->count, GL_UNSIGNED_INT, (const GLvoid*)(&indices[pMat->offset]));
 					 
 				}
 			//unbind the shader
@@ -629,19 +793,57 @@ void OnMouseWheel(int button, int dir, int x, int y) {
 	lightPosOS.y = radius * cos(phi);
 	lightPosOS.z = radius * sin(theta)*sin(phi);
 
+	//the light moved so the accumulated samples are invalid
+	ResetAccumulation();
+
 	//recall display function
 	glutPostRedisplay();
 }
 
-//keyboard event handler to toggle pathtracing and rasterization
+//idle callback keeps rendering while samples are being accumulated
+void OnIdle() {
+	int limit = (targetSamples>0) ? targetSamples : MAX_PROGRESSIVE_SAMPLES;
+	if(bPathtrace && (!bProgressive || sampleCount<limit))
+		glutPostRedisplay();
+}
+
+//keyboard event handler to toggle pathtracing and rasterization,
+//BVH traversal, progressive accumulation and to save the HDR image
 void OnKey(unsigned char k, int x, int y) {
 	switch(k) {
-		case ' ':bPathtrace=!bPathtrace; break;
+		case ' ':bPathtrace=!bPathtrace; ResetAccumulation(); break;
+		case 'b':
+			bUseBVH=!bUseBVH;
+			ResetAccumulation();
+			cout<<(bUseBVH?"BVH traversal":"Brute force triangle tests")<<endl;
+			break;
+		case 'a':
+			bProgressive=!bProgressive;
+			ResetAccumulation();
+			cout<<(bProgressive?"Progressive accumulation":"Single sample per frame")<<endl;
+			break;
+		case 's': {
+			stringstream ss;
+			ss<<"pathtracer_"<<sampleCount<<"spp.hdr";
+			SaveHDR(ss.str());
+		} break;
 	}
 	glutPostRedisplay();
 }
 
 int main(int argc, char** argv) {
+	//offline mode: pathtracer --spp N [output.hdr] converges to N samples
+	//per pixel, writes the HDR image and exits
+	for(int i=1;i<argc;i++) {
+		if(string(argv[i]) == "--spp" && i+1<argc) {
+			targetSamples = max(1, atoi(argv[++i]));
+			if(i+1<argc)
+				hdr_filename = argv[++i];
+			bPathtrace = true;
+			bProgressive = true;
+		}
+	}
+
 	//freeglut initialization
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
@@ -684,6 +886,7 @@ int main(int argc, char** argv) {
 	glutMotionFunc(OnMouseMove);
 	glutMouseWheelFunc(OnMouseWheel);
 	glutKeyboardFunc(OnKey);
+	glutIdleFunc(OnIdle);
 
 	//mainloop call
 	glutMainLoop();
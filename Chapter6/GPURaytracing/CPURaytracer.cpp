@@ -0,0 +1,435 @@
+#include "CPURaytracer.h"
+#include <algorithm>
+#include <chrono>
+
+//shader constants
+const float k0 = 1.0f;	//constant attenuation
+const float k1 = 0.0f;	//linear attenuation
+const float k2 = 0.0f;	//quadratic attenuation
+
+//material index of triangles without a texture
+const int NO_TEXTURE = 255;
+
+//the shader offsets shadow rays and checks occluders up to this distance
+const float SHADOW_OFFSET = 0.0001f;
+const float SHADOW_DISTANCE = 10000.0f;
+
+//size of the packet traversal stack
+const int STACK_SIZE = 64;
+
+CPURaytracer::CPURaytracer(void)
+{
+	pVertices = NULL;
+	pTriangles = NULL;
+	pBVH = NULL;
+	bg = glm::vec4(0,0,0,1);
+	renderTime = 0;
+	mraysPerSecond = 0;
+}
+
+CPURaytracer::~CPURaytracer(void)
+{
+	textures.clear();
+}
+
+void CPURaytracer::SetScene(const vector<glm::vec3>& vertices, const vector<unsigned int>& triangles, const BVH& bvh, const glm::vec3& aabbMin, const glm::vec3& aabbMax) {
+	pVertices = &vertices;
+	pTriangles = &triangles;
+	pBVH = &bvh;
+	this->aabbMin = aabbMin;
+	this->aabbMax = aabbMax;
+}
+
+void CPURaytracer::SetTexture(int index, const unsigned char* pData, int width, int height, int channels) {
+	if(index>=int(textures.size())) {
+		Texture empty;
+		empty.width = empty.height = empty.channels = 0;
+		textures.resize(index+1, empty);
+	}
+	Texture& tex = textures[index];
+	tex.width = width;
+	tex.height = height;
+	tex.channels = channels;
+	tex.data.assign(pData, pData+width*height*channels);
+}
+
+void CPURaytracer::SetBackgroundColor(const glm::vec4& color) {
+	bg = color;
+}
+
+float CPURaytracer::GetRenderTime() const {
+	return renderTime;
+}
+
+float CPURaytracer::GetMRaysPerSecond() const {
+	return mraysPerSecond;
+}
+
+float CPURaytracer::Random(const glm::vec3& fragCoord, const glm::vec3& scale, float seed) {
+	float x = sinf(glm::dot(fragCoord + glm::vec3(seed), scale))*43758.5453f + seed;
+	return x - floorf(x);
+}
+
+glm::vec3 CPURaytracer::UniformlyRandomVector(const glm::vec3& fragCoord, float seed) {
+	float u = Random(fragCoord, glm::vec3(12.9898f, 78.233f, 151.7182f), seed);
+	float v = Random(fragCoord, glm::vec3(63.7264f, 10.873f, 623.6736f), seed);
+	float z = 1.0f - 2.0f*u;
+	float r = sqrtf(std::max(0.0f, 1.0f - z*z));
+	float angle = 6.283185307179586f*v;
+	glm::vec3 dir(r*cosf(angle), r*sinf(angle), z);
+	return dir*sqrtf(Random(fragCoord, glm::vec3(36.7539f, 50.3658f, 306.2759f), seed));
+}
+
+glm::vec4 CPURaytracer::SampleTexture(int material, float s, float t) {
+	if(material==NO_TEXTURE || material>=int(textures.size()) || textures[material].data.empty())
+		return glm::vec4(1);
+
+	const Texture& tex = textures[material];
+
+	//GL_LINEAR filtering with the texel centers at half integer coordinates
+	float x = s*tex.width - 0.5f;
+	float y = t*tex.height - 0.5f;
+	int x0 = int(floorf(x));
+	int y0 = int(floorf(y));
+	float fx = x - x0;
+	float fy = y - y0;
+
+	glm::vec4 texels[4];
+	for(int i=0;i<4;i++) {
+		int tx = std::min(std::max(x0 + (i&1), 0), tex.width-1);
+		int ty = std::min(std::max(y0 + (i>>1), 0), tex.height-1);
+		const unsigned char* p = &tex.data[(ty*tex.width + tx)*tex.channels];
+		switch(tex.channels) {
+			case 1:  texels[i] = glm::vec4(p[0], p[0], p[0], 255); break;
+			case 2:  texels[i] = glm::vec4(p[0], p[0], p[0], p[1]); break;
+			case 3:  texels[i] = glm::vec4(p[0], p[1], p[2], 255); break;
+			default: texels[i] = glm::vec4(p[0], p[1], p[2], p[3]); break;
+		}
+	}
+	glm::vec4 bottom = texels[0]*(1-fx) + texels[1]*fx;
+	glm::vec4 top    = texels[2]*(1-fx) + texels[3]*fx;
+	return (bottom*(1-fy) + top*fy)*(1.0f/255.0f);
+}
+
+glm::vec3 CPURaytracer::GetNormal(int index) {
+	const vector<glm::vec3>& vertices = *pVertices;
+	const unsigned int* tri = &(*pTriangles)[index*4];
+
+	//same vertex order as intersectTriangle in the shader
+	int i0, i1, i2;
+	if((index+1)%2 != 0) {
+		i0 = tri[1]; i1 = tri[0]; i2 = tri[2];
+	} else {
+		i0 = tri[2]; i1 = tri[1]; i2 = tri[0];
+	}
+	glm::vec3 e1 = vertices[i1] - vertices[i0];
+	glm::vec3 e2 = vertices[i2] - vertices[i0];
+	return glm::normalize(glm::cross(e2, e1));
+}
+
+int CPURaytracer::IntersectBox(const RayPacket& ray, const BVHNode& node, const float4& tMin, const float4& tMax, float4& tNear) {
+	float4 t0x = (float4(node.min.x) - ray.ox)*ray.ix;
+	float4 t1x = (float4(node.max.x) - ray.ox)*ray.ix;
+	float4 t0y = (float4(node.min.y) - ray.oy)*ray.iy;
+	float4 t1y = (float4(node.max.y) - ray.oy)*ray.iy;
+	float4 t0z = (float4(node.min.z) - ray.oz)*ray.iz;
+	float4 t1z = (float4(node.max.z) - ray.oz)*ray.iz;
+
+	tNear      = max(max(min(t0x,t1x), min(t0y,t1y)), min(t0z,t1z));
+	float4 tFar = min(min(max(t0x,t1x), max(t0y,t1y)), max(t0z,t1z));
+	return movemask((tNear<=tFar) & (tFar>=tMin) & (tNear<=tMax));
+}
+
+int CPURaytracer::IntersectTriangle(const RayPacket& ray, int index, const float4& tMin, const float4& tMax, float4& t, float4& u, float4& v) {
+	const vector<glm::vec3>& vertices = *pVertices;
+	const unsigned int* tri = &(*pTriangles)[index*4];
+
+	//the shader swizzles every other triangle so that the barycentric
+	//coordinates of a quad's two triangles map to its texture coordinates
+	bool odd = ((index+1)%2 == 0);
+	const glm::vec3& v0 = odd ? vertices[tri[2]] : vertices[tri[1]];
+	const glm::vec3& v1 = odd ? vertices[tri[1]] : vertices[tri[0]];
+	const glm::vec3& v2 = odd ? vertices[tri[0]] : vertices[tri[2]];
+
+	glm::vec3 e1 = v1-v0;
+	glm::vec3 e2 = v2-v0;
+	float4 e1x(e1.x), e1y(e1.y), e1z(e1.z);
+	float4 e2x(e2.x), e2y(e2.y), e2z(e2.z);
+
+	float4 tx = ray.ox - float4(v0.x);
+	float4 ty = ray.oy - float4(v0.y);
+	float4 tz = ray.oz - float4(v0.z);
+
+	//pvec = cross(dir, e2)
+	float4 px = ray.dy*e2z - ray.dz*e2y;
+	float4 py = ray.dz*e2x - ray.dx*e2z;
+	float4 pz = ray.dx*e2y - ray.dy*e2x;
+
+	float4 det = e1x*px + e1y*py + e1z*pz;
+	float4 invDet = float4(1.0f)/det;
+
+	u = (tx*px + ty*py + tz*pz)*invDet;
+
+	//qvec = cross(tvec, e1)
+	float4 qx = ty*e1z - tz*e1y;
+	float4 qy = tz*e1x - tx*e1z;
+	float4 qz = tx*e1y - ty*e1x;
+
+	v = (ray.dx*qx + ray.dy*qy + ray.dz*qz)*invDet;
+	t = (e2x*qx + e2y*qy + e2z*qz)*invDet;
+
+	float4 zero(0.0f), one(1.0f);
+	int mask = movemask((u>=zero) & (u<=one) & (v>=zero) & ((u+v)<=one) & (t>tMin) & (t<=tMax));
+
+	if(odd)
+		v = one - v;
+	else
+		u = one - u;
+	return mask;
+}
+
+void CPURaytracer::Intersect(const RayPacket& ray, int activeMask, float tMin, HitPacket& hit) {
+	const vector<BVHNode>& nodes = pBVH->GetNodes();
+	const vector<int>& ids = pBVH->GetTriangleIndices();
+	if(nodes.empty() || activeMask==0)
+		return;
+
+	float4 tMinV(tMin);
+	int stack[STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+
+	while(top>0) {
+		const BVHNode& node = nodes[stack[--top]];
+
+		float4 tNear;
+		float4 tMaxV = float4::Load(hit.t);
+		int mask = IntersectBox(ray, node, tMinV, tMaxV, tNear) & activeMask;
+		if(mask==0)
+			continue;
+
+		if(node.count>0) {
+			for(int i=0;i<node.count;i++) {
+				int id = ids[node.offset+i];
+				float4 t, u, v;
+				int hitMask = IntersectTriangle(ray, id, tMinV, float4::Load(hit.t), t, u, v) & mask;
+				if(hitMask==0)
+					continue;
+				for(int k=0;k<4;k++) {
+					if(hitMask & (1<<k)) {
+						hit.t[k] = t[k];
+						hit.u[k] = u[k];
+						hit.v[k] = v[k];
+						hit.triangle[k] = id;
+					}
+				}
+			}
+		} else {
+			//push the far child first so that the near child is visited first.
+			//The children are ordered along the axis that separates them most
+			//using the direction of the first active ray.
+			int left = int(&node - &nodes[0]) + 1;
+			int right = node.offset;
+			glm::vec3 d = (nodes[right].min + nodes[right].max) - (nodes[left].min + nodes[left].max);
+			glm::vec3 a = glm::abs(d);
+			int axis = (a.x>a.y && a.x>a.z) ? 0 : ((a.y>a.z) ? 1 : 2);
+			int lane = 0;
+			while(!(mask & (1<<lane)))
+				++lane;
+			const float4& dir = (axis==0) ? ray.dx : ((axis==1) ? ray.dy : ray.dz);
+			bool leftFirst = (dir[lane]*d[axis]) >= 0;
+			stack[top++] = leftFirst ? right : left;
+			stack[top++] = leftFirst ? left : right;
+		}
+	}
+}
+
+int CPURaytracer::Occluded(const RayPacket& ray, int activeMask, float tMin, float tMax) {
+	const vector<BVHNode>& nodes = pBVH->GetNodes();
+	const vector<int>& ids = pBVH->GetTriangleIndices();
+	if(nodes.empty() || activeMask==0)
+		return 0;
+
+	float4 tMinV(tMin), tMaxV(tMax);
+	int occluded = 0;
+	int stack[STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+
+	while(top>0) {
+		const BVHNode& node = nodes[stack[--top]];
+
+		float4 tNear;
+		int mask = IntersectBox(ray, node, tMinV, tMaxV, tNear) & activeMask & ~occluded;
+		if(mask==0)
+			continue;
+
+		if(node.count>0) {
+			for(int i=0;i<node.count;i++) {
+				float4 t, u, v;
+				occluded |= IntersectTriangle(ray, ids[node.offset+i], tMinV, tMaxV, t, u, v) & mask;
+				if((occluded & activeMask)==activeMask)
+					return occluded;
+			}
+		} else {
+			stack[top++] = node.offset;
+			stack[top++] = int(&node - &nodes[0]) + 1;
+		}
+	}
+	return occluded;
+}
+
+int CPURaytracer::RenderTile(int tileX, int tileY, int width, int height, vector<unsigned char>& pixels) {
+	int rays = 0;
+
+	//camera basis as in setup_camera
+	glm::vec3 U = glm::vec3(invMVP[0].x, invMVP[0].y, invMVP[0].z);
+	glm::vec3 V = glm::vec3(invMVP[1].x, invMVP[1].y, invMVP[1].z);
+	glm::vec3 W = glm::vec3(invMVP[2].x, invMVP[2].y, invMVP[2].z);
+
+	int endX = std::min(tileX+TILE_SIZE, width);
+	int endY = std::min(tileY+TILE_SIZE, height);
+
+	for(int y=tileY;y<endY;y+=2) {
+		for(int x=tileX;x<endX;x+=2) {
+			//setup the 2x2 pixel packet
+			float dirs[3][4];
+			float tFar[4];
+			int active = 0;
+			glm::vec3 fragCoord[4];
+			for(int k=0;k<4;k++) {
+				int px = x + (k&1);
+				int py = y + (k>>1);
+				fragCoord[k] = glm::vec3(px+0.5f, py+0.5f, 0.5f);
+				glm::vec2 uv(fragCoord[k].x/width*2.0f-1.0f, fragCoord[k].y/height*2.0f-1.0f);
+				glm::vec3 dir = glm::normalize(uv.x*U + uv.y*V + W);
+				dir += U*uv.x;
+				dir += V*uv.y;
+				dirs[0][k] = dir.x;
+				dirs[1][k] = dir.y;
+				dirs[2][k] = dir.z;
+
+				//intersect the scene bounding box
+				glm::vec3 tMin = (aabbMin - eyePos)/dir;
+				glm::vec3 tMax = (aabbMax - eyePos)/dir;
+				glm::vec3 t1 = glm::min(tMin, tMax);
+				glm::vec3 t2 = glm::max(tMin, tMax);
+				float tNear = std::max(std::max(t1.x, t1.y), t1.z);
+				tFar[k] = std::min(std::min(t2.x, t2.y), t2.z) + 1;
+				if(px<width && py<height) {
+					++rays;
+					if(tNear<tFar[k]-1)
+						active |= 1<<k;
+				}
+			}
+
+			RayPacket ray;
+			ray.ox = float4(eyePos.x);
+			ray.oy = float4(eyePos.y);
+			ray.oz = float4(eyePos.z);
+			ray.dx = float4::Load(dirs[0]);
+			ray.dy = float4::Load(dirs[1]);
+			ray.dz = float4::Load(dirs[2]);
+			ray.ix = float4(1.0f)/ray.dx;
+			ray.iy = float4(1.0f)/ray.dy;
+			ray.iz = float4(1.0f)/ray.dz;
+
+			HitPacket hit;
+			for(int k=0;k<4;k++) {
+				hit.t[k] = tFar[k];
+				hit.triangle[k] = -1;
+			}
+			Intersect(ray, active, 0.0f, hit);
+
+			//setup the shadow rays from the hit points to the jittered light
+			int shaded = 0;
+			float diffuse[4];
+			float origins[3][4], lights[3][4];
+			glm::vec3 normals[4];
+			for(int k=0;k<4;k++) {
+				diffuse[k] = 0;
+				origins[0][k] = origins[1][k] = origins[2][k] = 0;
+				lights[0][k] = lights[1][k] = lights[2][k] = 1;
+				if(!(active & (1<<k)) || hit.triangle[k]<0)
+					continue;
+				shaded |= 1<<k;
+
+				glm::vec3 dir(dirs[0][k], dirs[1][k], dirs[2][k]);
+				glm::vec3 p = eyePos + dir*hit.t[k];
+				glm::vec3 N = GetNormal(hit.triangle[k]);
+				normals[k] = N;
+
+				glm::vec3 jitteredLight = lightPos + UniformlyRandomVector(fragCoord[k], fragCoord[k].x);
+				glm::vec3 L = jitteredLight - p;
+				float d = glm::length(L);
+				L = glm::normalize(L);
+
+				diffuse[k] = std::max(0.0f, glm::dot(N, L));
+				diffuse[k] *= 1.0f/(k0 + (k1*d) + (k2*d*d));
+
+				glm::vec3 o = p + N*SHADOW_OFFSET;
+				origins[0][k] = o.x; origins[1][k] = o.y; origins[2][k] = o.z;
+				lights[0][k] = L.x;  lights[1][k] = L.y;  lights[2][k] = L.z;
+				++rays;
+			}
+
+			int occluded = 0;
+			if(shaded) {
+				RayPacket shadowRay;
+				shadowRay.ox = float4::Load(origins[0]);
+				shadowRay.oy = float4::Load(origins[1]);
+				shadowRay.oz = float4::Load(origins[2]);
+				shadowRay.dx = float4::Load(lights[0]);
+				shadowRay.dy = float4::Load(lights[1]);
+				shadowRay.dz = float4::Load(lights[2]);
+				shadowRay.ix = float4(1.0f)/shadowRay.dx;
+				shadowRay.iy = float4(1.0f)/shadowRay.dy;
+				shadowRay.iz = float4(1.0f)/shadowRay.dz;
+				occluded = Occluded(shadowRay, shaded, 0.0f, SHADOW_DISTANCE);
+			}
+
+			//shade and write the pixels, the output rows are top down
+			for(int k=0;k<4;k++) {
+				int px = x + (k&1);
+				int py = y + (k>>1);
+				if(px>=width || py>=height)
+					continue;
+
+				glm::vec4 color = bg;
+				if(shaded & (1<<k)) {
+					int material = (*pTriangles)[hit.triangle[k]*4+3];
+					float inShadow = (occluded & (1<<k)) ? 0.5f : 1.0f;
+					color = inShadow*diffuse[k]*SampleTexture(material, hit.u[k], hit.v[k]);
+				}
+
+				unsigned char* pOut = &pixels[((height-1-py)*width + px)*4];
+				for(int c=0;c<4;c++)
+					pOut[c] = (unsigned char)(glm::clamp(color[c], 0.0f, 1.0f)*255.0f + 0.5f);
+			}
+		}
+	}
+	return rays;
+}
+
+void CPURaytracer::Render(const glm::mat4& invMVP, const glm::vec3& eyePos, const glm::vec3& lightPos, int width, int height, vector<unsigned char>& pixels) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	this->invMVP = invMVP;
+	this->eyePos = eyePos;
+	this->lightPos = lightPos;
+	pixels.resize(width*height*4);
+
+	int tilesX = (width+TILE_SIZE-1)/TILE_SIZE;
+	int tilesY = (height+TILE_SIZE-1)/TILE_SIZE;
+	int totalTiles = tilesX*tilesY;
+	int totalRays = 0;
+
+	#pragma omp parallel for schedule(dynamic,1) reduction(+:totalRays)
+	for(int i=0;i<totalTiles;i++) {
+		totalRays += RenderTile((i%tilesX)*TILE_SIZE, (i/tilesX)*TILE_SIZE, width, height, pixels);
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	renderTime = std::chrono::duration<float, std::milli>(end-start).count();
+	mraysPerSecond = (renderTime>0) ? totalRays/(renderTime*1000.0f) : 0.0f;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "../src/BVH.h"
+#include "../src/SIMD.h"
+
+using namespace std;
+
+//CPURaytracer class mirrors the shading in shaders/raytracer.frag on the CPU.
+//The image is split into tiles which are traced on multiple threads. Each tile
+//is traced in 2x2 pixel packets of 4 rays that traverse the shared BVH together.
+//It needs no OpenGL context so it can produce reference images headlessly.
+class CPURaytracer
+{
+public:
+	//constructor/destructor
+	CPURaytracer(void);
+	~CPURaytracer(void);
+
+	//sets the scene triangles (4 indices per triangle as output by the ObjLoader)
+	//and the BVH built over them. The data is referenced, not copied.
+	void SetScene(const vector<glm::vec3>& vertices, const vector<unsigned int>& triangles, const BVH& bvh, const glm::vec3& aabbMin, const glm::vec3& aabbMax);
+
+	//sets the image for the given material index. The image rows must be
+	//bottom up as uploaded to OpenGL. The data is copied.
+	void SetTexture(int index, const unsigned char* pData, int width, int height, int channels);
+
+	//sets the colour of the pixels that do not hit the scene
+	void SetBackgroundColor(const glm::vec4& color);
+
+	//traces the image of the given size using the same inputs as the raytracing
+	//shader. The output is RGBA with the top row first.
+	void Render(const glm::mat4& invMVP, const glm::vec3& eyePos, const glm::vec3& lightPos, int width, int height, vector<unsigned char>& pixels);
+
+	//statistics of the last Render call
+	float GetRenderTime() const;		//in milliseconds
+	float GetMRaysPerSecond() const;	//primary and shadow rays
+
+	//tile size in pixels, must be a multiple of 2
+	static const int TILE_SIZE = 16;
+
+protected:
+	//packet of 4 rays in structure of arrays layout
+	struct RayPacket {
+		float4 ox, oy, oz;		//origins
+		float4 dx, dy, dz;		//directions
+		float4 ix, iy, iz;		//inverse directions
+	};
+
+	//nearest intersection of each ray in a packet
+	struct HitPacket {
+		float t[4];
+		float u[4], v[4];
+		int triangle[4];
+	};
+
+	//traces the pixels of the given tile and returns the number of rays traced
+	int RenderTile(int tileX, int tileY, int width, int height, vector<unsigned char>& pixels);
+
+	//finds the nearest intersection in (tMin, hit.t] for the active rays
+	void Intersect(const RayPacket& ray, int activeMask, float tMin, HitPacket& hit);
+
+	//returns the mask of active rays that hit anything, used for shadows
+	int Occluded(const RayPacket& ray, int activeMask, float tMin, float tMax);
+
+	//intersects the packet with a node box, returns the lane mask and near t values
+	int IntersectBox(const RayPacket& ray, const BVHNode& node, const float4& tMin, const float4& tMax, float4& tNear);
+
+	//intersects the packet with a triangle in the same way as intersectTriangle
+	//in the shader, returns the lane mask of rays that hit in (tMin, tMax]
+	int IntersectTriangle(const RayPacket& ray, int index, const float4& tMin, const float4& tMax, float4& t, float4& u, float4& v);
+
+	//returns the geometric normal of the given triangle
+	glm::vec3 GetNormal(int index);
+
+	//bilinear texture lookup with clamping, returns white for untextured materials
+	glm::vec4 SampleTexture(int material, float s, float t);
+
+	//mirrors the pseudorandom functions of the shader
+	static float Random(const glm::vec3& fragCoord, const glm::vec3& scale, float seed);
+	static glm::vec3 UniformlyRandomVector(const glm::vec3& fragCoord, float seed);
+
+	//textures indexed by material
+	struct Texture {
+		int width, height, channels;
+		vector<unsigned char> data;
+	};
+	vector<Texture> textures;
+
+	//scene data
+	const vector<glm::vec3>* pVertices;
+	const vector<unsigned int>* pTriangles;
+	const BVH* pBVH;
+	glm::vec3 aabbMin, aabbMax;
+	glm::vec4 bg;
+
+	//per frame camera data
+	glm::mat4 invMVP;
+	glm::vec3 eyePos, lightPos;
+
+	//statistics
+	float renderTime;
+	float mraysPerSecond;
+};
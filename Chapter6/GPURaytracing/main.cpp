@@ -10,6 +10,10 @@
 #include "..\src\GLSLShader.h"
 #include <vector>
 #include "Obj.h"
+#include "..\src\BVH.h"
+#include "..\src\ScenePacker.h"
+#include "..\src\TextureArrayBuilder.h"
+#include "CPURaytracer.h"
 
 #include <SOIL.h>
 
@@ -51,9 +55,11 @@ glm::mat4 MV = glm::mat4(1);
 ObjLoader obj;
 vector<Mesh*> meshes;					//all meshes 
 vector<Material*> materials;			//all materials 
-vector<unsigned short> indices;			//all mesh indices 
+vector<unsigned int> indices;			//all mesh indices 
 vector<Vertex> vertices;				//all mesh vertices  
 vector<GLuint> textures;				//all textures
+vector<glm::vec3> vertices2;			//all vertex positions for raytracing
+vector<unsigned int> indices2;		//all triangles for raytracing
 
 //camera transformation variables
 int state = 0, oldX=0, oldY=0;
@@ -79,8 +85,19 @@ glm::vec3 eyePos;
 //scene axially aligned bounding box
 BBox aabb;
 
-GLuint texVerticesID; //texture storing vertex positions
-GLuint texTrianglesID; //texture storing triangles list 
+//scene textures storing the vertex positions, triangles list, flattened
+//BVH nodes and triangle indices in BVH leaf order
+ScenePacker scenePacker;
+
+//scene bounding volume hierarchy
+BVH bvh;
+
+//flag to enable BVH traversal, otherwise all triangles are tested
+bool bUseBVH = true;
+
+//CPU reference raytracer and its output filename
+CPURaytracer cpuRaytracer;
+const std::string cpu_render_filename = "cpu_render.tga";
 
 //light crosshair gizmo vetex array and buffer object IDs
 GLuint lightVAOID;
@@ -97,8 +114,8 @@ int total_frames = 0;
 float fps = 0;
 float lastTime =0;
 
-//texture ID for array texture
-GLuint textureID;
+//material texture arrays grouped by image size
+TextureArrayBuilder textureBuilder;
 
 //mouse click handler
 void OnMouseDown(int button, int s, int x, int y)
@@ -143,6 +160,118 @@ void OnMouseMove(int x, int y)
 	glutPostRedisplay();
 }
 
+//returns the modelview matrix of the current camera
+glm::mat4 GetModelView() {
+	glm::mat4 T		= glm::translate(glm::mat4(1.0f),glm::vec3(0.0f, 0.0f, dist));
+	glm::mat4 Rx	= glm::rotate(T,  rX, glm::vec3(1.0f, 0.0f, 0.0f));
+	return glm::rotate(Rx, rY, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+//renders the given view with the CPU raytracer and saves the result
+//the image is compared against the reference image if one is given
+//returns false if saving fails or the images differ
+bool RenderCPU(const glm::mat4& MV, const glm::mat4& P, int width, int height, const string& filename, const string& reference) {
+	glm::mat4 invMV  = glm::inverse(MV);
+	glm::vec3 eyePos = glm::vec3(invMV[3][0],invMV[3][1],invMV[3][2]);
+	glm::mat4 invMVP = glm::inverse(P*MV);
+
+	vector<unsigned char> pixels;
+	cpuRaytracer.Render(invMVP, eyePos, lightPosOS, width, height, pixels);
+	cout<<"CPU raytracer: "<<width<<"x"<<height<<" in "<<cpuRaytracer.GetRenderTime()<<" ms, "
+		<<cpuRaytracer.GetMRaysPerSecond()<<" Mrays/s"<<endl;
+
+	if(!SOIL_save_image(filename.c_str(), SOIL_SAVE_TYPE_TGA, width, height, 4, &pixels[0])) {
+		cerr<<"Cannot save image: "<<filename.c_str()<<endl;
+		return false;
+	}
+	cout<<"Saved "<<filename.c_str()<<endl;
+
+	if(reference.empty())
+		return true;
+
+	//compare against the reference image, small differences are allowed
+	//since the sin based random numbers are not bit exact across platforms
+	const float MAX_RMSE = 2.0f;
+	int ref_width = 0, ref_height = 0, channels = 0;
+	GLubyte* pRef = SOIL_load_image(reference.c_str(), &ref_width, &ref_height, &channels, SOIL_LOAD_RGBA);
+	if(pRef == NULL) {
+		cerr<<"Cannot load image: "<<reference.c_str()<<endl;
+		return false;
+	}
+	if(ref_width != width || ref_height != height) {
+		cerr<<"Reference image size mismatch: "<<ref_width<<"x"<<ref_height<<endl;
+		SOIL_free_image_data(pRef);
+		return false;
+	}
+	double sum = 0;
+	int maxDiff = 0;
+	for(int i=0;i<width*height*4;i++) {
+		if(i%4 == 3)
+			continue;
+		int diff = abs(int(pixels[i]) - int(pRef[i]));
+		maxDiff = max(maxDiff, diff);
+		sum += diff*diff;
+	}
+	SOIL_free_image_data(pRef);
+	float rmse = float(sqrt(sum/(width*height*3)));
+	cout<<"Difference to "<<reference.c_str()<<": RMSE "<<rmse<<", max "<<maxDiff<<endl;
+	return rmse <= MAX_RMSE;
+}
+
+//renders the default view on the CPU without creating a window so that reference
+//images can be generated and checked on machines without a GPU
+//usage: GPURaytracing --cpu output.tga [reference.tga]
+int RenderHeadless(int argc, char** argv) {
+	if(argc < 3) {
+		cerr<<"Usage: "<<argv[0]<<" --cpu output.tga [reference.tga]"<<endl;
+		return EXIT_FAILURE;
+	}
+
+	//load the obj model
+	if(!obj.Load(mesh_filename.c_str(), meshes, vertices, indices, materials, aabb, vertices2, indices2)) {
+		cout<<"Cannot load the 3ds mesh"<<endl;
+		return EXIT_FAILURE;
+	}
+
+	//load material textures
+	std::string mesh_path = mesh_filename.substr(0, mesh_filename.find_last_of("/")+1);
+	vector<string> texture_filenames(materials.size());
+	for(size_t k=0;k<materials.size();k++) {
+		if(materials[k]->map_Kd != "")
+			texture_filenames[k] = mesh_path + materials[k]->map_Kd;
+	}
+	if(!textureBuilder.Load(texture_filenames))
+		return EXIT_FAILURE;
+	for(size_t k=0;k<materials.size();k++) {
+		const TextureArrayBuilder::Image& image = textureBuilder.GetImage(int(k));
+		if(!image.pixels.empty())
+			cpuRaytracer.SetTexture(int(k), &image.pixels[0], image.width, image.height, 4);
+	}
+
+	//build the BVH and setup the raytracer
+	bvh.Build(vertices2, indices2);
+	cpuRaytracer.SetScene(vertices2, indices2, bvh, aabb.min, aabb.max);
+	cpuRaytracer.SetBackgroundColor(bg);
+
+	//use the initial camera and light of the interactive mode
+	lightPosOS.x = radius * cos(theta)*sin(phi);
+	lightPosOS.y = radius * cos(phi);
+	lightPosOS.z = radius * sin(theta)*sin(phi);
+	glm::mat4 proj = glm::perspective(glm::radians(60.0f),(float)WIDTH/HEIGHT, 0.1f,1000.0f);
+
+	bool result = RenderCPU(GetModelView(), proj, WIDTH, HEIGHT, argv[2], (argc > 3) ? argv[3] : "");
+
+	//delete all meshes and materials
+	for(size_t i=0;i<meshes.size();i++)
+		delete meshes[i];
+	meshes.clear();
+	for(size_t i=0;i<materials.size();i++)
+		delete materials[i];
+	materials.clear();
+
+	return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 //OpenGL initialization function
 void OnInit() {
 	//setup fullscreen quad geometry
@@ -176,8 +305,6 @@ void OnInit() {
 	std::string mesh_path = mesh_filename.substr(0, mesh_filename.find_last_of("/")+1);
 
 	//load the obj model
-	vector<unsigned short> indices2;
-	vector<glm::vec3> vertices2;
 	if(!obj.Load(mesh_filename.c_str(), meshes, vertices, indices, materials, aabb, vertices2, indices2)) {
 		cout<<"Cannot load the 3ds mesh"<<endl;
 		exit(EXIT_FAILURE);
@@ -185,76 +312,25 @@ void OnInit() {
 	
 	GL_CHECK_ERRORS
 
-	int total =0;
-	//check the total number of non empty textures since we will use this
-	//information to creare a single array texture to store all textures 
+	//decode the material textures in parallel and group them by size into
+	//array textures with CPU generated mipmaps. The material lookup texture
+	//is bound to texture unit 6 and the texture arrays to units 7 to 10.
+	vector<string> texture_filenames(materials.size());
 	for(size_t k=0;k<materials.size();k++) {
-		if(materials[k]->map_Kd != "") {
-			total++;
-		}
+		if(materials[k]->map_Kd != "")
+			texture_filenames[k] = mesh_path + materials[k]->map_Kd;
 	}
+	if(!textureBuilder.Load(texture_filenames))
+		exit(EXIT_FAILURE);
 
-	//load material textures
+	//keep a copy for the CPU raytracer
 	for(size_t k=0;k<materials.size();k++) {
-		//if the diffuse texture name is not empty
-		if(materials[k]->map_Kd != "") {
-			if(k==0) {
-				//generate a new OpenGL array texture
-				glGenTextures(1, &textureID);
-				glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
-				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP);
-				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP);
-			}
-			int texture_width = 0, texture_height = 0, channels=0;
-
-			const string& filename =  materials[k]->map_Kd;
-
-			std::string full_filename = mesh_path;
-			full_filename.append(filename);
-
-			//use SOIL to load the texture
-			GLubyte* pData = SOIL_load_image(full_filename.c_str(), &texture_width, &texture_height, &channels, SOIL_LOAD_AUTO);
-			if(pData == NULL) {
-				cerr<<"Cannot load image: "<<full_filename.c_str()<<endl;
-				exit(EXIT_FAILURE);
-			}
-
-			//Flip the image on Y axis
-			int i,j;
-			for( j = 0; j*2 < texture_height; ++j )
-			{
-				int index1 = j * texture_width * channels;
-				int index2 = (texture_height - 1 - j) * texture_width * channels;
-				for( i = texture_width * channels; i > 0; --i )
-				{
-					GLubyte temp = pData[index1];
-					pData[index1] = pData[index2];
-					pData[index2] = temp;
-					++index1;
-					++index2;
-				}
-			}
-			//get the image format
-			GLenum format = GL_RGBA;
-			switch(channels) {
-				case 2:	format = GL_RG32UI; break;
-				case 3: format = GL_RGB;	break;
-				case 4: format = GL_RGBA;	break;
-			}
-
-			//if this is the first texture, allocate the array texture
-			if(k==0) {
-				glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format, texture_width, texture_height, total, 0, format, GL_UNSIGNED_BYTE, NULL);
-			}
-			//modify the existing texture
-			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0,0,0,k, texture_width, texture_height, 1, format, GL_UNSIGNED_BYTE, pData);
-
-			//release the SOIL image data
-			SOIL_free_image_data(pData);
-		}
+		const TextureArrayBuilder::Image& image = textureBuilder.GetImage(int(k));
+		if(!image.pixels.empty())
+			cpuRaytracer.SetTexture(int(k), &image.pixels[0], image.width, image.height, 4);
 	}
+	textureBuilder.Upload(6);
+	textureBuilder.PrintStats();
 	GL_CHECK_ERRORS
 
 	//load flat shader
@@ -284,17 +360,25 @@ void OnInit() {
 		raytraceShader.AddUniform("aabb.max");
 		raytraceShader.AddUniform("vertex_positions");
 		raytraceShader.AddUniform("triangles_list");
-		raytraceShader.AddUniform("VERTEX_TEXTURE_SIZE");
 		raytraceShader.AddUniform("TRIANGLE_TEXTURE_SIZE");
+		raytraceShader.AddUniform("bvh_nodes");
+		raytraceShader.AddUniform("triangle_ids");
+		raytraceShader.AddUniform("textureMaps");
+		raytraceShader.AddUniform("material_maps");
+		raytraceShader.AddUniform("useBVH");
 
 		//set values of constant uniforms as initialization		
-		glUniform1f(raytraceShader("VERTEX_TEXTURE_SIZE"), (float)vertices2.size());
 		glUniform1f(raytraceShader("TRIANGLE_TEXTURE_SIZE"), (float)indices2.size()/4);
 		glUniform3fv(raytraceShader("aabb.min"),1, glm::value_ptr(aabb.min));
 		glUniform3fv(raytraceShader("aabb.max"),1, glm::value_ptr(aabb.max));
 		glUniform4fv(raytraceShader("backgroundColor"),1, glm::value_ptr(bg));
 		glUniform1i(raytraceShader("vertex_positions"), 1);
 		glUniform1i(raytraceShader("triangles_list"), 2);
+		glUniform1i(raytraceShader("bvh_nodes"), 3);
+		glUniform1i(raytraceShader("triangle_ids"), 4);
+		glUniform1i(raytraceShader("material_maps"), 6);
+		GLint texture_units[TextureArrayBuilder::MAX_BUCKETS] = {7, 8, 9, 10};
+		glUniform1iv(raytraceShader("textureMaps"), TextureArrayBuilder::MAX_BUCKETS, texture_units);
 	raytraceShader.UnUse();
 
 	GL_CHECK_ERRORS
@@ -314,6 +398,7 @@ void OnInit() {
 		shader.AddUniform("P");
 		shader.AddUniform("textureMap");
 		shader.AddUniform("textureIndex");
+		shader.AddUniform("uvScale");
 		shader.AddUniform("useDefault");
 		shader.AddUniform("diffuse_color");
 		shader.AddUniform("light_position");
@@ -355,7 +440,7 @@ void OnInit() {
 		if(materials.size()==1) {
 			//pass indices to the element array buffer if there is a single material			
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndicesID);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*indices.size(), &(indices[0]), GL_STATIC_DRAW);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*indices.size(), &(indices[0]), GL_STATIC_DRAW);
 		}
 		GL_CHECK_ERRORS
 
@@ -390,53 +475,23 @@ void OnInit() {
 	lightPosOS.y = radius * cos(phi);
 	lightPosOS.z = radius * sin(theta)*sin(phi);
 
-	//pass position to 1D texture bound to texture unit 1
-	glGenTextures(1, &texVerticesID);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture( GL_TEXTURE_2D, texVerticesID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-	GLfloat* pData = new GLfloat[vertices2.size()*4];
-	int count = 0;
-	for(size_t i=0;i<vertices2.size();i++) {
-		pData[count++] = vertices2[i].x;
-		pData[count++] = vertices2[i].y;
-		pData[count++] = vertices2[i].z;
-		pData[count++] = 0;				
-	}
-	//allocate a floating point texture
- 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, vertices2.size(),1, 0, GL_RGBA, GL_FLOAT, pData);
-
-	//delete the data pointer
-	delete [] pData;
+	//build the bounding volume hierarchy over the scene triangles
+	bvh.Build(vertices2, indices2);
+	cout<<"BVH built in "<<bvh.GetBuildTime()<<" ms: "<<bvh.GetNodes().size()<<" nodes, "
+		<<bvh.GetTotalLeaves()<<" leaves, depth "<<bvh.GetMaxDepth()<<", SAH cost "<<bvh.GetSAHCost()<<endl;
 
-	GL_CHECK_ERRORS
+	//the CPU raytracer shares the scene and the BVH
+	cpuRaytracer.SetScene(vertices2, indices2, bvh, aabb.min, aabb.max);
+	cpuRaytracer.SetBackgroundColor(bg);
 
-	//store the mesh topology in another texture bound to texture unit 2
-	glGenTextures(1, &texTrianglesID);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture( GL_TEXTURE_2D, texTrianglesID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-	GLushort* pData2 = new GLushort[indices2.size()];
-	count = 0;
-	for(size_t i=0;i<indices2.size();i+=4) {
-		pData2[count++] = (indices2[i]);
-		pData2[count++] = (indices2[i+1]);
-		pData2[count++] = (indices2[i+2]);
-		pData2[count++] = (indices2[i+3]);
+	//store the vertex positions, triangles, BVH nodes and triangle ids in 2D
+	//textures bound to texture units 1 to 4. All indices are 32-bit so large
+	//scenes are not limited by the maximum texture width
+	if(!scenePacker.Pack(vertices2, indices2, bvh, 1)) {
+		cout<<"Cannot pack the scene into textures"<<endl;
+		exit(EXIT_FAILURE);
 	}
-	//allocate an integer format texture
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16I, indices2.size()/4,1, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, pData2);
-	
-	//delete heap allocated buffer
-	delete [] pData2;
+	scenePacker.PrintFootprint(vertices2, indices2, bvh);
 
 	GL_CHECK_ERRORS
 
@@ -472,7 +527,7 @@ void OnShutdown() {
 	glDeleteBuffers(1, &quadIndicesID);
 
 	//delete all textures
-	glDeleteTextures(1, &textureID);
+	textureBuilder.Release();
 
 	//delete all meshes
 	size_t total_meshes = meshes.size();
@@ -502,8 +557,7 @@ void OnShutdown() {
 	glDeleteVertexArrays(1, &lightVAOID);
 	glDeleteBuffers(1, &lightVerticesVBO);
 
-	glDeleteTextures(1, &texVerticesID);
-	glDeleteTextures(1, &texTrianglesID);
+	scenePacker.Release();
 	cout<<"Shutdown successfull"<<endl;
 }
 
@@ -532,9 +586,7 @@ void OnRender() {
 	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
 	//set the camera transformation
-	glm::mat4 T		= glm::translate(glm::mat4(1.0f),glm::vec3(0.0f, 0.0f, dist));
-	glm::mat4 Rx	= glm::rotate(T,  rX, glm::vec3(1.0f, 0.0f, 0.0f));
-	glm::mat4 MV    = glm::rotate(Rx, rY, glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 MV    = GetModelView();
 
 	//get the eye position and inverse of MVP matrix
 	glm::mat4 invMV  = glm::inverse(MV);
@@ -547,6 +599,7 @@ void OnRender() {
 		raytraceShader.Use();
 			//pass shader uniforms
 			glUniform3fv(raytraceShader("eyePos"), 1, glm::value_ptr(eyePos));
+			glUniform1i(raytraceShader("useBVH"), bUseBVH);
 			glUniformMatrix4fv(raytraceShader("invMVP"), 1, GL_FALSE, glm::value_ptr(invMVP));
 			glUniform3fv(raytraceShader("light_position"),1, &(lightPosOS.x));
 				//draw a fullscreen quad
@@ -572,8 +625,12 @@ void OnRender() {
 					//if material texture filename is not empty
 					//dont use the default colour
 					if(pMat->map_Kd !="") {
+						//bind the texture array holding the material texture
+						const glm::vec4& map = textureBuilder.GetMaterialMap(int(i));
+						glBindTexture(GL_TEXTURE_2D_ARRAY, textureBuilder.GetArrayTexture(int(map.x)));
 						glUniform1f(shader("useDefault"), 0.0);
-						glUniform1i(shader("textureIndex"), i);
+						glUniform1i(shader("textureIndex"), int(map.y));
+						glUniform2f(shader("uvScale"), map.z, map.w);
 					}
 					else
 						//otherwise we have no texture, we use a default colour
@@ -581,10 +638,10 @@ void OnRender() {
 			
 					//if we have a single material, we render the whole mesh in a single call
 					if(materials.size()==1)
-						glDrawElements(GL_TRIANGLES,  indices.size() , GL_UNSIGNED_SHORT, 0);
+						glDrawElements(GL_TRIANGLES,  indices.size() , GL_UNSIGNED_INT, 0);
 					else
 						//otherwise we render the submesh
-						glDrawElements(GL_TRIANGLES, pMat->count, GL_UNSIGNED_SHORT, (const GLvoid*)(&indices[pMat->offset]));
+						glDrawElements(GL_TRIANGLES, pMat->count, GL_UNSIGNED_INT, (const GLvoid*)(&indices[pMat->offset]));
 					
 				}
 
@@ -637,14 +694,27 @@ void OnMouseWheel(int button, int dir, int x, int y) {
 }
 
 //keyboard event handler to toggle raytracing and rasterization
+//and BVH traversal and to render the current view on the CPU
 void OnKey(unsigned char k, int x, int y) {
 	switch(k) {
 		case ' ':bRaytrace=!bRaytrace; break;
+		case 'b':
+			bUseBVH=!bUseBVH;
+			cout<<(bUseBVH?"BVH traversal":"Brute force triangle tests")<<endl;
+			break;
+		case 'c':
+			//render the current view on the CPU for comparison
+			RenderCPU(GetModelView(), P, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT), cpu_render_filename, "");
+			break;
 	}
 	glutPostRedisplay();
 }
 
 int main(int argc, char** argv) {
+	//headless CPU rendering does not need an OpenGL context
+	if(argc > 1 && string(argv[1]) == "--cpu")
+		return RenderHeadless(argc, argv);
+
 	//freeglut initialization
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
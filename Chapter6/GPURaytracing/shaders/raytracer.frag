@@ -14,22 +14,63 @@ struct Camera {
 //input from the vertex shader
 smooth in vec2 vUV;					//interpolated texture coordinates
 
+//maximum number of texture arrays, must match TextureArrayBuilder::MAX_BUCKETS
+const int MAX_TEXTURE_BUCKETS = 4;
+
 //shader uniforms
 uniform mat4 invMVP;				//inverse of combined modelview projection matrix
 uniform vec4 backgroundColor;		//background colour
 uniform vec3 eyePos;				//eye position in object space
 uniform sampler2D vertex_positions;	//mesh vertices
 uniform isampler2D triangles_list;	//mesh triangles
-uniform sampler2DArray textureMaps;	//all mesh textures
+uniform sampler2DArray textureMaps[MAX_TEXTURE_BUCKETS];	//mesh textures grouped by size
+uniform sampler2D material_maps;	//bucket, layer and uv scale of each material
 uniform vec3 light_position;		//light position is in object space
 uniform Box aabb;					//scene's bounding box 
-uniform float VERTEX_TEXTURE_SIZE;	//size of the vertex texture
-uniform float TRIANGLE_TEXTURE_SIZE;//size of the triangle texture 
+uniform float TRIANGLE_TEXTURE_SIZE;//total number of triangles
+uniform sampler2D bvh_nodes;		//flattened BVH, two texels per node
+uniform isampler2D triangle_ids;	//triangle indices in BVH leaf order
+uniform bool useBVH;				//traverse the BVH instead of testing all triangles
+
+//the scene textures are ROW_WIDTH texels wide, element i of an array is
+//stored in column i & (ROW_WIDTH-1) of row i >> ROW_SHIFT
+const int ROW_SHIFT = 12;				//must match ScenePacker::ROW_SHIFT
+const int ROW_MASK = (1<<ROW_SHIFT)-1;
+
+//returns the texel holding the given array element
+ivec2 texelAddress(int i) {
+	return ivec2(i & ROW_MASK, i >> ROW_SHIFT);
+}
+
+//returns the texture colour of the given material at the given texture
+//coordinates, white for untextured materials. The ray hits have no screen
+//space derivatives so the base level is sampled.
+vec4 sampleMaterial(vec3 uvm) {
+	if(uvm.z==255)
+		return vec4(1);
+	vec4 map = texelFetch(material_maps, ivec2(int(uvm.z), 0), 0);
+	vec3 uvl = vec3(clamp(uvm.xy, 0, 1)*map.zw, map.y);
+
+	//samplers can only be indexed with constant expressions
+	int bucket = int(map.x);
+	if(bucket==0)
+		return textureLod(textureMaps[0], uvl, 0);
+	else if(bucket==1)
+		return textureLod(textureMaps[1], uvl, 0);
+	else if(bucket==2)
+		return textureLod(textureMaps[2], uvl, 0);
+	else if(bucket==3)
+		return textureLod(textureMaps[3], uvl, 0);
+	return vec4(1);
+}
  
 //shader constants
 const float k0 = 1.0;	//constant attenuation
 const float k1 = 0.0;	//linear attenuation
 const float k2 = 0.0;	//quadratic attenuation
+
+//size of the BVH traversal stack, must not be less than the BVH depth
+const int BVH_STACK_SIZE = 32;
  
 //function to return the intersection of a ray with a box
 //returns a vec2 in which the x value contains the t value at the near intersection
@@ -95,13 +136,13 @@ vec3 uniformlyRandomVector(float seed)
 //w -> texture map id
 vec4 intersectTriangle(vec3 origin, vec3 dir, int index,  out vec3 normal ) {
 	 
-	ivec4 list_pos = texture(triangles_list, vec2((index+0.5)/TRIANGLE_TEXTURE_SIZE, 0.5));
+	ivec4 list_pos = texelFetch(triangles_list, texelAddress(index), 0);
 	if((index+1) % 2 !=0 ) { 
 		list_pos.xyz = list_pos.zxy;
 	}  
-	vec3 v0 = texture(vertex_positions, vec2((list_pos.z + 0.5 )/VERTEX_TEXTURE_SIZE, 0.5)).xyz;
-	vec3 v1 = texture(vertex_positions, vec2((list_pos.y + 0.5 )/VERTEX_TEXTURE_SIZE, 0.5)).xyz;
-	vec3 v2 = texture(vertex_positions, vec2((list_pos.x + 0.5 )/VERTEX_TEXTURE_SIZE, 0.5)).xyz;
+	vec3 v0 = texelFetch(vertex_positions, texelAddress(list_pos.z), 0).xyz;
+	vec3 v1 = texelFetch(vertex_positions, texelAddress(list_pos.y), 0).xyz;
+	vec3 v2 = texelFetch(vertex_positions, texelAddress(list_pos.x), 0).xyz;
 	  
 	vec3 e1 = v1-v0;
 	vec3 e2 = v2-v0;
@@ -135,11 +176,110 @@ vec4 intersectTriangle(vec3 origin, vec3 dir, int index,  out vec3 normal ) {
 	return vec4(t,u,v,list_pos.w);
 }
 
+//returns the t values at the near and far slabs of the given box 
+//using the precomputed inverse ray direction
+vec2 intersectNode(vec3 origin, vec3 invDir, vec3 bmin, vec3 bmax) {
+	vec3   tMin = (bmin - origin) * invDir;
+	vec3   tMax = (bmax - origin) * invDir;
+	vec3     t1 = min(tMin, tMax);
+	vec3     t2 = max(tMin, tMax);
+	float tNear = max(max(t1.x, t1.y), t1.z);
+	float  tFar = min(min(t2.x, t2.y), t2.z);
+	return vec2(tNear, tFar);
+}
+
+//traverses the BVH front to back and returns the nearest intersection in 
+//(tMin, tMax] in the same format as intersectTriangle. If anyHit is true 
+//the first intersection found is returned which is all a shadow ray needs.
+//Each node is two texels: (min, offset) and (max, count) where offset is 
+//the first triangle of a leaf or the right child of an inner node. The left 
+//child of an inner node is always the next node.
+vec4 traverseBVH(vec3 origin, vec3 dir, float tMin, float tMax, bool anyHit, out vec3 N) {
+	vec4 val = vec4(tMax,0,0,0);
+	vec3 invDir = 1.0/dir;
+
+	int   stack[BVH_STACK_SIZE];
+	float stackT[BVH_STACK_SIZE];
+	int top = 0;
+
+	//check the root node
+	vec2 t = intersectNode(origin, invDir, texelFetch(bvh_nodes, texelAddress(0), 0).xyz, texelFetch(bvh_nodes, texelAddress(1), 0).xyz);
+	if(t.x > t.y || t.y < tMin || t.x > val.x)
+		return val;
+
+	int node = 0;
+	while(true) {
+		vec4 nodeMin = texelFetch(bvh_nodes, texelAddress(2*node), 0);
+		vec4 nodeMax = texelFetch(bvh_nodes, texelAddress(2*node+1), 0);
+		int offset = floatBitsToInt(nodeMin.w);
+		int count  = floatBitsToInt(nodeMax.w);
+
+		if(count > 0) {
+			//leaf node, test all of its triangles
+			for(int i=0;i<count;i++) {
+				int id = texelFetch(triangle_ids, texelAddress(offset+i), 0).r;
+				vec3 normal;
+				vec4 res = intersectTriangle(origin, dir, id, normal);
+				if(res.x>tMin && res.x <= val.x) {
+					val = res;
+					N = normal;
+					if(anyHit)
+						return val;
+				}
+			}
+		} else {
+			//inner node, visit the nearer child first and push the other one
+			int left = node+1;
+			int right = offset;
+			vec2 tL = intersectNode(origin, invDir, texelFetch(bvh_nodes, texelAddress(2*left), 0).xyz, texelFetch(bvh_nodes, texelAddress(2*left+1), 0).xyz);
+			vec2 tR = intersectNode(origin, invDir, texelFetch(bvh_nodes, texelAddress(2*right), 0).xyz, texelFetch(bvh_nodes, texelAddress(2*right+1), 0).xyz);
+			bool hitL = tL.x <= tL.y && tL.y >= tMin && tL.x <= val.x;
+			bool hitR = tR.x <= tR.y && tR.y >= tMin && tR.x <= val.x;
+
+			if(hitL && hitR) {
+				if(tR.x < tL.x) {
+					node = right;
+					stack[top] = left;
+					stackT[top++] = tL.x;
+				} else {
+					node = left;
+					stack[top] = right;
+					stackT[top++] = tR.x;
+				}
+				continue;
+			} else if(hitL) {
+				node = left;
+				continue;
+			} else if(hitR) {
+				node = right;
+				continue;
+			}
+		}
+
+		//pop the next node skipping the ones behind the nearest hit
+		bool found = false;
+		while(top > 0 && !found) {
+			--top;
+			if(stackT[top] <= val.x) {
+				node = stack[top];
+				found = true;
+			}
+		}
+		if(!found)
+			break;
+	}
+	return val;
+}
+
 //function to test if the given ray intersect any object
 //if so it returns 0.5 otherwise 1. This darkens the shade
 //simulating shadow
 float shadow(vec3 origin, vec3 dir ) {
 	vec3 tmp;
+	if(useBVH) {
+		vec4 res = traverseBVH(origin, dir, 0.0, 10000.0, true, tmp);
+		return (res.x < 10000) ? 0.5 : 1.0;
+	}
 	for(int i=0;i<int(TRIANGLE_TEXTURE_SIZE);i++) 
 	{
 		vec4 res = intersectTriangle(origin, dir, i, tmp); 
@@ -174,15 +314,20 @@ void main()
 		 
 		vec4 val=vec4(t,0,0,0);
 		vec3 N;
-		//brute force check all triangles
-		for(int i=0;i<int(TRIANGLE_TEXTURE_SIZE);i++) 
-		{
-			vec3 normal;
-			vec4 res = intersectTriangle(eyeRay.origin, eyeRay.dir, i, normal); 
-		 	if(res.x>0 && res.x <= val.x) {
-			   val = res;  
-			   N = normal;
-		    }
+		if(useBVH) {
+			//only check the triangles in the BVH leaves hit by the ray
+			val = traverseBVH(eyeRay.origin, eyeRay.dir, 0.0, t, false, N);
+		} else {
+			//brute force check all triangles
+			for(int i=0;i<int(TRIANGLE_TEXTURE_SIZE);i++) 
+			{
+				vec3 normal;
+				vec4 res = intersectTriangle(eyeRay.origin, eyeRay.dir, i, normal); 
+			 	if(res.x>0 && res.x <= val.x) {
+				   val = res;  
+				   N = normal;
+			    }
+			}
 		}
 
 		//if there is a valid intersection
@@ -210,7 +355,7 @@ void main()
 			//check for shadows
 			float inShadow = shadow(hit+ N*0.0001, L) ;
 			//return final color
-			vFragColor = inShadow*diffuse*mix(texture(textureMaps, val.yzw), vec4(1), (val.w==255) );
+			vFragColor = inShadow*diffuse*sampleMaterial(val.yzw);
         	return;
 		}    
 	} 
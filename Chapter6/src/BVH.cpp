@@ -0,0 +1,385 @@
+#include "BVH.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//total number of bins used to evaluate the SAH
+const int NUM_BINS = 16;
+
+//leaves are always created below this triangle count
+const int MIN_LEAF_TRIANGLES = 2;
+
+//leaves are never larger than this unless the maximum depth is reached
+const int MAX_LEAF_TRIANGLES = 8;
+
+//relative costs of a node traversal step and a ray triangle test
+const float COST_TRAVERSAL = 1.0f;
+const float COST_INTERSECTION = 1.0f;
+
+//ranges larger than this are binned with multiple threads
+const int PARALLEL_BINNING_THRESHOLD = 16384;
+
+//returns the number of worker threads
+static int GetTotalThreads() {
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+void BVH::Bounds::Reset() {
+	min = glm::vec3( FLT_MAX);
+	max = glm::vec3(-FLT_MAX);
+}
+
+void BVH::Bounds::Grow(const glm::vec3& p) {
+	min = glm::min(min, p);
+	max = glm::max(max, p);
+}
+
+void BVH::Bounds::Grow(const Bounds& b) {
+	min = glm::min(min, b.min);
+	max = glm::max(max, b.max);
+}
+
+float BVH::Bounds::Area() const {
+	glm::vec3 e = max-min;
+	if(e.x<0 || e.y<0 || e.z<0)
+		return 0;
+	return 2.0f*(e.x*e.y + e.y*e.z + e.z*e.x);
+}
+
+BVH::BVH(void)
+{
+	totalLeaves = 0;
+	maxDepth = 0;
+	sahCost = 0;
+	buildTime = 0;
+	taskThreshold = 0;
+}
+
+BVH::~BVH(void)
+{
+	nodes.clear();
+	triIndices.clear();
+}
+
+void BVH::Build(const vector<glm::vec3>& vertices, const vector<unsigned int>& triangles) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	int total = int(triangles.size()/4);
+	nodes.clear();
+	triIndices.resize(total);
+	triBounds.resize(total);
+	centroids.resize(total);
+
+	//calculate the per triangle bounds and centroids
+	#pragma omp parallel for
+	for(int i=0;i<total;i++) {
+		const glm::vec3& v0 = vertices[triangles[i*4]];
+		const glm::vec3& v1 = vertices[triangles[i*4+1]];
+		const glm::vec3& v2 = vertices[triangles[i*4+2]];
+		triBounds[i].Reset();
+		triBounds[i].Grow(v0);
+		triBounds[i].Grow(v1);
+		triBounds[i].Grow(v2);
+		centroids[i] = (triBounds[i].min + triBounds[i].max)*0.5f;
+		triIndices[i] = i;
+	}
+
+	if(total>0) {
+		//build the top of the hierarchy on the main thread and defer
+		//the subtrees below taskThreshold to the worker threads
+		int threads = GetTotalThreads();
+		taskThreshold = (threads>1) ? std::max(total/(threads*4), 256) : total+1;
+
+		vector<BVHNode> top;
+		vector<Task> tasks;
+		BuildRecursive(0, total, 0, top, &tasks);
+
+		#pragma omp parallel for schedule(dynamic,1)
+		for(int i=0;i<int(tasks.size());i++) {
+			BuildRecursive(tasks[i].first, tasks[i].count, tasks[i].depth, tasks[i].nodes, NULL);
+		}
+
+		//stitch the top level and the subtrees into a single depth first array
+		Flatten(top, 0, tasks);
+	}
+
+	//release the temporary construction data
+	triBounds.clear();
+	centroids.clear();
+
+	//gather the statistics
+	totalLeaves = 0;
+	maxDepth = 0;
+	sahCost = 0;
+	if(!nodes.empty()) {
+		Bounds root;
+		root.min = nodes[0].min;
+		root.max = nodes[0].max;
+		float invRootArea = (root.Area()>0) ? 1.0f/root.Area() : 0.0f;
+
+		vector<int> stack, depth;
+		stack.push_back(0);
+		depth.push_back(1);
+		while(!stack.empty()) {
+			int n = stack.back();
+			int d = depth.back();
+			stack.pop_back();
+			depth.pop_back();
+
+			Bounds b;
+			b.min = nodes[n].min;
+			b.max = nodes[n].max;
+			maxDepth = std::max(maxDepth, d);
+			if(nodes[n].count>0) {
+				++totalLeaves;
+				sahCost += COST_INTERSECTION*nodes[n].count*b.Area()*invRootArea;
+			} else {
+				sahCost += COST_TRAVERSAL*b.Area()*invRootArea;
+				stack.push_back(n+1);
+				depth.push_back(d+1);
+				stack.push_back(nodes[n].offset);
+				depth.push_back(d+1);
+			}
+		}
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	buildTime = std::chrono::duration<float, std::milli>(end-start).count();
+}
+
+void BVH::CalculateBounds(int first, int count, Bounds& bounds, Bounds& centroidBounds) {
+	bounds.Reset();
+	centroidBounds.Reset();
+	for(int i=first;i<first+count;i++) {
+		int t = triIndices[i];
+		bounds.Grow(triBounds[t]);
+		centroidBounds.Grow(centroids[t]);
+	}
+}
+
+//returns the bin index of the given centroid along the split axis
+inline int GetBin(const glm::vec3& c, int axis, float minC, float scale) {
+	int b = int((c[axis]-minC)*scale);
+	return std::min(std::max(b,0), NUM_BINS-1);
+}
+
+bool BVH::FindSplit(int first, int count, const Bounds& centroidBounds, int& axis, int& bin) {
+	Bounds bins[3][NUM_BINS];
+	int binCounts[3][NUM_BINS];
+
+	for(int a=0;a<3;a++) {
+		for(int b=0;b<NUM_BINS;b++) {
+			bins[a][b].Reset();
+			binCounts[a][b] = 0;
+		}
+	}
+
+	glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+	glm::vec3 scale;
+	for(int a=0;a<3;a++)
+		scale[a] = (extent[a]>0) ? NUM_BINS/extent[a] : 0.0f;
+
+	if(count>PARALLEL_BINNING_THRESHOLD) {
+		//each chunk fills its own set of bins which are then merged
+		int chunks = GetTotalThreads();
+		int chunkSize = (count+chunks-1)/chunks;
+		vector<Bounds> chunkBins(chunks*3*NUM_BINS);
+		vector<int> chunkCounts(chunks*3*NUM_BINS, 0);
+
+		#pragma omp parallel for
+		for(int c=0;c<chunks;c++) {
+			Bounds* pBins = &chunkBins[c*3*NUM_BINS];
+			int* pCounts = &chunkCounts[c*3*NUM_BINS];
+			for(int i=0;i<3*NUM_BINS;i++)
+				pBins[i].Reset();
+
+			int end = std::min(first+count, first+(c+1)*chunkSize);
+			for(int i=first+c*chunkSize;i<end;i++) {
+				int t = triIndices[i];
+				for(int a=0;a<3;a++) {
+					int b = a*NUM_BINS + GetBin(centroids[t], a, centroidBounds.min[a], scale[a]);
+					pBins[b].Grow(triBounds[t]);
+					pCounts[b]++;
+				}
+			}
+		}
+
+		for(int c=0;c<chunks;c++) {
+			for(int a=0;a<3;a++) {
+				for(int b=0;b<NUM_BINS;b++) {
+					bins[a][b].Grow(chunkBins[(c*3+a)*NUM_BINS+b]);
+					binCounts[a][b] += chunkCounts[(c*3+a)*NUM_BINS+b];
+				}
+			}
+		}
+	} else {
+		for(int i=first;i<first+count;i++) {
+			int t = triIndices[i];
+			for(int a=0;a<3;a++) {
+				int b = GetBin(centroids[t], a, centroidBounds.min[a], scale[a]);
+				bins[a][b].Grow(triBounds[t]);
+				binCounts[a][b]++;
+			}
+		}
+	}
+
+	//sweep the bins from both sides to evaluate the cost of all split planes
+	float bestCost = FLT_MAX;
+	axis = -1;
+	bin = -1;
+	for(int a=0;a<3;a++) {
+		if(extent[a]<=0)
+			continue;
+
+		float rightArea[NUM_BINS];
+		int rightCount[NUM_BINS];
+		Bounds acc;
+		acc.Reset();
+		int n = 0;
+		for(int b=NUM_BINS-1;b>0;b--) {
+			acc.Grow(bins[a][b]);
+			n += binCounts[a][b];
+			rightArea[b] = acc.Area();
+			rightCount[b] = n;
+		}
+
+		acc.Reset();
+		n = 0;
+		for(int b=0;b<NUM_BINS-1;b++) {
+			acc.Grow(bins[a][b]);
+			n += binCounts[a][b];
+			if(n==0 || rightCount[b+1]==0)
+				continue;
+			float cost = n*acc.Area() + rightCount[b+1]*rightArea[b+1];
+			if(cost<bestCost) {
+				bestCost = cost;
+				axis = a;
+				bin = b;
+			}
+		}
+	}
+	return axis != -1;
+}
+
+int BVH::Partition(int first, int count, const Bounds& centroidBounds, int axis, int bin) {
+	float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+	float scale = NUM_BINS/extent;
+	float minC = centroidBounds.min[axis];
+	const vector<glm::vec3>& c = centroids;
+
+	int* pBegin = &triIndices[0] + first;
+	int* pMid = std::partition(pBegin, pBegin+count, [&](int t) {
+		return GetBin(c[t], axis, minC, scale) <= bin;
+	});
+	return int(pMid-pBegin);
+}
+
+void BVH::BuildRecursive(int first, int count, int depth, vector<BVHNode>& out, vector<Task>* pTasks) {
+	Bounds bounds, centroidBounds;
+	CalculateBounds(first, count, bounds, centroidBounds);
+
+	int index = int(out.size());
+	BVHNode node;
+	node.min = bounds.min;
+	node.max = bounds.max;
+	node.offset = first;
+	node.count = count;
+	out.push_back(node);
+
+	if(count<=MIN_LEAF_TRIANGLES || depth>=MAX_DEPTH-1)
+		return;
+
+	//hand the subtree over to a worker thread, the count is set to
+	//a negative task id so that Flatten can find it
+	if(pTasks!=NULL && count<taskThreshold) {
+		Task task;
+		task.first = first;
+		task.count = count;
+		task.depth = depth;
+		pTasks->push_back(task);
+		out[index].count = -int(pTasks->size());
+		return;
+	}
+
+	int axis, bin, leftCount;
+	bool hasSplit = FindSplit(first, count, centroidBounds, axis, bin);
+	if(hasSplit) {
+		//compare against the cost of intersecting all triangles. The split
+		//cost from FindSplit is not returned so evaluate it through the areas
+		leftCount = Partition(first, count, centroidBounds, axis, bin);
+		Bounds lb, rb, lc, rc;
+		CalculateBounds(first, leftCount, lb, lc);
+		CalculateBounds(first+leftCount, count-leftCount, rb, rc);
+		float splitCost = COST_TRAVERSAL + COST_INTERSECTION*(leftCount*lb.Area() + (count-leftCount)*rb.Area())/bounds.Area();
+		float leafCost = COST_INTERSECTION*count;
+		if(count<=MAX_LEAF_TRIANGLES && leafCost<=splitCost)
+			return;
+	} else {
+		//all centroids coincide, split the range in the middle
+		if(count<=MAX_LEAF_TRIANGLES)
+			return;
+		leftCount = count/2;
+	}
+
+	out[index].count = 0;
+	BuildRecursive(first, leftCount, depth+1, out, pTasks);
+	out[index].offset = int(out.size());
+	BuildRecursive(first+leftCount, count-leftCount, depth+1, out, pTasks);
+}
+
+void BVH::Flatten(const vector<BVHNode>& top, int index, vector<Task>& tasks) {
+	const BVHNode& node = top[index];
+
+	if(node.count<0) {
+		//copy the subtree built by the worker thread, its right child
+		//indices are relative to the start of the subtree
+		const vector<BVHNode>& sub = tasks[-node.count-1].nodes;
+		int base = int(nodes.size());
+		for(size_t i=0;i<sub.size();i++) {
+			BVHNode n = sub[i];
+			if(n.count==0)
+				n.offset += base;
+			nodes.push_back(n);
+		}
+		return;
+	}
+
+	int newIndex = int(nodes.size());
+	nodes.push_back(node);
+	if(node.count==0) {
+		Flatten(top, index+1, tasks);
+		nodes[newIndex].offset = int(nodes.size());
+		Flatten(top, node.offset, tasks);
+	}
+}
+
+const vector<BVHNode>& BVH::GetNodes() const {
+	return nodes;
+}
+
+const vector<int>& BVH::GetTriangleIndices() const {
+	return triIndices;
+}
+
+int BVH::GetTotalLeaves() const {
+	return totalLeaves;
+}
+
+int BVH::GetMaxDepth() const {
+	return maxDepth;
+}
+
+float BVH::GetSAHCost() const {
+	return sahCost;
+}
+
+float BVH::GetBuildTime() const {
+	return buildTime;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+
+//a single node of the flattened bounding volume hierarchy. Nodes are stored
+//depth first so the left child of an inner node is always the next node in
+//the array. The node is 32 bytes so that it maps to two RGBA32F texels; the
+//integer fields are stored as raw bits and read with floatBitsToInt in GLSL.
+struct BVHNode {
+	glm::vec3 min;		//bounding box minimum
+	int offset;			//first triangle (leaf) or right child index (inner node)
+	glm::vec3 max;		//bounding box maximum
+	int count;			//total triangles in the leaf, 0 for inner nodes
+};
+
+//BVH class builds a binned SAH bounding volume hierarchy over an indexed
+//triangle list in which each triangle is stored as 4 indices (3 vertex
+//indices and a material index) as output by the ObjLoader
+class BVH
+{
+public:
+	//constructor/destructor
+	BVH(void);
+	~BVH(void);
+
+	//builds the hierarchy for the given vertex positions and triangles
+	void Build(const vector<glm::vec3>& vertices, const vector<unsigned int>& triangles);
+
+	//returns the flattened depth first node array
+	const vector<BVHNode>& GetNodes() const;
+
+	//returns the triangle indices sorted in leaf order, leaf nodes refer
+	//to a contiguous range in this array
+	const vector<int>& GetTriangleIndices() const;
+
+	//build statistics
+	int GetTotalLeaves() const;
+	int GetMaxDepth() const;
+	float GetSAHCost() const;
+	float GetBuildTime() const;		//in milliseconds
+
+	//maximum depth of the hierarchy, the traversal stack in the
+	//shaders must be at least this large
+	static const int MAX_DEPTH = 32;
+
+protected:
+	//simple axially aligned box used during construction
+	struct Bounds {
+		glm::vec3 min, max;
+		void Reset();
+		void Grow(const glm::vec3& p);
+		void Grow(const Bounds& b);
+		float Area() const;
+	};
+
+	//a subtree whose construction is deferred to the parallel build phase
+	struct Task {
+		int first, count, depth;
+		vector<BVHNode> nodes;
+	};
+
+	//finds the best SAH split for the given range, returns false if
+	//making a leaf is cheaper than any split
+	bool FindSplit(int first, int count, const Bounds& centroidBounds, int& axis, int& bin);
+
+	//partitions the given range around the split and returns the size of
+	//the left half
+	int Partition(int first, int count, const Bounds& centroidBounds, int axis, int bin);
+
+	//recursively builds the subtree for the given range into the output nodes.
+	//If pTasks is not NULL, small subtrees are not built but recorded as tasks
+	void BuildRecursive(int first, int count, int depth, vector<BVHNode>& out, vector<Task>* pTasks);
+
+	//appends the top level node and its subtrees to the final node array
+	//resolving deferred tasks
+	void Flatten(const vector<BVHNode>& top, int index, vector<Task>& tasks);
+
+	//calculates the bounds and centroid bounds of the given range
+	void CalculateBounds(int first, int count, Bounds& bounds, Bounds& centroidBounds);
+
+	//per triangle bounds and centroids
+	vector<Bounds> triBounds;
+	vector<glm::vec3> centroids;
+
+	//output node array and sorted triangle indices
+	vector<BVHNode> nodes;
+	vector<int> triIndices;
+
+	//subtrees smaller than this are built in parallel
+	int taskThreshold;
+
+	//statistics
+	int totalLeaves;
+	int maxDepth;
+	float sahCost;
+	float buildTime;
+};
@@ -0,0 +1,213 @@
+#include "BatchRenderer.h"
+#include <cstddef>
+
+BatchRenderer::BatchRenderer(void)
+{
+	totalMaterials = 0;
+	vaoID = 0;
+	vboVerticesID = 0;
+	vboIndicesID = 0;
+	vboDrawIDsID = 0;
+	indirectBufferID = 0;
+	transformBufferID = 0;
+	transformTextureID = 0;
+	bMultiDrawIndirect = false;
+}
+
+BatchRenderer::~BatchRenderer(void)
+{
+}
+
+int BatchRenderer::AddMesh(const Vertex* vertices, int totalVertices, const GLuint* indices, int totalIndices) {
+	Mesh mesh;
+	mesh.firstIndex = int(this->indices.size());
+	mesh.count = totalIndices;
+	mesh.baseVertex = int(this->vertices.size());
+	this->vertices.insert(this->vertices.end(), vertices, vertices + totalVertices);
+	this->indices.insert(this->indices.end(), indices, indices + totalIndices);
+	meshes.push_back(mesh);
+	return int(meshes.size()) - 1;
+}
+
+int BatchRenderer::AddSubMesh(int mesh, int firstIndex, int totalIndices) {
+	Mesh subMesh = meshes[mesh];
+	subMesh.firstIndex += firstIndex;
+	subMesh.count = totalIndices;
+	meshes.push_back(subMesh);
+	return int(meshes.size()) - 1;
+}
+
+int BatchRenderer::AddObject(int mesh, int material, const glm::mat4& transform) {
+	Object object;
+	object.mesh = mesh;
+	object.material = material;
+	object.transform = transform;
+	objects.push_back(object);
+	if(material >= totalMaterials)
+		totalMaterials = material + 1;
+	return int(objects.size()) - 1;
+}
+
+void BatchRenderer::SetTransform(int object, const glm::mat4& transform) {
+	objects[object].transform = transform;
+}
+
+void BatchRenderer::Init() {
+	bMultiDrawIndirect = GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+	int totalObjects = int(objects.size());
+
+	glGenVertexArrays(1, &vaoID);
+	glGenBuffers(1, &vboVerticesID);
+	glGenBuffers(1, &vboIndicesID);
+	glGenBuffers(1, &vboDrawIDsID);
+
+	glBindVertexArray(vaoID);
+		//interleaved vertex arena
+		glBindBuffer (GL_ARRAY_BUFFER, vboVerticesID);
+		glBufferData (GL_ARRAY_BUFFER, sizeof(Vertex)*vertices.size(), vertices.empty() ? 0 : &vertices[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+		glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, position));
+		glEnableVertexAttribArray(NORMAL_ATTRIBUTE);
+		glVertexAttribPointer(NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, normal));
+		glEnableVertexAttribArray(UV_ATTRIBUTE);
+		glVertexAttribPointer(UV_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, uv));
+
+		//draw indices 0..n-1, one per instance, so that the base instance of
+		//a command selects its own index
+		vector<GLuint> drawIDs(totalObjects);
+		for(int i=0;i<totalObjects;i++)
+			drawIDs[i] = i;
+		glBindBuffer (GL_ARRAY_BUFFER, vboDrawIDsID);
+		glBufferData (GL_ARRAY_BUFFER, sizeof(GLuint)*drawIDs.size(), drawIDs.empty() ? 0 : &drawIDs[0], GL_STATIC_DRAW);
+		glVertexAttribIPointer(DRAW_ID_ATTRIBUTE, 1, GL_UNSIGNED_INT, 0, 0);
+		glVertexAttribDivisor(DRAW_ID_ATTRIBUTE, 1);
+		//without base instances the draw index is a constant attribute
+		if(bMultiDrawIndirect)
+			glEnableVertexAttribArray(DRAW_ID_ATTRIBUTE);
+
+		//index arena
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndicesID);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*indices.size(), indices.empty() ? 0 : &indices[0], GL_STATIC_DRAW);
+	glBindVertexArray(0);
+
+	//indirect commands, rewritten every frame
+	if(bMultiDrawIndirect) {
+		glGenBuffers(1, &indirectBufferID);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBufferID);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand)*totalObjects, 0, GL_STREAM_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	//transforms in draw order as a texture buffer
+	glGenBuffers(1, &transformBufferID);
+	glBindBuffer(GL_TEXTURE_BUFFER, transformBufferID);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat4)*totalObjects, 0, GL_STREAM_DRAW);
+	glGenTextures(1, &transformTextureID);
+	glBindTexture(GL_TEXTURE_BUFFER, transformTextureID);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, transformBufferID);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	bucketOffsets.assign(totalMaterials + 1, 0);
+}
+
+void BatchRenderer::Destroy() {
+	glDeleteVertexArrays(1, &vaoID);
+	glDeleteBuffers(1, &vboVerticesID);
+	glDeleteBuffers(1, &vboIndicesID);
+	glDeleteBuffers(1, &vboDrawIDsID);
+	if(indirectBufferID)
+		glDeleteBuffers(1, &indirectBufferID);
+	glDeleteBuffers(1, &transformBufferID);
+	glDeleteTextures(1, &transformTextureID);
+	vaoID = vboVerticesID = vboIndicesID = vboDrawIDsID = 0;
+	indirectBufferID = transformBufferID = transformTextureID = 0;
+}
+
+void BatchRenderer::Build(const vector<int>& visible) {
+	int total = int(visible.size());
+
+	//count the visible objects of every material and give each material a
+	//contiguous range of commands
+	bucketOffsets.assign(totalMaterials + 1, 0);
+	for(int i=0;i<total;i++)
+		bucketOffsets[objects[visible[i]].material + 1]++;
+	for(int m=0;m<totalMaterials;m++)
+		bucketOffsets[m+1] += bucketOffsets[m];
+	bucketCursors.assign(bucketOffsets.begin(), bucketOffsets.end() - 1);
+
+	commands.resize(total);
+	drawTransforms.resize(total);
+	for(int i=0;i<total;i++) {
+		const Object& object = objects[visible[i]];
+		const Mesh& mesh = meshes[object.mesh];
+		int slot = bucketCursors[object.material]++;
+		DrawElementsIndirectCommand& command = commands[slot];
+		command.count = mesh.count;
+		command.instanceCount = 1;
+		command.firstIndex = mesh.firstIndex;
+		command.baseVertex = mesh.baseVertex;
+		command.baseInstance = slot;
+		drawTransforms[slot] = object.transform;
+	}
+	if(total == 0)
+		return;
+
+	//orphan the buffers so the previous frame can still read them
+	if(bMultiDrawIndirect) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBufferID);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand)*objects.size(), 0, GL_STREAM_DRAW);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(DrawElementsIndirectCommand)*total, &commands[0]);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, transformBufferID);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat4)*objects.size(), 0, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(glm::mat4)*total, &drawTransforms[0]);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void BatchRenderer::DrawCommands(int first, int count, GLenum textureUnit) {
+	if(count <= 0)
+		return;
+
+	glActiveTexture(textureUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, transformTextureID);
+	glActiveTexture(GL_TEXTURE0);
+	glBindVertexArray(vaoID);
+	if(bMultiDrawIndirect) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBufferID);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid*)(sizeof(DrawElementsIndirectCommand)*first), count, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	} else {
+		for(int i=first;i<first+count;i++) {
+			const DrawElementsIndirectCommand& command = commands[i];
+			glVertexAttribI1ui(DRAW_ID_ATTRIBUTE, command.baseInstance);
+			glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, (const GLvoid*)(sizeof(GLuint)*command.firstIndex), command.baseVertex);
+		}
+	}
+	glBindVertexArray(0);
+}
+
+void BatchRenderer::Draw(int material, GLenum textureUnit) {
+	DrawCommands(bucketOffsets[material], bucketOffsets[material+1] - bucketOffsets[material], textureUnit);
+}
+
+void BatchRenderer::DrawAll(GLenum textureUnit) {
+	DrawCommands(0, int(commands.size()), textureUnit);
+}
+
+int BatchRenderer::GetTotalObjects() const {
+	return int(objects.size());
+}
+
+int BatchRenderer::GetTotalMaterials() const {
+	return totalMaterials;
+}
+
+int BatchRenderer::GetDrawCount(int material) const {
+	return bucketOffsets[material+1] - bucketOffsets[material];
+}
+
+bool BatchRenderer::IsMultiDrawIndirect() const {
+	return bMultiDrawIndirect;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+
+//BatchRenderer class draws many objects with a handful of calls. The meshes
+//of all objects are merged into one vertex and one index arena. Every frame
+//the visible objects are grouped by material and a DrawElementsIndirect
+//command is written for each of them, so a material is drawn with a single
+//glMultiDrawElementsIndirect call no matter how many objects use it.
+//
+//The transforms of the visible objects are stored in draw order in a texture
+//buffer with 4 RGBA32F texels per matrix. Each command uses its draw index as
+//base instance, which makes the per instance attribute DRAW_ID_ATTRIBUTE
+//return the draw index in the vertex shader:
+//
+//	layout(location = 3) in uint vDrawID;
+//	uniform samplerBuffer transforms;
+//	mat4 M = mat4(texelFetch(transforms, int(vDrawID)*4), ... );
+//
+//Without GL_ARB_multi_draw_indirect and GL_ARB_base_instance the commands
+//are drawn one by one with glDrawElementsBaseVertex and the draw index is set
+//as a constant attribute, so the same shaders work on OpenGL 3.3.
+class BatchRenderer
+{
+public:
+	//vertex layout of the vertex arena
+	struct Vertex {
+		glm::vec3 position, normal;
+		glm::vec2 uv;
+	};
+
+	//attribute locations of the vertex arena and the draw index
+	static const GLuint POSITION_ATTRIBUTE = 0;
+	static const GLuint NORMAL_ATTRIBUTE = 1;
+	static const GLuint UV_ATTRIBUTE = 2;
+	static const GLuint DRAW_ID_ATTRIBUTE = 3;
+
+	//constructor/destructor
+	BatchRenderer(void);
+	~BatchRenderer(void);
+
+	//appends a mesh to the arenas and returns its ID
+	int AddMesh(const Vertex* vertices, int totalVertices, const GLuint* indices, int totalIndices);
+
+	//adds a mesh which draws a range of the indices of another mesh
+	int AddSubMesh(int mesh, int firstIndex, int totalIndices);
+
+	//adds an object drawing a mesh with a material and returns its ID
+	int AddObject(int mesh, int material, const glm::mat4& transform);
+	void SetTransform(int object, const glm::mat4& transform);
+
+	//uploads the arenas and creates the buffers, call after all meshes and
+	//objects are added
+	void Init();
+	void Destroy();
+
+	//writes the commands and transforms of the visible objects
+	void Build(const vector<int>& visible);
+
+	//draws the visible objects of one material or of all materials. The
+	//transform buffer texture is bound to the given texture unit and unit 0
+	//is left active.
+	void Draw(int material, GLenum textureUnit = GL_TEXTURE0);
+	void DrawAll(GLenum textureUnit = GL_TEXTURE0);
+
+	int GetTotalObjects() const;
+	int GetTotalMaterials() const;
+
+	//number of commands of a material in the last Build call
+	int GetDrawCount(int material) const;
+
+	//true if the commands are submitted with glMultiDrawElementsIndirect
+	bool IsMultiDrawIndirect() const;
+
+protected:
+	//layout defined by the OpenGL specification
+	struct DrawElementsIndirectCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	struct Mesh {
+		int firstIndex, count, baseVertex;
+	};
+
+	struct Object {
+		int mesh, material;
+		glm::mat4 transform;
+	};
+
+	//draws the commands [first, first+count)
+	void DrawCommands(int first, int count, GLenum textureUnit);
+
+	vector<Vertex> vertices;
+	vector<GLuint> indices;
+	vector<Mesh> meshes;
+	vector<Object> objects;
+	int totalMaterials;
+
+	//commands and transforms of the visible objects sorted by material, the
+	//commands of material m start at bucketOffsets[m]
+	vector<DrawElementsIndirectCommand> commands;
+	vector<glm::mat4> drawTransforms;
+	vector<int> bucketOffsets, bucketCursors;
+
+	GLuint vaoID;
+	GLuint vboVerticesID;
+	GLuint vboIndicesID;
+	GLuint vboDrawIDsID;
+	GLuint indirectBufferID;
+	GLuint transformBufferID;
+	GLuint transformTextureID;
+	bool bMultiDrawIndirect;
+};
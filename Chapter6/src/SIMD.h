@@ -0,0 +1,127 @@
+#pragma once
+
+//4 wide float vector used for ray packets. It maps to SSE registers when
+//the compiler targets SSE2 and falls back to plain arrays otherwise.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+
+#ifdef USE_SSE
+
+struct float4 {
+	__m128 v;
+
+	float4() {}
+	float4(__m128 x) : v(x) {}
+	explicit float4(float s) : v(_mm_set1_ps(s)) {}
+	float4(float a, float b, float c, float d) : v(_mm_setr_ps(a,b,c,d)) {}
+
+	float operator[](int i) const {
+		float tmp[4];
+		_mm_storeu_ps(tmp, v);
+		return tmp[i];
+	}
+	void Store(float* p) const { _mm_storeu_ps(p, v); }
+	static float4 Load(const float* p) { return _mm_loadu_ps(p); }
+};
+
+inline float4 operator+(const float4& a, const float4& b) { return _mm_add_ps(a.v, b.v); }
+inline float4 operator-(const float4& a, const float4& b) { return _mm_sub_ps(a.v, b.v); }
+inline float4 operator*(const float4& a, const float4& b) { return _mm_mul_ps(a.v, b.v); }
+inline float4 operator/(const float4& a, const float4& b) { return _mm_div_ps(a.v, b.v); }
+inline float4 min(const float4& a, const float4& b) { return _mm_min_ps(a.v, b.v); }
+inline float4 max(const float4& a, const float4& b) { return _mm_max_ps(a.v, b.v); }
+
+//comparisons return a lane mask with all bits set where the test passes
+inline float4 operator< (const float4& a, const float4& b) { return _mm_cmplt_ps(a.v, b.v); }
+inline float4 operator<=(const float4& a, const float4& b) { return _mm_cmple_ps(a.v, b.v); }
+inline float4 operator> (const float4& a, const float4& b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline float4 operator>=(const float4& a, const float4& b) { return _mm_cmpge_ps(a.v, b.v); }
+inline float4 operator&(const float4& a, const float4& b) { return _mm_and_ps(a.v, b.v); }
+inline float4 operator|(const float4& a, const float4& b) { return _mm_or_ps(a.v, b.v); }
+
+//returns a where the mask is set and b elsewhere
+inline float4 select(const float4& mask, const float4& a, const float4& b) {
+	return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+
+//returns the sign bits of the lanes packed in the lower 4 bits
+inline int movemask(const float4& mask) { return _mm_movemask_ps(mask.v); }
+
+#else
+
+struct float4 {
+	float v[4];
+
+	float4() {}
+	explicit float4(float s) { v[0]=v[1]=v[2]=v[3]=s; }
+	float4(float a, float b, float c, float d) { v[0]=a; v[1]=b; v[2]=c; v[3]=d; }
+
+	float operator[](int i) const { return v[i]; }
+	void Store(float* p) const { for(int i=0;i<4;i++) p[i] = v[i]; }
+	static float4 Load(const float* p) { return float4(p[0], p[1], p[2], p[3]); }
+};
+
+//lane masks are stored as floats with all bits set
+inline float MaskValue(bool b) {
+	union { unsigned int i; float f; } u;
+	u.i = b ? 0xffffffffu : 0;
+	return u.f;
+}
+inline bool MaskBit(float f) {
+	union { unsigned int i; float f; } u;
+	u.f = f;
+	return (u.i & 0x80000000u) != 0;
+}
+
+#define FLOAT4_OP(op) \
+inline float4 operator op(const float4& a, const float4& b) { \
+	return float4(a.v[0] op b.v[0], a.v[1] op b.v[1], a.v[2] op b.v[2], a.v[3] op b.v[3]); }
+FLOAT4_OP(+)
+FLOAT4_OP(-)
+FLOAT4_OP(*)
+FLOAT4_OP(/)
+#undef FLOAT4_OP
+
+#define FLOAT4_CMP(op) \
+inline float4 operator op(const float4& a, const float4& b) { \
+	return float4(MaskValue(a.v[0] op b.v[0]), MaskValue(a.v[1] op b.v[1]), MaskValue(a.v[2] op b.v[2]), MaskValue(a.v[3] op b.v[3])); }
+FLOAT4_CMP(<)
+FLOAT4_CMP(<=)
+FLOAT4_CMP(>)
+FLOAT4_CMP(>=)
+#undef FLOAT4_CMP
+
+inline float4 min(const float4& a, const float4& b) {
+	return float4(a.v[0]<b.v[0]?a.v[0]:b.v[0], a.v[1]<b.v[1]?a.v[1]:b.v[1], a.v[2]<b.v[2]?a.v[2]:b.v[2], a.v[3]<b.v[3]?a.v[3]:b.v[3]);
+}
+inline float4 max(const float4& a, const float4& b) {
+	return float4(a.v[0]>b.v[0]?a.v[0]:b.v[0], a.v[1]>b.v[1]?a.v[1]:b.v[1], a.v[2]>b.v[2]?a.v[2]:b.v[2], a.v[3]>b.v[3]?a.v[3]:b.v[3]);
+}
+inline float4 operator&(const float4& a, const float4& b) {
+	float4 r;
+	for(int i=0;i<4;i++) r.v[i] = MaskValue(MaskBit(a.v[i]) && MaskBit(b.v[i]));
+	return r;
+}
+inline float4 operator|(const float4& a, const float4& b) {
+	float4 r;
+	for(int i=0;i<4;i++) r.v[i] = MaskValue(MaskBit(a.v[i]) || MaskBit(b.v[i]));
+	return r;
+}
+inline float4 select(const float4& mask, const float4& a, const float4& b) {
+	float4 r;
+	for(int i=0;i<4;i++) r.v[i] = MaskBit(mask.v[i]) ? a.v[i] : b.v[i];
+	return r;
+}
+inline int movemask(const float4& mask) {
+	int m = 0;
+	for(int i=0;i<4;i++)
+		if(MaskBit(mask.v[i]))
+			m |= 1<<i;
+	return m;
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include "ScenePacker.h"
+#include <iostream>
+#include <iomanip>
+
+ScenePacker::ScenePacker(void)
+{
+	PackedTexture empty = {0, 0, 0, 0, 0};
+	vertexTex = triangleTex = nodeTex = triangleIDTex = empty;
+	maxTextureSize = 0;
+}
+
+ScenePacker::~ScenePacker(void)
+{
+}
+
+bool ScenePacker::Pack(const vector<glm::vec3>& vertices, const vector<unsigned int>& triangles, const BVH& bvh, int firstUnit) {
+	Release();
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+
+	//the triangles, node ids and node counts are signed integers in the shaders
+	if(vertices.size() >= 0x7fffffff || triangles.size()/4 >= 0x7fffffff) {
+		cerr<<"Scene too large: "<<vertices.size()<<" vertices, "<<triangles.size()/4<<" triangles"<<endl;
+		return false;
+	}
+
+	//vertex positions, one RGB32F texel each
+	bool bOk = CreateTexture(vertexTex, firstUnit, GL_RGB32F, GL_RGB, GL_FLOAT,
+							 sizeof(glm::vec3), int(vertices.size()), &vertices[0]);
+
+	//triangles, one RGBA32I texel each. The indices are below 2^31 so
+	//their bits are the same as signed integers.
+	bOk = bOk && CreateTexture(triangleTex, firstUnit+1, GL_RGBA32I, GL_RGBA_INTEGER, GL_INT,
+							   4*sizeof(unsigned int), int(triangles.size()/4), &triangles[0]);
+
+	//BVH nodes, two RGBA32F texels each. A node never straddles two rows
+	//since the row width is even.
+	const vector<BVHNode>& nodes = bvh.GetNodes();
+	bOk = bOk && CreateTexture(nodeTex, firstUnit+2, GL_RGBA32F, GL_RGBA, GL_FLOAT,
+							   sizeof(BVHNode)/2, int(nodes.size()*2), &nodes[0]);
+
+	//triangle indices in BVH leaf order, one R32I texel each
+	const vector<int>& triangleIDs = bvh.GetTriangleIndices();
+	bOk = bOk && CreateTexture(triangleIDTex, firstUnit+3, GL_R32I, GL_RED_INTEGER, GL_INT,
+							   sizeof(int), int(triangleIDs.size()), &triangleIDs[0]);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	if(!bOk) {
+		cerr<<"Scene does not fit in "<<ROW_WIDTH<<"x"<<maxTextureSize<<" textures"<<endl;
+		Release();
+	}
+	return bOk;
+}
+
+bool ScenePacker::CreateTexture(PackedTexture& tex, int unit, GLenum internalFormat, GLenum format, GLenum type,
+								int texelSize, int texels, const void* pData) {
+	tex.texels = texels;
+	tex.width = ROW_WIDTH;
+	tex.height = (texels + ROW_WIDTH - 1) >> ROW_SHIFT;
+	if(tex.height == 0)
+		tex.height = 1;
+	tex.bytes = size_t(tex.width) * tex.height * texelSize;
+	if(tex.width > maxTextureSize || tex.height > maxTextureSize)
+		return false;
+
+	glGenTextures(1, &tex.id);
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, tex.id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, tex.width, tex.height, 0, format, type, NULL);
+
+	//upload the full rows in one call and the partial last row in another
+	//so the source array does not have to be padded
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	int fullRows = texels >> ROW_SHIFT;
+	int remainder = texels & (ROW_WIDTH - 1);
+	if(fullRows > 0)
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, ROW_WIDTH, fullRows, format, type, pData);
+	if(remainder > 0) {
+		const GLubyte* pLastRow = (const GLubyte*)pData + size_t(fullRows) * ROW_WIDTH * texelSize;
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, fullRows, remainder, 1, format, type, pLastRow);
+	}
+	return true;
+}
+
+void ScenePacker::Release() {
+	PackedTexture* textures[4] = {&vertexTex, &triangleTex, &nodeTex, &triangleIDTex};
+	for(int i=0;i<4;i++) {
+		if(textures[i]->id != 0)
+			glDeleteTextures(1, &textures[i]->id);
+		textures[i]->id = 0;
+	}
+}
+
+size_t ScenePacker::GetTotalBytes() const {
+	return vertexTex.bytes + triangleTex.bytes + nodeTex.bytes + triangleIDTex.bytes;
+}
+
+void ScenePacker::PrintTexture(const string& name, const string& format, const PackedTexture& tex) {
+	cout<<"\t"<<setw(14)<<left<<name<<right<<setw(5)<<tex.width<<" x "<<setw(5)<<tex.height
+		<<" "<<setw(8)<<format<<setw(12)<<tex.texels<<" texels "
+		<<setw(10)<<fixed<<setprecision(2)<<tex.bytes/(1024.0*1024.0)<<" MB"<<endl;
+}
+
+void ScenePacker::PrintFootprint(const vector<glm::vec3>& vertices, const vector<unsigned int>& triangles, const BVH& bvh) const {
+	cout<<"Scene memory footprint: "<<vertices.size()<<" vertices, "<<triangles.size()/4<<" triangles, "
+		<<bvh.GetNodes().size()<<" BVH nodes"<<endl;
+	PrintTexture("Vertices", "RGB32F", vertexTex);
+	PrintTexture("Triangles", "RGBA32I", triangleTex);
+	PrintTexture("BVH nodes", "RGBA32F", nodeTex);
+	PrintTexture("Triangle ids", "R32I", triangleIDTex);
+
+	size_t cpuBytes = vertices.size()*sizeof(glm::vec3) + triangles.size()*sizeof(unsigned int) +
+					  bvh.GetNodes().size()*sizeof(BVHNode) + bvh.GetTriangleIndices().size()*sizeof(int);
+	cout<<fixed<<setprecision(2)<<"\tGPU total "<<GetTotalBytes()/(1024.0*1024.0)<<" MB, CPU copy "
+		<<cpuBytes/(1024.0*1024.0)<<" MB"<<endl;
+	cout.unsetf(ios::floatfield);
+	cout<<setprecision(6);
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include "BVH.h"
+
+using namespace std;
+
+//a linear array of texels laid out row by row in a 2D texture
+struct PackedTexture {
+	GLuint id;
+	int width, height;	//texture size in texels
+	int texels;			//number of used texels
+	size_t bytes;		//GPU memory of the whole texture
+};
+
+//ScenePacker class stores the raytracing scene data in 2D textures so that
+//the scene size is not limited by the maximum texture width. Element i of an
+//array is stored at texel (i % ROW_WIDTH, i / ROW_WIDTH), which the shaders
+//compute with a mask and a shift. All indices are 32-bit integers.
+class ScenePacker
+{
+public:
+	//constructor/destructor
+	ScenePacker(void);
+	~ScenePacker(void);
+
+	//uploads the vertex positions, the triangles (3 vertex indices and a
+	//material index each), the BVH nodes and the BVH triangle indices to
+	//textures bound to the consecutive texture units starting at firstUnit.
+	//Returns false if the scene does not fit in the maximum texture size.
+	bool Pack(const vector<glm::vec3>& vertices, const vector<unsigned int>& triangles, const BVH& bvh, int firstUnit);
+
+	//deletes all textures
+	void Release();
+
+	//prints the texture sizes and the GPU and CPU memory used by the scene
+	void PrintFootprint(const vector<glm::vec3>& vertices, const vector<unsigned int>& triangles, const BVH& bvh) const;
+
+	//packed textures
+	const PackedTexture& GetVertices() const		{ return vertexTex; }
+	const PackedTexture& GetTriangles() const		{ return triangleTex; }
+	const PackedTexture& GetBVHNodes() const		{ return nodeTex; }
+	const PackedTexture& GetTriangleIDs() const		{ return triangleIDTex; }
+
+	//total GPU memory of all scene textures in bytes
+	size_t GetTotalBytes() const;
+
+	//row width of all textures, must match ROW_SHIFT in the shaders
+	static const int ROW_SHIFT = 12;
+	static const int ROW_WIDTH = 1<<ROW_SHIFT;
+
+protected:
+	//creates a texture holding the given number of texels and uploads the
+	//data, leaving the end of the last row unused. Returns false if the
+	//texture exceeds the maximum texture size.
+	bool CreateTexture(PackedTexture& tex, int unit, GLenum internalFormat, GLenum format, GLenum type,
+					   int texelSize, int texels, const void* pData);
+
+	//prints a single line of the footprint report
+	static void PrintTexture(const string& name, const string& format, const PackedTexture& tex);
+
+	PackedTexture vertexTex;
+	PackedTexture triangleTex;
+	PackedTexture nodeTex;
+	PackedTexture triangleIDTex;
+
+	int maxTextureSize;
+};
@@ -0,0 +1,283 @@
+#include "TextureArrayBuilder.h"
+#include "SIMD.h"
+#include <SOIL.h>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+TextureArrayBuilder::TextureArrayBuilder(void)
+{
+	materialMapID = 0;
+	loadTime = 0;
+	mipTime = 0;
+}
+
+TextureArrayBuilder::~TextureArrayBuilder(void)
+{
+}
+
+bool TextureArrayBuilder::Load(const vector<string>& filenames) {
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+	int total = int(filenames.size());
+	images.clear();
+	images.resize(total);
+	buckets.clear();
+	materialMaps.assign(total, glm::vec4(-1, 0, 1, 1));
+
+	//decode the images in parallel, each image on its own thread
+	int failed = -1;
+	#pragma omp parallel for schedule(dynamic)
+	for(int i=0;i<total;i++) {
+		Image& image = images[i];
+		image.width = image.height = 0;
+		if(filenames[i].empty())
+			continue;
+
+		int channels = 0;
+		unsigned char* pData = SOIL_load_image(filenames[i].c_str(), &image.width, &image.height, &channels, SOIL_LOAD_RGBA);
+		if(pData == NULL) {
+			#pragma omp critical
+			failed = i;
+			continue;
+		}
+
+		//flip the image on Y axis while copying the rows
+		size_t rowSize = size_t(image.width)*4;
+		image.pixels.resize(rowSize*image.height);
+		for(int y=0;y<image.height;y++)
+			memcpy(&image.pixels[rowSize*(image.height-1-y)], pData + rowSize*y, rowSize);
+		SOIL_free_image_data(pData);
+	}
+
+	if(failed >= 0) {
+		cerr<<"Cannot load image: "<<filenames[failed].c_str()<<endl;
+		return false;
+	}
+
+	AssignBuckets();
+
+	loadTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+	return true;
+}
+
+void TextureArrayBuilder::AssignBuckets() {
+	//one bucket for each distinct image size
+	for(size_t i=0;i<images.size();i++) {
+		if(images[i].pixels.empty())
+			continue;
+		size_t j = 0;
+		while(j<buckets.size() && (buckets[j].width!=images[i].width || buckets[j].height!=images[i].height))
+			j++;
+		if(j==buckets.size()) {
+			Bucket bucket;
+			bucket.width = images[i].width;
+			bucket.height = images[i].height;
+			bucket.textureID = 0;
+			buckets.push_back(bucket);
+		}
+		buckets[j].materials.push_back(int(i));
+	}
+
+	//merge the pair of buckets which adds the fewest padding texels
+	while(buckets.size() > size_t(MAX_BUCKETS)) {
+		size_t bestA = 0, bestB = 1;
+		double bestCost = -1;
+		for(size_t a=0;a<buckets.size();a++) {
+			for(size_t b=a+1;b<buckets.size();b++) {
+				double w = max(buckets[a].width, buckets[b].width);
+				double h = max(buckets[a].height, buckets[b].height);
+				double cost = (w*h - double(buckets[a].width)*buckets[a].height)*buckets[a].materials.size() +
+							  (w*h - double(buckets[b].width)*buckets[b].height)*buckets[b].materials.size();
+				if(bestCost<0 || cost<bestCost) {
+					bestCost = cost;
+					bestA = a;
+					bestB = b;
+				}
+			}
+		}
+		Bucket& a = buckets[bestA];
+		Bucket& b = buckets[bestB];
+		a.width = max(a.width, b.width);
+		a.height = max(a.height, b.height);
+		a.materials.insert(a.materials.end(), b.materials.begin(), b.materials.end());
+		buckets.erase(buckets.begin()+bestB);
+	}
+
+	//map the materials to their layers
+	for(size_t i=0;i<buckets.size();i++) {
+		for(size_t j=0;j<buckets[i].materials.size();j++) {
+			const Image& image = images[buckets[i].materials[j]];
+			materialMaps[buckets[i].materials[j]] = glm::vec4(float(i), float(j),
+				float(image.width)/buckets[i].width, float(image.height)/buckets[i].height);
+		}
+	}
+}
+
+void TextureArrayBuilder::Downsample(const unsigned char* pSrc, int srcWidth, int srcHeight, unsigned char* pDst) {
+	int dstWidth = max(1, srcWidth/2);
+	int dstHeight = max(1, srcHeight/2);
+
+	for(int y=0;y<dstHeight;y++) {
+		const unsigned char* pRow0 = pSrc + size_t(min(2*y,   srcHeight-1))*srcWidth*4;
+		const unsigned char* pRow1 = pSrc + size_t(min(2*y+1, srcHeight-1))*srcWidth*4;
+		unsigned char* pOut = pDst + size_t(y)*dstWidth*4;
+		int x = 0;
+#ifdef USE_SSE
+		//8 source pixels of both rows give 4 output pixels. The rows are
+		//averaged first, then the even and odd pixels are averaged. The
+		//rounded averages are at most one step brighter than the exact mean.
+		if(srcWidth >= 2) {
+			for(;x+4<=dstWidth;x+=4) {
+				__m128i a0 = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(pRow0+x*8)),    _mm_loadu_si128((const __m128i*)(pRow1+x*8)));
+				__m128i a1 = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(pRow0+x*8+16)), _mm_loadu_si128((const __m128i*)(pRow1+x*8+16)));
+				__m128 even = _mm_shuffle_ps(_mm_castsi128_ps(a0), _mm_castsi128_ps(a1), _MM_SHUFFLE(2,0,2,0));
+				__m128 odd  = _mm_shuffle_ps(_mm_castsi128_ps(a0), _mm_castsi128_ps(a1), _MM_SHUFFLE(3,1,3,1));
+				_mm_storeu_si128((__m128i*)(pOut+x*4), _mm_avg_epu8(_mm_castps_si128(even), _mm_castps_si128(odd)));
+			}
+		}
+#endif
+		//remaining pixels and images that are one pixel wide
+		for(;x<dstWidth;x++) {
+			int x0 = min(2*x,   srcWidth-1)*4;
+			int x1 = min(2*x+1, srcWidth-1)*4;
+			for(int c=0;c<4;c++)
+				pOut[x*4+c] = (unsigned char)((pRow0[x0+c] + pRow0[x1+c] + pRow1[x0+c] + pRow1[x1+c] + 2) >> 2);
+		}
+	}
+}
+
+void TextureArrayBuilder::BuildLevels(Bucket& bucket) {
+	int layers = int(bucket.materials.size());
+	int levels = 1;
+	for(int size=max(bucket.width, bucket.height); size>1; size/=2)
+		levels++;
+
+	bucket.levels.resize(levels);
+	size_t layerSize = size_t(bucket.width)*bucket.height*4;
+	bucket.levels[0].resize(layerSize*layers);
+
+	//copy the images into the base level. Smaller images are padded by
+	//repeating the last column and row so that bilinear filtering at the
+	//scaled texture coordinate border matches clamping.
+	#pragma omp parallel for
+	for(int i=0;i<layers;i++) {
+		const Image& image = images[bucket.materials[i]];
+		unsigned char* pLayer = &bucket.levels[0][layerSize*i];
+		size_t rowSize = size_t(image.width)*4;
+		for(int y=0;y<bucket.height;y++) {
+			unsigned char* pDst = pLayer + size_t(y)*bucket.width*4;
+			const unsigned char* pSrc = &image.pixels[rowSize*min(y, image.height-1)];
+			memcpy(pDst, pSrc, rowSize);
+			for(int x=image.width;x<bucket.width;x++)
+				memcpy(pDst+x*4, pSrc+rowSize-4, 4);
+		}
+	}
+
+	//generate the mip chain of each layer in parallel
+	for(int level=1;level<levels;level++) {
+		int srcWidth  = max(1, bucket.width>>(level-1));
+		int srcHeight = max(1, bucket.height>>(level-1));
+		int dstWidth  = max(1, srcWidth/2);
+		int dstHeight = max(1, srcHeight/2);
+		size_t srcSize = size_t(srcWidth)*srcHeight*4;
+		size_t dstSize = size_t(dstWidth)*dstHeight*4;
+		bucket.levels[level].resize(dstSize*layers);
+
+		#pragma omp parallel for
+		for(int i=0;i<layers;i++)
+			Downsample(&bucket.levels[level-1][srcSize*i], srcWidth, srcHeight, &bucket.levels[level][dstSize*i]);
+	}
+}
+
+void TextureArrayBuilder::Upload(int firstUnit) {
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	for(size_t i=0;i<buckets.size();i++)
+		BuildLevels(buckets[i]);
+	mipTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+
+	//the material lookup texture has one RGBA32F texel per material
+	glGenTextures(1, &materialMapID);
+	glActiveTexture(GL_TEXTURE0 + firstUnit);
+	glBindTexture(GL_TEXTURE_2D, materialMapID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glm::vec4 untextured(-1, 0, 1, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, max(1, int(materialMaps.size())), 1, 0, GL_RGBA, GL_FLOAT,
+				 materialMaps.empty() ? &untextured.x : &materialMaps[0].x);
+
+	//one array texture with all mip levels for each bucket
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	for(size_t i=0;i<buckets.size();i++) {
+		Bucket& bucket = buckets[i];
+		int levels = int(bucket.levels.size());
+		glGenTextures(1, &bucket.textureID);
+		glActiveTexture(GL_TEXTURE0 + firstUnit + 1 + int(i));
+		glBindTexture(GL_TEXTURE_2D_ARRAY, bucket.textureID);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels-1);
+		for(int level=0;level<levels;level++) {
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, max(1, bucket.width>>level), max(1, bucket.height>>level),
+						 int(bucket.materials.size()), 0, GL_RGBA, GL_UNSIGNED_BYTE, &bucket.levels[level][0]);
+		}
+
+		//the CPU copies are not needed anymore
+		vector<vector<unsigned char> >().swap(bucket.levels);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void TextureArrayBuilder::Release() {
+	if(materialMapID != 0)
+		glDeleteTextures(1, &materialMapID);
+	materialMapID = 0;
+	for(size_t i=0;i<buckets.size();i++) {
+		if(buckets[i].textureID != 0)
+			glDeleteTextures(1, &buckets[i].textureID);
+		buckets[i].textureID = 0;
+	}
+}
+
+void TextureArrayBuilder::PrintStats() const {
+	//bytes of a full RGBA8 mip chain is about 4/3 of the base level
+	size_t used = 0;
+	int maxWidth = 0, maxHeight = 0, total = 0;
+	cout<<"Material textures: "<<buckets.size()<<" arrays, decoded in "<<loadTime<<" ms, mipmaps in "<<mipTime<<" ms"<<endl;
+	for(size_t i=0;i<buckets.size();i++) {
+		const Bucket& bucket = buckets[i];
+		size_t bytes = size_t(bucket.width)*bucket.height*4*bucket.materials.size()*4/3;
+		used += bytes;
+		total += int(bucket.materials.size());
+		maxWidth = max(maxWidth, bucket.width);
+		maxHeight = max(maxHeight, bucket.height);
+		cout<<"\t"<<bucket.width<<"x"<<bucket.height<<" x "<<bucket.materials.size()<<" layers, "<<bytes/1024<<" KB"<<endl;
+	}
+	size_t single = size_t(maxWidth)*maxHeight*4*total*4/3;
+	cout<<"\tTotal "<<used/1024<<" KB, a single "<<maxWidth<<"x"<<maxHeight<<" array would need "<<single/1024<<" KB"<<endl;
+}
+
+const TextureArrayBuilder::Image& TextureArrayBuilder::GetImage(int material) const {
+	return images[material];
+}
+
+const glm::vec4& TextureArrayBuilder::GetMaterialMap(int material) const {
+	return materialMaps[material];
+}
+
+GLuint TextureArrayBuilder::GetArrayTexture(int bucket) const {
+	return buckets[bucket].textureID;
+}
+
+int TextureArrayBuilder::GetTotalBuckets() const {
+	return int(buckets.size());
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+//TextureArrayBuilder class builds the material textures for the ray and path
+//tracers. The images are decoded in parallel, converted to RGBA and flipped so
+//the first row is the bottom row. Images are grouped by size into at most
+//MAX_BUCKETS array textures; when there are more distinct sizes, the smaller
+//images are placed in the corner of a larger layer and their texture
+//coordinates are scaled. The mipmaps are generated on the CPU with a SIMD box
+//filter. Each material maps to a (bucket, layer, u scale, v scale) entry
+//which is stored in a small lookup texture for the shaders.
+class TextureArrayBuilder
+{
+public:
+	//a decoded RGBA image with the bottom row first
+	struct Image {
+		int width, height;
+		vector<unsigned char> pixels;
+	};
+
+	//constructor/destructor
+	TextureArrayBuilder(void);
+	~TextureArrayBuilder(void);
+
+	//decodes the images of all materials in parallel and groups them into
+	//buckets. Empty filenames denote untextured materials. Returns false if
+	//any image cannot be loaded.
+	bool Load(const vector<string>& filenames);
+
+	//generates the mipmaps and creates the array textures. The material
+	//lookup texture is bound to firstUnit and the bucket arrays to the
+	//MAX_BUCKETS texture units that follow it.
+	void Upload(int firstUnit);
+
+	//deletes all textures
+	void Release();
+
+	//prints the load time, the bucket sizes and the memory used compared to
+	//storing all images in a single array of the largest size
+	void PrintStats() const;
+
+	//returns the decoded image of the given material
+	const Image& GetImage(int material) const;
+
+	//returns the bucket, layer and texture coordinate scale of the given
+	//material. The bucket is -1 for untextured materials.
+	const glm::vec4& GetMaterialMap(int material) const;
+
+	//returns the array texture of the given bucket
+	GLuint GetArrayTexture(int bucket) const;
+
+	int GetTotalBuckets() const;
+
+	//maximum number of array textures, must match MAX_TEXTURE_BUCKETS in the shaders
+	static const int MAX_BUCKETS = 4;
+
+protected:
+	//images of the same layer size share an array texture
+	struct Bucket {
+		int width, height;
+		vector<int> materials;				//material of each layer
+		vector<vector<unsigned char> > levels;	//all layers of each mip level
+		GLuint textureID;
+	};
+
+	//assigns the images to buckets, merging the buckets that waste the
+	//least memory until there are at most MAX_BUCKETS
+	void AssignBuckets();
+
+	//copies the images into their layers, padding smaller images by
+	//repeating their last row and column, and generates the mip chain
+	void BuildLevels(Bucket& bucket);
+
+	//halves the given RGBA image with a 2x2 box filter
+	static void Downsample(const unsigned char* pSrc, int srcWidth, int srcHeight, unsigned char* pDst);
+
+	vector<Image> images;
+	vector<glm::vec4> materialMaps;
+	vector<Bucket> buckets;
+	GLuint materialMapID;
+
+	//statistics
+	float loadTime;		//in milliseconds
+	float mipTime;		//in milliseconds
+};
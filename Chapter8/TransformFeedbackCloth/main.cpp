@@ -5,12 +5,15 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include "..\src\GLSLShader.h"
+#include "..\src\ClothSolver.h"
+#include "..\src\ClothPicker.h"
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <cassert>
+#include <cstring>
 #include <omp.h>
 
 
@@ -48,15 +51,23 @@ const int NUM_ITER = 10;
 //selected vertex index
 int selected_index = -1;
 
+//position the selected vertex is dragged to
+glm::vec3 dragPosition;
+
+//picks the particles from asynchronously read back positions
+ClothPicker picker;
+
+//largest distance of a picked particle from the mouse ray
+const float PICK_RADIUS = 0.1f;
+
 //flag to display/hide masses
 bool bDisplayMasses=true;
 
-//spring struct for storing cloth springs
-struct Spring {
-	int p1, p2;			//indices of two vertices
-	float rest_length;	//resting length
-	float Ks, Kd;		//spring and damping constants
-};
+//flag to simulate the cloth on the CPU instead of using transform feedback
+bool bUseCPU=false;
+
+//CPU mass spring solver running on the same particles and springs
+ClothSolver clothSolver;
 
 //cloth indices
 vector<GLushort> indices;
@@ -194,6 +205,100 @@ void AddSpring(int a, int b, float ks, float kd ) {
 	springs.push_back(spring);
 }
 
+//fills in the cloth positions, triangle indices and springs
+void CreateCloth() {
+	//local variables
+	size_t i=0, j=0, count=0;
+	int l1=0, l2=0;
+	int v = numY+1;
+	int u = numX+1;
+
+	printf("Total triangles: %3d\n",numX*numY*2);
+
+	//resize the cloth indices, position, previous position and force vectors
+	indices.resize( numX*numY*2*3);
+	X.resize(total_points);
+	X_last.resize(total_points);
+	F.resize(total_points);
+	springs.clear();
+
+	//fill in positions
+	for(int j=0;j<=numY;j++) {
+		for(int i=0;i<=numX;i++) {
+			X[count] = glm::vec4( ((float(i)/(u-1)) *2-1)* hsize, sizeX+1, ((float(j)/(v-1) )* sizeY),1);
+			X_last[count] = X[count];
+			count++;
+		}
+	}
+
+	//fill in indices
+	GLushort* id=&indices[0];
+	for (int i = 0; i < numY; i++) {
+		for (int j = 0; j < numX; j++) {
+			int i0 = i * (numX+1) + j;
+			int i1 = i0 + 1;
+			int i2 = i0 + (numX+1);
+			int i3 = i2 + 1;
+			if ((j+i)%2) {
+				*id++ = i0; *id++ = i2; *id++ = i1;
+				*id++ = i1; *id++ = i2; *id++ = i3;
+			} else {
+				*id++ = i0; *id++ = i2; *id++ = i3;
+				*id++ = i0; *id++ = i3; *id++ = i1;
+			}
+		}
+	}
+
+	// Setup springs
+	// structural Horizontal
+	for (l1 = 0; l1 < v; l1++)	// v
+		for (l2 = 0; l2 < (u - 1); l2++) {
+			AddSpring((l1 * u) + l2,(l1 * u) + l2 + 1,KsStruct,KdStruct);
+		}
+
+	// structural Vertical
+	for (l1 = 0; l1 < (u); l1++)
+		for (l2 = 0; l2 < (v - 1); l2++) {
+			AddSpring((l2 * u) + l1,((l2 + 1) * u) + l1,KsStruct,KdStruct);
+		}
+
+	// Shearing Springs
+	for (l1 = 0; l1 < (v - 1); l1++)
+		for (l2 = 0; l2 < (u - 1); l2++) {
+			AddSpring((l1 * u) + l2,((l1 + 1) * u) + l2 + 1,KsShear,KdShear);
+			AddSpring(((l1 + 1) * u) + l2,(l1 * u) + l2 + 1,KsShear,KdShear);
+		}
+
+	// Bend Springs
+	for (l1 = 0; l1 < (v); l1++) {
+		for (l2 = 0; l2 < (u - 2); l2++) {
+			AddSpring((l1 * u) + l2,(l1 * u) + l2 + 2,KsBend,KdBend);
+		}
+		AddSpring((l1 * u) + (u - 3),(l1 * u) + (u - 1),KsBend,KdBend);
+	}
+	for (l1 = 0; l1 < (u); l1++) {
+		for (l2 = 0; l2 < (v - 2); l2++) {
+			AddSpring((l2 * u) + l1,((l2 + 2) * u) + l1,KsBend,KdBend);
+		}
+		AddSpring(((v - 3) * u) + l1,((v - 1) * u) + l1,KsBend,KdBend);
+	}
+}
+
+//sets up a CPU solver with the cloth particles and springs. The shader scales
+//the damping constants by 1/1000 so the same is done here
+void SetupSolver(ClothSolver& solver, SolverType type) {
+	vector<Spring> cpu_springs(springs);
+	for(size_t i=0;i<cpu_springs.size();i++)
+		cpu_springs[i].Kd /= 1000.0f;
+	solver.Init(X, X_last, cpu_springs);
+	solver.SetSolver(type);
+	//XPBD takes one large step per frame instead of NUM_ITER small ones
+	solver.SetParameters(type==SOLVER_SPRINGS ? timeStep : timeStep*NUM_ITER, gravity, DEFAULT_DAMPING);
+	//the shader keeps the first and last vertex of the first row fixed
+	solver.SetFixed(0);
+	solver.SetFixed(numX);
+}
+
 //creates buffer objects for cloth and grid 
 void createVBO()
 {
@@ -333,39 +438,21 @@ void OnMouseDown(int button, int s, int x, int y)
 		//note that the y value is flipped
 		int winY = (height - y); 
 		int winX = x ; 
-		float winZ =0;
-
-		//read the depth value at the clicked position
-		glReadPixels( winX, winY, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &winZ );
-		if(winZ==1)
-			winZ=0;
-
-		//unproject the value using the current modelview, projection matrices and the current 
-		//viewport to get the object space position of the clicked point
-		double objX=0, objY=0, objZ=0;
-		gluUnProject(winX,winY, winZ,  MV,  P, viewport, &objX, &objY, &objZ);
-		glm::vec3 pt(objX,objY, objZ);
-		
-		//bind our render vertex array object
-		glBindVertexArray(vaoRenderID[readID]);
-		glBindBuffer(GL_ARRAY_BUFFER, vboID_Pos[writeID]);
-		//map the data so that we can read each vertex position
-		//to check the nearest vertex the user has picked
-		GLfloat* pData = (GLfloat*)glMapBuffer(GL_ARRAY_BUFFER, GL_READ_ONLY);
-		for(int i=0;i<total_points*4;i+=4) {
-			//if the vertex distance is close enough
-			if( abs(pData[i]-pt.x)<0.1 &&
-				abs(pData[i+1]-pt.y)<0.1  &&
-				abs(pData[i+2]-pt.z)<0.1 ) {
-				//take this as the selected vertex
-				selected_index = i/4;
-				printf("Intersected at %d\n",i);
-				break;
-			}
+
+		//unproject the clicked point on the near and far planes to get the picking
+		//ray. Reading the depth buffer here would wait for the frame to finish.
+		double nearX=0, nearY=0, nearZ=0, farX=0, farY=0, farZ=0;
+		gluUnProject(winX, winY, 0, MV, P, viewport, &nearX, &nearY, &nearZ);
+		gluUnProject(winX, winY, 1, MV, P, viewport, &farX, &farY, &farZ);
+		glm::vec3 origin((float)nearX, (float)nearY, (float)nearZ);
+		glm::vec3 dir = glm::vec3((float)farX, (float)farY, (float)farZ) - origin;
+
+		//find the nearest vertex along the ray in the last read back positions
+		selected_index = picker.Pick(origin, dir);
+		if(selected_index != -1) {
+			dragPosition = picker.GetPosition(selected_index);
+			printf("Intersected at %d (positions %d frames old)\n", selected_index, picker.GetLatency());
 		}
-		//unmap buffer to release the obtained pointer to GPU memory
-		glUnmapBuffer(GL_ARRAY_BUFFER);
-		glBindVertexArray(0);
 	}
 
 	if(button == GLUT_MIDDLE_BUTTON)
@@ -403,32 +490,15 @@ void OnMouseMove(int x, int y)
 		else
 			glutSetCursor(GLUT_CURSOR_UP_DOWN);
 
-		//set the rendering vertex array object
-		glBindVertexArray(vaoRenderID[readID]);
-		//bind the position buffer object
-		glBindBuffer(GL_ARRAY_BUFFER, vboID_Pos[writeID]);
-			//map the buffer object to obtain access to the selected vertex position
-			GLfloat* pData = (GLfloat*)glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE);
-				//assign a new value to the selected vertex
-				pData[selected_index*4]	  += Right[0]*valX ;
-				float newValue = pData[selected_index*4+1]+Up[1]*valY;
-				//for Y value, we test the new value to be >0 so that he vertex cannot go
-				//below the ground plane
-				if(newValue>0)
-					pData[selected_index*4+1] = newValue;
-				pData[selected_index*4+2] += Right[2]*valX + Up[2]*valY;
-			//unmap buffer to release the obtained pointer to GPU memory
-			glUnmapBuffer(GL_ARRAY_BUFFER);
-		//do the same steps for the previous position buffer object
-		glBindBuffer(GL_ARRAY_BUFFER, vboID_PrePos[writeID]);
-			pData = (GLfloat*)glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE);
-				pData[selected_index*4]	  += Right[0]*valX ;
-				newValue = pData[selected_index*4+1]+Up[1]*valY;
-				if(newValue>0)
-					pData[selected_index*4+1] = newValue;
-				pData[selected_index*4+2] += Right[2]*valX + Up[2]*valY;
-			glUnmapBuffer(GL_ARRAY_BUFFER);
-		glBindVertexArray(0);
+		//move the drag target, the solvers hold the selected vertex at this
+		//position so the position buffers do not have to be mapped
+		dragPosition.x += Right[0]*valX;
+		float newValue = dragPosition.y + Up[1]*valY;
+		//for Y value, we test the new value to be >0 so that he vertex cannot go
+		//below the ground plane
+		if(newValue>0)
+			dragPosition.y = newValue;
+		dragPosition.z += Right[2]*valX + Up[2]*valY;
 	}
 	oldX = x;
 	oldY = y;
@@ -494,46 +564,9 @@ void InitGL() {
     // start timer
     QueryPerformanceCounter(&t1);
 
-	//local variables
-	size_t i=0, j=0, count=0;
-	int l1=0, l2=0;
-	int v = numY+1;
-	int u = numX+1;
-
-	printf("Total triangles: %3d\n",numX*numY*2);
-
-	//resize the cloth indices, position, previous position and force vectors
-	indices.resize( numX*numY*2*3);
-	X.resize(total_points);
-	X_last.resize(total_points);
-	F.resize(total_points);
-
-	//fill in positions
-	for(int j=0;j<=numY;j++) {
-		for(int i=0;i<=numX;i++) {
-			X[count] = glm::vec4( ((float(i)/(u-1)) *2-1)* hsize, sizeX+1, ((float(j)/(v-1) )* sizeY),1);
-			X_last[count] = X[count];
-			count++;
-		}
-	}
+	//create the cloth particles, triangles and springs
+	CreateCloth();
 
-	//fill in indices
-	GLushort* id=&indices[0];
-	for (int i = 0; i < numY; i++) {
-		for (int j = 0; j < numX; j++) {
-			int i0 = i * (numX+1) + j;
-			int i1 = i0 + 1;
-			int i2 = i0 + (numX+1);
-			int i3 = i2 + 1;
-			if ((j+i)%2) {
-				*id++ = i0; *id++ = i2; *id++ = i1;
-				*id++ = i1; *id++ = i2; *id++ = i3;
-			} else {
-				*id++ = i0; *id++ = i2; *id++ = i3;
-				*id++ = i0; *id++ = i3; *id++ = i1;
-			}
-		}
-	}
 	//set the polygon rendering to render them as lines
 	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
@@ -551,40 +584,6 @@ void InitGL() {
 	//by writing to gl_PointSize value
 	glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
 
-	// Setup springs
-	// structural Horizontal
-	for (l1 = 0; l1 < v; l1++)	// v
-		for (l2 = 0; l2 < (u - 1); l2++) {
-			AddSpring((l1 * u) + l2,(l1 * u) + l2 + 1,KsStruct,KdStruct);
-		}
-
-	// structural Vertical
-	for (l1 = 0; l1 < (u); l1++)
-		for (l2 = 0; l2 < (v - 1); l2++) {
-			AddSpring((l2 * u) + l1,((l2 + 1) * u) + l1,KsStruct,KdStruct);
-		}
-
-	// Shearing Springs
-	for (l1 = 0; l1 < (v - 1); l1++)
-		for (l2 = 0; l2 < (u - 1); l2++) {
-			AddSpring((l1 * u) + l2,((l1 + 1) * u) + l2 + 1,KsShear,KdShear);
-			AddSpring(((l1 + 1) * u) + l2,(l1 * u) + l2 + 1,KsShear,KdShear);
-		}
-
-	// Bend Springs
-	for (l1 = 0; l1 < (v); l1++) {
-		for (l2 = 0; l2 < (u - 2); l2++) {
-			AddSpring((l1 * u) + l2,(l1 * u) + l2 + 2,KsBend,KdBend);
-		}
-		AddSpring((l1 * u) + (u - 3),(l1 * u) + (u - 1),KsBend,KdBend);
-	}
-	for (l1 = 0; l1 < (u); l1++) {
-		for (l2 = 0; l2 < (v - 2); l2++) {
-			AddSpring((l2 * u) + l1,((l2 + 2) * u) + l1,KsBend,KdBend);
-		}
-		AddSpring(((v - 3) * u) + l1,((v - 1) * u) + l1,KsBend,KdBend);
-	}
-
 	//setup shader loading
 	massSpringShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/Spring.vert");
 	particleShader.LoadFromFile(GL_VERTEX_SHADER,"shaders/Basic.vert");
@@ -614,6 +613,8 @@ void InitGL() {
 		massSpringShader.AddUniform("texsize_y");
 		massSpringShader.AddUniform("step");
 		massSpringShader.AddUniform("inv_cloth_size");
+		massSpringShader.AddUniform("drag_index");
+		massSpringShader.AddUniform("drag_position");
 	massSpringShader.UnUse();
 
 	CHECK_GL_ERRORS
@@ -675,8 +676,17 @@ void InitGL() {
 		glUniform1f(massSpringShader("kdShr"),  KdShear/1000.0f);
 		glUniform1f(massSpringShader("kdBnd"),  KdBend/1000.0f);
 		glUniform1f(massSpringShader("DEFAULT_DAMPING"),  DEFAULT_DAMPING);
+		glUniform1i(massSpringShader("drag_index"), -1);
 	massSpringShader.UnUse();
 
+	//setup the CPU solver with the same particles and springs
+	SetupSolver(clothSolver, SOLVER_SPRINGS);
+	printf("CPU solver: %d particles, %d spring colours\n", clothSolver.GetTotalParticles(), clothSolver.GetTotalColors());
+
+	//the picker uses the initial positions until the first read back
+	picker.Init(total_points, PICK_RADIUS);
+	picker.SetPositions(&X[0]);
+
 	//disable vsync
 	wglSwapIntervalEXT(0);
 }
@@ -701,6 +711,9 @@ void RenderGPU_TF() {
 	massSpringShader.Use();
 		//pass shader uniforms
 		glUniformMatrix4fv(massSpringShader("MVP"), 1, GL_FALSE, glm::value_ptr(mMVP));
+		//the selected vertex is held at the drag position
+		glUniform1i(massSpringShader("drag_index"), selected_index);
+		glUniform3fv(massSpringShader("drag_position"), 1, &dragPosition.x);
 
 		CHECK_GL_ERRORS
 		//run the iteration loop
@@ -747,6 +760,11 @@ void RenderGPU_TF() {
 		//get the transform feedback time
 		delta_time = elapsed_time / 1000000.0f;
 
+		//use the newest finished copy of the positions for picking and queue
+		//a copy of this frame's output, which is read back in a later frame
+		picker.Update();
+		picker.QueueReadback(vboID_Pos[writeID]);
+
 	//remove the cloth vertex shader
 	massSpringShader.UnUse();
 
@@ -789,6 +807,77 @@ void RenderGPU_TF() {
 
 }
 
+//copies the particles of the GPU buffers into the CPU solver
+void ReadBackGPU() {
+	vector<glm::vec4> pos(total_points), prev(total_points);
+	glBindBuffer(GL_ARRAY_BUFFER, vboID_Pos[writeID]);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, total_points*sizeof(glm::vec4), &pos[0].x);
+	glBindBuffer(GL_ARRAY_BUFFER, vboID_PrePos[writeID]);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, total_points*sizeof(glm::vec4), &prev[0].x);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	for(int i=0;i<total_points;i++)
+		clothSolver.SetPosition(i, vec3(pos[i]), vec3(prev[i]));
+}
+
+//update of cloth particles on the CPU and rendering
+void RenderCPU() {
+	//the spring model runs the same number of steps per frame as the transform
+	//feedback path, XPBD takes a single step of the whole frame time
+	int steps = (clothSolver.GetSolver()==SOLVER_SPRINGS) ? NUM_ITER : 1;
+	for(int i=0;i<steps;i++) {
+		//hold the selected vertex at the drag position
+		if(selected_index != -1)
+			clothSolver.SetPosition(selected_index, dragPosition, dragPosition);
+		clothSolver.Step();
+	}
+	if(selected_index != -1)
+		clothSolver.SetPosition(selected_index, dragPosition, dragPosition);
+
+	//upload the current and previous positions to the buffers holding the
+	//latest transform feedback output so that picking and switching back
+	//to the GPU continue from the CPU state
+	clothSolver.GetPositions(X, X_last);
+	picker.SetPositions(&X[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, vboID_Pos[writeID]);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, X.size()*sizeof(glm::vec4), &X[0].x);
+	glBindBuffer(GL_ARRAY_BUFFER, vboID_PrePos[writeID]);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, X_last.size()*sizeof(glm::vec4), &X_last[0].x);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//bind the render vertex array object
+	glBindVertexArray(vaoRenderID[writeID]);	
+		//disable depth test
+		glDisable(GL_DEPTH_TEST);
+			//set the render shader
+			renderShader.Use();
+				//set the shader uniform
+				glUniformMatrix4fv(renderShader("MVP"), 1, GL_FALSE, glm::value_ptr(mMVP));
+					//draw the cloth geometry
+					glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_SHORT,0);
+			//remove render shader
+			renderShader.UnUse();
+		//enable depth test
+		glEnable(GL_DEPTH_TEST);
+
+		//if we want to display masses
+		if(bDisplayMasses) {
+			//set the particle shader
+			particleShader.Use();
+				//set shader uniforms
+				glUniform1i(particleShader("selected_index"), selected_index);
+				glUniformMatrix4fv(particleShader("MV"), 1, GL_FALSE, glm::value_ptr(mMV));
+				glUniformMatrix4fv(particleShader("MVP"), 1, GL_FALSE, glm::value_ptr(mMVP));
+					//draw the masses last
+		  			glDrawArrays(GL_POINTS, 0, total_points);
+			//remove the particle shader
+			particleShader.UnUse();
+		}
+	//remove the currently bound vertex array object
+	glBindVertexArray( 0);
+
+	CHECK_GL_ERRORS 
+}
+
 //display function
 void OnRender() {
 
@@ -812,7 +901,9 @@ void OnRender() {
 		fps = (totalFrames/ elapsedTime)*1000 ;
 		startTime = newTime;
 		totalFrames=0;
-		sprintf_s(info, "FPS: %3.2f, Frame time (GLUT): %3.4f msecs, Frame time (QP): %3.3f, TF Time: %3.3f", fps, frameTime, frameTimeQP, delta_time);
+		sprintf_s(info, "FPS: %3.2f, Frame time (GLUT): %3.4f msecs, Frame time (QP): %3.3f, TF Time: %3.3f, CPU Time: %3.3f msecs/step (%s, %s, %d iterations)", 
+			fps, frameTime, frameTimeQP, delta_time, clothSolver.GetStepTime(), bUseCPU?"CPU":"GPU",
+			ClothSolver::GetSolverName(clothSolver.GetSolver()), clothSolver.GetIterations());
 	}
 
 	glutSetWindowTitle(info);
@@ -840,7 +931,10 @@ void OnRender() {
  	DrawGrid();
 
 	//deform and render cloth 
-	RenderGPU_TF();
+	if(bUseCPU)
+		RenderCPU();
+	else
+		RenderGPU_TF();
 
 	//swap back and front buffers to display the result on screen
 	glutSwapBuffers();
@@ -848,6 +942,7 @@ void OnRender() {
 
 //delete all allocated objects
 void OnShutdown() {
+	picker.Destroy();
 	X.clear();
 	X_last.clear();
 	F.clear();
@@ -888,12 +983,123 @@ void OnIdle() {
 void OnKey(unsigned char key, int , int) {
 	switch(key) {
 		case 'm':	bDisplayMasses=!bDisplayMasses;	break;
+		case 'c':
+			//continue from the current GPU state when switching to the CPU
+			bUseCPU=!bUseCPU;
+			if(bUseCPU)
+				ReadBackGPU();
+			printf("Simulating on the %s\n", bUseCPU?"CPU":"GPU");
+			break;
+		case 'x': {
+			//cycle the CPU solvers, the XPBD solvers take one step per frame
+			SolverType type = SolverType((clothSolver.GetSolver()+1)%TOTAL_SOLVERS);
+			clothSolver.SetSolver(type);
+			clothSolver.SetParameters(type==SOLVER_SPRINGS ? timeStep : timeStep*NUM_ITER, gravity, DEFAULT_DAMPING);
+			printf("CPU solver: %s\n", ClothSolver::GetSolverName(type));
+		} break;
+		case '+':
+		case '-':
+			clothSolver.SetIterations(clothSolver.GetIterations() + (key=='+' ? 1 : -1));
+			printf("XPBD iterations: %d\n", clothSolver.GetIterations());
+			break;
 	}
 
 	glutPostRedisplay();
 }
 
+//simulates the cloth for the given number of frames and returns the average
+//time per frame in milliseconds. Returns a negative time if the cloth blew up.
+double SimulateFrames(ClothSolver& solver, int steps, int frames) {
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	for(int f=0;f<frames;f++)
+		for(int i=0;i<steps;i++)
+			solver.Step();
+	QueryPerformanceCounter(&end);
+
+	for(int i=0;i<solver.GetTotalParticles();i++) {
+		glm::vec3 p = solver.GetPosition(i);
+		if(!(fabs(p.x) < 1000 && fabs(p.y) < 1000 && fabs(p.z) < 1000))
+			return -1;
+	}
+	return (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart / frames;
+}
+
+//runs the CPU solvers without a window. The spring model is run with a
+//varying number of steps per frame and XPBD with a varying number of
+//iterations of a single step per frame, for the default springs and for
+//springs that are 100 times stiffer. For every run the spring strain after a
+//fixed simulated time is reported; a solver has converged once its mean
+//strain is within 5% of the strain of its largest setting.
+void RunBenchmark() {
+	const int BENCHMARK_FRAMES = 300;
+	//with smaller steps gravity moves the particles by less than the float
+	//precision of their positions, so the spring model stops at 20 steps
+	const int springSettings[] = {1, 2, 5, 10, 20};
+	const int xpbdSettings[] = {1, 2, 5, 10, 20, 50};
+	const int TOTAL_SPRING_SETTINGS = sizeof(springSettings)/sizeof(springSettings[0]);
+	const int TOTAL_XPBD_SETTINGS = sizeof(xpbdSettings)/sizeof(xpbdSettings[0]);
+	const int MAX_SETTINGS = (TOTAL_SPRING_SETTINGS > TOTAL_XPBD_SETTINGS) ? TOTAL_SPRING_SETTINGS : TOTAL_XPBD_SETTINGS;
+	const float stiffness[] = {1, 100};
+
+	QueryPerformanceFrequency(&frequency);
+	for(int k=0;k<2;k++) {
+		//scale the spring constants of a fresh cloth
+		CreateCloth();
+		for(size_t i=0;i<springs.size();i++)
+			springs[i].Ks *= stiffness[k];
+
+		printf("Cloth benchmark: %d particles, %d springs, stiffness x%g, %d frames of %3.3f msecs\n",
+			total_points, (int)springs.size(), stiffness[k], BENCHMARK_FRAMES, timeStep*NUM_ITER*1000.0f);
+		printf("%-20s %10s %10s %12s %12s %12s\n", "solver", "iterations", "stable", "mean strain", "max strain", "msecs/frame");
+
+		for(int type=0;type<TOTAL_SOLVERS;type++) {
+			const int* settings = (type==SOLVER_SPRINGS) ? springSettings : xpbdSettings;
+			int totalSettings = (type==SOLVER_SPRINGS) ? TOTAL_SPRING_SETTINGS : TOTAL_XPBD_SETTINGS;
+			float meanStrain[MAX_SETTINGS];
+			bool stable[MAX_SETTINGS];
+			for(int s=0;s<totalSettings;s++) {
+				ClothSolver solver;
+				SetupSolver(solver, SolverType(type));
+				//the spring model splits the frame into smaller steps instead
+				int steps = 1;
+				if(type==SOLVER_SPRINGS) {
+					steps = settings[s];
+					solver.SetParameters(timeStep*NUM_ITER/steps, gravity, DEFAULT_DAMPING);
+				} else {
+					solver.SetIterations(settings[s]);
+				}
+
+				float maxStrain = 0;
+				double time = SimulateFrames(solver, steps, BENCHMARK_FRAMES);
+				stable[s] = time >= 0;
+				meanStrain[s] = 0;
+				if(stable[s])
+					solver.GetStrain(maxStrain, meanStrain[s]);
+				printf("%-20s %10d %10s %12.5f %12.5f %12.3f\n", ClothSolver::GetSolverName(SolverType(type)), settings[s],
+					stable[s]?"yes":"no", meanStrain[s], maxStrain, stable[s]?time:0.0);
+			}
+
+			int converged = -1;
+			float reference = meanStrain[totalSettings-1];
+			for(int s=0;s<totalSettings && converged<0;s++)
+				if(stable[s] && stable[totalSettings-1] && fabs(meanStrain[s]-reference) <= 0.05f*reference)
+					converged = settings[s];
+			if(converged>0)
+				printf("%s converges in %d %s\n\n", ClothSolver::GetSolverName(SolverType(type)), converged, type==SOLVER_SPRINGS?"steps per frame":"iterations");
+			else
+				printf("%s does not converge\n\n", ClothSolver::GetSolverName(SolverType(type)));
+		}
+	}
+}
+
 int main(int argc, char** argv) {
+	//compare the CPU solvers without creating a window
+	if(argc>1 && strcmp(argv[1], "--benchmark")==0) {
+		RunBenchmark();
+		return 0;
+	}
+
 	//freeglut initialization calls
 	glutInit(&argc, argv);
 	glutInitContextVersion(3,3);
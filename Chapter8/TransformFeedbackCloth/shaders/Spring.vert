@@ -11,6 +11,8 @@ uniform vec2  inv_cloth_size;					//size of a single patch in world space
 uniform vec2  step;								//delta texture size
 uniform int texsize_x;							//size of position texture
 uniform int texsize_y; 
+uniform int drag_index;							//vertex held by the mouse, -1 if none
+uniform vec3 drag_position;						//position the vertex is held at
 
 //elapsed time, spring and damping constants
 uniform float dt, ksStr, ksShr, ksBnd, 
@@ -153,6 +155,12 @@ void main()
 	//collision with floor
 	pos.y=max(0, pos.y); 
  
+	//the vertex dragged with the mouse is held at the drag position
+	if(index == drag_index) {
+		pos = drag_position;
+		pos_old = drag_position;
+	}
+
 	//set the shader outputs and clip space position
 	out_position_mass = vec4(pos, m);	
 	out_prev_position = vec4(pos_old,m);			  
@@ -5,6 +5,8 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include "..\src\GLSLShader.h"
+#include "..\src\ClothSolver.h"
+#include "..\src\ClothPicker.h"
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -32,9 +34,12 @@ using namespace std;
 //screen size
 const int width = 1024, height = 1024;
 
-//total number of particles on X and Z axis
+//total number of particles on X and Z axis, can be set on the command line
 int numX = 21, numY=21;
-const int total_points = (numX+1)*(numY+1);
+int total_points = (numX+1)*(numY+1);
+
+//largest cloth resolution accepted on the command line
+const int MAX_CLOTH_SIZE = 256;
 
 //world space cloth size
 int sizeX = 4,
@@ -47,18 +52,28 @@ const int NUM_ITER = 10;
 //selected vertex index
 int selected_index = -1;
 
+//position the selected vertex is dragged to
+glm::vec3 dragPosition;
+
+//picks the particles from asynchronously read back positions
+ClothPicker picker;
+
+//largest distance of a picked particle from the mouse ray
+const float PICK_RADIUS = 0.1f;
+
 //flag to display/hide masses
 bool bDisplayMasses=true;
 
-//spring struct for storing cloth springs
-struct Spring {
-	int p1, p2;			//indices of two vertices
-	float rest_length;	//resting length
-	float Ks, Kd;		//spring and damping constants
-};
+//flag to simulate the cloth on the CPU instead of using transform feedback
+bool bUseCPU=false;
+
+//CPU mass spring solver and its collision handler. Self collision is only
+//available on the CPU; both paths use the same list of colliders.
+ClothSolver clothSolver;
+ClothCollision clothCollision;
 
-//cloth indices
-vector<GLushort> indices;
+//cloth indices, 32-bit so that cloths larger than 255x255 can be indexed
+vector<GLuint> indices;
 
 //cloth springs
 vector<Spring> springs;
@@ -175,6 +190,10 @@ GLuint clothVAOID, clothVBOVerticesID, clothVBOIndicesID;
 //spehre vertex array and buffer objects
 GLuint sphereVAOID, sphereVerticesID, sphereIndicesID;
 
+//cube vertex array and buffer objects used to draw box colliders
+GLuint cubeVAOID, cubeVerticesID, cubeIndicesID;
+const int TOTAL_CUBE_INDICES = 36;
+
 //transform feedback id
 GLuint tfID;
 
@@ -189,6 +208,9 @@ float fRadius = 1;
 //total sphere indices
 int total_sphere_indices=0;
 
+//maximum number of colliders, must match MAX_COLLIDERS in the mass spring shader
+const int MAX_COLLIDERS = 8;
+
 //converts vec4 to vec3
 glm::vec3 vec3(const glm::vec4& v) {
 	return glm::vec3(v.x, v.y, v.z);
@@ -259,7 +281,7 @@ void createVBO()
 		//setup the indices array buffer
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndices);
 		if(i==0)
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
 	}
 
 	glBindVertexArray(0);
@@ -324,7 +346,7 @@ void createVBO()
 		CHECK_GL_ERRORS
 		//pass cloth indices to element array buffer 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, clothVBOIndicesID);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*indices.size(), &indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*indices.size(), &indices[0], GL_STATIC_DRAW);
 
 	//setup sphere vertices and indices
 	vector<glm::vec4> sphere_vertices;
@@ -413,6 +435,28 @@ void createVBO()
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereIndicesID);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*total_sphere_indices, &sphere_indices[0], GL_STATIC_DRAW);
 
+	//setup the unit cube for box colliders
+	glm::vec4 cube_vertices[8];
+	for(int i=0;i<8;i++)
+		cube_vertices[i] = glm::vec4((i&1)?1.0f:-1.0f, (i&2)?1.0f:-1.0f, (i&4)?1.0f:-1.0f, 1.0f);
+	GLushort cube_indices[TOTAL_CUBE_INDICES] = {	0,2,1, 1,2,3,	4,5,6, 5,7,6,
+													0,1,4, 1,5,4,	2,6,3, 3,6,7,
+													0,4,2, 2,4,6,	1,3,5, 3,7,5 };
+	glGenVertexArrays(1, &cubeVAOID);
+	glGenBuffers (1, &cubeVerticesID);
+	glGenBuffers (1, &cubeIndicesID);
+	glBindVertexArray(cubeVAOID);
+		glBindBuffer (GL_ARRAY_BUFFER, cubeVerticesID);
+		//pass cube vertices into buffer object
+		glBufferData (GL_ARRAY_BUFFER, sizeof(cube_vertices), &cube_vertices[0].x, GL_STATIC_DRAW);
+		//enable vertex attribute array
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer (0, 4, GL_FLOAT, GL_FALSE,0,0);
+
+		CHECK_GL_ERRORS
+		//pass cube indices to element array object
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeIndicesID);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_indices), &cube_indices[0], GL_STATIC_DRAW);
 
 	glBindVertexArray(0);
 
@@ -429,43 +473,21 @@ void OnMouseDown(int button, int s, int x, int y)
 		//note that the y value is flipped
 		int winY = (height - y); 
 		int winX = x ; 
-		float winZ =0;
-
-		//read the depth value at the clicked position
-		glReadPixels( winX, winY, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &winZ );
-		if(winZ==1)
-			winZ=0;
 
-		//unproject the value using the current modelview, projection matrices and the current 
-		//viewport to get the object space position of the clicked point
-		double objX=0, objY=0, objZ=0;
-		gluUnProject(winX, winY, winZ,  MV,  P, viewport, &objX, &objY, &objZ);
-	
-		glm::vec3 pt(objX,objY, objZ);
-	 
-		//bind our render vertex array object
-		glBindVertexArray(vaoRenderID[readID]);
-		glBindBuffer(GL_ARRAY_BUFFER, vboID_Pos[writeID]);
-		//map the data so that we can read each vertex position
-		//to check the nearest vertex the user has picked
-		GLfloat* pData = (GLfloat*)glMapBuffer(GL_ARRAY_BUFFER, GL_READ_ONLY);
-
-		//loop through all cloth vertices
-		for(int i=0;i<total_points*4;i+=4) {
-			//if the vertex distance is close enough
-			if( abs(pData[i]-pt.x)<0.1 &&
-				abs(pData[i+1]-pt.y)<0.1  &&
-				abs(pData[i+2]-pt.z)<0.1 ) {
-				//take this as the selected vertex
-				selected_index = i/4;
-				printf("Intersected at %d\n",i);
-				break;
-			}
+		//unproject the clicked point on the near and far planes to get the picking
+		//ray. Reading the depth buffer here would wait for the frame to finish.
+		double nearX=0, nearY=0, nearZ=0, farX=0, farY=0, farZ=0;
+		gluUnProject(winX, winY, 0, MV, P, viewport, &nearX, &nearY, &nearZ);
+		gluUnProject(winX, winY, 1, MV, P, viewport, &farX, &farY, &farZ);
+		glm::vec3 origin((float)nearX, (float)nearY, (float)nearZ);
+		glm::vec3 dir = glm::vec3((float)farX, (float)farY, (float)farZ) - origin;
+
+		//find the nearest vertex along the ray in the last read back positions
+		selected_index = picker.Pick(origin, dir);
+		if(selected_index != -1) {
+			dragPosition = picker.GetPosition(selected_index);
+			printf("Intersected at %d (positions %d frames old)\n", selected_index, picker.GetLatency());
 		}
-		//unmap buffer to release the obtained pointer to GPU memory
-		glUnmapBuffer(GL_ARRAY_BUFFER);
-		glBindVertexArray(0);
-
 	}
 
 	if(button == GLUT_MIDDLE_BUTTON)
@@ -501,35 +523,16 @@ void OnMouseMove(int x, int y)
 		else
 			glutSetCursor(GLUT_CURSOR_UP_DOWN);
 
-		//set the rendering vertex array object
-		glBindVertexArray(vaoRenderID[readID]);
-		//bind the position buffer object
-		glBindBuffer(GL_ARRAY_BUFFER, vboID_Pos[writeID]);
-			//map the buffer object to obtain access to the selected vertex position
-			GLfloat* pData = (GLfloat*)glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE);
-				//assign a new value to the selected vertex
-				pData[selected_index*4]	  += Right[0]*valX ;
-				float newValue = pData[selected_index*4+1]+Up[1]*valY;
-
-				//for Y value, we test the new value to be >0 so that he vertex cannot go
-				//below the ground plane
-				if(newValue>0)
-					pData[selected_index*4+1] = newValue;
-				pData[selected_index*4+2] += Right[2]*valX + Up[2]*valY;
-			//unmap buffer to release the obtained pointer to GPU memory
-			glUnmapBuffer(GL_ARRAY_BUFFER);
-		//do the same steps for the previous position buffer object
-		glBindBuffer(GL_ARRAY_BUFFER, vboID_PrePos[writeID]);
-			pData = (GLfloat*)glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE);
-				pData[selected_index*4]	  += Right[0]*valX ;
-				newValue = pData[selected_index*4+1]+Up[1]*valY;
-				if(newValue>0)
-					pData[selected_index*4+1] = newValue;
-				pData[selected_index*4+2] += Right[2]*valX + Up[2]*valY;
-			glUnmapBuffer(GL_ARRAY_BUFFER);
-		glBindVertexArray(0);
+		//move the drag target, the solvers hold the selected vertex at this
+		//position so the position buffers do not have to be mapped
+		dragPosition.x += Right[0]*valX;
+		float newValue = dragPosition.y + Up[1]*valY;
+		//for Y value, we test the new value to be >0 so that he vertex cannot go
+		//below the ground plane
+		if(newValue>0)
+			dragPosition.y = newValue;
+		dragPosition.z += Right[2]*valX + Up[2]*valY;
 	}
-
 	oldX = x;
 	oldY = y;
 
@@ -555,7 +558,7 @@ void DrawCloth()
 	renderShader.Use();
 		glBindVertexArray(clothVAOID);
 		glUniformMatrix4fv(renderShader("MVP"), 1, GL_FALSE, glm::value_ptr(mMVP));
-			glDrawElements(GL_TRIANGLES, indices.size(),GL_UNSIGNED_SHORT,0);
+			glDrawElements(GL_TRIANGLES, indices.size(),GL_UNSIGNED_INT,0);
 		//glBindVertexArray(0);
 	renderShader.UnUse();
 }
@@ -569,6 +572,47 @@ void DrawSphere(const glm::mat4& mvp) {
 	renderShader.UnUse();
 }
 
+//renders cube using the render shader
+void DrawCube(const glm::mat4& mvp) {
+	renderShader.Use();
+		glBindVertexArray(cubeVAOID);
+		glUniformMatrix4fv(renderShader("MVP"), 1, GL_FALSE, glm::value_ptr(mvp));
+			glDrawElements(GL_TRIANGLES, TOTAL_CUBE_INDICES,GL_UNSIGNED_SHORT,0); 
+	renderShader.UnUse();
+}
+
+//renders the colliders. Capsules are drawn as their two end spheres and an
+//ellipsoid along the axis; planes are not drawn, the grid shows the floor.
+void DrawColliders() {
+	const vector<Collider>& colliders = clothCollision.GetColliders();
+	for(size_t i=0;i<colliders.size();i++) {
+		const Collider& c = colliders[i];
+		glm::vec3 a(c.a.x, c.a.y, c.a.z), b(c.b.x, c.b.y, c.b.z);
+		switch(int(c.b.w)) {
+			case COLLIDER_SPHERE:
+				DrawSphere(mMVP*glm::scale(glm::translate(glm::mat4(1), a), glm::vec3(c.a.w)));
+				break;
+
+			case COLLIDER_CAPSULE: {
+				DrawSphere(mMVP*glm::scale(glm::translate(glm::mat4(1), a), glm::vec3(c.a.w)));
+				DrawSphere(mMVP*glm::scale(glm::translate(glm::mat4(1), b), glm::vec3(c.a.w)));
+				//orthonormal basis with the z axis along the capsule axis
+				glm::vec3 axis = b - a;
+				float halfLength = glm::length(axis)*0.5f;
+				glm::vec3 Z = axis/(halfLength*2);
+				glm::vec3 X = glm::normalize(glm::cross(Z, (fabs(Z.y)<0.9f)?glm::vec3(0,1,0):glm::vec3(1,0,0)));
+				glm::vec3 Y = glm::cross(Z, X);
+				glm::mat4 M(glm::vec4(X*c.a.w,0), glm::vec4(Y*c.a.w,0), glm::vec4(Z*halfLength,0), glm::vec4((a+b)*0.5f,1));
+				DrawSphere(mMVP*M);
+			} break;
+
+			case COLLIDER_BOX:
+				DrawCube(mMVP*glm::scale(glm::translate(glm::mat4(1), a), b));
+				break;
+		}
+	}
+}
+
 //renders cloth vertices using particle shader
 //this call assumes that the cloth vertex array object is bound currently
 void DrawClothPoints()
@@ -631,7 +675,7 @@ void InitGL() {
 	}
 
 	//fill in indices
-	GLushort* id=&indices[0];
+	GLuint* id=&indices[0];
 	for (int i = 0; i < numY; i++) {
 		for (int j = 0; j < numX; j++) {
 			int i0 = i * (numX+1) + j;
@@ -727,9 +771,13 @@ void InitGL() {
 		massSpringShader.AddUniform("texsize_y");
 		massSpringShader.AddUniform("step");
 		massSpringShader.AddUniform("inv_cloth_size");
+		massSpringShader.AddUniform("drag_index");
+		massSpringShader.AddUniform("drag_position");
 		massSpringShader.AddUniform("ellipsoid_xform");	
 		massSpringShader.AddUniform("inv_ellipsoid");	
 		massSpringShader.AddUniform("ellipsoid");		
+		massSpringShader.AddUniform("colliders");
+		massSpringShader.AddUniform("num_colliders");
 	massSpringShader.UnUse();
 
 	CHECK_GL_ERRORS
@@ -771,6 +819,15 @@ void InitGL() {
 	ellipsoid = glm::scale(ellipsoid, glm::vec3(fRadius,fRadius,fRadius/2));
 	inverse_ellipsoid = glm::inverse(ellipsoid);
 
+	//colliders shared by the GPU and CPU paths, the plane replaces the floor
+	clothCollision.AddCollider(PlaneCollider(glm::vec3(0,1,0), 0));
+	clothCollision.AddCollider(SphereCollider(glm::vec3(1.4f,1.0f,0.6f), 0.5f));
+	clothCollision.AddCollider(CapsuleCollider(glm::vec3(-2.0f,0.6f,0.2f), glm::vec3(-0.6f,0.6f,1.6f), 0.25f));
+	clothCollision.AddCollider(BoxCollider(glm::vec3(0.0f,0.3f,2.2f), glm::vec3(0.8f,0.3f,0.5f)));
+	clothCollision.SetEllipsoid(ellipsoid);
+	const vector<Collider>& colliders = clothCollision.GetColliders();
+	assert(colliders.size() <= MAX_COLLIDERS);
+
 	//setup transform feedback attributes
 	glGenTransformFeedbacks(1, &tfID);
 	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfID);
@@ -791,6 +848,8 @@ void InitGL() {
 		glUniformMatrix4fv(massSpringShader("ellipsoid_xform"), 1, GL_FALSE, glm::value_ptr(ellipsoid));
 		glUniformMatrix4fv(massSpringShader("inv_ellipsoid"), 1, GL_FALSE, glm::value_ptr(inverse_ellipsoid));
 		glUniform4f(massSpringShader("ellipsoid"),0, 0, 0, fRadius);		
+		glUniform4fv(massSpringShader("colliders"), 2*colliders.size(), &colliders[0].a.x);
+		glUniform1i(massSpringShader("num_colliders"), colliders.size());
 		glUniform2f(massSpringShader("inv_cloth_size"),float(sizeX)/numX,float(sizeY)/numY);
 		glUniform2f(massSpringShader("step"),1.0f/(texture_size_x-1.0f),1.0f/(texture_size_y-1.0f));
 		glUniform1f(massSpringShader("ksStr"),  KsStruct);
@@ -800,9 +859,29 @@ void InitGL() {
 		glUniform1f(massSpringShader("kdShr"),  KdShear/1000.0f);
 		glUniform1f(massSpringShader("kdBnd"),  KdBend/1000.0f);
 		glUniform1f(massSpringShader("DEFAULT_DAMPING"),  DEFAULT_DAMPING);
+		glUniform1i(massSpringShader("drag_index"), -1);
 	massSpringShader.UnUse();
 
-	
+	//setup the CPU solver with the same particles and springs. The shader
+	//scales the damping constants by 1/1000 so the same is done here
+	vector<Spring> cpu_springs(springs);
+	for(size_t i=0;i<cpu_springs.size();i++)
+		cpu_springs[i].Kd /= 1000.0f;
+	clothSolver.Init(X, X_last, cpu_springs);
+	clothSolver.SetParameters(timeStep, gravity, DEFAULT_DAMPING);
+	//the shader keeps the first and last vertex of the first row fixed
+	clothSolver.SetFixed(0);
+	clothSolver.SetFixed(texture_size_x-1);
+
+	//the cloth keeps half the particle spacing between its layers
+	vector<unsigned int> triangles(indices.begin(), indices.end());
+	clothCollision.Init(X, triangles, 0.5f*min(float(sizeX)/numX, float(sizeY)/numY));
+	clothSolver.SetCollision(&clothCollision);
+	printf("CPU solver: %d particles, %d spring colours, %d colliders\n", clothSolver.GetTotalParticles(), clothSolver.GetTotalColors(), int(colliders.size()));
+
+	//the picker uses the initial positions until the first read back
+	picker.Init(total_points, PICK_RADIUS);
+	picker.SetPositions(&X[0]);
 
 	//disable vsync
 	wglSwapIntervalEXT(0);
@@ -830,6 +909,9 @@ void RenderGPU_TF() {
 	CHECK_GL_ERRORS
 		//pass shader uniforms
 		glUniformMatrix4fv(massSpringShader("MVP"), 1, GL_FALSE, glm::value_ptr(mMVP));
+		//the selected vertex is held at the drag position
+		glUniform1i(massSpringShader("drag_index"), selected_index);
+		glUniform3fv(massSpringShader("drag_position"), 1, &dragPosition.x);
 	 
 		CHECK_GL_ERRORS
 		//run the iteration loop
@@ -875,6 +957,11 @@ void RenderGPU_TF() {
 		glGetQueryObjectui64v(t_query, GL_QUERY_RESULT, &elapsed_time);
 		//get the transform feedback time
 		delta_time = elapsed_time / 1000000.0f;
+
+		//use the newest finished copy of the positions for picking and queue
+		//a copy of this frame's output, which is read back in a later frame
+		picker.Update();
+		picker.QueueReadback(vboID_Pos[writeID]);
 	//remove the cloth vertex shader
 	massSpringShader.UnUse();
 
@@ -889,7 +976,7 @@ void RenderGPU_TF() {
 				//set the shader uniform
 				glUniformMatrix4fv(renderShader("MVP"), 1, GL_FALSE, glm::value_ptr(mMVP));
 					//draw the cloth geometry
-					glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_SHORT,0);
+					glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT,0);
 			//remove render shader
 			renderShader.UnUse();
 		//enable depth test
@@ -916,6 +1003,77 @@ void RenderGPU_TF() {
 	CHECK_GL_ERRORS
 }
 
+//copies the particles of the GPU buffers into the CPU solver
+void ReadBackGPU() {
+	vector<glm::vec4> pos(total_points), prev(total_points);
+	glBindBuffer(GL_ARRAY_BUFFER, vboID_Pos[writeID]);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, total_points*sizeof(glm::vec4), &pos[0].x);
+	glBindBuffer(GL_ARRAY_BUFFER, vboID_PrePos[writeID]);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, total_points*sizeof(glm::vec4), &prev[0].x);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	for(int i=0;i<total_points;i++)
+		clothSolver.SetPosition(i, vec3(pos[i]), vec3(prev[i]));
+}
+
+//update of cloth particles on the CPU and rendering
+void RenderCPU() {
+	//the spring model runs the same number of steps per frame as the transform
+	//feedback path, XPBD takes a single step of the whole frame time
+	int steps = (clothSolver.GetSolver()==SOLVER_SPRINGS) ? NUM_ITER : 1;
+	for(int i=0;i<steps;i++) {
+		//hold the selected vertex at the drag position
+		if(selected_index != -1)
+			clothSolver.SetPosition(selected_index, dragPosition, dragPosition);
+		clothSolver.Step();
+	}
+	if(selected_index != -1)
+		clothSolver.SetPosition(selected_index, dragPosition, dragPosition);
+
+	//upload the current and previous positions to the buffers holding the
+	//latest transform feedback output so that picking and switching back
+	//to the GPU continue from the CPU state
+	clothSolver.GetPositions(X, X_last);
+	picker.SetPositions(&X[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, vboID_Pos[writeID]);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, X.size()*sizeof(glm::vec4), &X[0].x);
+	glBindBuffer(GL_ARRAY_BUFFER, vboID_PrePos[writeID]);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, X_last.size()*sizeof(glm::vec4), &X_last[0].x);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//bind the render vertex array object
+	glBindVertexArray(vaoRenderID[writeID]);	
+		//disable depth test
+		glDisable(GL_DEPTH_TEST);
+			//set the render shader
+			renderShader.Use();
+				//set the shader uniform
+				glUniformMatrix4fv(renderShader("MVP"), 1, GL_FALSE, glm::value_ptr(mMVP));
+					//draw the cloth geometry
+					glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT,0);
+			//remove render shader
+			renderShader.UnUse();
+		//enable depth test
+		glEnable(GL_DEPTH_TEST);
+
+		//if we want to display masses
+		if(bDisplayMasses) {
+			//set the particle shader
+			particleShader.Use();
+				//set shader uniforms
+				glUniform1i(particleShader("selected_index"), selected_index);
+				glUniformMatrix4fv(particleShader("MV"), 1, GL_FALSE, glm::value_ptr(mMV));
+				glUniformMatrix4fv(particleShader("MVP"), 1, GL_FALSE, glm::value_ptr(mMVP));
+					//draw the masses last
+		  			glDrawArrays(GL_POINTS, 0, total_points);
+			//remove the particle shader
+			particleShader.UnUse();
+		}
+	//remove the currently bound vertex array object
+	glBindVertexArray( 0);
+
+	CHECK_GL_ERRORS 
+}
+
 //display function
 void OnRender() {
 
@@ -940,7 +1098,10 @@ void OnRender() {
 		fps = (totalFrames/ elapsedTime)*1000 ;
 		startTime = newTime;
 		totalFrames=0;
-		sprintf_s(info, "FPS: %3.2f, Frame time (GLUT): %3.4f msecs, Frame time (QP): %3.3f, TF Time: %3.3f", fps, frameTime, frameTimeQP, delta_time);
+		sprintf_s(info, "FPS: %3.2f, Frame time (QP): %3.3f, TF Time: %3.3f, CPU Time: %3.3f msecs/step (%s, %s, %d iterations), Self collision: %3.3f msecs, %d contacts", 
+			fps, frameTimeQP, delta_time, clothSolver.GetStepTime(), bUseCPU?"CPU":"GPU", 
+			ClothSolver::GetSolverName(clothSolver.GetSolver()), clothSolver.GetIterations(),
+			clothCollision.GetResolveTime(), clothCollision.GetTotalContacts());
 	}
 
 	glutSetWindowTitle(info);
@@ -970,8 +1131,14 @@ void OnRender() {
 	//draw ellipsoids
 	DrawSphere(mP*(mMV*ellipsoid));
 
+	//draw the other colliders
+	DrawColliders();
+
 	//deform and render cloth 
-	RenderGPU_TF(); 
+	if(bUseCPU)
+		RenderCPU();
+	else
+		RenderGPU_TF(); 
 
 	//swap back and front buffers to display the result on screen
 	glutSwapBuffers();
@@ -979,6 +1146,7 @@ void OnRender() {
 
 //delete all allocated objects
 void OnShutdown() {
+	picker.Destroy();
 	X.clear();
 	X_last.clear();
 	F.clear();
@@ -996,6 +1164,7 @@ void OnShutdown() {
 	glDeleteVertexArrays(1, &clothVAOID);
 	glDeleteVertexArrays(1, &gridVAOID);
 	glDeleteVertexArrays(1, &sphereVAOID);
+	glDeleteVertexArrays(1, &cubeVAOID);
 
 	glDeleteBuffers( 1, &gridVBOVerticesID);
 	glDeleteBuffers( 1, &gridVBOIndicesID);
@@ -1003,6 +1172,8 @@ void OnShutdown() {
 	glDeleteBuffers( 1, &clothVBOIndicesID);
 	glDeleteBuffers( 1, &sphereVerticesID);
 	glDeleteBuffers( 1, &sphereIndicesID);
+	glDeleteBuffers( 1, &cubeVerticesID);
+	glDeleteBuffers( 1, &cubeIndicesID);
 
     glDeleteBuffers( 2, vboID_Pos);
 	glDeleteBuffers( 2, vboID_PrePos);
@@ -1024,12 +1195,45 @@ void OnIdle() {
 void OnKey(unsigned char key, int , int) {
 	switch(key) {
 		case 'm':	bDisplayMasses=!bDisplayMasses;	break;
+		case 'c':
+			//continue from the current GPU state when switching to the CPU
+			bUseCPU=!bUseCPU;
+			if(bUseCPU)
+				ReadBackGPU();
+			printf("Simulating on the %s\n", bUseCPU?"CPU":"GPU");
+			break;
+		case 's':
+			clothCollision.SetSelfCollision(!clothCollision.GetSelfCollision());
+			printf("Self collision %s\n", clothCollision.GetSelfCollision()?"enabled":"disabled");
+			break;
+		case 'x': {
+			//cycle the CPU solvers, the XPBD solvers take one step per frame
+			SolverType type = SolverType((clothSolver.GetSolver()+1)%TOTAL_SOLVERS);
+			clothSolver.SetSolver(type);
+			clothSolver.SetParameters(type==SOLVER_SPRINGS ? timeStep : timeStep*NUM_ITER, gravity, DEFAULT_DAMPING);
+			printf("CPU solver: %s\n", ClothSolver::GetSolverName(type));
+		} break;
+		case '+':
+		case '-':
+			clothSolver.SetIterations(clothSolver.GetIterations() + (key=='+' ? 1 : -1));
+			printf("XPBD iterations: %d\n", clothSolver.GetIterations());
+			break;
 	}
 
 	glutPostRedisplay();
 }
 
 int main(int argc, char** argv) {
+	//optional cloth resolution, e.g. "TransformFeedbackClothCollision 255 255"
+	if(argc>2) {
+		numX = max(2, min(atoi(argv[1]), MAX_CLOTH_SIZE));
+		numY = max(2, min(atoi(argv[2]), MAX_CLOTH_SIZE));
+		total_points = (numX+1)*(numY+1);
+		//the masses hide the cloth at high resolutions
+		bDisplayMasses = (numX*numY <= 64*64);
+	}
+	printf("Cloth resolution: %dx%d\n", numX, numY);
+
 	//freeglut initialization calls
 	glutInit(&argc, argv);
 	glutInitContextVersion(3,3);
@@ -13,6 +13,8 @@ uniform vec2  inv_cloth_size;					//size of a single patch in world space
 uniform vec2  step;								//delta texture size
 uniform int texsize_x;							//size of position texture
 uniform int texsize_y;							
+uniform int drag_index;							//vertex held by the mouse, -1 if none
+uniform vec3 drag_position;						//position the vertex is held at
 
 //elapsed time, spring and damping constants
 uniform float dt, ksStr, ksShr, ksBnd, 
@@ -22,6 +24,16 @@ uniform mat4  ellipsoid_xform;		//ellipsoid's transform
 uniform mat4  inv_ellipsoid;		//inverse of the ellipsoid's transform
 uniform vec4  ellipsoid;			//(center in xyz, radius in w) of ellipsoid
 
+//collider types and the collider list, two vec4s per collider with the type in
+//the w component of the second one (see ClothCollision.h)
+const int MAX_COLLIDERS = 8;
+const int COLLIDER_SPHERE = 0;
+const int COLLIDER_CAPSULE = 1;
+const int COLLIDER_BOX = 2;
+const int COLLIDER_PLANE = 3;
+uniform vec4 colliders[2*MAX_COLLIDERS];
+uniform int num_colliders;
+
 //force due to gravity
 uniform vec3 gravity;
  
@@ -103,6 +115,29 @@ void planeCollision(inout vec3 x,  vec4 plane) {
 		 x += plane.xyz*-dist;
 	 }
 }
+
+//function for collision resolution of a capsule with a given vertex x
+//it is a sphere collision with the closest point on the capsule axis
+void capsuleCollision(inout vec3 x, vec3 p0, vec3 p1, float radius) {
+	vec3 axis = p1 - p0;
+	float s = clamp(dot(x - p0, axis) / max(dot(axis, axis), 1e-6), 0.0, 1.0);
+	sphereCollision(x, vec4(p0 + axis*s, radius));
+}
+
+//function for collision resolution of an axis aligned box with a given vertex x
+//the vertex is pushed out through the face of least penetration
+void boxCollision(inout vec3 x, vec3 center, vec3 halfExtents) {
+	vec3 local = x - center;
+	vec3 depth = halfExtents - abs(local);
+	if(all(greaterThan(depth, vec3(0)))) {
+		if(depth.x < depth.y && depth.x < depth.z)
+			x.x += (local.x < 0) ? -depth.x : depth.x;
+		else if(depth.y < depth.z)
+			x.y += (local.y < 0) ? -depth.y : depth.y;
+		else
+			x.z += (local.z < 0) ? -depth.z : depth.z;
+	}
+}
  
 void main() 
 {  
@@ -180,14 +215,20 @@ void main()
 	//collision with floor replaced with the plane collision
 	//pos.y=max(0, pos.y);
 
-	//collision with plane
-	//planeCollision(pos, vec4(0,1,0,0));
-
-	//collision with sphere
-	//sphereCollision(pos, vec4(0,2,0,1)) ;
-
-	//collision with box
-	///boxCollision(pos, pos_old, vec3(0,0,0), vec3(1,1,1));
+	//collision with the list of colliders
+	for(int i=0;i<num_colliders;i++) {
+		vec4 a = colliders[2*i];
+		vec4 b = colliders[2*i+1];
+		int type = int(b.w);
+		if(type == COLLIDER_SPHERE)
+			sphereCollision(pos, a);
+		else if(type == COLLIDER_CAPSULE)
+			capsuleCollision(pos, a.xyz, b.xyz, a.w);
+		else if(type == COLLIDER_BOX)
+			boxCollision(pos, a.xyz, b.xyz);
+		else if(type == COLLIDER_PLANE)
+			planeCollision(pos, a);
+	}
 
 	
 	//apply collision to the ellipsoid	
@@ -224,6 +265,12 @@ void main()
 					   //removing this will cause points to continuously popup at the collision
 	}
 	
+	//the vertex dragged with the mouse is held at the drag position
+	if(index == drag_index) {
+		pos = drag_position;
+		pos_old = drag_position;
+	}
+
 	//set the shader outputs and clip space position
 	out_position_mass = vec4(pos, m);	
 	out_prev_position = vec4(pos_old,m);			  
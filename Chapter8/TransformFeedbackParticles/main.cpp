@@ -5,12 +5,14 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include "../src/GLSLShader.h"
+#include "../src/ParticleSystem.h"
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <cassert>
+#include <cstdlib>
 
 using namespace std;
 #ifdef _WIN32
@@ -30,11 +32,13 @@ using namespace std;
 
 const int width = 1024, height = 1024;
 
-//max number of particles in the simulation
-const int TOTAL_PARTICLES = 10000;
+//default number of particles in the simulation, can be given on the command line
+const int DEFAULT_PARTICLES = 10000;
+int totalParticles = DEFAULT_PARTICLES;
 
-//total number of iterations for transform feedback
-const int NUM_ITER = 1;
+//seconds a particle lives on average, the emitter rates are set so that
+//the emitters fill the pool together
+const float PARTICLE_LIFE = 2.0f;
 
 //variables for camera transformation
 int oldX=0, oldY=0;
@@ -83,21 +87,20 @@ GLfloat vGray[] = { .25f, .25f, .25f, 1.0f };
 //delta time per frame for transform feedback
 float delta_time=0;
 
-//ping pong ids
-int readID=0, writeID = 1;
+//the particle engine and the emitters
+ParticleSystem particles;
+int fountainID, leftJetID, rightJetID;
 
-//buffer object ids for current and previous positions
-GLuint	vboID_Pos[2],
-		vboID_PrePos[2];
+//toggles back to front sorting of the CPU particles
+bool bSort = true;
 
-//vertex array object ids for update, render cycle 
-GLuint vaoUpdateID[2], vaoRenderID[2];
-GLuint vboID_Direction[2];
-size_t i=0;
+//the compact backend needs transform feedback objects and
+//glDrawTransformFeedback (GL_ARB_transform_feedback2 or OpenGL 4.0)
+bool bCompactSupported = false;
 
 //shaders for particle, passthrough and rendering
 GLSLShader	particleShader, passShader,
-			renderShader;
+			renderShader, compactShader;
 
 //timer query ids
 GLuint t_query, query;
@@ -110,115 +113,61 @@ GLuint gridVAOID, gridVBOVerticesID, gridVBOIndicesID;
 vector<glm::vec3> grid_vertices;
 vector<GLushort> grid_indices;
 
-//transform feedback id
-GLuint tfID;
-
-//current time
-float t=0; 
-
-const int HALF_RAND = (RAND_MAX / 2);
-
-//particle variables
-int max_life = 60;
-int	  emitterLife = max_life;
-int   emitterLifeVar = 15;
-
 //function to convert degrees to radians
 float DEGTORAD(const float f) {
 	return f*(float)M_PI/180.0f;
 }
 
-//emitter variables and variation for each particle
-float emitterYaw = DEGTORAD(0.0f);
-float emitterYawVar	= DEGTORAD(360.0f);
-float emitterPitch	= DEGTORAD(90.0f);
-float emitterPitchVar = DEGTORAD(40.0f);
-float emitterSpeed = 0.05f;
-float emitterSpeedVar = 0.01f;
-
-//pseudo random number generator
-float RandomNum()
+//sets up the emitters, the rates are scaled so that the pool is just full
+//when every emitter runs
+void CreateEmitters()
 {
-	int rn;
-	rn = rand();
-	return ((float)(rn - HALF_RAND) / (float)HALF_RAND);
+	float rate = totalParticles/(3*PARTICLE_LIFE);
+
+	//a fountain in the centre
+	Emitter fountain;
+	fountain.pitchVar = DEGTORAD(40.0f);
+	fountain.speed = 5.0f;
+	fountain.speedVar = 1.0f;
+	fountain.life = PARTICLE_LIFE*0.9f;
+	fountain.lifeVar = PARTICLE_LIFE*0.2f;
+	fountain.rate = rate;
+	fountain.force = glm::vec3(0,-5,0);
+	fountainID = particles.AddEmitter(fountain);
+
+	//two jets aiming at each other
+	Emitter jet;
+	jet.position = glm::vec3(-4,0.5f,0);
+	jet.yaw = DEGTORAD(-90.0f);
+	jet.yawVar = DEGTORAD(20.0f);
+	jet.pitch = DEGTORAD(45.0f);
+	jet.pitchVar = DEGTORAD(10.0f);
+	jet.speed = 6.0f;
+	jet.speedVar = 0.5f;
+	jet.life = PARTICLE_LIFE*0.9f;
+	jet.lifeVar = PARTICLE_LIFE*0.2f;
+	jet.rate = rate;
+	jet.force = glm::vec3(0,-9.8f,0);
+	leftJetID = particles.AddEmitter(jet);
+
+	jet.position = glm::vec3(4,0.5f,0);
+	jet.yaw = DEGTORAD(90.0f);
+	rightJetID = particles.AddEmitter(jet);
 }
 
-//converts a given pitch and yaw value to a unit direction vector 
-void RotationToDirection(float pitch,float yaw,glm::vec3 *direction)
+//creates the particle pool on the given backend. The GPU backends relink
+//their particle shader to capture its outputs.
+void CreateParticles(ParticleBackend backend)
 {
-	direction->x = -sin(yaw) * cos(pitch);
-	direction->y = sin(pitch);
-	direction->z = cos(pitch) * cos(yaw);
+	GLSLShader& shader = (backend == PARTICLES_GPU_COMPACT) ? compactShader : particleShader;
+	particles.Init(totalParticles, backend, shader.GetProgram());
+	particles.SetCollisionPlane(glm::vec4(0,1,0,0), 0.5f);
+	CHECK_GL_ERRORS
 }
 
-//creates buffer objects for particles
+//creates buffer objects for the grid
 void createVBO()
 {
-	//fill the vertices
-	int count = 0;
-
-    // create vertex array objects
-	glGenVertexArrays(2, vaoUpdateID);
-	glGenVertexArrays(2, vaoRenderID);
-
-	// create buffer objects
-	glGenBuffers( 2, vboID_Pos);
-	glGenBuffers( 2, vboID_PrePos);
-  	glGenBuffers( 2, vboID_Direction);
-
-	//set update vao
-	for(int i=0;i<2;i++) {
-		glBindVertexArray(vaoUpdateID[i]);
-		//pass current positions 
-		glBindBuffer( GL_ARRAY_BUFFER, vboID_Pos[i]);
-		glBufferData( GL_ARRAY_BUFFER, TOTAL_PARTICLES* sizeof(glm::vec4), 0, GL_DYNAMIC_COPY);
-
-		//xyz -> position
-		//w -> speed
-		//enable vertex attribute attribute
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0,  4, GL_FLOAT, GL_FALSE, 0, 0);
-
-		CHECK_GL_ERRORS
-
-		//pass previous positions 
-		glBindBuffer( GL_ARRAY_BUFFER, vboID_PrePos[i]);
-		glBufferData( GL_ARRAY_BUFFER, TOTAL_PARTICLES*sizeof(glm::vec4), 0, GL_DYNAMIC_COPY);
-
-		//xyz -> previous position
-		//w -> life
-		//enable vertex attribute attribute
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1,  4, GL_FLOAT, GL_FALSE, 0,0);
-
-		CHECK_GL_ERRORS;
-
-		//xyz -> initial direction
-		//w -> life
-		//pass initial particle directions 
-		glBindBuffer( GL_ARRAY_BUFFER, vboID_Direction[i]);
-		glBufferData( GL_ARRAY_BUFFER, TOTAL_PARTICLES*sizeof(glm::vec4), 0, GL_DYNAMIC_COPY);
-
-		//enable vertex attribute attribute
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2,  4, GL_FLOAT, GL_FALSE, 0,0);
-
-	}
-
-	CHECK_GL_ERRORS;
-
-	//setup the render vao which simply uses the position buffer object we filled earlier
-	for(int i=0;i<2;i++) {
-		glBindVertexArray(vaoRenderID[i]);
-		glBindBuffer( GL_ARRAY_BUFFER, vboID_Pos[i]);
-		//enable vertex attribute array
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0,  4, GL_FLOAT, GL_FALSE, 0, 0);
-	}
-
-	glBindVertexArray(0);
-
 	//setup the grid vertices
 	for(int i=-GRID_SIZE;i<=GRID_SIZE;i++)
 	{
@@ -261,6 +210,27 @@ void createVBO()
 }
 
 
+//keyboard event handler
+void OnKey(unsigned char key, int x, int y)
+{
+	switch(key) {
+		//cycle through the CPU and the GPU backends
+		case 'b': {
+			ParticleBackend backend = ParticleBackend((particles.GetBackend() + 1) % TOTAL_BACKENDS);
+			if(backend == PARTICLES_GPU_COMPACT && !bCompactSupported)
+				backend = ParticleBackend((backend + 1) % TOTAL_BACKENDS);
+			CreateParticles(backend);
+			printf("Simulating %d particles on the %s backend\n", particles.GetCapacity(), ParticleSystem::GetBackendName(particles.GetBackend()));
+		} break;
+
+		//toggle depth sorting of the CPU particles
+		case 's':
+			bSort = !bSort;
+			break;
+	}
+	glutPostRedisplay();
+}
+
 void OnMouseDown(int button, int s, int x, int y)
 {
 	if (s == GLUT_DOWN)
@@ -307,12 +277,10 @@ void DrawGrid()
 //use the render shader which uses the interpolated colour from the vertex shader as fragment colour
 void RenderParticles()
 {
-	glBindVertexArray(vaoRenderID[readID]);
 	renderShader.Use();
 		glUniformMatrix4fv(renderShader("MVP"), 1, GL_FALSE, glm::value_ptr(mMVP));
-			glDrawArrays(GL_POINTS, 0, TOTAL_PARTICLES);
+			particles.Draw();
 	renderShader.UnUse();
-	glBindVertexArray(0);
 }
 
 void InitGL() {
@@ -336,22 +304,20 @@ void InitGL() {
 	//setup shader loading
 	particleShader.LoadFromFile(GL_VERTEX_SHADER,"shaders/Particle.vert");
 
+	//the compact update drops the dead particles in a geometry shader
+	compactShader.LoadFromFile(GL_VERTEX_SHADER,"shaders/ParticleCompact.vert");
+	compactShader.LoadFromFile(GL_GEOMETRY_SHADER,"shaders/ParticleCompact.geom");
+
 	renderShader.LoadFromFile(GL_VERTEX_SHADER,"shaders/Render.vert");
 	renderShader.LoadFromFile(GL_FRAGMENT_SHADER,"shaders/Render.frag");
 
 	passShader.LoadFromFile(GL_VERTEX_SHADER,"shaders/Passthrough.vert");
 	passShader.LoadFromFile(GL_FRAGMENT_SHADER,"shaders/Passthrough.frag");
 
-	//compile and link particle shader
+	//compile and link particle shader, the particle engine looks up the
+	//uniforms itself after it has set up the transform feedback outputs
 	particleShader.CreateAndLinkProgram();
-	particleShader.Use();
-		//add attribute and uniform locations
-		particleShader.AddAttribute("position");
-		particleShader.AddAttribute("prev_position");
-		particleShader.AddAttribute("direction");
-		particleShader.AddUniform("MVP");
-		particleShader.AddUniform("time");
-	particleShader.UnUse();
+	compactShader.CreateAndLinkProgram();
 
 	//compile and link render shader
 	renderShader.CreateAndLinkProgram();
@@ -377,14 +343,9 @@ void InitGL() {
 	//create vbo
 	createVBO();
 
-	//setup transform feedback attributes
-	glGenTransformFeedbacks(1, &tfID);
-	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfID);
-	//pass the vertex shader outputs for transform feedback
-	const char* varying_names[]={"out_position", "out_prev_position", "out_direction"};
-	glTransformFeedbackVaryings(particleShader.GetProgram(), 3, varying_names, GL_SEPARATE_ATTRIBS);
-	//relink the particle shader program
-	glLinkProgram(particleShader.GetProgram());
+	//setup the emitters and the particle pool
+	CreateEmitters();
+	CreateParticles(bCompactSupported ? PARTICLES_GPU_COMPACT : PARTICLES_GPU);
 
 	//set the particle size
 	glPointSize(pointSize); 
@@ -400,56 +361,28 @@ void OnReshape(int nw, int nh) {
   
 }
 
-//update the particle position on GPU
-void UpdateParticlesGPU() {
-	//get current elapsed time
-	t = (float)glutGet(GLUT_ELAPSED_TIME)/1000.0f;
-	
-	//set the particle shader
-	particleShader.Use();
-		//pass shader uniforms
-		glUniformMatrix4fv(particleShader("MVP"), 1, GL_FALSE, glm::value_ptr(mMVP));
-		glUniform1f(particleShader("time"), t);
-		CHECK_GL_ERRORS
-		//run the iteration loop
-		for(int i=0;i<NUM_ITER;i++) {
-			//set the update vertex array object
-			glBindVertexArray( vaoUpdateID[readID]);
-				//bind transform feedback buffers
-				//index 0 -> current position
-				//index 1 -> previous position
-				//index 2 -> particle direction
-				glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vboID_Pos[writeID]);
-				glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, vboID_PrePos[writeID]);
-				glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 2, vboID_Direction[writeID]);
-				//disable rasterizer
-				glEnable(GL_RASTERIZER_DISCARD);    
-					//run hardware timer query
-					glBeginQuery(GL_TIME_ELAPSED,t_query);
-						//initiate transform feedback
-						glBeginTransformFeedback(GL_POINTS);
-							//render points, this call pushes all attributes to GPU
-							glDrawArrays(GL_POINTS, 0, TOTAL_PARTICLES);
-						//end transform feedback
-						glEndTransformFeedback();
-					//end timer query
-					glEndQuery(GL_TIME_ELAPSED);
-					glFlush();
-				//enable rasterizer
-				glDisable(GL_RASTERIZER_DISCARD);
-
-			//swap read/write pathways
-			int tmp = readID;
-			readID  = writeID;
-			writeID = tmp;
-		}
+//update the particles on the current backend
+void UpdateParticles(float dt) {
+	//the simulation is not stable for very long frames
+	dt = min(dt, 0.05f);
+
+	if(particles.GetBackend() != PARTICLES_CPU) {
+		//run hardware timer query around the transform feedback pass
+		glBeginQuery(GL_TIME_ELAPSED,t_query);
+			particles.Update(dt);
+		glEndQuery(GL_TIME_ELAPSED);
 		CHECK_GL_ERRORS
 		// get the query result
 		glGetQueryObjectui64v(t_query, GL_QUERY_RESULT, &elapsed_time);
 		//get the transform feedback time
 		delta_time = elapsed_time / 1000000.0f;
-	//remove the particle shader
-	particleShader.UnUse();
+	} else {
+		particles.Update(dt);
+		//sort back to front for the over compositing
+		if(bSort)
+			particles.Sort(mMV);
+		delta_time = particles.GetUpdateTime() + particles.GetSortTime();
+	}
 
 	CHECK_GL_ERRORS
 }
@@ -480,7 +413,10 @@ void OnRender() {
 		fps = (totalFrames/ elapsedTime)*1000 ;
 		startTime = newTime;
 		totalFrames=0;
-		sprintf_s(info, "FPS: %3.2f, Frame time (GLUT): %3.4f msecs, Frame time (QP): %3.3f, TF Time: %3.3f", fps , frameTime, frameTimeQP, delta_time);
+		if(particles.GetBackend() != PARTICLES_CPU)
+			sprintf_s(info, "FPS: %3.2f, Frame time (QP): %3.3f, %s particles: %d, TF Time: %3.3f", fps, frameTimeQP, ParticleSystem::GetBackendName(particles.GetBackend()), particles.GetLiveCount(), delta_time);
+		else
+			sprintf_s(info, "FPS: %3.2f, Frame time (QP): %3.3f, CPU particles: %d, Update: %3.3f msecs, Sort (%s): %3.3f msecs", fps, frameTimeQP, particles.GetLiveCount(), particles.GetUpdateTime(), bSort ? "on" : "off", particles.GetSortTime());
 	}
 	
 	glutSetWindowTitle(info);
@@ -497,8 +433,8 @@ void OnRender() {
 	//draw grid
  	DrawGrid();
 
-	//update particles on GPU
-	UpdateParticlesGPU();
+	//update particles with the real frame time
+	UpdateParticles((float)frameTimeQP/1000.0f);
 
 	//render particles
 	RenderParticles();
@@ -513,20 +449,15 @@ void OnShutdown() {
 	glDeleteQueries(1, &query);
 	glDeleteQueries(1, &t_query);
 
-	glDeleteVertexArrays(2, vaoUpdateID);
-	glDeleteVertexArrays(2, vaoRenderID);
+	particles.Destroy();
 
 	glDeleteVertexArrays(1, &gridVAOID);
 	glDeleteBuffers( 1, &gridVBOVerticesID);
 	glDeleteBuffers( 1, &gridVBOIndicesID);
 
-    glDeleteBuffers( 2, vboID_Pos);
-	glDeleteBuffers( 2, vboID_PrePos);
-	glDeleteBuffers( 2, vboID_Direction);
-
-	glDeleteTransformFeedbacks(1, &tfID);
 	renderShader.DeleteShaderProgram();
 	particleShader.DeleteShaderProgram();
+	compactShader.DeleteShaderProgram();
 	passShader.DeleteShaderProgram();
 
 	printf("Shutdown successful.");
@@ -539,6 +470,10 @@ void OnIdle() {
 int main(int argc, char** argv) {
 	//freeglut initialization calls
 	glutInit(&argc, argv);
+
+	//optional number of particles
+	if(argc > 1)
+		totalParticles = max(1, atoi(argv[1]));
 	glutInitContextVersion(3,3);
 	glutInitContextProfile(GLUT_CORE_PROFILE);
 	glutInitContextFlags(GLUT_FORWARD_COMPATIBLE);
@@ -554,6 +489,7 @@ int main(int argc, char** argv) {
 
 	glutMouseFunc(OnMouseDown);
 	glutMotionFunc(OnMouseMove);
+	glutKeyboardFunc(OnKey);
 	glutCloseFunc(OnShutdown);
 
 	//glew initialization
@@ -573,10 +509,10 @@ int main(int argc, char** argv) {
 	} else {
 		puts("OpenGL 3.3 supported.");
 	}
-	if(!glewIsExtensionSupported("GL_ARB_transform_feedback2"))
+	bCompactSupported = GLEW_ARB_transform_feedback2 || GLEW_VERSION_4_0;
+	if(!bCompactSupported)
 	{
-		puts("Your hardware does not support a required extension [GL_ARB_transform_feedback2].");
-		exit(EXIT_FAILURE);
+		puts("GL_ARB_transform_feedback2 not supported, the compact GPU backend is disabled.");
 	} else {
 		puts("GL_ARB_transform_feedback2 supported.");
 	}
@@ -3,41 +3,31 @@ precision highp float;
 
 #extension EXT_gpu_shader4 : require
 
-layout( location = 0 )  in vec4 position;           //xyz pos, w speed
-layout( location = 1 )  in vec4 prev_position;      //xyz prevPos, w life
-layout( location = 2 )  in vec4 direction;			//xyz direction, w 0
- 
-uniform mat4 MVP; //combine modelview projection matrix
- 
-uniform float time; //current time
-   
-//constants
-const float PI = 3.14159;
-const float TWO_PI = 2*PI;
-const float PI_BY_2 = PI*0.5;
-const float PI_BY_4 = PI_BY_2*0.5;
- 
+layout( location = 0 )  in vec4 position;           //xyz pos, w age
+layout( location = 1 )  in vec4 velocity;           //xyz velocity, w life
+
+//must match MAX_EMITTERS in ParticleSystem.h
+const int MAX_EMITTERS = 8;
+
+uniform float dt;			//time step in seconds
+uniform uint seed;			//changes every frame
+
+//the collision plane (normal, distance) and the bounce damping
+uniform vec4 plane;
+uniform float restitution;
+
+//emitter parameters
+uniform int num_emitters;
+uniform vec4 emitter_position[MAX_EMITTERS];	//xyz position
+uniform vec4 emitter_force[MAX_EMITTERS];		//xyz acceleration
+uniform vec4 emitter_angles[MAX_EMITTERS];		//yaw, yaw variation, pitch, pitch variation
+uniform vec4 emitter_motion[MAX_EMITTERS];		//speed, speed variation, life, life variation
+uniform ivec4 emitter_range[MAX_EMITTERS];		//first particle, particles, spawn window start, spawn window size
+
 //shader outputs
 out vec4 out_position;
-out	vec4 out_prev_position;
-out vec4 out_direction;
-
-const float DAMPING_COEFFICIENT =  0.9995;			//velocity damping coefficient
-const vec3 emitterForce = vec3(0.0f,-0.001f, 0.0f);	//the default force direction
-const vec4 collidor = vec4(0,1,0,0);				//the colliding plane
-const vec3 emitterPos = vec3(0);					//current emitter position
-
-//emitter orientation parameters
-float emitterYaw = (0.0f);
-float emitterPitch	= PI_BY_2;
-float emitterSpeed = 0.05f;
-int	  emitterLife = 60;
-
-//adjustment for each individual particle
-float emitterYawVar	= TWO_PI;
-float emitterPitchVar = PI_BY_4;
-float emitterSpeedVar = 0.01f;
-int   emitterLifeVar = 15;
+out vec4 out_velocity;
+out vec4 out_render;
 
 //for pseudo random number
 const float UINT_MAX = 4294967295.0;
@@ -51,7 +41,7 @@ uint randhash(uint seed)
     i+=(i<<5u)^(i>>12u);
     return i;
 }
-//returns a pseudo random number between 0 and 1
+//returns a pseudo random number between 0 and b
 float randhashf(uint seed, float b)
 {
     return float(b * randhash(seed)) / UINT_MAX;
@@ -66,48 +56,60 @@ void RotationToDirection(float pitch, float yaw, out vec3 direction)
 	direction.z = cos(pitch) * cos(yaw);
 }
 
- 
-void main() 
-{    
-	//store current and previous position of particle
-	vec3 prevPos = prev_position.xyz;
-	int life = int(prev_position.w);
-	vec3 pos  = position.xyz;
-
-	//also store the current speed and direction of particle
-	float speed = position.w;
-	vec3 dir = direction.xyz; 
-
-	//if life is > 0, we can simulate the particle
-	if(life > 0) {
-		prevPos = pos;
-		pos += dir*speed; 
-		if(dot(pos+emitterPos, collidor.xyz)+ collidor.w <0) {			 
-			dir = reflect(dir, collidor.xyz);
-			speed *= DAMPING_COEFFICIENT;
-		}  
-		dir += emitterForce;
-		life--;
-	
-	//otherwise we spawn a new particle using the (particle id + current time) as seed
-	//we assign this particle a random life using the emitters life variation as limit
-	//similarly for other properties of particle like yaw, pitch, speed etc
-	}  else { 
-		uint seed =   uint(time + gl_VertexID); 
-		life = emitterLife + int(randhashf(seed++, emitterLifeVar));    
-        float yaw = emitterYaw + (randhashf(seed++, emitterYawVar ));
-		float pitch = emitterPitch + randhashf(seed++, emitterPitchVar);
-		RotationToDirection(pitch, yaw, dir);		 
-		float nspeed = emitterSpeed + (randhashf(seed++, emitterSpeedVar ));
-		dir *= nspeed;  
-		pos = emitterPos;
-		prevPos = emitterPos; 
-		speed = 1;
-	}  
-
-	//we then store the outputs and write to gl_Position 
-	out_position = vec4(pos, speed);	
-	out_prev_position = vec4(prevPos, life);		
-	out_direction = vec4(dir, 0);
-	gl_Position = MVP*vec4(pos, 1); 
-}
\ No newline at end of file
+void main()
+{
+	vec3 pos = position.xyz;
+	float age = position.w;
+	vec3 vel = velocity.xyz;
+	float life = velocity.w;
+
+	//find the emitter owning this particle
+	int e = -1;
+	int local = 0;
+	for(int i=0;i<num_emitters;i++) {
+		if(gl_VertexID >= emitter_range[i].x && gl_VertexID < emitter_range[i].x + emitter_range[i].y) {
+			e = i;
+			local = gl_VertexID - emitter_range[i].x;
+		}
+	}
+
+	age += dt;
+
+	//if the particle is alive, we simulate it
+	if(age < life) {
+		vel += emitter_force[e].xyz*dt;
+		pos += vel*dt;
+
+		//bounce off the collision plane
+		float d = dot(pos, plane.xyz) + plane.w;
+		if(d < 0) {
+			float vn = dot(vel, plane.xyz);
+			if(vn < 0)
+				vel -= (1 + restitution)*vn*plane.xyz;
+			pos -= d*plane.xyz;
+		}
+
+	//otherwise we respawn it if it lies in the spawn window of its emitter,
+	//the window advances at the spawn rate of the emitter
+	} else if(e >= 0) {
+		int offset = local - emitter_range[e].z;
+		if(offset < 0)
+			offset += emitter_range[e].y;
+		if(offset < emitter_range[e].w) {
+			uint s = randhash(seed ^ uint(gl_VertexID));
+			float yaw = emitter_angles[e].x + randhashf(s++, emitter_angles[e].y);
+			float pitch = emitter_angles[e].z + randhashf(s++, emitter_angles[e].w);
+			float speed = emitter_motion[e].x + randhashf(s++, emitter_motion[e].y);
+			RotationToDirection(pitch, yaw, vel);
+			vel *= speed;
+			pos = emitter_position[e].xyz;
+			age = 0;
+			life = emitter_motion[e].z + randhashf(s++, emitter_motion[e].w);
+		}
+	}
+
+	//store the outputs, dead particles get a normalized age above 1
+	out_position = vec4(pos, age);
+	out_velocity = vec4(vel, life);
+	out_render = vec4(pos, (age < life) ? age/life : 2.0);
+}
@@ -0,0 +1,108 @@
+#version 330 core
+precision highp float;
+
+#extension EXT_gpu_shader4 : require
+
+layout( location = 0 )  in vec4 position;           //xyz pos, w normalized age
+layout( location = 1 )  in vec4 velocity;           //xyz velocity, w life
+layout( location = 2 )  in float emitter;           //index of the emitter
+
+//must match MAX_EMITTERS in ParticleSystem.h
+const int MAX_EMITTERS = 8;
+
+uniform float dt;			//time step in seconds
+uniform uint seed;			//changes every frame
+
+//the collision plane (normal, distance) and the bounce damping
+uniform vec4 plane;
+uniform float restitution;
+
+//emitter parameters
+uniform int num_emitters;
+uniform vec4 emitter_position[MAX_EMITTERS];	//xyz position
+uniform vec4 emitter_force[MAX_EMITTERS];		//xyz acceleration
+uniform vec4 emitter_angles[MAX_EMITTERS];		//yaw, yaw variation, pitch, pitch variation
+uniform vec4 emitter_motion[MAX_EMITTERS];		//speed, speed variation, life, life variation
+uniform ivec4 emitter_range[MAX_EMITTERS];		//first vertex and number of vertices in the spawn draw
+
+//0 when the live particles are updated, 1 when new particles are spawned
+uniform int spawn;
+
+//outputs to the geometry shader, which drops the dead particles
+out vec4 vPosition;
+out vec4 vVelocity;
+out float vEmitter;
+
+//for pseudo random number
+const float UINT_MAX = 4294967295.0;
+
+//hashing function for pseudo random number
+uint randhash(uint seed)
+{
+    uint i=(seed^12345391u)*2654435769u;
+    i^=(i<<6u)^(i>>26u);
+    i*=2654435769u;
+    i+=(i<<5u)^(i>>12u);
+    return i;
+}
+//returns a pseudo random number between 0 and b
+float randhashf(uint seed, float b)
+{
+    return float(b * randhash(seed)) / UINT_MAX;
+}
+
+//given a pitch and yaw value, this function returns a direction
+//vector on the unit sphere
+void RotationToDirection(float pitch, float yaw, out vec3 direction)
+{
+	direction.x = -sin(yaw) * cos(pitch);
+	direction.y = sin(pitch);
+	direction.z = cos(pitch) * cos(yaw);
+}
+
+void main()
+{
+	if(spawn == 0) {
+		//simulate a live particle of the last frame
+		int e = int(emitter);
+		vec3 pos = position.xyz;
+		vec3 vel = velocity.xyz;
+		float life = velocity.w;
+		float age = position.w*life + dt;
+
+		vel += emitter_force[e].xyz*dt;
+		pos += vel*dt;
+
+		//bounce off the collision plane
+		float d = dot(pos, plane.xyz) + plane.w;
+		if(d < 0) {
+			float vn = dot(vel, plane.xyz);
+			if(vn < 0)
+				vel -= (1 + restitution)*vn*plane.xyz;
+			pos -= d*plane.xyz;
+		}
+
+		vPosition = vec4(pos, age/life);
+		vVelocity = vec4(vel, life);
+		vEmitter = emitter;
+	} else {
+		//find the emitter spawning this particle
+		int e = 0;
+		for(int i=0;i<num_emitters;i++) {
+			if(gl_VertexID >= emitter_range[i].x && gl_VertexID < emitter_range[i].x + emitter_range[i].y)
+				e = i;
+		}
+
+		uint s = randhash(seed ^ uint(gl_VertexID));
+		float yaw = emitter_angles[e].x + randhashf(s++, emitter_angles[e].y);
+		float pitch = emitter_angles[e].z + randhashf(s++, emitter_angles[e].w);
+		float speed = emitter_motion[e].x + randhashf(s++, emitter_motion[e].y);
+		vec3 vel;
+		RotationToDirection(pitch, yaw, vel);
+		float life = emitter_motion[e].z + randhashf(s++, emitter_motion[e].w);
+
+		vPosition = vec4(emitter_position[e].xyz, 0);
+		vVelocity = vec4(vel*speed, max(life, 1e-4));
+		vEmitter = float(e);
+	}
+}
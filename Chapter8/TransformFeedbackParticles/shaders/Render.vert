@@ -1,7 +1,7 @@
 #version 330 core
 precision highp float;
 
-layout (location=0) in vec4 position;	//particle object space position
+layout (location=0) in vec4 position;	//xyz particle position, w normalized age
 
 uniform mat4 MVP;						//combine modelview projection matrix
 
@@ -14,11 +14,18 @@ const vec3 YELLOW = vec3(1,1,0);
 
 void main() 
 {  
+	//dead particles are moved outside the clip volume
+	if(position.w >= 1.0) {
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		color = vec4(0);
+		return;
+	}
+
 	//store the clip space position
 	gl_Position = MVP*vec4(position.xyz, 1.0);	
 	//get the t value for interpolation of the colour map colours 
-	//using the distance of the particle from the origin, if it is 
-	//3 or greater, the particle colour is changed to yellow
-	float t =  1.0- length(position.xyz)/3.0;	
-	color = vec4(mix(YELLOW, RED, t), t);
-}
\ No newline at end of file
+	//using the age of the particle, young particles are yellow and
+	//fade to red as they die
+	float t =  1.0 - position.w;	
+	color = vec4(mix(RED, YELLOW, t), t);
+}
@@ -0,0 +1,385 @@
+#include "ClothCollision.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//below this many particles the threads cost more than they save
+const int PARALLEL_THRESHOLD = 4096;
+
+//particles closer than this many thicknesses in the rest pose never collide
+const float EXCLUSION_FACTOR = 3.0f;
+
+//smallest triangle area and particle distance used to normalize directions
+const float MIN_LENGTH = 1e-6f;
+
+Collider SphereCollider(const glm::vec3& center, float radius) {
+	Collider c;
+	c.a = glm::vec4(center, radius);
+	c.b = glm::vec4(0, 0, 0, float(COLLIDER_SPHERE));
+	return c;
+}
+
+Collider CapsuleCollider(const glm::vec3& p0, const glm::vec3& p1, float radius) {
+	Collider c;
+	c.a = glm::vec4(p0, radius);
+	c.b = glm::vec4(p1, float(COLLIDER_CAPSULE));
+	return c;
+}
+
+Collider BoxCollider(const glm::vec3& center, const glm::vec3& halfExtents) {
+	Collider c;
+	c.a = glm::vec4(center, 0);
+	c.b = glm::vec4(halfExtents, float(COLLIDER_BOX));
+	return c;
+}
+
+Collider PlaneCollider(const glm::vec3& normal, float distance) {
+	Collider c;
+	c.a = glm::vec4(glm::normalize(normal), distance);
+	c.b = glm::vec4(0, 0, 0, float(COLLIDER_PLANE));
+	return c;
+}
+
+ClothCollision::ClothCollision(void)
+{
+	total = 0;
+	thickness = 0;
+	triangleReach = 0;
+	bSelfCollision = true;
+	bEllipsoid = false;
+	totalContacts = 0;
+	hashTime = 0;
+	resolveTime = 0;
+}
+
+ClothCollision::~ClothCollision(void)
+{
+}
+
+void ClothCollision::Init(const vector<glm::vec4>& X, const vector<unsigned int>& triangles, float thickness) {
+	total = int(X.size());
+	this->thickness = thickness;
+
+	rx.resize(total);
+	ry.resize(total);
+	rz.resize(total);
+	for(int i=0;i<total;i++) {
+		rx[i] = X[i].x;
+		ry[i] = X[i].y;
+		rz[i] = X[i].z;
+	}
+	this->triangles.assign(triangles.begin(), triangles.end());
+
+	//triangles are stored in the cell of their centroid. A particle closer
+	//than the thickness to a triangle is then at most one cell away from the
+	//centroid if the cells are larger than the edges plus the thickness.
+	//Both hashes use the same cells so that they can be searched together.
+	float maxEdge = 0;
+	int totalTriangles = int(triangles.size()/3);
+	for(int t=0;t<totalTriangles;t++) {
+		for(int k=0;k<3;k++) {
+			glm::vec3 d = glm::vec3(X[triangles[t*3+k]] - X[triangles[t*3+(k+1)%3]]);
+			maxEdge = max(maxEdge, glm::length(d));
+		}
+	}
+	//a triangle centroid is at most 2/3 of the longest edge away from the
+	//vertices, the reach leaves room for triangles stretched by a quarter
+	triangleReach = maxEdge*(2.0f/3.0f)*1.25f + thickness;
+	particleHash.SetCellSize(maxEdge + thickness);
+	particleHash.SetTableSize(total);
+	triangleHash.SetCellSize(maxEdge + thickness);
+	triangleHash.SetTableSize(totalTriangles);
+
+	particleEntries.resize(total);
+	particleItems.resize(total);
+	particleCells.resize(total);
+	for(int i=0;i<total;i++)
+		particleItems[i] = i;
+	triangleEntries.resize(totalTriangles);
+	triangleItems.resize(totalTriangles);
+	triangleCells.resize(totalTriangles);
+	for(int t=0;t<totalTriangles;t++)
+		triangleItems[t] = t;
+	triangleMin.resize(totalTriangles);
+	triangleMax.resize(totalTriangles);
+	corrections.assign(total, glm::vec3(0));
+}
+
+void ClothCollision::AddCollider(const Collider& collider) {
+	colliders.push_back(collider);
+}
+
+void ClothCollision::ClearColliders() {
+	colliders.clear();
+}
+
+const vector<Collider>& ClothCollision::GetColliders() const {
+	return colliders;
+}
+
+void ClothCollision::SetEllipsoid(const glm::mat4& xform) {
+	ellipsoid = xform;
+	invEllipsoid = glm::inverse(xform);
+	bEllipsoid = true;
+}
+
+void ClothCollision::SetSelfCollision(bool enable) {
+	bSelfCollision = enable;
+}
+
+bool ClothCollision::GetSelfCollision() const {
+	return bSelfCollision;
+}
+
+bool ClothCollision::IsRestNeighbor(int i, int j) const {
+	float dx = rx[i]-rx[j], dy = ry[i]-ry[j], dz = rz[i]-rz[j];
+	float exclusion = EXCLUSION_FACTOR*thickness;
+	return (dx*dx + dy*dy + dz*dz) < exclusion*exclusion;
+}
+
+void ClothCollision::BuildHashes(const float* px, const float* py, const float* pz) {
+	int totalTriangles = int(triangles.size()/3);
+
+	#pragma omp parallel for if(total >= PARALLEL_THRESHOLD)
+	for(int i=0;i<total;i++) {
+		particleCells[i] = particleHash.GetCell(glm::vec3(px[i], py[i], pz[i]));
+		particleEntries[i] = particleHash.Hash(particleCells[i]);
+	}
+	particleHash.Build(particleEntries, particleItems);
+
+	//the triangle bounds grown by the thickness are kept for early rejection
+	#pragma omp parallel for if(total >= PARALLEL_THRESHOLD)
+	for(int t=0;t<totalTriangles;t++) {
+		int a = triangles[t*3], b = triangles[t*3+1], c = triangles[t*3+2];
+		glm::vec3 pa(px[a], py[a], pz[a]), pb(px[b], py[b], pz[b]), pc(px[c], py[c], pz[c]);
+		triangleMin[t] = glm::min(pa, glm::min(pb, pc)) - glm::vec3(thickness);
+		triangleMax[t] = glm::max(pa, glm::max(pb, pc)) + glm::vec3(thickness);
+		triangleCells[t] = triangleHash.GetCell((pa + pb + pc)/3.0f);
+		triangleEntries[t] = triangleHash.Hash(triangleCells[t]);
+	}
+	triangleHash.Build(triangleEntries, triangleItems);
+}
+
+int ClothCollision::ComputeSelfCollisions(const float* px, const float* py, const float* pz,
+										  const float* ox, const float* oy, const float* oz, const float* invMass) {
+	const int* particles = particleHash.GetItems();
+	const int* tris = triangleHash.GetItems();
+	float thickness2 = thickness*thickness;
+	float cellSize = particleHash.GetCellSize();
+	float triangleReach2 = triangleReach*triangleReach;
+	int contacts = 0;
+
+	#pragma omp parallel for reduction(+:contacts) if(total >= PARALLEL_THRESHOLD)
+	for(int i=0;i<total;i++) {
+		corrections[i] = glm::vec3(0);
+		if(invMass[i] == 0)
+			continue;
+
+		glm::vec3 p(px[i], py[i], pz[i]);
+		glm::vec3 correction(0);
+		int count = 0;
+
+		//search the cells around the particle that are within reach of a
+		//contact. Different cells may share a table entry, so the cell of
+		//every close item is compared as well to count each contact once.
+		for(int z=-1;z<=1;z++)
+			for(int y=-1;y<=1;y++)
+				for(int x=-1;x<=1;x++) {
+					glm::ivec3 cell = particleCells[i] + glm::ivec3(x, y, z);
+
+					//distance from the particle to the cell
+					float dx = max(max(cell.x*cellSize - p.x, p.x - (cell.x+1)*cellSize), 0.0f);
+					float dy = max(max(cell.y*cellSize - p.y, p.y - (cell.y+1)*cellSize), 0.0f);
+					float dz = max(max(cell.z*cellSize - p.z, p.z - (cell.z+1)*cellSize), 0.0f);
+					float cellDist2 = dx*dx + dy*dy + dz*dz;
+					if(cellDist2 >= triangleReach2)
+						continue;
+
+					//particle-particle, only the cells closer than the thickness
+					int first = 0, last = 0;
+					if(cellDist2 < thickness2)
+						particleHash.GetRange(particleHash.Hash(cell), first, last);
+					for(int k=first;k<last;k++) {
+						int j = particles[k];
+						float ex = p.x - px[j], ey = p.y - py[j], ez = p.z - pz[j];
+						float dist2 = ex*ex + ey*ey + ez*ez;
+						if(dist2 >= thickness2 || dist2 < MIN_LENGTH*MIN_LENGTH || particleCells[j] != cell || IsRestNeighbor(i, j))
+							continue;
+						//split the correction by the inverse masses, this
+						//particle only applies its own share
+						float dist = sqrt(dist2);
+						float w = (thickness - dist)*invMass[i]/((invMass[i] + invMass[j])*dist);
+						correction += glm::vec3(ex, ey, ez)*w;
+						count++;
+					}
+
+					//particle-triangle
+					triangleHash.GetRange(triangleHash.Hash(cell), first, last);
+					for(int k=first;k<last;k++) {
+						int t = tris[k];
+						const glm::vec3& lo = triangleMin[t];
+						const glm::vec3& hi = triangleMax[t];
+						if(p.x < lo.x || p.y < lo.y || p.z < lo.z || p.x > hi.x || p.y > hi.y || p.z > hi.z || triangleCells[t] != cell)
+							continue;
+						int a = triangles[t*3], b = triangles[t*3+1], c = triangles[t*3+2];
+						if(a == i || b == i || c == i || IsRestNeighbor(i, a) || IsRestNeighbor(i, b) || IsRestNeighbor(i, c))
+							continue;
+
+						glm::vec3 pa(px[a], py[a], pz[a]);
+						glm::vec3 e1 = glm::vec3(px[b], py[b], pz[b]) - pa;
+						glm::vec3 e2 = glm::vec3(px[c], py[c], pz[c]) - pa;
+						glm::vec3 n = glm::cross(e1, e2);
+						float area = glm::length(n);
+						if(area < MIN_LENGTH)
+							continue;
+						n /= area;
+
+						//side of the triangle the particle was on in the last step
+						glm::vec3 oa(ox[a], oy[a], oz[a]);
+						glm::vec3 on = glm::cross(glm::vec3(ox[b], oy[b], oz[b]) - oa, glm::vec3(ox[c], oy[c], oz[c]) - oa);
+						float side = (glm::dot(glm::vec3(ox[i], oy[i], oz[i]) - oa, on) >= 0) ? 1.0f : -1.0f;
+
+						//signed distance to the triangle plane. A particle that
+						//crossed the plane within the last step is pushed back
+						//even if it is already further away than the thickness.
+						glm::vec3 ap = p - pa;
+						float d = glm::dot(ap, n);
+						if(fabs(d) >= thickness && d*side > 0)
+							continue;
+
+						//barycentric coordinates of the projection onto the plane
+						float d11 = glm::dot(e1, e1), d12 = glm::dot(e1, e2), d22 = glm::dot(e2, e2);
+						float dp1 = glm::dot(ap, e1), dp2 = glm::dot(ap, e2);
+						float denom = d11*d22 - d12*d12;
+						float v = (d22*dp1 - d12*dp2)/denom;
+						float w = (d11*dp2 - d12*dp1)/denom;
+						if(v < 0 || w < 0 || v + w > 1)
+							continue;
+
+						//push the particle back to the side it came from
+						correction += n*(side*thickness - d);
+						count++;
+					}
+				}
+
+		if(count > 0) {
+			corrections[i] = correction/float(count);
+			contacts += count;
+		}
+	}
+	return contacts;
+}
+
+void ClothCollision::ResolveColliders(glm::vec3& pos, glm::vec3& prev) const {
+	for(size_t c=0;c<colliders.size();c++) {
+		const glm::vec4& a = colliders[c].a;
+		const glm::vec4& b = colliders[c].b;
+		switch(int(b.w)) {
+			case COLLIDER_SPHERE: {
+				glm::vec3 delta = pos - glm::vec3(a);
+				float dist = glm::length(delta);
+				if(dist < a.w && dist > MIN_LENGTH)
+					pos = glm::vec3(a) + delta*(a.w/dist);
+			} break;
+
+			case COLLIDER_CAPSULE: {
+				//sphere collision with the closest point on the axis
+				glm::vec3 p0(a), axis = glm::vec3(b) - p0;
+				float s = glm::clamp(glm::dot(pos - p0, axis)/max(glm::dot(axis, axis), MIN_LENGTH), 0.0f, 1.0f);
+				glm::vec3 center = p0 + axis*s;
+				glm::vec3 delta = pos - center;
+				float dist = glm::length(delta);
+				if(dist < a.w && dist > MIN_LENGTH)
+					pos = center + delta*(a.w/dist);
+			} break;
+
+			case COLLIDER_BOX: {
+				//push out through the face of least penetration
+				glm::vec3 local = pos - glm::vec3(a);
+				glm::vec3 depth = glm::vec3(b) - glm::abs(local);
+				if(depth.x > 0 && depth.y > 0 && depth.z > 0) {
+					int axis = (depth.x < depth.y) ? ((depth.x < depth.z) ? 0 : 2) : ((depth.y < depth.z) ? 1 : 2);
+					pos[axis] += (local[axis] < 0) ? -depth[axis] : depth[axis];
+				}
+			} break;
+
+			case COLLIDER_PLANE: {
+				float dist = glm::dot(glm::vec3(a), pos) + a.w;
+				if(dist < 0)
+					pos -= glm::vec3(a)*dist;
+			} break;
+		}
+	}
+
+	if(bEllipsoid) {
+		//same as the mass spring shader, the penetration is computed in the
+		//ellipsoid object space and transformed back
+		glm::vec3 x0 = glm::vec3(invEllipsoid*glm::vec4(pos, 1));
+		float dist2 = glm::dot(x0, x0);
+		if(dist2 < 1 && dist2 > MIN_LENGTH) {
+			glm::vec3 delta0 = (1.0f - dist2)*x0/dist2;
+			glm::vec3 delta;
+			for(int k=0;k<3;k++) {
+				glm::vec3 transformInv(ellipsoid[0][k], ellipsoid[1][k], ellipsoid[2][k]);
+				transformInv /= glm::dot(transformInv, transformInv);
+				delta[k] = glm::dot(delta0, transformInv);
+			}
+			pos += delta;
+			prev = pos;
+		}
+	}
+}
+
+void ClothCollision::Resolve(float* px, float* py, float* pz, float* ox, float* oy, float* oz, const float* invMass) {
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+	totalContacts = 0;
+	if(bSelfCollision && total > 0) {
+		BuildHashes(px, py, pz);
+		hashTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+
+		totalContacts = ComputeSelfCollisions(px, py, pz, ox, oy, oz, invMass);
+	} else {
+		hashTime = 0;
+	}
+
+	//apply the self collision corrections, then the colliders which win
+	//over the cloth when both disagree
+	#pragma omp parallel for if(total >= PARALLEL_THRESHOLD)
+	for(int i=0;i<total;i++) {
+		if(invMass[i] == 0)
+			continue;
+		glm::vec3 pos(px[i], py[i], pz[i]);
+		glm::vec3 prev(ox[i], oy[i], oz[i]);
+		if(bSelfCollision) {
+			//remove the velocity along the correction so that contacts are
+			//inelastic, otherwise the pushes of stacked layers add energy
+			float length = glm::length(corrections[i]);
+			if(length > MIN_LENGTH) {
+				glm::vec3 n = corrections[i]/length;
+				pos += corrections[i];
+				prev += n*glm::dot(pos - prev, n);
+			}
+		}
+		ResolveColliders(pos, prev);
+		px[i] = pos.x; py[i] = pos.y; pz[i] = pos.z;
+		ox[i] = prev.x; oy[i] = prev.y; oz[i] = prev.z;
+	}
+
+	resolveTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+int ClothCollision::GetTotalContacts() const {
+	return totalContacts;
+}
+
+float ClothCollision::GetHashTime() const {
+	return hashTime;
+}
+
+float ClothCollision::GetResolveTime() const {
+	return resolveTime;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "SpatialHash.h"
+
+using namespace std;
+
+//collider types, must match the constants in the mass spring shader
+enum ColliderType {
+	COLLIDER_SPHERE = 0,
+	COLLIDER_CAPSULE,
+	COLLIDER_BOX,
+	COLLIDER_PLANE
+};
+
+//a collider is stored in two vec4s so that the array of colliders can be
+//passed to the shaders as it is. The type is stored in b.w.
+//	sphere:  a = (center, radius)
+//	capsule: a = (first end point, radius), b.xyz = second end point
+//	box:     a.xyz = center, b.xyz = half extents (axis aligned)
+//	plane:   a = (normal, distance from origin)
+struct Collider {
+	glm::vec4 a;
+	glm::vec4 b;
+};
+
+//helpers to fill in a collider of the given type
+Collider SphereCollider(const glm::vec3& center, float radius);
+Collider CapsuleCollider(const glm::vec3& p0, const glm::vec3& p1, float radius);
+Collider BoxCollider(const glm::vec3& center, const glm::vec3& halfExtents);
+Collider PlaneCollider(const glm::vec3& normal, float distance);
+
+//ClothCollision class resolves the collisions of the cloth particles with a
+//list of colliders, the collision ellipsoid of the sample and the cloth
+//itself. For self collision the particles and the triangles are stored in two
+//spatial hashes which are rebuilt every step. Each particle gathers the
+//corrections of the particles and triangles closer than the cloth thickness,
+//so the particles can be processed in parallel without locks. Particles and
+//triangles that are close in the rest pose (e.g. the springs) are ignored.
+class ClothCollision
+{
+public:
+	//constructor/destructor
+	ClothCollision(void);
+	~ClothCollision(void);
+
+	//sets the rest positions and the triangles of the cloth. The thickness is
+	//the minimum distance kept between unrelated parts of the cloth.
+	void Init(const vector<glm::vec4>& X, const vector<unsigned int>& triangles, float thickness);
+
+	//collider list
+	void AddCollider(const Collider& collider);
+	void ClearColliders();
+	const vector<Collider>& GetColliders() const;
+
+	//sets the transform of the unit collision ellipsoid, the collision
+	//response matches the mass spring shader
+	void SetEllipsoid(const glm::mat4& xform);
+
+	//enables/disables cloth self collision
+	void SetSelfCollision(bool enable);
+	bool GetSelfCollision() const;
+
+	//moves the particles out of the colliders and the cloth. The arrays hold
+	//the current and previous positions and the inverse masses, particles with
+	//an inverse mass of 0 are never moved.
+	void Resolve(float* px, float* py, float* pz, float* ox, float* oy, float* oz, const float* invMass);
+
+	//number of self collision contacts found in the last Resolve call
+	int GetTotalContacts() const;
+
+	//times spent in the last Resolve call in milliseconds
+	float GetHashTime() const;
+	float GetResolveTime() const;
+
+protected:
+	//rebuilds the particle and triangle hashes from the current positions
+	void BuildHashes(const float* px, const float* py, const float* pz);
+
+	//computes the self collision correction of every particle
+	int ComputeSelfCollisions(const float* px, const float* py, const float* pz,
+							  const float* ox, const float* oy, const float* oz, const float* invMass);
+
+	//moves a single particle out of all colliders
+	void ResolveColliders(glm::vec3& pos, glm::vec3& prev) const;
+
+	//returns true if the two particles are closer than the exclusion distance in the rest pose
+	bool IsRestNeighbor(int i, int j) const;
+
+	int total;
+	float thickness;
+	bool bSelfCollision;
+
+	//rest positions
+	vector<float> rx, ry, rz;
+
+	//triangle vertex indices
+	vector<int> triangles;
+
+	vector<Collider> colliders;
+	bool bEllipsoid;
+	glm::mat4 ellipsoid, invEllipsoid;
+
+	//particles are hashed by position and triangles by centroid
+	SpatialHash particleHash;
+	SpatialHash triangleHash;
+	vector<int> particleEntries, particleItems;
+	vector<int> triangleEntries, triangleItems;
+	vector<glm::ivec3> particleCells, triangleCells;
+	vector<glm::vec3> triangleMin, triangleMax;	//triangle bounds grown by the thickness
+	float triangleReach;	//largest distance of a colliding particle from a triangle centroid
+
+	//self collision correction of every particle
+	vector<glm::vec3> corrections;
+
+	//statistics
+	int totalContacts;
+	float hashTime;		//in milliseconds
+	float resolveTime;	//in milliseconds
+};
@@ -0,0 +1,217 @@
+#include "ClothPicker.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+ClothPicker::ClothPicker(void)
+{
+	total = 0;
+	radius = 0.1f;
+	next = 0;
+	frame = 0;
+	latency = 0;
+	for(int i=0;i<TOTAL_STAGING;i++) {
+		stagingIDs[i] = 0;
+		fences[i] = 0;
+		queuedFrames[i] = 0;
+	}
+	boundsMin = boundsMax = glm::vec3(0);
+}
+
+ClothPicker::~ClothPicker(void)
+{
+}
+
+void ClothPicker::Init(int totalPoints, float radius) {
+	Destroy();
+	total = totalPoints;
+	this->radius = radius;
+	positions.assign(total, glm::vec4(0));
+
+	//the staging buffers are only read by the CPU
+	glGenBuffers(TOTAL_STAGING, stagingIDs);
+	for(int i=0;i<TOTAL_STAGING;i++) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, stagingIDs[i]);
+		glBufferData(GL_COPY_WRITE_BUFFER, total*sizeof(glm::vec4), 0, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	//a ray inside the pick sphere of a particle always passes through one of
+	//the cells the sphere is stored in
+	hash.SetCellSize(2*radius);
+	hash.SetTableSize(2*total);
+}
+
+void ClothPicker::Destroy() {
+	for(int i=0;i<TOTAL_STAGING;i++) {
+		if(fences[i])
+			glDeleteSync(fences[i]);
+		fences[i] = 0;
+	}
+	if(stagingIDs[0])
+		glDeleteBuffers(TOTAL_STAGING, stagingIDs);
+	for(int i=0;i<TOTAL_STAGING;i++)
+		stagingIDs[i] = 0;
+	next = 0;
+}
+
+void ClothPicker::QueueReadback(GLuint positionBuffer) {
+	frame++;
+
+	//all staging buffers are waiting for the GPU, try again next frame
+	if(fences[next])
+		return;
+
+	//the copy runs on the GPU after the transform feedback passes
+	glBindBuffer(GL_COPY_READ_BUFFER, positionBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, stagingIDs[next]);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, total*sizeof(glm::vec4));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	fences[next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	queuedFrames[next] = frame;
+	next = (next+1) % TOTAL_STAGING;
+}
+
+bool ClothPicker::Update() {
+	//the fences signal in order so the copies are checked from the oldest one
+	int ready = -1;
+	for(int k=0;k<TOTAL_STAGING;k++) {
+		int slot = (next + k) % TOTAL_STAGING;
+		if(!fences[slot])
+			continue;
+		GLenum result = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if(result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+			break;
+		glDeleteSync(fences[slot]);
+		fences[slot] = 0;
+		ready = slot;
+	}
+	if(ready < 0)
+		return false;
+
+	//the copy has finished so this does not wait for the GPU
+	glBindBuffer(GL_COPY_READ_BUFFER, stagingIDs[ready]);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, total*sizeof(glm::vec4), &positions[0].x);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	latency = frame - queuedFrames[ready];
+
+	BuildHash();
+	return true;
+}
+
+void ClothPicker::SetPositions(const glm::vec4* positions) {
+	this->positions.assign(positions, positions + total);
+	latency = 0;
+	BuildHash();
+}
+
+void ClothPicker::BuildHash() {
+	entries.clear();
+	items.clear();
+	if(total == 0)
+		return;
+
+	boundsMin = boundsMax = glm::vec3(positions[0].x, positions[0].y, positions[0].z);
+	for(int i=0;i<total;i++) {
+		glm::vec3 p(positions[i].x, positions[i].y, positions[i].z);
+		boundsMin = glm::min(boundsMin, p);
+		boundsMax = glm::max(boundsMax, p);
+
+		//with cells twice the radius a sphere overlaps at most 8 cells
+		glm::ivec3 c0 = hash.GetCell(p - glm::vec3(radius));
+		glm::ivec3 c1 = hash.GetCell(p + glm::vec3(radius));
+		for(int z=c0.z;z<=c1.z;z++)
+			for(int y=c0.y;y<=c1.y;y++)
+				for(int x=c0.x;x<=c1.x;x++) {
+					entries.push_back(hash.Hash(x, y, z));
+					items.push_back(i);
+				}
+	}
+	boundsMin -= glm::vec3(radius);
+	boundsMax += glm::vec3(radius);
+
+	hash.Build(entries, items);
+}
+
+int ClothPicker::Pick(const glm::vec3& origin, const glm::vec3& dir) const {
+	if(entries.empty())
+		return -1;
+
+	float o[3] = {origin.x, origin.y, origin.z};
+	glm::vec3 d = glm::normalize(dir);
+	float dv[3] = {d.x, d.y, d.z};
+	float bmin[3] = {boundsMin.x, boundsMin.y, boundsMin.z};
+	float bmax[3] = {boundsMax.x, boundsMax.y, boundsMax.z};
+
+	//clip the ray to the bounds of the pick spheres
+	float tMin = 0, tMax = FLT_MAX;
+	for(int a=0;a<3;a++) {
+		if(fabs(dv[a]) < 1e-8f) {
+			if(o[a] < bmin[a] || o[a] > bmax[a])
+				return -1;
+			continue;
+		}
+		float t0 = (bmin[a] - o[a])/dv[a];
+		float t1 = (bmax[a] - o[a])/dv[a];
+		tMin = max(tMin, min(t0, t1));
+		tMax = min(tMax, max(t0, t1));
+	}
+	if(tMin > tMax)
+		return -1;
+
+	//walk the cells along the ray (3D DDA)
+	float cellSize = hash.GetCellSize();
+	glm::ivec3 start = hash.GetCell(origin + d*tMin);
+	int cell[3] = {start.x, start.y, start.z};
+	int step[3];
+	float tNext[3], tDelta[3];
+	for(int a=0;a<3;a++) {
+		step[a] = (dv[a] >= 0) ? 1 : -1;
+		if(fabs(dv[a]) < 1e-8f) {
+			tNext[a] = tDelta[a] = FLT_MAX;
+		} else {
+			tNext[a] = ((cell[a] + (dv[a] >= 0 ? 1 : 0))*cellSize - o[a])/dv[a];
+			tDelta[a] = cellSize/fabs(dv[a]);
+		}
+	}
+
+	const int* sorted = hash.GetItems();
+	float r2 = radius*radius;
+	int best = -1;
+	float bestT = FLT_MAX;
+	for(;;) {
+		int first, last;
+		hash.GetRange(hash.Hash(cell[0], cell[1], cell[2]), first, last);
+		for(int k=first;k<last;k++) {
+			int i = sorted[k];
+			float vx = positions[i].x - o[0], vy = positions[i].y - o[1], vz = positions[i].z - o[2];
+			float t = vx*dv[0] + vy*dv[1] + vz*dv[2];
+			if(t < 0 || t >= bestT)
+				continue;
+			if(vx*vx + vy*vy + vz*vz - t*t <= r2) {
+				best = i;
+				bestT = t;
+			}
+		}
+
+		//a particle whose closest point on the ray lies before the end of
+		//this cell is stored in this cell or in one already visited
+		int a = (tNext[0] < tNext[1]) ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+		float tExit = tNext[a];
+		if(bestT <= tExit || tExit > tMax)
+			break;
+		cell[a] += step[a];
+		tNext[a] += tDelta[a];
+	}
+	return best;
+}
+
+glm::vec3 ClothPicker::GetPosition(int index) const {
+	return glm::vec3(positions[index].x, positions[index].y, positions[index].z);
+}
+
+int ClothPicker::GetLatency() const {
+	return latency;
+}
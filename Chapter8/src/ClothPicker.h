@@ -0,0 +1,71 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "SpatialHash.h"
+
+using namespace std;
+
+//ClothPicker class finds the cloth particle under the mouse without stalling
+//the GPU. Every frame the position buffer written by transform feedback is
+//copied into one of a ring of staging buffers and a fence is inserted after
+//the copy. The copy is only read back once its fence has signalled, so the
+//positions used for picking are usually one frame old. The particles are
+//stored in a spatial hash which is walked along the picking ray.
+class ClothPicker
+{
+public:
+	//constructor/destructor
+	ClothPicker(void);
+	~ClothPicker(void);
+
+	//creates the staging buffers for the given number of particles. The pick
+	//radius is the largest distance of a picked particle from the ray.
+	void Init(int totalPoints, float radius);
+	void Destroy();
+
+	//queues an asynchronous copy of the given position buffer (one vec4 per
+	//particle). The copy is skipped if all staging buffers are still in flight.
+	void QueueReadback(GLuint positionBuffer);
+
+	//reads back the newest finished copy without blocking and rebuilds the
+	//spatial hash. Returns true if the positions were updated.
+	bool Update();
+
+	//rebuilds the spatial hash from positions that are already on the CPU
+	void SetPositions(const glm::vec4* positions);
+
+	//returns the particle closest to the origin of the ray among the particles
+	//closer than the pick radius to the ray, or -1 if there is none
+	int Pick(const glm::vec3& origin, const glm::vec3& dir) const;
+
+	//last known position of the given particle
+	glm::vec3 GetPosition(int index) const;
+
+	//number of frames between queueing the copy and reading it back
+	int GetLatency() const;
+
+protected:
+	//stores every particle in all cells overlapped by its pick sphere
+	void BuildHash();
+
+	static const int TOTAL_STAGING = 3;
+
+	int total;
+	float radius;
+
+	//staging buffers, fences and the frame each copy was queued in
+	GLuint stagingIDs[TOTAL_STAGING];
+	GLsync fences[TOTAL_STAGING];
+	int queuedFrames[TOTAL_STAGING];
+	int next;			//next staging buffer to write
+	int frame;
+	int latency;
+
+	//last read back positions and their bounds
+	vector<glm::vec4> positions;
+	glm::vec3 boundsMin, boundsMax;
+
+	SpatialHash hash;
+	vector<int> entries, items;
+};
@@ -0,0 +1,512 @@
+#include "ClothSolver.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <set>
+#include <utility>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+
+//SIMD width and the number of springs/particles handed to a thread at once
+const int SIMD_WIDTH = 8;
+const int BLOCK_SIZE = 256;
+
+//below this many springs the threads cost more than they save
+const int PARALLEL_THRESHOLD = 4096;
+
+//smallest spring length used to normalize the spring direction
+const float MIN_LENGTH = 1e-6f;
+
+//over-relaxation of the Jacobi corrections. Each correction is divided by the
+//largest number of constraints of its two particles so that the sum of the
+//corrections of a particle cannot overshoot by more than this factor.
+const float JACOBI_RELAXATION = 1.5f;
+
+ClothSolver::ClothSolver(void)
+{
+	total = 0;
+	dt = 1.0f/60.0f;
+	gravity = glm::vec3(0.0f,-0.00981f,0.0f);
+	damping = -0.05f;
+	pCollision = NULL;
+	solver = SOLVER_SPRINGS;
+	iterations = 10;
+	complianceScale = 1;
+	stepCount = 0;
+	for(int i=0;i<STATS_STEPS;i++)
+		stepTimes[i] = 0;
+}
+
+ClothSolver::~ClothSolver(void)
+{
+}
+
+void ClothSolver::Init(const vector<glm::vec4>& X, const vector<glm::vec4>& X_last, const vector<Spring>& springs) {
+	total = int(X.size());
+	int padded = (total + SIMD_WIDTH - 1)/SIMD_WIDTH*SIMD_WIDTH;
+
+	vector<float>* arrays[] = {&px, &py, &pz, &ox, &oy, &oz, &vx, &vy, &vz, &fx, &fy, &fz, &mass, &invMass, &cx, &cy, &cz, &invDegree};
+	for(int i=0;i<18;i++)
+		arrays[i]->assign(padded, 0.0f);
+
+	for(int i=0;i<total;i++) {
+		px[i] = X[i].x;		 py[i] = X[i].y;	  pz[i] = X[i].z;
+		ox[i] = X_last[i].x; oy[i] = X_last[i].y; oz[i] = X_last[i].z;
+		mass[i] = X[i].w;
+		invMass[i] = (X[i].w != 0) ? 1.0f/X[i].w : 0.0f;
+	}
+
+	ColorSprings(springs);
+	stepCount = 0;
+}
+
+void ClothSolver::SetParameters(float dt, const glm::vec3& gravity, float damping) {
+	this->dt = dt;
+	this->gravity = gravity;
+	this->damping = damping;
+}
+
+void ClothSolver::SetFixed(int index) {
+	mass[index] = 0;
+	invMass[index] = 0;
+}
+
+void ClothSolver::SetCollision(ClothCollision* pCollision) {
+	this->pCollision = pCollision;
+}
+
+void ClothSolver::SetSolver(SolverType type) {
+	solver = type;
+}
+
+void ClothSolver::SetIterations(int iterations) {
+	this->iterations = max(1, iterations);
+}
+
+void ClothSolver::SetComplianceScale(float scale) {
+	complianceScale = scale;
+}
+
+SolverType ClothSolver::GetSolver() const {
+	return solver;
+}
+
+int ClothSolver::GetIterations() const {
+	return iterations;
+}
+
+const char* ClothSolver::GetSolverName(SolverType type) {
+	switch(type) {
+		case SOLVER_SPRINGS:			return "Springs";
+		case SOLVER_XPBD_GAUSS_SEIDEL:	return "XPBD Gauss-Seidel";
+		case SOLVER_XPBD_JACOBI:		return "XPBD Jacobi";
+		default:						return "Unknown";
+	}
+}
+
+void ClothSolver::ColorSprings(const vector<Spring>& springs) {
+	//the same pair of particles may be connected twice, e.g. the last bend
+	//spring of each cloth row, while the shader visits each neighbour once
+	vector<Spring> unique;
+	set<pair<int,int> > pairs;
+	for(size_t i=0;i<springs.size();i++) {
+		pair<int,int> key(min(springs[i].p1, springs[i].p2), max(springs[i].p1, springs[i].p2));
+		if(pairs.insert(key).second)
+			unique.push_back(springs[i]);
+	}
+
+	//greedy colouring, each spring takes the lowest colour that is not yet
+	//used by a spring of either of its particles
+	vector<vector<int> > used(total);
+	vector<int> colors(unique.size());
+	int totalColors = 0;
+	for(size_t i=0;i<unique.size();i++) {
+		const vector<int>& u1 = used[unique[i].p1];
+		const vector<int>& u2 = used[unique[i].p2];
+		int c = 0;
+		while(find(u1.begin(), u1.end(), c)!=u1.end() || find(u2.begin(), u2.end(), c)!=u2.end())
+			c++;
+		colors[i] = c;
+		used[unique[i].p1].push_back(c);
+		used[unique[i].p2].push_back(c);
+		totalColors = max(totalColors, c+1);
+	}
+
+	//counting sort of the springs by colour
+	colorOffsets.assign(totalColors+1, 0);
+	for(size_t i=0;i<unique.size();i++)
+		colorOffsets[colors[i]+1]++;
+	for(int c=0;c<totalColors;c++)
+		colorOffsets[c+1] += colorOffsets[c];
+
+	size_t count = unique.size();
+	springP1.resize(count);
+	springP2.resize(count);
+	springRest.resize(count);
+	springKs.resize(count);
+	springKd.resize(count);
+	vector<int> next(colorOffsets.begin(), colorOffsets.end()-1);
+	for(size_t i=0;i<count;i++) {
+		int j = next[colors[i]]++;
+		springP1[j] = unique[i].p1;
+		springP2[j] = unique[i].p2;
+		springRest[j] = unique[i].rest_length;
+		springKs[j] = unique[i].Ks;
+		springKd[j] = unique[i].Kd;
+	}
+
+	//XPBD constraint data, the compliance is the inverse spring stiffness
+	springCompliance.resize(count);
+	lambda.assign(count, 0.0f);
+	for(size_t i=0;i<count;i++) {
+		springCompliance[i] = (springKs[i] > 0) ? 1.0f/springKs[i] : 0.0f;
+		invDegree[springP1[i]] += 1;
+		invDegree[springP2[i]] += 1;
+	}
+	for(int i=0;i<total;i++)
+		invDegree[i] = (invDegree[i] > 0) ? 1.0f/invDegree[i] : 0.0f;
+}
+
+void ClothSolver::ComputeExternalForces(int first, int last) {
+	float invDt = 1.0f/dt;
+	int i = first;
+#ifdef USE_AVX2
+	__m256 vInvDt = _mm256_set1_ps(invDt);
+	__m256 vDamping = _mm256_set1_ps(damping);
+	__m256 gx = _mm256_set1_ps(gravity.x), gy = _mm256_set1_ps(gravity.y), gz = _mm256_set1_ps(gravity.z);
+	for(;i+SIMD_WIDTH<=last;i+=SIMD_WIDTH) {
+		__m256 m = _mm256_loadu_ps(&mass[i]);
+		__m256 velX = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&px[i]), _mm256_loadu_ps(&ox[i])), vInvDt);
+		__m256 velY = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&py[i]), _mm256_loadu_ps(&oy[i])), vInvDt);
+		__m256 velZ = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&pz[i]), _mm256_loadu_ps(&oz[i])), vInvDt);
+		_mm256_storeu_ps(&vx[i], velX);
+		_mm256_storeu_ps(&vy[i], velY);
+		_mm256_storeu_ps(&vz[i], velZ);
+		_mm256_storeu_ps(&fx[i], _mm256_add_ps(_mm256_mul_ps(gx, m), _mm256_mul_ps(vDamping, velX)));
+		_mm256_storeu_ps(&fy[i], _mm256_add_ps(_mm256_mul_ps(gy, m), _mm256_mul_ps(vDamping, velY)));
+		_mm256_storeu_ps(&fz[i], _mm256_add_ps(_mm256_mul_ps(gz, m), _mm256_mul_ps(vDamping, velZ)));
+	}
+#endif
+	for(;i<last;i++) {
+		vx[i] = (px[i]-ox[i])*invDt;
+		vy[i] = (py[i]-oy[i])*invDt;
+		vz[i] = (pz[i]-oz[i])*invDt;
+		fx[i] = gravity.x*mass[i] + damping*vx[i];
+		fy[i] = gravity.y*mass[i] + damping*vy[i];
+		fz[i] = gravity.z*mass[i] + damping*vz[i];
+	}
+}
+
+void ClothSolver::ComputeSpringForces(int first, int last) {
+	int s = first;
+#ifdef USE_AVX2
+	__m256 minLength = _mm256_set1_ps(MIN_LENGTH);
+	for(;s+SIMD_WIDTH<=last;s+=SIMD_WIDTH) {
+		__m256i i1 = _mm256_loadu_si256((const __m256i*)&springP1[s]);
+		__m256i i2 = _mm256_loadu_si256((const __m256i*)&springP2[s]);
+
+		//position and velocity differences of both ends
+		__m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(&px[0], i1, 4), _mm256_i32gather_ps(&px[0], i2, 4));
+		__m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(&py[0], i1, 4), _mm256_i32gather_ps(&py[0], i2, 4));
+		__m256 dz = _mm256_sub_ps(_mm256_i32gather_ps(&pz[0], i1, 4), _mm256_i32gather_ps(&pz[0], i2, 4));
+		__m256 dvx = _mm256_sub_ps(_mm256_i32gather_ps(&vx[0], i1, 4), _mm256_i32gather_ps(&vx[0], i2, 4));
+		__m256 dvy = _mm256_sub_ps(_mm256_i32gather_ps(&vy[0], i1, 4), _mm256_i32gather_ps(&vy[0], i2, 4));
+		__m256 dvz = _mm256_sub_ps(_mm256_i32gather_ps(&vz[0], i1, 4), _mm256_i32gather_ps(&vz[0], i2, 4));
+
+		__m256 dist = _mm256_max_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx,dx), _mm256_mul_ps(dy,dy)), _mm256_mul_ps(dz,dz))), minLength);
+		__m256 invDist = _mm256_div_ps(_mm256_set1_ps(1.0f), dist);
+		__m256 dotVP = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dvx,dx), _mm256_mul_ps(dvy,dy)), _mm256_mul_ps(dvz,dz));
+
+		//spring and damping terms along the spring direction
+		__m256 leftTerm = _mm256_mul_ps(_mm256_loadu_ps(&springKs[s]), _mm256_sub_ps(_mm256_loadu_ps(&springRest[s]), dist));
+		__m256 rightTerm = _mm256_mul_ps(_mm256_loadu_ps(&springKd[s]), _mm256_mul_ps(dotVP, invDist));
+		__m256 f = _mm256_mul_ps(_mm256_add_ps(leftTerm, rightTerm), invDist);
+
+		//AVX2 has no scatter, the springs of a colour never share a
+		//particle so the lanes can be added one after the other
+		float sfx[SIMD_WIDTH], sfy[SIMD_WIDTH], sfz[SIMD_WIDTH];
+		_mm256_storeu_ps(sfx, _mm256_mul_ps(f, dx));
+		_mm256_storeu_ps(sfy, _mm256_mul_ps(f, dy));
+		_mm256_storeu_ps(sfz, _mm256_mul_ps(f, dz));
+		for(int k=0;k<SIMD_WIDTH;k++) {
+			int a = springP1[s+k], b = springP2[s+k];
+			fx[a] += sfx[k]; fy[a] += sfy[k]; fz[a] += sfz[k];
+			fx[b] -= sfx[k]; fy[b] -= sfy[k]; fz[b] -= sfz[k];
+		}
+	}
+#endif
+	for(;s<last;s++) {
+		int a = springP1[s], b = springP2[s];
+		float dx = px[a]-px[b], dy = py[a]-py[b], dz = pz[a]-pz[b];
+		float dvx = vx[a]-vx[b], dvy = vy[a]-vy[b], dvz = vz[a]-vz[b];
+		float dist = max(sqrt(dx*dx + dy*dy + dz*dz), MIN_LENGTH);
+
+		float leftTerm = -springKs[s]*(dist - springRest[s]);
+		float rightTerm = springKd[s]*((dvx*dx + dvy*dy + dvz*dz)/dist);
+		float f = (leftTerm + rightTerm)/dist;
+
+		fx[a] += f*dx; fy[a] += f*dy; fz[a] += f*dz;
+		fx[b] -= f*dx; fy[b] -= f*dy; fz[b] -= f*dz;
+	}
+}
+
+void ClothSolver::Integrate(int first, int last) {
+	float dt2 = dt*dt;
+	int i = first;
+#ifdef USE_AVX2
+	__m256 vDt2 = _mm256_set1_ps(dt2);
+	__m256 two = _mm256_set1_ps(2.0f);
+	__m256 zero = _mm256_setzero_ps();
+	for(;i+SIMD_WIDTH<=last;i+=SIMD_WIDTH) {
+		__m256 scale = _mm256_mul_ps(_mm256_loadu_ps(&invMass[i]), vDt2);
+		__m256 x = _mm256_loadu_ps(&px[i]), y = _mm256_loadu_ps(&py[i]), z = _mm256_loadu_ps(&pz[i]);
+		__m256 nx = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(x, two), _mm256_loadu_ps(&ox[i])), _mm256_mul_ps(_mm256_loadu_ps(&fx[i]), scale));
+		__m256 ny = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(y, two), _mm256_loadu_ps(&oy[i])), _mm256_mul_ps(_mm256_loadu_ps(&fy[i]), scale));
+		__m256 nz = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(z, two), _mm256_loadu_ps(&oz[i])), _mm256_mul_ps(_mm256_loadu_ps(&fz[i]), scale));
+		_mm256_storeu_ps(&ox[i], x);
+		_mm256_storeu_ps(&oy[i], y);
+		_mm256_storeu_ps(&oz[i], z);
+		_mm256_storeu_ps(&px[i], nx);
+		_mm256_storeu_ps(&py[i], _mm256_max_ps(ny, zero));	//collision with floor
+		_mm256_storeu_ps(&pz[i], nz);
+	}
+#endif
+	for(;i<last;i++) {
+		float scale = invMass[i]*dt2;
+		float x = px[i], y = py[i], z = pz[i];
+		px[i] = x*2.0f - ox[i] + fx[i]*scale;
+		py[i] = max(0.0f, y*2.0f - oy[i] + fy[i]*scale);	//collision with floor
+		pz[i] = z*2.0f - oz[i] + fz[i]*scale;
+		ox[i] = x;
+		oy[i] = y;
+		oz[i] = z;
+	}
+}
+
+void ClothSolver::StepSprings() {
+	int padded = int(px.size());
+	int particleBlocks = (padded + BLOCK_SIZE - 1)/BLOCK_SIZE;
+	int totalColors = int(colorOffsets.size()) - 1;
+
+	#pragma omp parallel if(springP1.size() >= size_t(PARALLEL_THRESHOLD))
+	{
+		#pragma omp for
+		for(int b=0;b<particleBlocks;b++)
+			ComputeExternalForces(b*BLOCK_SIZE, min(padded, (b+1)*BLOCK_SIZE));
+
+		//the implicit barrier after each colour keeps the colours apart
+		for(int c=0;c<totalColors;c++) {
+			int first = colorOffsets[c];
+			int last = colorOffsets[c+1];
+			int springBlocks = (last - first + BLOCK_SIZE - 1)/BLOCK_SIZE;
+			#pragma omp for
+			for(int b=0;b<springBlocks;b++)
+				ComputeSpringForces(first + b*BLOCK_SIZE, min(last, first + (b+1)*BLOCK_SIZE));
+		}
+
+		#pragma omp for
+		for(int b=0;b<particleBlocks;b++)
+			Integrate(b*BLOCK_SIZE, min(padded, (b+1)*BLOCK_SIZE));
+	}
+}
+
+void ClothSolver::StepXPBD() {
+	int padded = int(px.size());
+	int particleBlocks = (padded + BLOCK_SIZE - 1)/BLOCK_SIZE;
+	int totalColors = int(colorOffsets.size()) - 1;
+	int totalSprings = int(springP1.size());
+	int springBlocks = (totalSprings + BLOCK_SIZE - 1)/BLOCK_SIZE;
+	float alphaScale = complianceScale/(dt*dt);
+	bool bJacobi = (solver == SOLVER_XPBD_JACOBI);
+
+	#pragma omp parallel if(springP1.size() >= size_t(PARALLEL_THRESHOLD))
+	{
+		//predict the positions from the external forces only
+		#pragma omp for
+		for(int b=0;b<particleBlocks;b++) {
+			ComputeExternalForces(b*BLOCK_SIZE, min(padded, (b+1)*BLOCK_SIZE));
+			Integrate(b*BLOCK_SIZE, min(padded, (b+1)*BLOCK_SIZE));
+		}
+
+		#pragma omp for
+		for(int b=0;b<springBlocks;b++)
+			fill(lambda.begin() + b*BLOCK_SIZE, lambda.begin() + min(totalSprings, (b+1)*BLOCK_SIZE), 0.0f);
+
+		for(int it=0;it<iterations;it++) {
+			//the colours are still needed by Jacobi so that the corrections
+			//of a colour can be accumulated without locks
+			for(int c=0;c<totalColors;c++) {
+				int first = colorOffsets[c];
+				int last = colorOffsets[c+1];
+				int colorBlocks = (last - first + BLOCK_SIZE - 1)/BLOCK_SIZE;
+				#pragma omp for
+				for(int b=0;b<colorBlocks;b++)
+					SolveConstraints(first + b*BLOCK_SIZE, min(last, first + (b+1)*BLOCK_SIZE), alphaScale, bJacobi);
+			}
+
+			if(bJacobi) {
+				#pragma omp for
+				for(int b=0;b<particleBlocks;b++)
+					ApplyCorrections(b*BLOCK_SIZE, min(padded, (b+1)*BLOCK_SIZE));
+			}
+		}
+
+		//the constraints may have pulled particles below the floor
+		#pragma omp for
+		for(int i=0;i<padded;i++)
+			py[i] = max(0.0f, py[i]);
+	}
+}
+
+void ClothSolver::SolveConstraints(int first, int last, float alphaScale, bool bJacobi) {
+	float* tx = bJacobi ? &cx[0] : &px[0];
+	float* ty = bJacobi ? &cy[0] : &py[0];
+	float* tz = bJacobi ? &cz[0] : &pz[0];
+	int s = first;
+#ifdef USE_AVX2
+	__m256 minLength = _mm256_set1_ps(MIN_LENGTH);
+	__m256 vAlphaScale = _mm256_set1_ps(alphaScale);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 relaxation = _mm256_set1_ps(JACOBI_RELAXATION);
+	for(;s+SIMD_WIDTH<=last;s+=SIMD_WIDTH) {
+		__m256i i1 = _mm256_loadu_si256((const __m256i*)&springP1[s]);
+		__m256i i2 = _mm256_loadu_si256((const __m256i*)&springP2[s]);
+
+		__m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(&px[0], i1, 4), _mm256_i32gather_ps(&px[0], i2, 4));
+		__m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(&py[0], i1, 4), _mm256_i32gather_ps(&py[0], i2, 4));
+		__m256 dz = _mm256_sub_ps(_mm256_i32gather_ps(&pz[0], i1, 4), _mm256_i32gather_ps(&pz[0], i2, 4));
+		__m256 w1 = _mm256_i32gather_ps(&invMass[0], i1, 4);
+		__m256 w2 = _mm256_i32gather_ps(&invMass[0], i2, 4);
+		__m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx,dx), _mm256_mul_ps(dy,dy)), _mm256_mul_ps(dz,dz)));
+
+		//delta lambda = (-C - alpha*lambda) / (w1 + w2 + alpha), zero for
+		//degenerate and fixed constraints
+		__m256 alpha = _mm256_mul_ps(_mm256_loadu_ps(&springCompliance[s]), vAlphaScale);
+		__m256 lam = _mm256_loadu_ps(&lambda[s]);
+		__m256 denom = _mm256_add_ps(_mm256_add_ps(w1, w2), alpha);
+		__m256 valid = _mm256_and_ps(_mm256_cmp_ps(len, minLength, _CMP_GT_OQ), _mm256_cmp_ps(denom, zero, _CMP_GT_OQ));
+		__m256 C = _mm256_sub_ps(len, _mm256_loadu_ps(&springRest[s]));
+		__m256 dl = _mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(zero, C), _mm256_mul_ps(alpha, lam)), _mm256_blendv_ps(_mm256_set1_ps(1.0f), denom, valid));
+		dl = _mm256_and_ps(dl, valid);
+		if(bJacobi)
+			dl = _mm256_mul_ps(dl, _mm256_mul_ps(relaxation, _mm256_min_ps(_mm256_i32gather_ps(&invDegree[0], i1, 4), _mm256_i32gather_ps(&invDegree[0], i2, 4))));
+		_mm256_storeu_ps(&lambda[s], _mm256_add_ps(lam, dl));
+		__m256 f = _mm256_div_ps(dl, _mm256_max_ps(len, minLength));
+
+		//the constraints of a colour never share a particle so the lanes
+		//can be written one after the other
+		float sx[SIMD_WIDTH], sy[SIMD_WIDTH], sz[SIMD_WIDTH], sw1[SIMD_WIDTH], sw2[SIMD_WIDTH];
+		_mm256_storeu_ps(sx, _mm256_mul_ps(f, dx));
+		_mm256_storeu_ps(sy, _mm256_mul_ps(f, dy));
+		_mm256_storeu_ps(sz, _mm256_mul_ps(f, dz));
+		_mm256_storeu_ps(sw1, w1);
+		_mm256_storeu_ps(sw2, w2);
+		for(int k=0;k<SIMD_WIDTH;k++) {
+			int a = springP1[s+k], b = springP2[s+k];
+			tx[a] += sw1[k]*sx[k]; ty[a] += sw1[k]*sy[k]; tz[a] += sw1[k]*sz[k];
+			tx[b] -= sw2[k]*sx[k]; ty[b] -= sw2[k]*sy[k]; tz[b] -= sw2[k]*sz[k];
+		}
+	}
+#endif
+	for(;s<last;s++) {
+		int a = springP1[s], b = springP2[s];
+		float w1 = invMass[a], w2 = invMass[b];
+		float dx = px[a]-px[b], dy = py[a]-py[b], dz = pz[a]-pz[b];
+		float len = sqrt(dx*dx + dy*dy + dz*dz);
+		float alpha = springCompliance[s]*alphaScale;
+		float denom = w1 + w2 + alpha;
+		if(len <= MIN_LENGTH || denom <= 0)
+			continue;
+
+		float dl = (-(len - springRest[s]) - alpha*lambda[s])/denom;
+		if(bJacobi)
+			dl *= JACOBI_RELAXATION*min(invDegree[a], invDegree[b]);
+		lambda[s] += dl;
+		float f = dl/len;
+		tx[a] += w1*f*dx; ty[a] += w1*f*dy; tz[a] += w1*f*dz;
+		tx[b] -= w2*f*dx; ty[b] -= w2*f*dy; tz[b] -= w2*f*dz;
+	}
+}
+
+void ClothSolver::ApplyCorrections(int first, int last) {
+	for(int i=first;i<last;i++) {
+		px[i] += cx[i];
+		py[i] += cy[i];
+		pz[i] += cz[i];
+		cx[i] = cy[i] = cz[i] = 0;
+	}
+}
+
+void ClothSolver::Step() {
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+	if(solver == SOLVER_SPRINGS)
+		StepSprings();
+	else
+		StepXPBD();
+
+	if(pCollision)
+		pCollision->Resolve(&px[0], &py[0], &pz[0], &ox[0], &oy[0], &oz[0], &invMass[0]);
+
+	stepTimes[stepCount % STATS_STEPS] = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+	stepCount++;
+}
+
+void ClothSolver::GetStrain(float& maxStrain, float& meanStrain) const {
+	maxStrain = 0;
+	double sum = 0;
+	for(size_t s=0;s<springP1.size();s++) {
+		int a = springP1[s], b = springP2[s];
+		float dx = px[a]-px[b], dy = py[a]-py[b], dz = pz[a]-pz[b];
+		float strain = fabs(sqrt(dx*dx + dy*dy + dz*dz) - springRest[s])/springRest[s];
+		maxStrain = max(maxStrain, strain);
+		sum += strain;
+	}
+	meanStrain = springP1.empty() ? 0.0f : float(sum/springP1.size());
+}
+
+void ClothSolver::GetPositions(vector<glm::vec4>& X, vector<glm::vec4>& X_last) const {
+	X.resize(total);
+	X_last.resize(total);
+	for(int i=0;i<total;i++) {
+		X[i] = glm::vec4(px[i], py[i], pz[i], mass[i]);
+		X_last[i] = glm::vec4(ox[i], oy[i], oz[i], mass[i]);
+	}
+}
+
+void ClothSolver::SetPosition(int index, const glm::vec3& position, const glm::vec3& prev_position) {
+	px[index] = position.x;
+	py[index] = position.y;
+	pz[index] = position.z;
+	ox[index] = prev_position.x;
+	oy[index] = prev_position.y;
+	oz[index] = prev_position.z;
+}
+
+glm::vec3 ClothSolver::GetPosition(int index) const {
+	return glm::vec3(px[index], py[index], pz[index]);
+}
+
+int ClothSolver::GetTotalParticles() const {
+	return total;
+}
+
+int ClothSolver::GetTotalColors() const {
+	return int(colorOffsets.size()) - 1;
+}
+
+float ClothSolver::GetStepTime() const {
+	int count = min(stepCount, int(STATS_STEPS));
+	if(count == 0)
+		return 0;
+	float sum = 0;
+	for(int i=0;i<count;i++)
+		sum += stepTimes[i];
+	return sum/count;
+}
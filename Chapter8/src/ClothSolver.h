@@ -0,0 +1,144 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "ClothCollision.h"
+
+using namespace std;
+
+//spring struct for storing cloth springs
+struct Spring {
+	int p1, p2;			//indices of two vertices
+	float rest_length;	//resting length
+	float Ks, Kd;		//spring and damping constants
+};
+
+//solver used by ClothSolver::Step
+enum SolverType {
+	SOLVER_SPRINGS = 0,			//explicit mass springs, same as the vertex shader
+	SOLVER_XPBD_GAUSS_SEIDEL,	//XPBD, colours are solved one after the other
+	SOLVER_XPBD_JACOBI,			//XPBD, all constraints see the same positions
+	TOTAL_SOLVERS
+};
+
+//ClothSolver class is a CPU implementation of the mass spring cloth of the
+//transform feedback samples. Each Step performs the same explicit Verlet
+//update as the mass spring vertex shader. The particles are stored in
+//structure of arrays layout and the springs are graph coloured so that no two
+//springs of a colour share a particle. The forces of a colour can then be
+//accumulated in parallel without locks, 8 springs at a time with AVX2.
+//
+//The XPBD solvers treat every spring as a distance constraint with a
+//compliance of 1/Ks, so at convergence they reach the same rest state as the
+//springs, but remain stable at much larger time steps. The spring damping
+//constants are not used by XPBD; only the velocity damping is applied.
+class ClothSolver
+{
+public:
+	//constructor/destructor
+	ClothSolver(void);
+	~ClothSolver(void);
+
+	//sets the particles and springs. The w component of the positions is the
+	//particle mass, a mass of 0 makes the particle immovable.
+	void Init(const vector<glm::vec4>& X, const vector<glm::vec4>& X_last, const vector<Spring>& springs);
+
+	//sets the time step, gravity and the velocity damping of all particles
+	void SetParameters(float dt, const glm::vec3& gravity, float damping);
+
+	//fixes the given particle in place
+	void SetFixed(int index);
+
+	//sets the collision handler run after each step, NULL to disable collisions
+	void SetCollision(ClothCollision* pCollision);
+
+	//selects the solver, the number of XPBD constraint iterations per step
+	//and a factor applied to the compliance of all constraints
+	void SetSolver(SolverType type);
+	void SetIterations(int iterations);
+	void SetComplianceScale(float scale);
+	SolverType GetSolver() const;
+	int GetIterations() const;
+	static const char* GetSolverName(SolverType type);
+
+	//advances the simulation by one time step
+	void Step();
+
+	//relative length error |length - rest length| / rest length of the springs
+	void GetStrain(float& maxStrain, float& meanStrain) const;
+
+	//copies the particles back to arrays of positions with the mass in w
+	void GetPositions(vector<glm::vec4>& X, vector<glm::vec4>& X_last) const;
+
+	//overwrites the current and previous position of the given particle
+	void SetPosition(int index, const glm::vec3& position, const glm::vec3& prev_position);
+
+	//returns the current position of the given particle
+	glm::vec3 GetPosition(int index) const;
+
+	int GetTotalParticles() const;
+	int GetTotalColors() const;
+
+	//average time of a Step call over the last STATS_STEPS steps in milliseconds
+	float GetStepTime() const;
+
+	//number of steps the step time is averaged over
+	static const int STATS_STEPS = 60;
+
+protected:
+	//assigns the springs to colours so that the springs of a colour do not
+	//share particles and sorts them by colour
+	void ColorSprings(const vector<Spring>& springs);
+
+	//calculates the velocities and the external forces of all particles
+	void ComputeExternalForces(int first, int last);
+
+	//accumulates the forces of the given range of springs of a single colour
+	void ComputeSpringForces(int first, int last);
+
+	//integrates the given range of particles
+	void Integrate(int first, int last);
+
+	//one step of the explicit spring model and of XPBD
+	void StepSprings();
+	void StepXPBD();
+
+	//projects the given range of distance constraints of a single colour.
+	//Gauss-Seidel writes the particles directly, Jacobi accumulates the
+	//corrections, scaled by the number of constraints, for ApplyCorrections.
+	void SolveConstraints(int first, int last, float alphaScale, bool bJacobi);
+	void ApplyCorrections(int first, int last);
+
+	//particles, the arrays are padded to a multiple of the SIMD width
+	int total;
+	vector<float> px, py, pz;		//current positions
+	vector<float> ox, oy, oz;		//previous positions
+	vector<float> vx, vy, vz;		//velocities
+	vector<float> fx, fy, fz;		//forces
+	vector<float> mass, invMass;
+
+	//springs sorted by colour in structure of arrays layout
+	vector<int> springP1, springP2;
+	vector<float> springRest, springKs, springKd;
+	vector<int> colorOffsets;		//first spring of each colour, one extra entry at the end
+
+	//XPBD state
+	SolverType solver;
+	int iterations;
+	float complianceScale;
+	vector<float> springCompliance;		//1/Ks of each spring
+	vector<float> lambda;				//accumulated multiplier of each constraint
+	vector<float> cx, cy, cz;			//Jacobi corrections
+	vector<float> invDegree;			//1/number of constraints of each particle
+
+	//simulation parameters
+	float dt;
+	glm::vec3 gravity;
+	float damping;
+
+	//optional collision handler, not owned by the solver
+	ClothCollision* pCollision;
+
+	//timing
+	float stepTimes[STATS_STEPS];
+	int stepCount;
+};
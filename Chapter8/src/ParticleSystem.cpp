@@ -0,0 +1,803 @@
+#include "ParticleSystem.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+
+//SIMD width and the number of slots handed to a thread at once
+const int SIMD_WIDTH = 8;
+const int BLOCK_SIZE = 4096;
+
+//below this many slots or particles the threads cost more than they save
+const int PARALLEL_THRESHOLD = 16384;
+
+const float PI = 3.14159265f;
+
+//uniforms of the transform feedback update program
+enum ParticleUniform {
+	U_DT = 0,
+	U_SEED,
+	U_PLANE,
+	U_RESTITUTION,
+	U_NUM_EMITTERS,
+	U_EMITTER_POSITION,
+	U_EMITTER_FORCE,
+	U_EMITTER_ANGLES,
+	U_EMITTER_MOTION,
+	U_EMITTER_RANGE,
+	U_SPAWN,
+	TOTAL_UNIFORMS
+};
+
+const char* uniformNames[TOTAL_UNIFORMS] = {
+	"dt", "seed", "plane", "restitution", "num_emitters",
+	"emitter_position", "emitter_force", "emitter_angles", "emitter_motion", "emitter_range",
+	"spawn"
+};
+
+const char* backendNames[TOTAL_BACKENDS] = {
+	"CPU", "GPU", "GPU compact"
+};
+
+//converts a float to an unsigned int with the same order
+inline unsigned int FloatToKey(float f) {
+	unsigned int u;
+	memcpy(&u, &f, sizeof(u));
+	return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+//stable least significant digit radix sort of the key/value pairs, 8 bits
+//per pass. Each thread counts a contiguous range so the passes run in
+//parallel; passes where all keys share the digit are skipped.
+static void RadixSort(vector<unsigned int>& keys, vector<int>& values,
+					  vector<unsigned int>& tmpKeys, vector<int>& tmpValues, vector<int>& histograms) {
+	const int RADIX = 256;
+	int count = int(keys.size());
+	tmpKeys.resize(count);
+	tmpValues.resize(count);
+
+#ifdef _OPENMP
+	int threads = 1;
+	if(count >= PARALLEL_THRESHOLD)
+		threads = omp_get_max_threads();
+#endif
+
+	for(int shift=0;shift<32;shift+=8) {
+		bool bSkip = false;
+		int team = 1;
+		#pragma omp parallel num_threads(threads)
+		{
+			//OpenMP may start fewer threads than asked for, so the ranges
+			//and histograms are split by the size of the team that started
+			#pragma omp single
+			{
+#ifdef _OPENMP
+				team = omp_get_num_threads();
+#endif
+				histograms.resize(team*RADIX);
+			}
+
+			int t = 0;
+#ifdef _OPENMP
+			t = omp_get_thread_num();
+#endif
+			int first = int((long long)count*t/team);
+			int last = int((long long)count*(t+1)/team);
+			int* hist = &histograms[t*RADIX];
+			for(int d=0;d<RADIX;d++)
+				hist[d] = 0;
+			for(int i=first;i<last;i++)
+				hist[(keys[i] >> shift) & 0xFF]++;
+
+			#pragma omp barrier
+
+			//turn the counts into per thread write offsets
+			#pragma omp single
+			{
+				int sum = 0;
+				for(int d=0;d<RADIX;d++) {
+					int total = 0;
+					for(int k=0;k<team;k++)
+						total += histograms[k*RADIX+d];
+					if(total == count)
+						bSkip = true;
+					for(int k=0;k<team;k++) {
+						int c = histograms[k*RADIX+d];
+						histograms[k*RADIX+d] = sum;
+						sum += c;
+					}
+				}
+			}
+
+			if(!bSkip) {
+				for(int i=first;i<last;i++) {
+					int dst = hist[(keys[i] >> shift) & 0xFF]++;
+					tmpKeys[dst] = keys[i];
+					tmpValues[dst] = values[i];
+				}
+			}
+		}
+		if(!bSkip) {
+			keys.swap(tmpKeys);
+			values.swap(tmpValues);
+		}
+	}
+}
+
+Emitter::Emitter()
+{
+	position = glm::vec3(0);
+	force = glm::vec3(0,-3.6f,0);
+	yaw = 0;
+	yawVar = 2*PI;
+	pitch = PI/2;
+	pitchVar = PI/4;
+	speed = 3;
+	speedVar = 0.6f;
+	life = 1;
+	lifeVar = 0.25f;
+	rate = 5000;
+}
+
+ParticleSystem::ParticleSystem(void)
+{
+	backend = PARTICLES_CPU;
+	capacity = 0;
+	plane = glm::vec4(0,1,0,0);
+	restitution = 0.5f;
+	highWater = 0;
+	randomState = 0x12345678u;
+	liveCount = 0;
+	bDirty = false;
+	updateProgram = 0;
+	vaoUpdateID[0] = vaoUpdateID[1] = 0;
+	vboPositionID[0] = vboPositionID[1] = 0;
+	vboVelocityID[0] = vboVelocityID[1] = 0;
+	vboEmitterID[0] = vboEmitterID[1] = 0;
+	vboRenderID = 0;
+	vaoRenderID = 0;
+	readID = 0;
+	for(int i=0;i<TOTAL_UNIFORMS;i++)
+		uniformLocations[i] = -1;
+	bRangesDirty = true;
+	frame = 0;
+	tfoID[0] = tfoID[1] = 0;
+	bPrimed = false;
+	queryID = 0;
+	bQueryPending = false;
+	writtenCount = 0;
+	updateTime = 0;
+	sortTime = 0;
+	for(int i=0;i<MAX_EMITTERS;i++)
+		forceX[i] = forceY[i] = forceZ[i] = 0;
+}
+
+ParticleSystem::~ParticleSystem(void)
+{
+}
+
+void ParticleSystem::Init(int capacity, ParticleBackend backend, GLuint updateProgram) {
+	Destroy();
+	this->capacity = capacity;
+	this->backend = backend;
+
+	//the render buffer holds one vec4 per particle, the compact backend
+	//renders from its position buffers instead
+	if(backend != PARTICLES_GPU_COMPACT) {
+		glGenVertexArrays(1, &vaoRenderID);
+		glGenBuffers(1, &vboRenderID);
+		vector<glm::vec4> dead(capacity, glm::vec4(0,0,0,2));
+		glBindVertexArray(vaoRenderID);
+			glBindBuffer(GL_ARRAY_BUFFER, vboRenderID);
+			glBufferData(GL_ARRAY_BUFFER, capacity*sizeof(glm::vec4), &dead[0].x, backend==PARTICLES_CPU ? GL_STREAM_DRAW : GL_DYNAMIC_COPY);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	if(backend == PARTICLES_CPU)
+		InitCPU();
+	else
+		InitGPU(updateProgram);
+}
+
+void ParticleSystem::InitCPU() {
+	//the slot arrays are padded to the SIMD width
+	int padded = (capacity + SIMD_WIDTH - 1)/SIMD_WIDTH*SIMD_WIDTH;
+	vector<float>* arrays[] = {&px, &py, &pz, &vx, &vy, &vz, &life};
+	for(int i=0;i<7;i++)
+		arrays[i]->assign(padded, 0.0f);
+	age.assign(padded, 1.0f);
+	emitterIDs.assign(padded, 0);
+
+	//the free list is a stack, push the slots in reverse so that the
+	//lowest slots are used first
+	freeList.resize(capacity);
+	for(int i=0;i<capacity;i++)
+		freeList[i] = capacity - 1 - i;
+	highWater = 0;
+	liveCount = 0;
+	renderData.clear();
+}
+
+void ParticleSystem::InitGPU(GLuint updateProgram) {
+	this->updateProgram = updateProgram;
+
+	//capture the update outputs in separate buffers and relink
+	bool bCompact = (backend == PARTICLES_GPU_COMPACT);
+	const char* varying_names[] = {"out_position", "out_velocity", bCompact ? "out_emitter" : "out_render"};
+	glTransformFeedbackVaryings(updateProgram, 3, varying_names, GL_SEPARATE_ATTRIBS);
+	glLinkProgram(updateProgram);
+	for(int i=0;i<TOTAL_UNIFORMS;i++)
+		uniformLocations[i] = glGetUniformLocation(updateProgram, uniformNames[i]);
+
+	//all particles start dead (age 1, life 0). The compact buffers start
+	//empty and are never read beyond the written count.
+	vector<glm::vec4> positions, velocities;
+	if(!bCompact) {
+		positions.assign(capacity, glm::vec4(0,0,0,1));
+		velocities.assign(capacity, glm::vec4(0));
+	}
+
+	glGenVertexArrays(2, vaoUpdateID);
+	glGenBuffers(2, vboPositionID);
+	glGenBuffers(2, vboVelocityID);
+	if(bCompact)
+		glGenBuffers(2, vboEmitterID);
+	for(int i=0;i<2;i++) {
+		glBindVertexArray(vaoUpdateID[i]);
+			glBindBuffer(GL_ARRAY_BUFFER, vboPositionID[i]);
+			glBufferData(GL_ARRAY_BUFFER, capacity*sizeof(glm::vec4), bCompact ? 0 : &positions[0].x, GL_DYNAMIC_COPY);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+			glBindBuffer(GL_ARRAY_BUFFER, vboVelocityID[i]);
+			glBufferData(GL_ARRAY_BUFFER, capacity*sizeof(glm::vec4), bCompact ? 0 : &velocities[0].x, GL_DYNAMIC_COPY);
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+			if(bCompact) {
+				glBindBuffer(GL_ARRAY_BUFFER, vboEmitterID[i]);
+				glBufferData(GL_ARRAY_BUFFER, capacity*sizeof(float), 0, GL_DYNAMIC_COPY);
+				glEnableVertexAttribArray(2);
+				glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 0, 0);
+			}
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//every transform feedback object writes one set of ping pong buffers
+	//and remembers how many particles it has written
+	if(bCompact) {
+		glGenTransformFeedbacks(2, tfoID);
+		for(int i=0;i<2;i++) {
+			glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfoID[i]);
+			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vboPositionID[i]);
+			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, vboVelocityID[i]);
+			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 2, vboEmitterID[i]);
+		}
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+		glGenQueries(1, &queryID);
+	}
+	readID = 0;
+	bPrimed = false;
+	bQueryPending = false;
+	writtenCount = 0;
+	bRangesDirty = true;
+}
+
+void ParticleSystem::Destroy() {
+	if(vaoRenderID) {
+		glDeleteVertexArrays(1, &vaoRenderID);
+		glDeleteBuffers(1, &vboRenderID);
+	}
+	if(vaoUpdateID[0]) {
+		glDeleteVertexArrays(2, vaoUpdateID);
+		glDeleteBuffers(2, vboPositionID);
+		glDeleteBuffers(2, vboVelocityID);
+	}
+	if(vboEmitterID[0])
+		glDeleteBuffers(2, vboEmitterID);
+	if(tfoID[0]) {
+		glDeleteTransformFeedbacks(2, tfoID);
+		glDeleteQueries(1, &queryID);
+	}
+	vaoRenderID = vboRenderID = 0;
+	vaoUpdateID[0] = vaoUpdateID[1] = 0;
+	vboPositionID[0] = vboPositionID[1] = 0;
+	vboVelocityID[0] = vboVelocityID[1] = 0;
+	vboEmitterID[0] = vboEmitterID[1] = 0;
+	tfoID[0] = tfoID[1] = 0;
+	queryID = 0;
+}
+
+int ParticleSystem::AddEmitter(const Emitter& emitter) {
+	if(int(emitters.size()) >= MAX_EMITTERS)
+		return -1;
+	emitters.push_back(emitter);
+	spawnAccumulators.push_back(0.0f);
+	bRangesDirty = true;
+	return int(emitters.size()) - 1;
+}
+
+Emitter& ParticleSystem::GetEmitter(int index) {
+	//the pool ranges of the GPU backend depend on the rates and lifetimes
+	bRangesDirty = true;
+	return emitters[index];
+}
+
+int ParticleSystem::GetTotalEmitters() const {
+	return int(emitters.size());
+}
+
+void ParticleSystem::SetCollisionPlane(const glm::vec4& plane, float restitution) {
+	this->plane = plane;
+	this->restitution = restitution;
+}
+
+float ParticleSystem::Random() {
+	//xorshift32
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return (randomState >> 8)*(1.0f/16777216.0f);
+}
+
+void ParticleSystem::Spawn(float dt) {
+	for(size_t e=0;e<emitters.size();e++) {
+		const Emitter& em = emitters[e];
+		spawnAccumulators[e] += em.rate*dt;
+		int count = int(spawnAccumulators[e]);
+		spawnAccumulators[e] -= count;
+
+		for(int k=0;k<count;k++) {
+			//the pool is exhausted, the emitter waits for particles to die
+			if(freeList.empty()) {
+				spawnAccumulators[e] = 0;
+				break;
+			}
+			int i = freeList.back();
+			freeList.pop_back();
+			highWater = max(highWater, i+1);
+
+			float yaw = em.yaw + Random()*em.yawVar;
+			float pitch = em.pitch + Random()*em.pitchVar;
+			float speed = em.speed + Random()*em.speedVar;
+			px[i] = em.position.x;
+			py[i] = em.position.y;
+			pz[i] = em.position.z;
+			vx[i] = -sin(yaw)*cos(pitch)*speed;
+			vy[i] = sin(pitch)*speed;
+			vz[i] = cos(pitch)*cos(yaw)*speed;
+			age[i] = 0;
+			life[i] = em.life + Random()*em.lifeVar;
+			emitterIDs[i] = int(e);
+		}
+	}
+}
+
+void ParticleSystem::Simulate(int first, int last, float dt) {
+	int i = first;
+#ifdef USE_AVX2
+	__m256 vDt = _mm256_set1_ps(dt);
+	__m256 nx = _mm256_set1_ps(plane.x), ny = _mm256_set1_ps(plane.y), nz = _mm256_set1_ps(plane.z), nw = _mm256_set1_ps(plane.w);
+	__m256 bounce = _mm256_set1_ps(1.0f + restitution);
+	__m256 zero = _mm256_setzero_ps();
+	for(;i+SIMD_WIDTH<=last;i+=SIMD_WIDTH) {
+		__m256 a = _mm256_add_ps(_mm256_loadu_ps(&age[i]), vDt);
+		_mm256_storeu_ps(&age[i], a);
+		__m256 alive = _mm256_cmp_ps(a, _mm256_loadu_ps(&life[i]), _CMP_LT_OQ);
+		if(_mm256_movemask_ps(alive) == 0)
+			continue;
+
+		//per emitter acceleration
+		__m256i e = _mm256_loadu_si256((const __m256i*)&emitterIDs[i]);
+		__m256 velX = _mm256_add_ps(_mm256_loadu_ps(&vx[i]), _mm256_mul_ps(_mm256_i32gather_ps(forceX, e, 4), vDt));
+		__m256 velY = _mm256_add_ps(_mm256_loadu_ps(&vy[i]), _mm256_mul_ps(_mm256_i32gather_ps(forceY, e, 4), vDt));
+		__m256 velZ = _mm256_add_ps(_mm256_loadu_ps(&vz[i]), _mm256_mul_ps(_mm256_i32gather_ps(forceZ, e, 4), vDt));
+		__m256 posX = _mm256_add_ps(_mm256_loadu_ps(&px[i]), _mm256_mul_ps(velX, vDt));
+		__m256 posY = _mm256_add_ps(_mm256_loadu_ps(&py[i]), _mm256_mul_ps(velY, vDt));
+		__m256 posZ = _mm256_add_ps(_mm256_loadu_ps(&pz[i]), _mm256_mul_ps(velZ, vDt));
+
+		//bounce off the collision plane: reflect the approaching velocity
+		//and put the particle back on the plane
+		__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(posX, nx), _mm256_mul_ps(posY, ny)), _mm256_mul_ps(posZ, nz)), nw);
+		__m256 vn = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(velX, nx), _mm256_mul_ps(velY, ny)), _mm256_mul_ps(velZ, nz));
+		__m256 below = _mm256_cmp_ps(d, zero, _CMP_LT_OQ);
+		__m256 push = _mm256_and_ps(d, below);
+		__m256 reflect = _mm256_and_ps(_mm256_mul_ps(bounce, vn), _mm256_and_ps(below, _mm256_cmp_ps(vn, zero, _CMP_LT_OQ)));
+		velX = _mm256_sub_ps(velX, _mm256_mul_ps(reflect, nx));
+		velY = _mm256_sub_ps(velY, _mm256_mul_ps(reflect, ny));
+		velZ = _mm256_sub_ps(velZ, _mm256_mul_ps(reflect, nz));
+		posX = _mm256_sub_ps(posX, _mm256_mul_ps(push, nx));
+		posY = _mm256_sub_ps(posY, _mm256_mul_ps(push, ny));
+		posZ = _mm256_sub_ps(posZ, _mm256_mul_ps(push, nz));
+
+		//dead slots keep their state
+		_mm256_storeu_ps(&vx[i], _mm256_blendv_ps(_mm256_loadu_ps(&vx[i]), velX, alive));
+		_mm256_storeu_ps(&vy[i], _mm256_blendv_ps(_mm256_loadu_ps(&vy[i]), velY, alive));
+		_mm256_storeu_ps(&vz[i], _mm256_blendv_ps(_mm256_loadu_ps(&vz[i]), velZ, alive));
+		_mm256_storeu_ps(&px[i], _mm256_blendv_ps(_mm256_loadu_ps(&px[i]), posX, alive));
+		_mm256_storeu_ps(&py[i], _mm256_blendv_ps(_mm256_loadu_ps(&py[i]), posY, alive));
+		_mm256_storeu_ps(&pz[i], _mm256_blendv_ps(_mm256_loadu_ps(&pz[i]), posZ, alive));
+	}
+#endif
+	for(;i<last;i++) {
+		age[i] += dt;
+		if(age[i] >= life[i])
+			continue;
+		int e = emitterIDs[i];
+		vx[i] += forceX[e]*dt;
+		vy[i] += forceY[e]*dt;
+		vz[i] += forceZ[e]*dt;
+		px[i] += vx[i]*dt;
+		py[i] += vy[i]*dt;
+		pz[i] += vz[i]*dt;
+
+		float d = px[i]*plane.x + py[i]*plane.y + pz[i]*plane.z + plane.w;
+		if(d < 0) {
+			float vn = vx[i]*plane.x + vy[i]*plane.y + vz[i]*plane.z;
+			if(vn < 0) {
+				vx[i] -= (1 + restitution)*vn*plane.x;
+				vy[i] -= (1 + restitution)*vn*plane.y;
+				vz[i] -= (1 + restitution)*vn*plane.z;
+			}
+			px[i] -= d*plane.x;
+			py[i] -= d*plane.y;
+			pz[i] -= d*plane.z;
+		}
+	}
+}
+
+void ParticleSystem::Update(float dt) {
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+	if(backend == PARTICLES_CPU)
+		UpdateCPU(dt);
+	else if(backend == PARTICLES_GPU)
+		UpdateGPU(dt);
+	else
+		UpdateGPUCompact(dt);
+
+	updateTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+void ParticleSystem::UpdateCPU(float dt) {
+	for(size_t e=0;e<emitters.size();e++) {
+		forceX[e] = emitters[e].force.x;
+		forceY[e] = emitters[e].force.y;
+		forceZ[e] = emitters[e].force.z;
+	}
+
+	Spawn(dt);
+
+	//the blocks start at multiples of the SIMD width, the padding slots are
+	//never used so the last block may run up to the padded size
+	int padded = int(px.size());
+	int blocks = (highWater + BLOCK_SIZE - 1)/BLOCK_SIZE;
+	blockLive.resize(blocks+1);
+	blockDead.resize(blocks+1);
+	int freeCount = int(freeList.size());
+
+	#pragma omp parallel if(highWater >= PARALLEL_THRESHOLD)
+	{
+		//simulate and count the live and the newly dead particles
+		#pragma omp for
+		for(int b=0;b<blocks;b++) {
+			int first = b*BLOCK_SIZE, last = min(padded, (b+1)*BLOCK_SIZE);
+			Simulate(first, last, dt);
+			int live = 0, dead = 0;
+			for(int i=first;i<last;i++) {
+				if(age[i] < life[i])
+					live++;
+				else if(life[i] > 0)
+					dead++;
+			}
+			blockLive[b] = live;
+			blockDead[b] = dead;
+		}
+
+		#pragma omp single
+		{
+			int live = 0, dead = 0;
+			for(int b=0;b<blocks;b++) {
+				int l = blockLive[b], d = blockDead[b];
+				blockLive[b] = live;
+				blockDead[b] = dead;
+				live += l;
+				dead += d;
+			}
+			liveCount = live;
+			renderData.resize(max(1, live));
+			freeList.resize(freeCount + dead);
+		}
+
+		//pack the live particles and return the dead slots to the pool
+		#pragma omp for
+		for(int b=0;b<blocks;b++) {
+			int first = b*BLOCK_SIZE, last = min(padded, (b+1)*BLOCK_SIZE);
+			int live = blockLive[b], dead = freeCount + blockDead[b];
+			for(int i=first;i<last;i++) {
+				if(age[i] < life[i]) {
+					renderData[live++] = glm::vec4(px[i], py[i], pz[i], age[i]/life[i]);
+				} else if(life[i] > 0) {
+					life[i] = 0;
+					freeList[dead++] = i;
+				}
+			}
+		}
+	}
+	bDirty = true;
+}
+
+void ParticleSystem::UpdateGPU(float dt) {
+	int totalEmitters = int(emitters.size());
+	if(totalEmitters == 0)
+		return;
+
+	//split the pool among the emitters by the number of particles each one
+	//keeps alive on average
+	if(bRangesDirty) {
+		rangeFirst.resize(totalEmitters, -1);
+		rangeCount.resize(totalEmitters, 0);
+		spawnStart.resize(totalEmitters, 0);
+		spawnCount.resize(totalEmitters);
+		double sum = 0;
+		for(int e=0;e<totalEmitters;e++)
+			sum += emitters[e].rate*(emitters[e].life + emitters[e].lifeVar*0.5f);
+		int first = 0;
+		for(int e=0;e<totalEmitters;e++) {
+			double weight = (sum > 0) ? emitters[e].rate*(emitters[e].life + emitters[e].lifeVar*0.5f)/sum : 1.0/totalEmitters;
+			int count = max(0, (e == totalEmitters-1) ? capacity - first : int(capacity*weight));
+			//the window only restarts if the range has changed
+			if(rangeFirst[e] != first || rangeCount[e] != count)
+				spawnStart[e] = 0;
+			rangeFirst[e] = first;
+			rangeCount[e] = count;
+			first += count;
+		}
+		bRangesDirty = false;
+	}
+
+	//advance the spawn window of every emitter
+	glm::vec4 positions[MAX_EMITTERS], forces[MAX_EMITTERS], angles[MAX_EMITTERS], motions[MAX_EMITTERS];
+	GLint ranges[MAX_EMITTERS*4];
+	for(int e=0;e<totalEmitters;e++) {
+		const Emitter& em = emitters[e];
+		spawnAccumulators[e] += em.rate*dt;
+		int count = int(spawnAccumulators[e]);
+		spawnAccumulators[e] -= count;
+		spawnCount[e] = min(count, rangeCount[e]);
+
+		positions[e] = glm::vec4(em.position, 1);
+		forces[e] = glm::vec4(em.force, 0);
+		angles[e] = glm::vec4(em.yaw, em.yawVar, em.pitch, em.pitchVar);
+		motions[e] = glm::vec4(em.speed, em.speedVar, em.life, em.lifeVar);
+		ranges[e*4+0] = rangeFirst[e];
+		ranges[e*4+1] = rangeCount[e];
+		ranges[e*4+2] = spawnStart[e];
+		ranges[e*4+3] = spawnCount[e];
+		if(rangeCount[e] > 0)
+			spawnStart[e] = (spawnStart[e] + spawnCount[e]) % rangeCount[e];
+	}
+
+	glUseProgram(updateProgram);
+		glUniform1f(uniformLocations[U_DT], dt);
+		glUniform1ui(uniformLocations[U_SEED], frame++ * 2654435769u);
+		glUniform4fv(uniformLocations[U_PLANE], 1, &plane.x);
+		glUniform1f(uniformLocations[U_RESTITUTION], restitution);
+		glUniform1i(uniformLocations[U_NUM_EMITTERS], totalEmitters);
+		glUniform4fv(uniformLocations[U_EMITTER_POSITION], totalEmitters, &positions[0].x);
+		glUniform4fv(uniformLocations[U_EMITTER_FORCE], totalEmitters, &forces[0].x);
+		glUniform4fv(uniformLocations[U_EMITTER_ANGLES], totalEmitters, &angles[0].x);
+		glUniform4fv(uniformLocations[U_EMITTER_MOTION], totalEmitters, &motions[0].x);
+		glUniform4iv(uniformLocations[U_EMITTER_RANGE], totalEmitters, ranges);
+
+		int writeID = 1 - readID;
+		glBindVertexArray(vaoUpdateID[readID]);
+			//index 0 -> position and age
+			//index 1 -> velocity and life
+			//index 2 -> render attribute
+			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vboPositionID[writeID]);
+			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, vboVelocityID[writeID]);
+			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 2, vboRenderID);
+			glEnable(GL_RASTERIZER_DISCARD);
+				glBeginTransformFeedback(GL_POINTS);
+					glDrawArrays(GL_POINTS, 0, capacity);
+				glEndTransformFeedback();
+			glDisable(GL_RASTERIZER_DISCARD);
+		glBindVertexArray(0);
+		readID = writeID;
+	glUseProgram(0);
+}
+
+void ParticleSystem::UpdateGPUCompact(float dt) {
+	int totalEmitters = int(emitters.size());
+
+	//the new particles of every emitter are a range of the spawn draw
+	glm::vec4 positions[MAX_EMITTERS], forces[MAX_EMITTERS], angles[MAX_EMITTERS], motions[MAX_EMITTERS];
+	GLint ranges[MAX_EMITTERS*4];
+	int totalSpawn = 0;
+	for(int e=0;e<totalEmitters;e++) {
+		const Emitter& em = emitters[e];
+		spawnAccumulators[e] += em.rate*dt;
+		int count = min(int(spawnAccumulators[e]), capacity);
+		spawnAccumulators[e] -= count;
+
+		positions[e] = glm::vec4(em.position, 1);
+		forces[e] = glm::vec4(em.force, 0);
+		angles[e] = glm::vec4(em.yaw, em.yawVar, em.pitch, em.pitchVar);
+		motions[e] = glm::vec4(em.speed, em.speedVar, em.life, em.lifeVar);
+		ranges[e*4+0] = totalSpawn;
+		ranges[e*4+1] = count;
+		ranges[e*4+2] = ranges[e*4+3] = 0;
+		totalSpawn += count;
+	}
+	totalSpawn = min(totalSpawn, capacity);
+
+	//collect the number of particles written a few frames ago, if the
+	//result is not there yet the query is skipped this frame
+	if(bQueryPending) {
+		GLuint available = 0;
+		glGetQueryObjectuiv(queryID, GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available) {
+			GLuint written = 0;
+			glGetQueryObjectuiv(queryID, GL_QUERY_RESULT, &written);
+			writtenCount = int(written);
+			bQueryPending = false;
+		}
+	}
+	bool bQuery = !bQueryPending;
+
+	glUseProgram(updateProgram);
+		glUniform1f(uniformLocations[U_DT], dt);
+		glUniform1ui(uniformLocations[U_SEED], frame++ * 2654435769u);
+		glUniform4fv(uniformLocations[U_PLANE], 1, &plane.x);
+		glUniform1f(uniformLocations[U_RESTITUTION], restitution);
+		glUniform1i(uniformLocations[U_NUM_EMITTERS], totalEmitters);
+		if(totalEmitters > 0) {
+			glUniform4fv(uniformLocations[U_EMITTER_POSITION], totalEmitters, &positions[0].x);
+			glUniform4fv(uniformLocations[U_EMITTER_FORCE], totalEmitters, &forces[0].x);
+			glUniform4fv(uniformLocations[U_EMITTER_ANGLES], totalEmitters, &angles[0].x);
+			glUniform4fv(uniformLocations[U_EMITTER_MOTION], totalEmitters, &motions[0].x);
+			glUniform4iv(uniformLocations[U_EMITTER_RANGE], totalEmitters, ranges);
+		}
+
+		int writeID = 1 - readID;
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfoID[writeID]);
+		glBindVertexArray(vaoUpdateID[readID]);
+			glEnable(GL_RASTERIZER_DISCARD);
+				if(bQuery)
+					glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, queryID);
+				glBeginTransformFeedback(GL_POINTS);
+					//the survivors of the last frame, the count comes from
+					//the transform feedback object that wrote them
+					if(bPrimed) {
+						glUniform1i(uniformLocations[U_SPAWN], 0);
+						glDrawTransformFeedback(GL_POINTS, tfoID[readID]);
+					}
+					//the new particles are appended, whatever does not fit
+					//in the buffers is dropped by the transform feedback
+					if(totalSpawn > 0) {
+						glUniform1i(uniformLocations[U_SPAWN], 1);
+						glDrawArrays(GL_POINTS, 0, totalSpawn);
+					}
+				glEndTransformFeedback();
+				if(bQuery) {
+					glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+					bQueryPending = true;
+				}
+			glDisable(GL_RASTERIZER_DISCARD);
+		glBindVertexArray(0);
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+		readID = writeID;
+		bPrimed = true;
+	glUseProgram(0);
+}
+
+void ParticleSystem::Sort(const glm::mat4& MV) {
+	if(backend != PARTICLES_CPU || liveCount < 2) {
+		sortTime = 0;
+		return;
+	}
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+	//the eye space z is negative in front of the camera, so ascending z
+	//orders the particles back to front
+	int count = liveCount;
+	keys.resize(count);
+	values.resize(count);
+	sortedData.resize(count);
+	float m0 = MV[0][2], m1 = MV[1][2], m2 = MV[2][2], m3 = MV[3][2];
+
+	#pragma omp parallel for if(count >= PARALLEL_THRESHOLD)
+	for(int i=0;i<count;i++) {
+		const glm::vec4& p = renderData[i];
+		keys[i] = FloatToKey(m0*p.x + m1*p.y + m2*p.z + m3);
+		values[i] = i;
+	}
+
+	RadixSort(keys, values, tmpKeys, tmpValues, histograms);
+
+	#pragma omp parallel for if(count >= PARALLEL_THRESHOLD)
+	for(int i=0;i<count;i++)
+		sortedData[i] = renderData[values[i]];
+	renderData.swap(sortedData);
+	bDirty = true;
+
+	sortTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+void ParticleSystem::Draw() {
+	//the compact buffers hold only live particles, the transform feedback
+	//object knows how many
+	if(backend == PARTICLES_GPU_COMPACT) {
+		if(!bPrimed)
+			return;
+		glBindVertexArray(vaoUpdateID[readID]);
+			glDrawTransformFeedback(GL_POINTS, tfoID[readID]);
+		glBindVertexArray(0);
+		return;
+	}
+
+	int count = capacity;
+	if(backend == PARTICLES_CPU) {
+		//orphan the buffer so that the upload does not wait for the last draw
+		if(bDirty) {
+			glBindBuffer(GL_ARRAY_BUFFER, vboRenderID);
+			glBufferData(GL_ARRAY_BUFFER, capacity*sizeof(glm::vec4), 0, GL_STREAM_DRAW);
+			if(liveCount > 0)
+				glBufferSubData(GL_ARRAY_BUFFER, 0, liveCount*sizeof(glm::vec4), &renderData[0].x);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			bDirty = false;
+		}
+		count = liveCount;
+	}
+	if(count == 0)
+		return;
+
+	glBindVertexArray(vaoRenderID);
+		glDrawArrays(GL_POINTS, 0, count);
+	glBindVertexArray(0);
+}
+
+ParticleBackend ParticleSystem::GetBackend() const {
+	return backend;
+}
+
+int ParticleSystem::GetCapacity() const {
+	return capacity;
+}
+
+int ParticleSystem::GetLiveCount() const {
+	if(backend == PARTICLES_CPU)
+		return liveCount;
+	if(backend == PARTICLES_GPU_COMPACT)
+		return writtenCount;
+
+	int live = 0;
+	for(size_t e=0;e<emitters.size() && e<rangeCount.size();e++)
+		live += min(rangeCount[e], int(emitters[e].rate*(emitters[e].life + emitters[e].lifeVar*0.5f)));
+	return live;
+}
+
+float ParticleSystem::GetUpdateTime() const {
+	return updateTime;
+}
+
+float ParticleSystem::GetSortTime() const {
+	return sortTime;
+}
+
+const char* ParticleSystem::GetBackendName(ParticleBackend backend) {
+	return backendNames[backend];
+}
@@ -0,0 +1,107 @@
+#include "SpatialHash.h"
+#include <cmath>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//below this many items the table is built by a single thread
+const int PARALLEL_THRESHOLD = 4096;
+
+SpatialHash::SpatialHash(void)
+{
+	cellSize = 1;
+	invCellSize = 1;
+	tableSize = 1;
+	entryStart.assign(2, 0);
+	sortedItems.assign(1, 0);
+}
+
+SpatialHash::~SpatialHash(void)
+{
+}
+
+void SpatialHash::SetCellSize(float size) {
+	cellSize = size;
+	invCellSize = 1.0f/size;
+}
+
+void SpatialHash::SetTableSize(int minSize) {
+	tableSize = 1;
+	while(tableSize < minSize)
+		tableSize <<= 1;
+	entryStart.assign(tableSize+1, 0);
+}
+
+glm::ivec3 SpatialHash::GetCell(const glm::vec3& p) const {
+	return glm::ivec3(int(floor(p.x*invCellSize)), int(floor(p.y*invCellSize)), int(floor(p.z*invCellSize)));
+}
+
+int SpatialHash::Hash(int ix, int iy, int iz) const {
+	unsigned int h = ((unsigned int)ix*73856093u) ^ ((unsigned int)iy*19349663u) ^ ((unsigned int)iz*83492791u);
+	return int(h & (unsigned int)(tableSize-1));
+}
+
+void SpatialHash::Build(const vector<int>& entries, const vector<int>& items) {
+	int count = int(entries.size());
+
+#ifdef _OPENMP
+	int threads = 1;
+	if(count >= PARALLEL_THRESHOLD)
+		threads = omp_get_max_threads();
+#endif
+
+	entryStart.assign(tableSize+1, 0);
+	sortedItems.resize(count>0 ? count : 1);
+
+	int team = 1;
+	#pragma omp parallel num_threads(threads)
+	{
+		//OpenMP may start fewer threads than asked for, so the ranges and
+		//histograms are split by the size of the team that started
+		#pragma omp single
+		{
+#ifdef _OPENMP
+			team = omp_get_num_threads();
+#endif
+			histograms.resize(team*tableSize);
+		}
+
+		int t = 0;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+#endif
+		//each thread counts a contiguous range of the pairs
+		int first = int((long long)count*t/team);
+		int last = int((long long)count*(t+1)/team);
+		int* hist = &histograms[t*tableSize];
+		for(int h=0;h<tableSize;h++)
+			hist[h] = 0;
+		for(int i=first;i<last;i++)
+			hist[entries[i]]++;
+
+		#pragma omp barrier
+
+		//turn the counts into per thread offsets within each entry so that
+		//the threads write disjoint slots and the sort stays stable
+		#pragma omp for
+		for(int h=0;h<tableSize;h++) {
+			int sum = 0;
+			for(int k=0;k<team;k++) {
+				int c = histograms[k*tableSize+h];
+				histograms[k*tableSize+h] = sum;
+				sum += c;
+			}
+			entryStart[h+1] = sum;
+		}
+
+		#pragma omp single
+		for(int h=0;h<tableSize;h++)
+			entryStart[h+1] += entryStart[h];
+
+		//scatter the items
+		for(int i=first;i<last;i++) {
+			int e = entries[i];
+			sortedItems[entryStart[e] + hist[e]++] = items[i];
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+
+//SpatialHash class stores items in a uniform grid of cubic cells. The grid is
+//unbounded; cells are mapped to a fixed size hash table so that memory only
+//depends on the number of items. An item may be stored in several cells. The
+//table is rebuilt from scratch every time with a parallel counting sort so
+//that the items of a table entry are contiguous in memory.
+class SpatialHash
+{
+public:
+	//constructor/destructor
+	SpatialHash(void);
+	~SpatialHash(void);
+
+	//sets the cell size in world units
+	void SetCellSize(float size);
+	float GetCellSize() const { return cellSize; }
+
+	//sets the number of table entries to the next power of two of minSize.
+	//The entries passed to Build have to be hashed with the same size.
+	void SetTableSize(int minSize);
+
+	//returns the integer coordinates of the cell containing the given point
+	glm::ivec3 GetCell(const glm::vec3& p) const;
+
+	//returns the table entry of the given cell
+	int Hash(int ix, int iy, int iz) const;
+	int Hash(const glm::ivec3& cell) const { return Hash(cell.x, cell.y, cell.z); }
+
+	//sorts the given (table entry, item) pairs by table entry
+	void Build(const vector<int>& entries, const vector<int>& items);
+
+	//returns the range [first, last) of GetItems() stored in the given entry.
+	//Different cells may share an entry so the caller has to test the items.
+	void GetRange(int entry, int& first, int& last) const {
+		first = entryStart[entry];
+		last = entryStart[entry+1];
+	}
+
+	//sorted items
+	const int* GetItems() const { return &sortedItems[0]; }
+
+	int GetTableSize() const { return tableSize; }
+
+protected:
+	float cellSize;
+	float invCellSize;
+	int tableSize;
+
+	vector<int> entryStart;		//first item of each entry, one extra entry at the end
+	vector<int> sortedItems;
+
+	//per thread histograms and write offsets of the counting sort
+	vector<int> histograms;
+};